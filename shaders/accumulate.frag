@@ -0,0 +1,14 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D frameTexture;
+uniform float uvScaleX; // the frame covers only the lower-left part of its render target
+uniform float uvScaleY;
+uniform float weight;   // 1 / sample count, used as the blend factor
+
+void main()
+{
+    FragColor = vec4(texture(frameTexture, TexCoords * vec2(uvScaleX, uvScaleY)).rgb, weight);
+}
@@ -0,0 +1,32 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// One entry per indirect command, see BatchRenderer.h
+layout(std430, binding = 2) readonly buffer DrawData
+{
+    mat4 models[];
+};
+
+void main()
+{
+    mat4 model = models[gl_DrawIDARB];
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+    TexCoords = aTexCoords;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,29 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 3) in mat4 aInstanceModel; // locations 3-6, advanced once per instance
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// World matrix of the scene node being drawn, shared by all instances
+uniform mat4 model;
+
+void main()
+{
+    mat4 world = aInstanceModel * model;
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(world))) * aNormal;
+    TexCoords = aTexCoords;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
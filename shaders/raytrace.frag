@@ -5,32 +5,167 @@ in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
 uniform sampler2D texture_diffuse;
 uniform samplerCube skybox;
 
 struct Light {
-    vec3 position;
-    vec3 color;
+    vec4 position;
+    vec4 color;
 };
 
-uniform Light light1;
-uniform Light light2;
+// Must match MAX_LIGHTS and LightData in FrameUniforms.h
+const int MAX_LIGHTS = 16;
+
+layout(std140) uniform LightData
+{
+    ivec4 lightCount;
+    Light lights[MAX_LIGHTS];
+};
+
+// Scene BVH from TriangleBvh.h, enabled by lightCount.y. Nodes are two texels (min and the right
+// child or first triangle, max and the triangle count), triangles three (vertex 0 and two edges).
+uniform samplerBuffer bvhNodes;
+uniform samplerBuffer bvhTriangles;
+const int BVH_STACK_SIZE = 64;
+
+bool bvhOccluded(vec3 origin, vec3 direction, float maxDistance)
+{
+    vec3 safeDirection = mix(direction, vec3(1e-12), lessThan(abs(direction), vec3(1e-12)));
+    vec3 inverseDirection = 1.0 / safeDirection;
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = 0;
+    while (true)
+    {
+        vec4 lower = texelFetch(bvhNodes, node * 2);
+        vec4 upper = texelFetch(bvhNodes, node * 2 + 1);
+        vec3 t0 = (lower.xyz - origin) * inverseDirection;
+        vec3 t1 = (upper.xyz - origin) * inverseDirection;
+        vec3 tMin = min(t0, t1);
+        vec3 tMax = max(t0, t1);
+        float tNear = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+        float tFar = min(min(tMax.x, tMax.y), min(tMax.z, maxDistance));
+        if (tNear <= tFar)
+        {
+            int leftFirst = int(floatBitsToUint(lower.w));
+            int count = int(floatBitsToUint(upper.w));
+            if (count == 0)
+            {
+                // Left child is the next node; the right one waits on the stack
+                if (stackSize < BVH_STACK_SIZE)
+                {
+                    stack[stackSize++] = leftFirst;
+                }
+                node += 1;
+                continue;
+            }
+            for (int i = 0; i < count; ++i)
+            {
+                int triangle = (leftFirst + i) * 3;
+                vec3 v0 = texelFetch(bvhTriangles, triangle).xyz;
+                vec3 edge1 = texelFetch(bvhTriangles, triangle + 1).xyz;
+                vec3 edge2 = texelFetch(bvhTriangles, triangle + 2).xyz;
+                vec3 p = cross(direction, edge2);
+                float det = dot(edge1, p);
+                if (det == 0.0)
+                {
+                    continue;
+                }
+                float inverseDet = 1.0 / det;
+                vec3 s = origin - v0;
+                float u = dot(s, p) * inverseDet;
+                vec3 q = cross(s, edge1);
+                float v = dot(direction, q) * inverseDet;
+                float t = dot(edge2, q) * inverseDet;
+                if (u >= 0.0 && v >= 0.0 && u + v <= 1.0 && t > 0.0 && t < maxDistance)
+                {
+                    return true;
+                }
+            }
+        }
+        if (stackSize == 0)
+        {
+            break;
+        }
+        node = stack[--stackSize];
+    }
+    return false;
+}
+
+#ifdef CLUSTERED_LIGHTING
+// Set by ClusteredLighting, which prepends #version 430 and this define when GL 4.3 is available
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+layout(std140) uniform ClusterData
+{
+    uvec4 gridSize;   // xyz clusters, w point light count
+    vec4 depthParams; // near, far, slice scale, slice bias
+    vec4 tileSize;
+};
+
+struct PointLight {
+    vec4 positionRadius;
+    vec4 color;
+};
+
+// Must match the bindings in ClusteredLighting.h
+layout(std430, binding = 3) readonly buffer PointLights { PointLight pointLights[]; };
+layout(std430, binding = 4) readonly buffer ClusterGrid { uvec2 clusterRanges[]; };
+layout(std430, binding = 5) readonly buffer ClusterIndices { uint clusterIndices[]; };
+
+vec3 shadePointLights(vec3 norm, vec3 albedo)
+{
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    uint slice = uint(clamp(floor(log(viewDepth) * depthParams.z + depthParams.w), 0.0, float(gridSize.z - 1u)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / tileSize.xy), gridSize.xy - 1u);
+    uvec2 range = clusterRanges[(slice * gridSize.y + tile.y) * gridSize.x + tile.x];
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i)
+    {
+        PointLight light = pointLights[clusterIndices[range.x + i]];
+        vec3 toLight = light.positionRadius.xyz - FragPos;
+        float distanceSquared = dot(toLight, toLight);
+        float radius = light.positionRadius.w;
+
+        // Inverse square, windowed to reach zero at the radius the light was clustered with
+        float window = clamp(1.0 - distanceSquared * distanceSquared / (radius * radius * radius * radius), 0.0, 1.0);
+        float attenuation = window * window / (distanceSquared + 1.0);
+        float diff = max(dot(norm, toLight * inversesqrt(max(distanceSquared, 1e-8))), 0.0);
+        result += diff * attenuation * light.color.rgb * albedo;
+    }
+    return result;
+}
+#endif
 
 void main()
 {
-    vec3 ambient = 0.1 * texture(texture_diffuse, TexCoords).rgb;
+    vec3 albedo = texture(texture_diffuse, TexCoords).rgb;
+    vec3 ambient = 0.1 * albedo;
 
-    // Light 1
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(light1.position - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * light1.color * texture(texture_diffuse, TexCoords).rgb;
-
-    // Light 2
-    lightDir = normalize(light2.position - FragPos);
-    diff = max(dot(norm, lightDir), 0.0);
-    diffuse += diff * light2.color * texture(texture_diffuse, TexCoords).rgb;
+    vec3 diffuse = vec3(0.0);
+    for (int i = 0; i < lightCount.x; ++i)
+    {
+        vec3 toLight = lights[i].position.xyz - FragPos;
+        float lightDistance = length(toLight);
+        vec3 lightDir = toLight / lightDistance;
+        float diff = max(dot(norm, lightDir), 0.0);
+        if (diff > 0.0 && lightCount.y != 0 && bvhOccluded(FragPos + norm * 1e-3, lightDir, lightDistance))
+        {
+            diff = 0.0;
+        }
+        diffuse += diff * lights[i].color.rgb * albedo;
+    }
+
+#ifdef CLUSTERED_LIGHTING
+    diffuse += shadePointLights(norm, albedo);
+#endif
 
     vec3 result = ambient + diffuse;
     FragColor = vec4(result, 1.0);
@@ -7,15 +7,40 @@ out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 
+// Shared by all programs, updated once per frame (see FrameUniforms.h)
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Cooked meshes have unorm16 positions and texture coordinates within per-mesh ranges and
+// octahedral normals as raw snorm16 in xy; float vertices use the identity (see VertexQuantization.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+uniform vec4 texCoordTransform; // offset in xy, scale in zw
+uniform bool octahedralNormals;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = max(-normal.z, 0.0);
+    normal.x += normal.x >= 0.0 ? -fold : fold;
+    normal.y += normal.y >= 0.0 ? -fold : fold;
+    return normalize(normal);
+}
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    TexCoords = aTexCoords;
+    vec3 position = positionOffset + aPos * positionScale;
+    vec3 normal = octahedralNormals ? decodeOctahedral(aNormal.xy / 32767.0) : aNormal;
+
+    FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normal;
+    TexCoords = texCoordTransform.xy + aTexCoords * texCoordTransform.zw;
 
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
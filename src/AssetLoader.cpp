@@ -0,0 +1,101 @@
+﻿#include "AssetLoader.h"
+#include "Model.h"
+#include "Texture.h"
+#include <memory>
+
+AssetLoader::AssetLoader(unsigned int workerCount)
+    : pool(workerCount)
+{
+}
+
+void AssetLoader::loadModel(Model& model, const std::string& path, std::function<void()> onReady)
+{
+    ++submittedJobs;
+    Model* target = &model;
+    pool.submit([this, target, path, onReady]()
+    {
+        bool loaded = target->load(path, &pool);
+        complete([target, loaded, onReady]()
+        {
+            if (loaded)
+            {
+                target->upload();
+                if (onReady)
+                {
+                    onReady();
+                }
+            }
+        });
+    });
+}
+
+void AssetLoader::loadCubeMap(const std::vector<std::string>& faces, std::function<void(GLuint)> onReady)
+{
+    ++submittedJobs;
+
+    // One task per face; whichever finishes last hands the decoded set to the GL thread
+    struct CubeMapJob
+    {
+        std::vector<std::string> paths;
+        std::vector<ImageData> images;
+        std::atomic<size_t> remaining{0};
+    };
+    auto job = std::make_shared<CubeMapJob>();
+    job->paths = faces;
+    job->images.resize(faces.size());
+    job->remaining = faces.size();
+
+    if (faces.empty())
+    {
+        complete([onReady]() { onReady(createCubeMap({})); });
+        return;
+    }
+
+    for (size_t i = 0; i < faces.size(); ++i)
+    {
+        pool.submit([this, job, i, onReady]()
+        {
+            decodeImageFile(job->paths[i], job->images[i]);
+            if (--job->remaining == 0)
+            {
+                complete([job, onReady]() { onReady(createCubeMap(job->images)); });
+            }
+        });
+    }
+}
+
+void AssetLoader::update()
+{
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(completedMutex);
+        ready.swap(completed);
+    }
+
+    for (auto& finalize : ready)
+    {
+        finalize();
+        ++finishedJobs;
+    }
+}
+
+void AssetLoader::shutdown()
+{
+    pool.cancelPending();
+    pool.waitIdle();
+
+    std::lock_guard<std::mutex> lock(completedMutex);
+    completed.clear();
+}
+
+float AssetLoader::getProgress() const
+{
+    int submitted = submittedJobs;
+    return submitted > 0 ? static_cast<float>(finishedJobs) / submitted : 1.0f;
+}
+
+void AssetLoader::complete(std::function<void()> finalize)
+{
+    std::lock_guard<std::mutex> lock(completedMutex);
+    completed.push_back(std::move(finalize));
+}
@@ -0,0 +1,47 @@
+﻿#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <GL/glew.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+class Model;
+
+// Streams assets in without blocking the render loop. Parsing and image decoding
+// run on the worker pool; the GL uploads and completion callbacks are queued and
+// run by update() on the thread that owns the context.
+class AssetLoader
+{
+public:
+    explicit AssetLoader(unsigned int workerCount = 0);
+
+    // The model must outlive the request; onReady runs after its GPU upload
+    void loadModel(Model& model, const std::string& path, std::function<void()> onReady = nullptr);
+    void loadCubeMap(const std::vector<std::string>& faces, std::function<void(GLuint)> onReady);
+
+    // Call once per frame on the GL thread
+    void update();
+
+    // Drops queued jobs, waits for running ones and discards their completions. Call before
+    // tearing down GL or any model a job may still be loading into.
+    void shutdown();
+
+    bool isBusy() const { return finishedJobs < submittedJobs; }
+    float getProgress() const;
+    ThreadPool& getThreadPool() { return pool; }
+
+private:
+    std::mutex completedMutex;
+    std::vector<std::function<void()>> completed;
+    std::atomic<int> submittedJobs{0};
+    std::atomic<int> finishedJobs{0};
+    ThreadPool pool; // declared last so workers are joined before the members they use go away
+
+    void complete(std::function<void()> finalize);
+};
+
+#endif
@@ -0,0 +1,388 @@
+﻿#include "BatchRenderer.h"
+#include "ClusteredLighting.h"
+#include "Model.h"
+#include "OcclusionCulling.h"
+#include "Profiler.h"
+#include "TriangleBvh.h"
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+BatchRenderer::BatchRenderer()
+{
+    // gl_DrawID needs ARB_shader_draw_parameters on top of the GL 4.3 MDI/SSBO core
+    if (GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters)
+    {
+        // Sampler units are set on first draw so the compile can overlap the rest of startup
+        multiDrawShader = std::make_unique<Shader>("shaders/batch.vert", "shaders/raytrace.frag",
+                                                   ClusteredLighting::getShaderPreamble());
+    }
+    else
+    {
+        std::cout << "Multi-draw indirect not available, batched rendering uses the base-vertex fallback" << std::endl;
+    }
+}
+
+BatchRenderer::~BatchRenderer()
+{
+    releaseBuffers();
+    if (multiDrawShader)
+    {
+        multiDrawShader->release();
+    }
+}
+
+size_t BatchRenderer::addModel(const Model& model, const glm::mat4& transform)
+{
+    size_t firstDraw = commands.size();
+
+    struct PackedPrimitive
+    {
+        DrawElementsIndirectCommand command;
+        Aabb bounds;
+        DrawLods lods;
+    };
+    std::vector<std::vector<PackedPrimitive>> meshPrimitives(model.getMeshCount());
+    model.forEachPrimitive([&](const PrimitiveGeometry& geometry)
+    {
+        if (geometry.mesh < 0 || geometry.mesh >= static_cast<int>(meshPrimitives.size()))
+        {
+            return;
+        }
+
+        DrawElementsIndirectCommand command;
+        command.count = static_cast<GLuint>(geometry.indexCount);
+        command.instanceCount = 1;
+        command.firstIndex = static_cast<GLuint>(indices.size());
+        command.baseVertex = static_cast<GLint>(vertices.size());
+        command.baseInstance = 0;
+        DrawLods lods = {};
+        lods.lodCount = geometry.lodCount;
+        size_t indexCount = geometry.indexCount;
+        for (uint32_t lod = 0; lod < geometry.lodCount; ++lod)
+        {
+            lods.lods[lod] = geometry.lods[lod];
+            indexCount = std::max<size_t>(indexCount, size_t(geometry.lods[lod].firstIndex) + geometry.lods[lod].indexCount);
+        }
+        meshPrimitives[geometry.mesh].push_back({command, geometry.bounds, lods});
+
+        // The LOD index lists follow LOD 0, so they are packed along with it
+        vertices.insert(vertices.end(), geometry.vertices, geometry.vertices + geometry.vertexCount);
+        indices.insert(indices.end(), geometry.indices, geometry.indices + indexCount);
+    });
+
+    auto addMeshDraws = [&](int mesh, int node, const glm::mat4& world)
+    {
+        if (mesh < 0 || mesh >= static_cast<int>(meshPrimitives.size()))
+        {
+            return;
+        }
+        for (const auto& primitive : meshPrimitives[mesh])
+        {
+            commands.push_back(primitive.command);
+            transforms.push_back(transform * world);
+            localBounds.push_back(primitive.bounds);
+            drawLods.push_back(primitive.lods);
+            drawSources.push_back({&model, node, transform});
+        }
+    };
+
+    const SceneGraph& sceneGraph = model.getSceneGraph();
+    if (sceneGraph.getNodeCount() == 0)
+    {
+        for (int mesh = 0; mesh < static_cast<int>(meshPrimitives.size()); ++mesh)
+        {
+            addMeshDraws(mesh, -1, glm::mat4(1.0f));
+        }
+    }
+    else
+    {
+        for (int node : sceneGraph.getDrawableNodes())
+        {
+            addMeshDraws(sceneGraph.getMesh(node), node, sceneGraph.getWorldMatrix(node));
+        }
+    }
+    boundsDirty = true;
+    return firstDraw;
+}
+
+void BatchRenderer::setDrawTransform(size_t drawIndex, const glm::mat4& transform)
+{
+    if (drawIndex < transforms.size())
+    {
+        transforms[drawIndex] = transform;
+        transformsDirty = true;
+        boundsDirty = true;
+    }
+}
+
+void BatchRenderer::syncTransforms()
+{
+    for (size_t i = 0; i < drawSources.size(); ++i)
+    {
+        const DrawSource& source = drawSources[i];
+        if (source.node >= 0)
+        {
+            transforms[i] = source.root * source.model->getSceneGraph().getWorldMatrix(source.node);
+        }
+    }
+    transformsDirty = true;
+    boundsDirty = true;
+}
+
+void BatchRenderer::upload()
+{
+    releaseBuffers();
+    if (commands.empty())
+    {
+        return;
+    }
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(CookedVertex), vertices.data(), GL_STATIC_DRAW);
+
+    const GLsizei stride = sizeof(CookedVertex);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(CookedVertex, position)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(CookedVertex, normal)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(CookedVertex, texCoord)));
+
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (multiDrawShader)
+    {
+        glGenBuffers(1, &indirectBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+                     commands.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        glGenBuffers(1, &drawDataBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(),
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    transformsDirty = false;
+    uploadedVisibleDraws.clear();
+    for (uint32_t i = 0; i < commands.size(); ++i)
+    {
+        uploadedVisibleDraws.push_back(i);
+    }
+    uploadedLods.assign(commands.size(), 0);
+
+    std::cout << "Batched " << commands.size() << " draws, " << vertices.size() << " vertices, "
+        << indices.size() << " indices" << std::endl;
+}
+
+void BatchRenderer::clear()
+{
+    releaseBuffers();
+    vertices.clear();
+    indices.clear();
+    commands.clear();
+    transforms.clear();
+    drawSources.clear();
+    localBounds.clear();
+    drawBounds.clear();
+    cullingBvh.clear();
+    visibleDraws.clear();
+    uploadedVisibleDraws.clear();
+    drawLods.clear();
+    selectedLods.clear();
+    uploadedLods.clear();
+    cullStats = CullStats();
+    lodStats = LodStats();
+}
+
+void BatchRenderer::updateBounds()
+{
+    if (!boundsDirty)
+    {
+        return;
+    }
+
+    drawBounds.resize(commands.size());
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        drawBounds[i] = transformAabb(localBounds[i], transforms[i]);
+    }
+
+    // Transform edits keep the BVH topology; refit() rebuilds by itself when draws were added
+    if (cullingBvh.isEmpty())
+    {
+        cullingBvh.build(drawBounds);
+    }
+    else
+    {
+        cullingBvh.refit(drawBounds);
+    }
+    boundsDirty = false;
+    ++boundsVersion;
+}
+
+DrawElementsIndirectCommand BatchRenderer::getLodCommand(uint32_t draw, uint32_t lod) const
+{
+    DrawElementsIndirectCommand command = commands[draw];
+    command.count = drawLods[draw].lods[lod].indexCount;
+    command.firstIndex += drawLods[draw].lods[lod].firstIndex;
+    return command;
+}
+
+void BatchRenderer::draw(Shader& fallbackShader, const Frustum* frustum, const LodSelector* lodSelector,
+                         OcclusionCuller* occlusionCuller)
+{
+    PROFILE_ZONE("BatchRenderer::draw");
+    PROFILE_GPU_ZONE("BatchRenderer::draw");
+    submitCount = 0;
+    if (vao == 0)
+    {
+        return;
+    }
+
+    visibleDraws.clear();
+    if (frustum || lodSelector || occlusionCuller)
+    {
+        updateBounds();
+    }
+    if (frustum)
+    {
+        cullingBvh.cull(*frustum, visibleDraws);
+        std::sort(visibleDraws.begin(), visibleDraws.end());
+    }
+    else
+    {
+        for (uint32_t i = 0; i < commands.size(); ++i)
+        {
+            visibleDraws.push_back(i);
+        }
+    }
+    cullStats.visible = visibleDraws.size();
+    cullStats.culled = commands.size() - visibleDraws.size();
+
+    selectedLods.assign(commands.size(), 0);
+    lodStats = LodStats();
+    for (uint32_t i : visibleDraws)
+    {
+        uint32_t lod = lodSelector ?
+            lodSelector->select(drawLods[i].lods, drawLods[i].lodCount, drawBounds[i], getMaxScale(transforms[i])) : 0;
+        selectedLods[i] = static_cast<uint8_t>(lod);
+        lodStats.draws[lod]++;
+        lodStats.triangles += drawLods[i].lods[lod].indexCount / 3;
+    }
+
+    glBindVertexArray(vao);
+    if (multiDrawShader)
+    {
+        if (transformsDirty)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.data());
+            Profiler::get().addCounter(ProfileCounter::BytesUploaded, transforms.size() * sizeof(glm::mat4));
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            transformsDirty = false;
+        }
+
+        // Rewrite the indirect buffer only when the visible set or a LOD selection changes
+        if (visibleDraws != uploadedVisibleDraws || selectedLods != uploadedLods)
+        {
+            culledCommands = commands;
+            for (auto& command : culledCommands)
+            {
+                command.instanceCount = 0;
+            }
+            for (uint32_t draw : visibleDraws)
+            {
+                culledCommands[draw] = getLodCommand(draw, selectedLods[draw]);
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, culledCommands.size() * sizeof(DrawElementsIndirectCommand),
+                            culledCommands.data());
+            Profiler::get().addCounter(ProfileCounter::BytesUploaded,
+                                       culledCommands.size() * sizeof(DrawElementsIndirectCommand));
+            uploadedVisibleDraws = visibleDraws;
+            uploadedLods = selectedLods;
+        }
+
+        multiDrawShader->use();
+        if (!samplersBound)
+        {
+            multiDrawShader->setInt("texture_diffuse", 0);
+            multiDrawShader->setInt("skybox", 1);
+            multiDrawShader->setInt("bvhNodes", BVH_NODE_TEXTURE_UNIT);
+            multiDrawShader->setInt("bvhTriangles", BVH_TRIANGLE_TEXTURE_UNIT);
+            samplersBound = true;
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+        if (occlusionCuller)
+        {
+            drawOccluded(*occlusionCuller);
+        }
+        else
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(commands.size()), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            submitCount = 1;
+        }
+    }
+    else
+    {
+        fallbackShader.use();
+        setVertexDequantization(fallbackShader, VertexDequantization()); // the merged buffer holds float vertices
+        UniformHandle<glm::mat4> modelUniform = fallbackModelUniform.get(fallbackShader);
+        for (uint32_t i : visibleDraws)
+        {
+            DrawElementsIndirectCommand command = getLodCommand(i, selectedLods[i]);
+            fallbackShader.set(modelUniform, transforms[i]);
+            glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                     reinterpret_cast<void*>(command.firstIndex * sizeof(uint32_t)),
+                                     command.baseVertex);
+        }
+        submitCount = visibleDraws.size();
+    }
+    glBindVertexArray(0);
+    Profiler::get().addCounter(ProfileCounter::StateChanges);
+    Profiler::get().addCounter(ProfileCounter::DrawCalls, submitCount);
+}
+
+// The indirect buffer holds the candidates; the culler turns them into the early and late command lists.
+// Its compute passes switch programs, so the draw program is bound again before each phase.
+void BatchRenderer::drawOccluded(OcclusionCuller& occlusionCuller)
+{
+    if (occlusionCuller.getDrawCount() != commands.size() || occlusionBoundsVersion != boundsVersion)
+    {
+        occlusionCuller.setDrawBounds(drawBounds);
+        occlusionBoundsVersion = boundsVersion;
+    }
+
+    for (int phase = 0; phase < 2; ++phase)
+    {
+        GLuint commandBuffer = phase == 0 ? occlusionCuller.cullEarly(indirectBuffer)
+                                          : occlusionCuller.cullLate(indirectBuffer);
+        multiDrawShader->use();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(commands.size()), 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    submitCount = 2;
+}
+
+void BatchRenderer::releaseBuffers()
+{
+    GLuint buffers[] = { vbo, ebo, indirectBuffer, drawDataBuffer };
+    glDeleteBuffers(4, buffers);
+    glDeleteVertexArrays(1, &vao);
+    vao = vbo = ebo = indirectBuffer = drawDataBuffer = 0;
+}
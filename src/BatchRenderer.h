@@ -0,0 +1,114 @@
+﻿#ifndef BATCH_RENDERER_H
+#define BATCH_RENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include "MeshCache.h"
+#include "Culling.h"
+#include "MeshLod.h"
+#include "Shader.h"
+
+class Model;
+class OcclusionCuller;
+
+const GLuint DRAW_DATA_BINDING = 2;
+
+// Layout fixed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Packs the primitives of every added model into one vertex buffer, one index
+// buffer and one VAO, and submits the whole set with a single
+// glMultiDrawElementsIndirect. Per-draw transforms live in an SSBO indexed by
+// gl_DrawID. Without MDI support it falls back to a glDrawElementsBaseVertex
+// loop that sets the fallback program's "model" uniform per draw. Culled draws
+// keep their slot (and gl_DrawID) but get an instance count of zero; LOD
+// selection rewrites the slot's count and first index. With an occlusion culler
+// those commands are only candidates: the multi-draw path submits them in two
+// phases around the culler's depth pyramid (see OcclusionCulling.h).
+class BatchRenderer
+{
+public:
+    BatchRenderer();
+    ~BatchRenderer();
+    BatchRenderer(const BatchRenderer&) = delete;
+    BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+    // Adds one draw per primitive of every mesh-carrying scene node and returns the first draw index.
+    // Mesh geometry is packed once no matter how many nodes reference it.
+    size_t addModel(const Model& model, const glm::mat4& transform);
+    void setDrawTransform(size_t drawIndex, const glm::mat4& transform);
+    void syncTransforms(); // pulls current world matrices from the models' scene graphs
+    void upload();
+    void clear();
+
+    void draw(Shader& fallbackShader, const Frustum* frustum = nullptr, const LodSelector* lodSelector = nullptr,
+              OcclusionCuller* occlusionCuller = nullptr);
+
+    bool isMultiDrawAvailable() const { return multiDrawShader != nullptr; }
+    size_t getDrawCount() const { return commands.size(); }
+    size_t getSubmitCount() const { return submitCount; }
+    const CullStats& getCullStats() const { return cullStats; }
+    const LodStats& getLodStats() const { return lodStats; }
+
+private:
+    std::vector<CookedVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<glm::mat4> transforms;
+    bool transformsDirty = false;
+
+    struct DrawSource
+    {
+        const Model* model;
+        int node; // -1 when the model has no scene graph
+        glm::mat4 root;
+    };
+    std::vector<DrawSource> drawSources;
+    size_t submitCount = 0;
+
+    std::vector<Aabb> localBounds; // per draw, object space
+    std::vector<Aabb> drawBounds;  // per draw, world space
+    CullingBvh cullingBvh;
+    bool boundsDirty = false;
+    uint64_t boundsVersion = 0;
+    uint64_t occlusionBoundsVersion = 0; // drawBounds last handed to the occlusion culler
+    std::vector<uint32_t> visibleDraws;
+    std::vector<uint32_t> uploadedVisibleDraws; // visibility currently baked into the indirect buffer
+    std::vector<DrawElementsIndirectCommand> culledCommands;
+    CullStats cullStats;
+
+    struct DrawLods
+    {
+        MeshLod lods[MAX_MESH_LODS]; // firstIndex relative to the draw's LOD 0 command
+        uint32_t lodCount;
+    };
+    std::vector<DrawLods> drawLods;
+    std::vector<uint8_t> selectedLods;
+    std::vector<uint8_t> uploadedLods;
+    LodStats lodStats;
+
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    GLuint indirectBuffer = 0;
+    GLuint drawDataBuffer = 0;
+    std::unique_ptr<Shader> multiDrawShader;
+    CachedUniform<glm::mat4> fallbackModelUniform{"model"};
+    bool samplersBound = false;
+
+    void updateBounds();
+    void drawOccluded(OcclusionCuller& occlusionCuller);
+    DrawElementsIndirectCommand getLodCommand(uint32_t draw, uint32_t lod) const;
+    void releaseBuffers();
+};
+
+#endif
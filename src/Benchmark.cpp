@@ -0,0 +1,368 @@
+﻿#include "Benchmark.h"
+#include <stb_image_write.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+    void printUsage(const char* program)
+    {
+        std::cout << "Usage: " << program << " [options]\n"
+            << "  --model <path>        glTF/GLB model to load (default DamagedHelmet.glb)\n"
+            << "  --cwd <dir>           working directory holding shaders/ and textures/ (default ../)\n"
+            << "  --headless            render offscreen without a visible window and exit\n"
+            << "  --cpu                 path trace one image on the CPU (no GPU needed) and exit\n"
+            << "  --spp <n>             samples per pixel for --cpu (default 64)\n"
+            << "  --output <file>       PNG written by --cpu (default cpu_render.png)\n"
+            << "  --size <w>x<h>        offscreen resolution (default 800x600)\n"
+            << "  --frames <n>          measured frames (default 300)\n"
+            << "  --warmup <n>          unmeasured frames rendered first (default 10)\n"
+            << "  --lights <n>          point lights for the clustered lighting stress test (default 0)\n"
+            << "  --camera-path <file>  camera keyframes, one \"time x y z yaw pitch\" per line\n"
+            << "  --report <file>       write the JSON report here instead of stdout\n"
+            << "  --dump-frames <dir>   save every measured frame as a PNG\n";
+    }
+
+    bool parseCount(const std::string& text, int minValue, int& value)
+    {
+        char* end = nullptr;
+        long parsed = std::strtol(text.c_str(), &end, 10);
+        if (end == text.c_str() || *end != '\0' || parsed < minValue || parsed > 1 << 20)
+        {
+            return false;
+        }
+        value = static_cast<int>(parsed);
+        return true;
+    }
+
+    std::string escapeJson(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) >= 0x20)
+                {
+                    escaped += c;
+                }
+            }
+        }
+        return escaped;
+    }
+
+    void writeStats(std::ostream& out, const char* name, const std::vector<double>& samples)
+    {
+        out << "  \"" << name << "\": ";
+        if (samples.empty())
+        {
+            out << "null";
+            return;
+        }
+        FrameTimeStats stats = computeFrameTimeStats(samples);
+        out << "{ \"samples\": " << samples.size() << ", \"minMs\": " << stats.min << ", \"avgMs\": " << stats.avg
+            << ", \"p95Ms\": " << stats.p95 << ", \"p99Ms\": " << stats.p99 << ", \"maxMs\": " << stats.max
+            << ", \"stdDevMs\": " << stats.stdDev << " }";
+    }
+
+    std::string getGlString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? reinterpret_cast<const char*>(value) : "";
+    }
+}
+
+bool parseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool valid = true;
+
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        else if (arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (arg == "--cpu")
+        {
+            options.cpuRender = true;
+        }
+        else if (!hasValue)
+        {
+            valid = false;
+        }
+        else if (arg == "--model")
+        {
+            options.modelPath = argv[++i];
+        }
+        else if (arg == "--cwd")
+        {
+            options.workingDirectory = argv[++i];
+        }
+        else if (arg == "--size")
+        {
+            std::string size = argv[++i];
+            size_t x = size.find('x');
+            valid = x != std::string::npos && parseCount(size.substr(0, x), 1, options.width) &&
+                parseCount(size.substr(x + 1), 1, options.height);
+        }
+        else if (arg == "--frames")
+        {
+            valid = parseCount(argv[++i], 1, options.frames);
+        }
+        else if (arg == "--warmup")
+        {
+            valid = parseCount(argv[++i], 0, options.warmupFrames);
+        }
+        else if (arg == "--lights")
+        {
+            valid = parseCount(argv[++i], 0, options.pointLights);
+        }
+        else if (arg == "--camera-path")
+        {
+            options.cameraPath = argv[++i];
+        }
+        else if (arg == "--report")
+        {
+            options.reportPath = argv[++i];
+        }
+        else if (arg == "--dump-frames")
+        {
+            options.frameDumpDir = argv[++i];
+        }
+        else if (arg == "--spp")
+        {
+            valid = parseCount(argv[++i], 1, options.samplesPerPixel);
+        }
+        else if (arg == "--output")
+        {
+            options.cpuOutputPath = argv[++i];
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            std::cerr << "Invalid argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CameraPath::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Failed to open camera path: " << path << std::endl;
+        return false;
+    }
+
+    keys.clear();
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream(line);
+        Key key;
+        if (stream >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+        {
+            keys.push_back(key);
+        }
+    }
+    if (keys.empty())
+    {
+        std::cerr << "Camera path has no keyframes: " << path << std::endl;
+        return false;
+    }
+
+    std::stable_sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) { return a.time < b.time; });
+    return true;
+}
+
+void CameraPath::setOrbit(const glm::vec3& center, float radius, float height)
+{
+    // One full turn; yaw faces the centre (yaw = angle + 180 degrees)
+    keys.clear();
+    const int segments = 32;
+    for (int i = 0; i <= segments; ++i)
+    {
+        float angle = 360.0f * i / segments + 90.0f;
+        Key key;
+        key.time = static_cast<float>(i) / segments;
+        key.position = center + glm::vec3(radius * std::cos(glm::radians(angle)), height,
+                                          radius * std::sin(glm::radians(angle)));
+        key.yaw = angle + 180.0f;
+        key.pitch = -glm::degrees(std::atan2(height, radius));
+        keys.push_back(key);
+    }
+}
+
+void CameraPath::sample(float t, glm::vec3& position, float& yaw, float& pitch) const
+{
+    if (keys.empty())
+    {
+        return;
+    }
+
+    float time = keys.front().time + (keys.back().time - keys.front().time) * std::min(std::max(t, 0.0f), 1.0f);
+    size_t next = 0;
+    while (next < keys.size() && keys[next].time < time)
+    {
+        ++next;
+    }
+    if (next == 0 || next == keys.size())
+    {
+        const Key& key = next == 0 ? keys.front() : keys.back();
+        position = key.position;
+        yaw = key.yaw;
+        pitch = key.pitch;
+        return;
+    }
+
+    const Key& a = keys[next - 1];
+    const Key& b = keys[next];
+    float span = b.time - a.time;
+    float blend = span > 0.0f ? (time - a.time) / span : 1.0f;
+    position = glm::mix(a.position, b.position, blend);
+    yaw = a.yaw + (b.yaw - a.yaw) * blend;
+    pitch = a.pitch + (b.pitch - a.pitch) * blend;
+}
+
+GpuFrameTimer::GpuFrameTimer()
+{
+    available = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (available)
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+}
+
+GpuFrameTimer::~GpuFrameTimer()
+{
+    if (available)
+    {
+        glDeleteQueries(QUERY_COUNT, queries);
+    }
+}
+
+void GpuFrameTimer::begin()
+{
+    if (!available)
+    {
+        return;
+    }
+
+    // Never reuse a query whose result hasn't been read yet
+    if (issued - collected >= QUERY_COUNT)
+    {
+        collect(true);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, queries[issued % QUERY_COUNT]);
+}
+
+void GpuFrameTimer::end()
+{
+    if (!available)
+    {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    ++issued;
+}
+
+void GpuFrameTimer::collect(bool wait)
+{
+    while (collected < issued)
+    {
+        GLuint query = queries[collected % QUERY_COUNT];
+        if (!wait)
+        {
+            GLint ready = GL_FALSE;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &ready);
+            if (!ready)
+            {
+                return;
+            }
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        samples.push_back(elapsed / 1.0e6);
+        ++collected;
+        wait = false; // only block for the oldest one
+    }
+}
+
+bool writeBenchmarkReport(const BenchmarkOptions& options, const std::vector<double>& cpuSamples,
+                          const std::vector<double>& gpuSamples)
+{
+    std::ostringstream out;
+    out << "{\n"
+        << "  \"model\": \"" << escapeJson(options.modelPath) << "\",\n"
+        << "  \"width\": " << options.width << ",\n"
+        << "  \"height\": " << options.height << ",\n"
+        << "  \"frames\": " << options.frames << ",\n"
+        << "  \"warmupFrames\": " << options.warmupFrames << ",\n"
+        << "  \"pointLights\": " << options.pointLights << ",\n"
+        << "  \"renderer\": \"" << escapeJson(getGlString(GL_RENDERER)) << "\",\n"
+        << "  \"version\": \"" << escapeJson(getGlString(GL_VERSION)) << "\",\n";
+    writeStats(out, "cpu", cpuSamples);
+    out << ",\n";
+    writeStats(out, "gpu", gpuSamples);
+    out << "\n}\n";
+
+    if (options.reportPath.empty())
+    {
+        std::cout << out.str();
+        return true;
+    }
+
+    std::ofstream file(options.reportPath);
+    if (!file)
+    {
+        std::cerr << "Failed to write benchmark report: " << options.reportPath << std::endl;
+        return false;
+    }
+    file << out.str();
+    return true;
+}
+
+bool saveFramebufferImage(const std::string& path, int width, int height)
+{
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    return saveImageBottomUp(path, width, height, pixels.data());
+}
+
+bool saveImageBottomUp(const std::string& path, int width, int height, const unsigned char* rgb)
+{
+    stbi_flip_vertically_on_write(1);
+    bool written = stbi_write_png(path.c_str(), width, height, 3, rgb, width * 3) != 0;
+    stbi_flip_vertically_on_write(0);
+    if (!written)
+    {
+        std::cerr << "Failed to write image: " << path << std::endl;
+    }
+    return written;
+}
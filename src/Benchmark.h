@@ -0,0 +1,91 @@
+﻿#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include "FrameClock.h"
+
+// Command line of the executable. Without --headless or --cpu the options only
+// pick the model and working directory for the interactive viewer.
+struct BenchmarkOptions
+{
+    bool headless = false;
+    bool cpuRender = false;  // path trace on the CPU without creating a window or GL context
+    std::string workingDirectory = "../";
+    std::string modelPath = "DamagedHelmet.glb";
+    int width = 800;
+    int height = 600;
+    int frames = 300;
+    int warmupFrames = 10;
+    int pointLights = 0;     // clustered point lights scattered around the scene
+    std::string cameraPath;  // keyframe file, empty orbits the origin
+    std::string reportPath;  // JSON report, empty writes to stdout
+    std::string frameDumpDir; // PNG per frame when set
+    int samplesPerPixel = 64;             // --cpu passes
+    std::string cpuOutputPath = "cpu_render.png";
+};
+
+// Returns false when the program should exit (bad arguments or --help)
+bool parseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options);
+
+// Camera keyframes, one "time x y z yaw pitch" per line ('#' starts a comment).
+// The benchmark spreads its frames evenly over the key time range.
+class CameraPath
+{
+public:
+    struct Key
+    {
+        float time;
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+    };
+
+    bool load(const std::string& path);
+    void setOrbit(const glm::vec3& center, float radius, float height);
+
+    // t in [0, 1]
+    void sample(float t, glm::vec3& position, float& yaw, float& pitch) const;
+
+private:
+    std::vector<Key> keys;
+};
+
+// GL_TIME_ELAPSED queries kept in a small ring so results are read a few frames
+// late instead of stalling the pipeline every frame.
+class GpuFrameTimer
+{
+public:
+    GpuFrameTimer();
+    ~GpuFrameTimer();
+    GpuFrameTimer(const GpuFrameTimer&) = delete;
+    GpuFrameTimer& operator=(const GpuFrameTimer&) = delete;
+
+    bool isAvailable() const { return available; }
+    void begin();
+    void end();
+    void collect(bool wait); // appends finished results to getSamples()
+    const std::vector<double>& getSamples() const { return samples; } // milliseconds
+    void clearSamples() { samples.clear(); } // long-running users consume them as they arrive
+
+private:
+    static const int QUERY_COUNT = 4;
+    GLuint queries[QUERY_COUNT] = {};
+    int issued = 0;    // total queries started
+    int collected = 0; // total queries read back
+    bool available = false;
+    std::vector<double> samples;
+};
+
+bool writeBenchmarkReport(const BenchmarkOptions& options, const std::vector<double>& cpuSamples,
+                          const std::vector<double>& gpuSamples);
+
+// Reads the bound read framebuffer and writes it as a PNG, flipped to top-down
+bool saveFramebufferImage(const std::string& path, int width, int height);
+
+// Writes RGB8 rows stored bottom-up (as glReadPixels returns them) as a top-down PNG
+bool saveImageBottomUp(const std::string& path, int width, int height, const unsigned char* rgb);
+
+#endif
@@ -0,0 +1,78 @@
+﻿#include "BufferManager.h"
+#include "Profiler.h"
+#include <iostream>
+
+BufferManager::~BufferManager()
+{
+    release();
+}
+
+GLuint BufferManager::getBuffer(const tinygltf::Model& model, int bufferViewIndex)
+{
+    auto it = viewBuffers.find(bufferViewIndex);
+    if (it != viewBuffers.end())
+    {
+        return it->second;
+    }
+
+    if (bufferViewIndex < 0 || bufferViewIndex >= model.bufferViews.size())
+    {
+        std::cerr << "Error: Buffer view index out of range: " << bufferViewIndex << std::endl;
+        return 0;
+    }
+
+    const tinygltf::BufferView& bufferView = model.bufferViews[bufferViewIndex];
+    if (bufferView.buffer < 0 || bufferView.buffer >= model.buffers.size())
+    {
+        std::cerr << "Error: Buffer index out of range: " << bufferView.buffer << std::endl;
+        return 0;
+    }
+
+    const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+    if (bufferView.byteOffset + bufferView.byteLength > buffer.data.size())
+    {
+        std::cerr << "Error: Buffer view " << bufferViewIndex << " exceeds buffer size" << std::endl;
+        return 0;
+    }
+
+    GLuint glBuffer = createBuffer(buffer.data.data() + bufferView.byteOffset, bufferView.byteLength);
+    viewBuffers[bufferViewIndex] = glBuffer;
+    return glBuffer;
+}
+
+GLuint BufferManager::createBuffer(const void* data, size_t size)
+{
+    // Upload through the copy target so the currently bound VAO is left untouched
+    GLuint glBuffer;
+    glGenBuffers(1, &glBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, glBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (!staging)
+    {
+        staging = std::make_unique<StagingRing>();
+    }
+    staging->upload(glBuffer, 0, data, size);
+
+    bytesUploaded += size;
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, size);
+    ownedBuffers.push_back(glBuffer);
+    return glBuffer;
+}
+
+void BufferManager::finishUploads()
+{
+    staging.reset();
+}
+
+void BufferManager::release()
+{
+    staging.reset();
+    if (!ownedBuffers.empty())
+    {
+        glDeleteBuffers(static_cast<GLsizei>(ownedBuffers.size()), ownedBuffers.data());
+    }
+    viewBuffers.clear();
+    ownedBuffers.clear();
+    bytesUploaded = 0;
+}
@@ -0,0 +1,39 @@
+﻿#ifndef BUFFER_MANAGER_H
+#define BUFFER_MANAGER_H
+
+#include <tiny_gltf.h>
+#include <GL/glew.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "StagingRing.h"
+
+// Owns the GL buffers backing a glTF model. Each bufferView is uploaded once on
+// first use and the same buffer is handed out to every VAO that references it.
+// Data is streamed through a staging ring, so a source in a file mapping is read
+// piecewise and never copied whole by the driver.
+class BufferManager
+{
+public:
+    BufferManager() = default;
+    ~BufferManager();
+    BufferManager(const BufferManager&) = delete;
+    BufferManager& operator=(const BufferManager&) = delete;
+
+    GLuint getBuffer(const tinygltf::Model& model, int bufferViewIndex);
+    GLuint createBuffer(const void* data, size_t size);
+    void finishUploads(); // frees the staging ring once the model's geometry is in
+    void release();
+
+    size_t getBytesUploaded() const { return bytesUploaded; }
+    size_t getBufferCount() const { return ownedBuffers.size(); }
+
+private:
+    std::unordered_map<int, GLuint> viewBuffers;
+    std::vector<GLuint> ownedBuffers;
+    std::unique_ptr<StagingRing> staging;
+    size_t bytesUploaded = 0;
+};
+
+#endif
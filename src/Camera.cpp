@@ -53,6 +53,14 @@ void Camera::processMouseMovement(float xoffset, float yoffset, bool constrainPi
     updateCameraVectors();
 }
 
+void Camera::setPose(const glm::vec3& position, float yaw, float pitch)
+{
+    this->position = position;
+    this->yaw = yaw;
+    this->pitch = pitch;
+    updateCameraVectors();
+}
+
 void Camera::updateCameraVectors()
 {
     glm::vec3 front;
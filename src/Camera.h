@@ -19,6 +19,7 @@ public:
     glm::mat4 getViewMatrix();
     void processKeyboard(Camera_Movement direction, float deltaTime);
     void processMouseMovement(float xoffset, float yoffset, bool constrainPitch = true);
+    void setPose(const glm::vec3& position, float yaw, float pitch);
 
     glm::vec3 position;
     glm::vec3 front;
@@ -0,0 +1,328 @@
+﻿#include "ClusteredLighting.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLUSTERS_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const size_t INITIAL_LIGHT_CAPACITY = 64;
+    const size_t INITIAL_INDEX_CAPACITY = 4096;
+
+    // Grows a storage buffer by doubling, or updates the used part in place
+    void uploadStorage(GLuint buffer, size_t& capacity, const void* data, size_t size)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        if (size > capacity)
+        {
+            capacity = std::max(size, capacity * 2);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+        }
+        if (size > 0)
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+        }
+    }
+
+    uint32_t getSlice(float depth, float scale, float bias)
+    {
+        float slice = std::floor(std::log(depth) * scale + bias);
+        return static_cast<uint32_t>(std::min(std::max(slice, 0.0f), static_cast<float>(CLUSTER_GRID_Z - 1)));
+    }
+}
+
+bool ClusteredLighting::isSupported()
+{
+    return GLEW_VERSION_4_3 != 0;
+}
+
+std::string ClusteredLighting::getShaderPreamble()
+{
+    return isSupported() ? "#version 430 core\n#define CLUSTERED_LIGHTING 1\n" : "";
+}
+
+ClusteredLighting::ClusteredLighting()
+{
+    glGenBuffers(1, &clusterDataBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, clusterDataBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Storage bindings must never be empty, so every buffer starts with some capacity
+    lightCapacity = INITIAL_LIGHT_CAPACITY * sizeof(GpuPointLight);
+    indexCapacity = INITIAL_INDEX_CAPACITY * sizeof(uint32_t);
+    glGenBuffers(1, &lightBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, lightCapacity, nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &gridBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &indexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, indexCapacity, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    clusterLights.resize(CLUSTER_COUNT);
+    clusterRanges.resize(CLUSTER_COUNT);
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+    glDeleteBuffers(1, &clusterDataBuffer);
+    glDeleteBuffers(1, &lightBuffer);
+    glDeleteBuffers(1, &gridBuffer);
+    glDeleteBuffers(1, &indexBuffer);
+}
+
+void ClusteredLighting::update(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+                               int viewportWidth, int viewportHeight, const std::vector<PointLight>& lights,
+                               ThreadPool* pool)
+{
+    PROFILE_ZONE("ClusteredLighting::update");
+    if (viewportWidth <= 0 || viewportHeight <= 0)
+    {
+        return;
+    }
+
+    if (projection != boundsProjection || viewportWidth != boundsWidth || viewportHeight != boundsHeight)
+    {
+        buildClusterBounds(projection, nearPlane, farPlane, viewportWidth, viewportHeight);
+    }
+
+    float logDepthRange = std::log(farPlane / nearPlane);
+    float sliceScale = CLUSTER_GRID_Z / logDepthRange;
+    float sliceBias = -static_cast<float>(CLUSTER_GRID_Z) * std::log(nearPlane) / logDepthRange;
+
+    // Lights entirely in front of the near plane or behind the far plane never reach a cluster
+    viewLights.clear();
+    gpuLights.clear();
+    for (const PointLight& light : lights)
+    {
+        glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        float nearest = -center.z - light.radius;
+        float farthest = -center.z + light.radius;
+        if (light.radius <= 0.0f || farthest < nearPlane || nearest > farPlane)
+        {
+            continue;
+        }
+
+        ViewLight viewLight;
+        viewLight.center = center;
+        viewLight.radius = light.radius;
+        viewLight.firstSlice = getSlice(std::max(nearest, nearPlane), sliceScale, sliceBias);
+        viewLight.lastSlice = getSlice(std::min(farthest, farPlane), sliceScale, sliceBias);
+        viewLights.push_back(viewLight);
+        gpuLights.push_back({glm::vec4(light.position, light.radius), glm::vec4(light.color, 1.0f)});
+    }
+
+    // Slices own disjoint clusters, so they need no synchronisation
+    if (pool && !viewLights.empty())
+    {
+        pool->parallelFor(CLUSTER_GRID_Z, [this](size_t slice) { assignSlice(static_cast<uint32_t>(slice)); });
+    }
+    else
+    {
+        for (uint32_t slice = 0; slice < CLUSTER_GRID_Z; ++slice)
+        {
+            assignSlice(slice);
+        }
+    }
+
+    stats = ClusterStats();
+    stats.lights = gpuLights.size();
+    indices.clear();
+    for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+    {
+        const std::vector<uint32_t>& list = clusterLights[cluster];
+        size_t count = std::min(list.size(), MAX_CLUSTER_LIGHT_INDICES - indices.size());
+        clusterRanges[cluster] = glm::uvec2(static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(count));
+        indices.insert(indices.end(), list.begin(), list.begin() + count);
+
+        stats.droppedIndices += list.size() - count;
+        stats.maxClusterLights = std::max(stats.maxClusterLights, list.size());
+        stats.occupiedClusters += list.empty() ? 0 : 1;
+    }
+    stats.lightIndices = indices.size();
+    if (stats.droppedIndices > 0)
+    {
+        std::cerr << "Warning: " << stats.droppedIndices << " cluster light indices over the limit were dropped" << std::endl;
+    }
+
+    ClusterData clusterData;
+    clusterData.gridSize = glm::uvec4(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, static_cast<uint32_t>(gpuLights.size()));
+    clusterData.depthParams = glm::vec4(nearPlane, farPlane, sliceScale, sliceBias);
+    clusterData.tileSize = glm::vec4(tileSize.x, tileSize.y, 0.0f, 0.0f);
+    upload(clusterData);
+}
+
+void ClusteredLighting::buildClusterBounds(const glm::mat4& projection, float nearPlane, float farPlane, int width,
+                                           int height)
+{
+    boundsProjection = projection;
+    boundsWidth = width;
+    boundsHeight = height;
+
+    // Tiles are whole pixels, so the last row and column may reach past the viewport
+    tileSize = glm::vec2(std::ceil(static_cast<float>(width) / CLUSTER_GRID_X),
+                         std::ceil(static_cast<float>(height) / CLUSTER_GRID_Y));
+
+    // Tile corners on the near plane; points further out along the same ray scale with depth
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    auto nearPoint = [&](float x, float y)
+    {
+        glm::vec4 ndc(x / width * 2.0f - 1.0f, y / height * 2.0f - 1.0f, -1.0f, 1.0f);
+        glm::vec4 point = inverseProjection * ndc;
+        return glm::vec3(point) / point.w;
+    };
+
+    const size_t tileCount = CLUSTER_GRID_X * CLUSTER_GRID_Y;
+    const size_t paddedCount = (tileCount + 3) & ~size_t(3);
+    slices.resize(CLUSTER_GRID_Z);
+    for (uint32_t z = 0; z < CLUSTER_GRID_Z; ++z)
+    {
+        float sliceNear = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(z) / CLUSTER_GRID_Z);
+        float sliceFar = nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(z + 1) / CLUSTER_GRID_Z);
+
+        // Padding boxes are inverted so no sphere can touch them
+        SliceBounds& bounds = slices[z];
+        bounds.minX.assign(paddedCount, FLT_MAX);
+        bounds.minY.assign(paddedCount, FLT_MAX);
+        bounds.minZ.assign(paddedCount, FLT_MAX);
+        bounds.maxX.assign(paddedCount, -FLT_MAX);
+        bounds.maxY.assign(paddedCount, -FLT_MAX);
+        bounds.maxZ.assign(paddedCount, -FLT_MAX);
+        for (uint32_t y = 0; y < CLUSTER_GRID_Y; ++y)
+        {
+            for (uint32_t x = 0; x < CLUSTER_GRID_X; ++x)
+            {
+                glm::vec3 corners[4] =
+                {
+                    nearPoint(x * tileSize.x, y * tileSize.y),
+                    nearPoint((x + 1) * tileSize.x, y * tileSize.y),
+                    nearPoint(x * tileSize.x, (y + 1) * tileSize.y),
+                    nearPoint((x + 1) * tileSize.x, (y + 1) * tileSize.y)
+                };
+
+                Aabb box;
+                for (const glm::vec3& corner : corners)
+                {
+                    // Near-plane points sit at z = -near
+                    box.expand(corner * (sliceNear / -corner.z));
+                    box.expand(corner * (sliceFar / -corner.z));
+                }
+
+                size_t tile = y * CLUSTER_GRID_X + x;
+                bounds.minX[tile] = box.min.x;
+                bounds.minY[tile] = box.min.y;
+                bounds.minZ[tile] = box.min.z;
+                bounds.maxX[tile] = box.max.x;
+                bounds.maxY[tile] = box.max.y;
+                bounds.maxZ[tile] = box.max.z;
+            }
+        }
+    }
+}
+
+void ClusteredLighting::assignSlice(uint32_t slice)
+{
+    const uint32_t tileCount = CLUSTER_GRID_X * CLUSTER_GRID_Y;
+    std::vector<uint32_t>* lists = &clusterLights[slice * tileCount];
+    for (uint32_t tile = 0; tile < tileCount; ++tile)
+    {
+        lists[tile].clear();
+    }
+
+    const SliceBounds& bounds = slices[slice];
+    const size_t paddedCount = bounds.minX.size();
+    for (uint32_t lightIndex = 0; lightIndex < viewLights.size(); ++lightIndex)
+    {
+        const ViewLight& light = viewLights[lightIndex];
+        if (slice < light.firstSlice || slice > light.lastSlice)
+        {
+            continue;
+        }
+
+        // Squared distance from the sphere centre to each box, four boxes at a time
+#ifdef CLUSTERS_USE_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 cx = _mm_set1_ps(light.center.x), cy = _mm_set1_ps(light.center.y), cz = _mm_set1_ps(light.center.z);
+        const __m128 radiusSquared = _mm_set1_ps(light.radius * light.radius);
+        for (size_t group = 0; group < paddedCount; group += 4)
+        {
+            __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.minX[group]), cx), zero),
+                                   _mm_sub_ps(cx, _mm_loadu_ps(&bounds.maxX[group])));
+            __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.minY[group]), cy), zero),
+                                   _mm_sub_ps(cy, _mm_loadu_ps(&bounds.maxY[group])));
+            __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.minZ[group]), cz), zero),
+                                   _mm_sub_ps(cz, _mm_loadu_ps(&bounds.maxZ[group])));
+            __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            int hits = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, radiusSquared));
+            for (int lane = 0; hits != 0; ++lane, hits >>= 1)
+            {
+                if (hits & 1)
+                {
+                    lists[group + lane].push_back(lightIndex);
+                }
+            }
+        }
+#else
+        float radiusSquared = light.radius * light.radius;
+        for (size_t tile = 0; tile < paddedCount; ++tile)
+        {
+            float dx = std::max(std::max(bounds.minX[tile] - light.center.x, 0.0f), light.center.x - bounds.maxX[tile]);
+            float dy = std::max(std::max(bounds.minY[tile] - light.center.y, 0.0f), light.center.y - bounds.maxY[tile]);
+            float dz = std::max(std::max(bounds.minZ[tile] - light.center.z, 0.0f), light.center.z - bounds.maxZ[tile]);
+            if (dx * dx + dy * dy + dz * dz <= radiusSquared)
+            {
+                lists[tile].push_back(lightIndex);
+            }
+        }
+#endif
+    }
+}
+
+void ClusteredLighting::upload(const ClusterData& clusterData)
+{
+    PROFILE_ZONE("ClusteredLighting::upload");
+    glBindBuffer(GL_UNIFORM_BUFFER, clusterDataBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusterData), &clusterData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_DATA_BINDING, clusterDataBuffer);
+
+    uploadStorage(lightBuffer, lightCapacity, gpuLights.data(), gpuLights.size() * sizeof(GpuPointLight));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gridBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, clusterRanges.size() * sizeof(glm::uvec2), clusterRanges.data());
+    uploadStorage(indexBuffer, indexCapacity, indices.data(), indices.size() * sizeof(uint32_t));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, POINT_LIGHT_BINDING, lightBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, gridBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_BINDING, indexBuffer);
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded,
+                               sizeof(ClusterData) + gpuLights.size() * sizeof(GpuPointLight) +
+                               clusterRanges.size() * sizeof(glm::uvec2) + indices.size() * sizeof(uint32_t));
+}
+
+void scatterPointLights(std::vector<PointLight>& lights, size_t count, const Aabb& bounds, float minRadius,
+                        float maxRadius, uint32_t seed)
+{
+    // Generated in order from one stream, so a smaller count is a prefix of a larger one
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    lights.resize(count);
+    for (PointLight& light : lights)
+    {
+        light.position = bounds.min + (bounds.max - bounds.min) * glm::vec3(unit(rng), unit(rng), unit(rng));
+        light.radius = minRadius + (maxRadius - minRadius) * unit(rng);
+        glm::vec3 color(unit(rng), unit(rng), unit(rng));
+        light.color = color / std::max(std::max(color.x, color.y), std::max(color.z, 0.001f));
+    }
+}
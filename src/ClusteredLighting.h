@@ -0,0 +1,120 @@
+﻿#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Culling.h"
+#include "FrameUniforms.h"
+#include "Light.h"
+
+class ThreadPool;
+
+// Shader storage bindings, after DRAW_DATA_BINDING (2) from BatchRenderer.h
+const GLuint POINT_LIGHT_BINDING = 3;
+const GLuint CLUSTER_GRID_BINDING = 4;
+const GLuint CLUSTER_INDEX_BINDING = 5;
+
+// View frustum split into tiles on screen and exponential slices in depth
+const uint32_t CLUSTER_GRID_X = 16;
+const uint32_t CLUSTER_GRID_Y = 9;
+const uint32_t CLUSTER_GRID_Z = 24;
+const uint32_t CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+const uint32_t MAX_CLUSTER_LIGHT_INDICES = 1u << 20;
+
+// std430 mirror of PointLight in raytrace.frag
+struct GpuPointLight
+{
+    glm::vec4 positionRadius;
+    glm::vec4 color;
+};
+
+// std140 mirror of the ClusterData block in raytrace.frag
+struct ClusterData
+{
+    glm::uvec4 gridSize;   // xyz cluster counts, w point light count
+    glm::vec4 depthParams; // near, far, slice scale, slice bias: slice = log(depth) * scale + bias
+    glm::vec4 tileSize;    // pixels per tile in xy
+};
+
+struct ClusterStats
+{
+    size_t lights = 0;        // point lights in front of the far plane
+    size_t lightIndices = 0;  // cluster/light pairs uploaded
+    size_t droppedIndices = 0; // pairs past MAX_CLUSTER_LIGHT_INDICES
+    size_t maxClusterLights = 0;
+    size_t occupiedClusters = 0;
+};
+
+// Clustered forward lighting. Every frame the point lights are assigned to the
+// view-space cluster boxes they touch (one depth slice per pool task, four
+// sphere/box tests per SSE op) and the light list, the per-cluster ranges and
+// the flat index list go to shader storage buffers. Fragments then only loop
+// over the lights of their own cluster. Needs GL 4.3 for storage buffers in the
+// fragment stage; without it only the global lights are drawn.
+class ClusteredLighting
+{
+public:
+    static bool isSupported();
+
+    // Prepended to raytrace.frag: switches it to GLSL 4.30 and enables the cluster loop
+    static std::string getShaderPreamble();
+
+    ClusteredLighting();
+    ~ClusteredLighting();
+    ClusteredLighting(const ClusteredLighting&) = delete;
+    ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+    void update(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+                int viewportWidth, int viewportHeight, const std::vector<PointLight>& lights, ThreadPool* pool);
+
+    const ClusterStats& getStats() const { return stats; }
+
+private:
+    // Cluster boxes of one depth slice, structure-of-arrays and padded to a multiple of four
+    struct SliceBounds
+    {
+        std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    };
+
+    struct ViewLight
+    {
+        glm::vec3 center; // view space
+        float radius;
+        uint32_t firstSlice;
+        uint32_t lastSlice;
+    };
+
+    GLuint clusterDataBuffer = 0;
+    GLuint lightBuffer = 0;
+    GLuint gridBuffer = 0;
+    GLuint indexBuffer = 0;
+    size_t lightCapacity = 0;
+    size_t indexCapacity = 0;
+
+    // Cluster boxes only change with the projection or the viewport
+    glm::mat4 boundsProjection = glm::mat4(0.0f);
+    int boundsWidth = 0;
+    int boundsHeight = 0;
+    std::vector<SliceBounds> slices;
+    glm::vec2 tileSize = glm::vec2(0.0f);
+
+    std::vector<ViewLight> viewLights;
+    std::vector<std::vector<uint32_t>> clusterLights; // per cluster, reused between frames
+    std::vector<glm::uvec2> clusterRanges;             // offset, count into indices
+    std::vector<uint32_t> indices;
+    std::vector<GpuPointLight> gpuLights;
+    ClusterStats stats;
+
+    void buildClusterBounds(const glm::mat4& projection, float nearPlane, float farPlane, int width, int height);
+    void assignSlice(uint32_t slice);
+    void upload(const ClusterData& clusterData);
+};
+
+// Random point lights inside `bounds` for stress testing; the same seed gives the same lights
+void scatterPointLights(std::vector<PointLight>& lights, size_t count, const Aabb& bounds, float minRadius,
+                        float maxRadius, uint32_t seed = 1);
+
+#endif
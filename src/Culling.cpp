@@ -0,0 +1,270 @@
+﻿#include "Culling.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const uint32_t MAX_LEAF_ITEMS = 4;
+}
+
+void Aabb::expand(const glm::vec3& point)
+{
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void Aabb::expand(const Aabb& box)
+{
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+}
+
+Aabb transformAabb(const Aabb& box, const glm::mat4& transform)
+{
+    if (!box.isValid())
+    {
+        return box;
+    }
+
+    Aabb result;
+    result.min = result.max = glm::vec3(transform[3]);
+    for (int column = 0; column < 3; ++column)
+    {
+        for (int row = 0; row < 3; ++row)
+        {
+            float a = transform[column][row] * box.min[column];
+            float b = transform[column][row] * box.max[column];
+            result.min[row] += std::min(a, b);
+            result.max[row] += std::max(a, b);
+        }
+    }
+    return result;
+}
+
+Frustum::Frustum(const glm::mat4& viewProjection)
+{
+    // Gribb/Hartmann plane extraction; planes are left unnormalised since only signs are compared
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    const glm::vec4 planes[6] =
+    {
+        rows[3] + rows[0], rows[3] - rows[0], // left, right
+        rows[3] + rows[1], rows[3] - rows[1], // bottom, top
+        rows[3] + rows[2], rows[3] - rows[2]  // near, far
+    };
+    for (int i = 0; i < 8; ++i)
+    {
+        glm::vec4 plane = i < 6 ? planes[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        nx[i] = plane.x;
+        ny[i] = plane.y;
+        nz[i] = plane.z;
+        nw[i] = plane.w;
+    }
+}
+
+CullResult Frustum::test(const Aabb& box) const
+{
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+#ifdef CULLING_USE_SSE
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+    const __m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+
+    int outsideMask = 0;
+    int intersectMask = 0;
+    for (int group = 0; group < 8; group += 4)
+    {
+        __m128 px = _mm_load_ps(nx + group);
+        __m128 py = _mm_load_ps(ny + group);
+        __m128 pz = _mm_load_ps(nz + group);
+        __m128 pw = _mm_load_ps(nw + group);
+
+        // Signed distance of the centre and projected radius of the box for four planes
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                                     _mm_add_ps(_mm_mul_ps(pz, cz), pw));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, px), ex),
+                                              _mm_mul_ps(_mm_andnot_ps(signMask, py), ey)),
+                                   _mm_mul_ps(_mm_andnot_ps(signMask, pz), ez));
+
+        outsideMask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        intersectMask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), _mm_setzero_ps()));
+    }
+#else
+    int outsideMask = 0;
+    int intersectMask = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        float distance = nx[i] * center.x + ny[i] * center.y + nz[i] * center.z + nw[i];
+        float radius = std::abs(nx[i]) * extent.x + std::abs(ny[i]) * extent.y + std::abs(nz[i]) * extent.z;
+        outsideMask |= distance + radius < 0.0f;
+        intersectMask |= distance - radius < 0.0f;
+    }
+#endif
+
+    if (outsideMask)
+    {
+        return CullResult::Outside;
+    }
+    return intersectMask ? CullResult::Intersecting : CullResult::Inside;
+}
+
+void CullingBvh::build(const std::vector<Aabb>& itemBounds)
+{
+    clear();
+    if (itemBounds.empty())
+    {
+        return;
+    }
+
+    std::vector<glm::vec3> centers(itemBounds.size());
+    itemIndices.resize(itemBounds.size());
+    for (uint32_t i = 0; i < itemBounds.size(); ++i)
+    {
+        centers[i] = (itemBounds[i].min + itemBounds[i].max) * 0.5f;
+        itemIndices[i] = i;
+    }
+
+    nodes.reserve(itemBounds.size());
+    nodes.push_back({});
+    buildNode(0, centers, 0, static_cast<uint32_t>(itemBounds.size()));
+    refit(itemBounds);
+}
+
+void CullingBvh::buildNode(uint32_t nodeIndex, const std::vector<glm::vec3>& centers, uint32_t begin, uint32_t end)
+{
+    if (end - begin <= MAX_LEAF_ITEMS)
+    {
+        nodes[nodeIndex].first = begin;
+        nodes[nodeIndex].count = end - begin;
+        return;
+    }
+
+    // Median split along the widest axis of the item centres
+    Aabb centerBounds;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        centerBounds.expand(centers[itemIndices[i]]);
+    }
+    glm::vec3 size = centerBounds.max - centerBounds.min;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(itemIndices.begin() + begin, itemIndices.begin() + middle, itemIndices.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+    // Children are allocated as a consecutive pair, always after their parent
+    uint32_t left = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({});
+    nodes.push_back({});
+    nodes[nodeIndex].first = left;
+    nodes[nodeIndex].count = 0;
+    buildNode(left, centers, begin, middle);
+    buildNode(left + 1, centers, middle, end);
+}
+
+void CullingBvh::refit(const std::vector<Aabb>& itemBounds)
+{
+    if (itemBounds.size() != itemIndices.size())
+    {
+        build(itemBounds);
+        return;
+    }
+
+    slotBounds.resize(itemIndices.size());
+    for (size_t slot = 0; slot < itemIndices.size(); ++slot)
+    {
+        slotBounds[slot] = itemBounds[itemIndices[slot]];
+    }
+
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        Node& node = nodes[i];
+        Aabb bounds;
+        if (node.count > 0)
+        {
+            for (uint32_t slot = node.first; slot < node.first + node.count; ++slot)
+            {
+                bounds.expand(slotBounds[slot]);
+            }
+        }
+        else
+        {
+            bounds.expand(nodes[node.first].bounds);
+            bounds.expand(nodes[node.first + 1].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+
+void CullingBvh::clear()
+{
+    nodes.clear();
+    itemIndices.clear();
+    slotBounds.clear();
+}
+
+void CullingBvh::cull(const Frustum& frustum, std::vector<uint32_t>& visibleItems) const
+{
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    // Median splits keep the depth near log2(items), far below the stack size
+    uint32_t stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const Node& node = nodes[stack[--stackSize]];
+
+        CullResult result = frustum.test(node.bounds);
+        if (result == CullResult::Outside)
+        {
+            continue;
+        }
+
+        if (node.count > 0)
+        {
+            for (uint32_t slot = node.first; slot < node.first + node.count; ++slot)
+            {
+                if (result == CullResult::Inside || node.count == 1 ||
+                    frustum.test(slotBounds[slot]) != CullResult::Outside)
+                {
+                    visibleItems.push_back(itemIndices[slot]);
+                }
+            }
+        }
+        else if (result == CullResult::Inside)
+        {
+            appendSubtree(node, visibleItems);
+        }
+        else
+        {
+            stack[stackSize++] = node.first + 1;
+            stack[stackSize++] = node.first;
+        }
+    }
+}
+
+void CullingBvh::appendSubtree(const Node& node, std::vector<uint32_t>& visibleItems) const
+{
+    if (node.count > 0)
+    {
+        visibleItems.insert(visibleItems.end(), itemIndices.begin() + node.first,
+                            itemIndices.begin() + node.first + node.count);
+        return;
+    }
+    appendSubtree(nodes[node.first], visibleItems);
+    appendSubtree(nodes[node.first + 1], visibleItems);
+}
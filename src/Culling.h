@@ -0,0 +1,87 @@
+﻿#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+struct Aabb
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool isValid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+    void expand(const glm::vec3& point);
+    void expand(const Aabb& box);
+};
+
+// Bounds of a box after an affine transform (Arvo's method, stays tight for rotations of the box axes)
+Aabb transformAabb(const Aabb& box, const glm::mat4& transform);
+
+enum class CullResult
+{
+    Outside,
+    Intersecting,
+    Inside
+};
+
+// Six view-frustum planes stored structure-of-arrays in two groups of four, so
+// one SSE pass tests a box against four planes at once. The last two slots of
+// the second group are padded with planes that always pass.
+class Frustum
+{
+public:
+    Frustum() = default;
+    explicit Frustum(const glm::mat4& viewProjection);
+
+    CullResult test(const Aabb& box) const;
+
+private:
+    alignas(16) float nx[8] = {};
+    alignas(16) float ny[8] = {};
+    alignas(16) float nz[8] = {};
+    alignas(16) float nw[8] = {};
+};
+
+struct CullStats
+{
+    size_t visible = 0;
+    size_t culled = 0;
+};
+
+// Binary BVH over item bounds for view culling. Nodes are stored parent before
+// children, so refit() is a single reverse pass when item bounds move but the
+// topology is kept. Subtrees fully inside the frustum are accepted without
+// testing their leaves.
+class CullingBvh
+{
+public:
+    void build(const std::vector<Aabb>& itemBounds);
+    void refit(const std::vector<Aabb>& itemBounds);
+    void clear();
+
+    // Appends the indices of visible items to visibleItems (in BVH order)
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visibleItems) const;
+
+    bool isEmpty() const { return nodes.empty(); }
+    size_t getItemCount() const { return itemIndices.size(); }
+    size_t getNodeCount() const { return nodes.size(); }
+
+private:
+    struct Node
+    {
+        Aabb bounds;
+        uint32_t first; // left child (right is first + 1) for inner nodes, first item slot for leaves
+        uint32_t count; // item count, 0 for inner nodes
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> itemIndices;
+    std::vector<Aabb> slotBounds; // item bounds in leaf order
+
+    void buildNode(uint32_t nodeIndex, const std::vector<glm::vec3>& centers, uint32_t begin, uint32_t end);
+    void appendSubtree(const Node& node, std::vector<uint32_t>& visibleItems) const;
+};
+
+#endif
@@ -0,0 +1,79 @@
+﻿#include "DynamicResolution.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const double smoothing = 0.2;       // weight of the newest sample
+    const int samplesAfterChange = 8;   // let the timer ring and the average catch up with a new scale
+    const double lowerBand = 0.8;       // only scale up below this fraction of the budget
+    const float scaleStep = 0.05f;
+}
+
+void DynamicResolution::setEnabled(bool value)
+{
+    enabled = value;
+    smoothedMilliseconds = 0.0;
+    settleSamples = samplesAfterChange;
+}
+
+void DynamicResolution::setScaleRange(float minimum, float maximum)
+{
+    minScale = minimum;
+    maxScale = std::max(minimum, maximum);
+    applyScale(scale);
+}
+
+void DynamicResolution::setScale(float value)
+{
+    applyScale(value);
+}
+
+void DynamicResolution::begin()
+{
+    timer.begin();
+}
+
+void DynamicResolution::end()
+{
+    timer.end();
+}
+
+void DynamicResolution::update()
+{
+    timer.collect(false);
+    for (double sample : timer.getSamples())
+    {
+        smoothedMilliseconds = smoothedMilliseconds > 0.0 ? smoothedMilliseconds + (sample - smoothedMilliseconds) * smoothing : sample;
+        if (settleSamples > 0)
+        {
+            --settleSamples;
+        }
+    }
+    timer.clearSamples();
+
+    if (!enabled || settleSamples > 0 || smoothedMilliseconds <= 0.0)
+    {
+        return;
+    }
+    if (smoothedMilliseconds <= budgetMilliseconds && smoothedMilliseconds >= budgetMilliseconds * lowerBand)
+    {
+        return;
+    }
+
+    // Aim a little under the budget, rounded down to a step so small noise doesn't resize
+    float target = scale * static_cast<float>(std::sqrt(budgetMilliseconds * 0.9 / smoothedMilliseconds));
+    target = std::floor(target / scaleStep) * scaleStep;
+    float previous = scale;
+    applyScale(target);
+    if (scale != previous)
+    {
+        smoothedMilliseconds = 0.0;
+        settleSamples = samplesAfterChange;
+    }
+}
+
+void DynamicResolution::applyScale(float value)
+{
+    scale = std::min(std::max(value, minScale), maxScale);
+}
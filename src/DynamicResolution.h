@@ -0,0 +1,42 @@
+﻿#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include "Benchmark.h"
+
+// Picks the viewport's internal render scale from measured GPU time. The pass is
+// bracketed with begin()/end(); update() reads finished timings (a few frames late,
+// never stalling) and, since cost follows the pixel count, moves the scale by the
+// square root of budget / time. A dead band and a settle period after each change
+// keep the resolution from oscillating.
+class DynamicResolution
+{
+public:
+    void setEnabled(bool value);
+    bool isEnabled() const { return enabled; }
+    bool isAvailable() const { return timer.isAvailable(); }
+
+    void setBudgetMilliseconds(double milliseconds) { budgetMilliseconds = milliseconds; }
+    double getBudgetMilliseconds() const { return budgetMilliseconds; }
+    void setScaleRange(float minimum, float maximum);
+    void setScale(float value); // manual scale while disabled
+    float getScale() const { return scale; }
+    double getGpuMilliseconds() const { return smoothedMilliseconds; } // 0 until measured
+
+    void begin();
+    void end();
+    void update();
+
+private:
+    GpuFrameTimer timer;
+    bool enabled = true;
+    double budgetMilliseconds = 8.0;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float scale = 1.0f;
+    double smoothedMilliseconds = 0.0;
+    int settleSamples = 0;
+
+    void applyScale(float value);
+};
+
+#endif
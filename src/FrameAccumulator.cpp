@@ -0,0 +1,116 @@
+﻿#include "FrameAccumulator.h"
+#include "Profiler.h"
+#include "RenderTargetPool.h"
+#include "Shader.h"
+#include <cstring>
+
+void RedrawTracker::add(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    current.insert(current.end(), bytes, bytes + size);
+}
+
+bool RedrawTracker::commit()
+{
+    bool changed = forced || current.size() != previous.size() ||
+        (!current.empty() && std::memcmp(current.data(), previous.data(), current.size()) != 0);
+    forced = false;
+    previous.swap(current);
+    current.clear();
+    return changed;
+}
+
+namespace
+{
+    float halton(int index, int base)
+    {
+        float result = 0.0f;
+        float fraction = 1.0f;
+        while (index > 0)
+        {
+            fraction /= static_cast<float>(base);
+            result += fraction * static_cast<float>(index % base);
+            index /= base;
+        }
+        return result;
+    }
+}
+
+FrameAccumulator::FrameAccumulator(RenderTargetPool& pool)
+    : pool(pool)
+{
+    shader = std::make_unique<Shader>("shaders/fullscreen.vert", "shaders/accumulate.frag");
+
+    // The fullscreen triangle comes from gl_VertexID, but core profiles still need a VAO bound
+    glGenVertexArrays(1, &vao);
+}
+
+FrameAccumulator::~FrameAccumulator()
+{
+    shader->release();
+    glDeleteVertexArrays(1, &vao);
+    if (target)
+    {
+        pool.release(target);
+    }
+}
+
+void FrameAccumulator::resize(int width, int height)
+{
+    sampleCount = 0;
+    target = target ? pool.resize(target, width, height) : pool.acquire(width, height, GL_RGBA16F, false);
+}
+
+glm::vec2 FrameAccumulator::getNextJitter() const
+{
+    if (sampleCount == 0)
+    {
+        return glm::vec2(0.0f);
+    }
+    // Halton (2, 3) fills the pixel evenly for any sample count
+    return glm::vec2(halton(sampleCount, 2), halton(sampleCount, 3)) - 0.5f;
+}
+
+void FrameAccumulator::accumulate(const RenderTarget& frame)
+{
+    PROFILE_ZONE("accumulate");
+    PROFILE_GPU_ZONE("accumulate");
+
+    ++sampleCount;
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glViewport(0, 0, target->usedWidth, target->usedHeight);
+    if (sampleCount == 1)
+    {
+        // Alpha stays opaque for ImGui::Image, only the colour is blended
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    // The shader writes alpha 1/n: new mean = frame / n + old mean * (n - 1) / n
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+
+    shader->use();
+    shader->setInt("frameTexture", 0);
+    shader->setFloat("weight", 1.0f / static_cast<float>(sampleCount));
+    shader->setFloat("uvScaleX", frame.getUvScaleX());
+    shader->setFloat("uvScaleY", frame.getUvScaleY());
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frame.colorTexture);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+glm::mat4 jitterProjection(const glm::mat4& projection, const glm::vec2& jitter, int width, int height)
+{
+    // Third column scales with view depth, so after the divide the offset is constant in NDC
+    glm::mat4 jittered = projection;
+    jittered[2][0] += jitter.x * 2.0f / static_cast<float>(width);
+    jittered[2][1] += jitter.y * 2.0f / static_cast<float>(height);
+    return jittered;
+}
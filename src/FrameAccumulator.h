@@ -0,0 +1,71 @@
+﻿#ifndef FRAME_ACCUMULATOR_H
+#define FRAME_ACCUMULATOR_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class Shader;
+class RenderTargetPool;
+struct RenderTarget;
+
+// Everything that decides what the viewport shows is appended each frame; commit()
+// compares it with the previous frame's bytes, so unchanged frames can skip the redraw.
+// Events the state cannot see (loads finishing, shader reloads, node edits) call invalidate().
+class RedrawTracker
+{
+public:
+    template <typename T>
+    void add(const T& value)
+    {
+        add(&value, sizeof(T));
+    }
+    void add(const void* data, size_t size);
+
+    void invalidate() { forced = true; }
+
+    // True when this frame's state differs from the last committed one or a redraw was forced
+    bool commit();
+
+private:
+    std::vector<unsigned char> current;
+    std::vector<unsigned char> previous;
+    bool forced = true;
+};
+
+// Running average of subpixel-jittered frames of an unchanged view (progressive
+// supersampling). Each accumulate() blends a frame into an RGBA16F target with
+// weight 1/n, so the target always holds the mean of the samples so far. The
+// target comes from the pool and, like the frames, only its (0, 0) corner is used.
+class FrameAccumulator
+{
+public:
+    explicit FrameAccumulator(RenderTargetPool& pool);
+    ~FrameAccumulator();
+    FrameAccumulator(const FrameAccumulator&) = delete;
+    FrameAccumulator& operator=(const FrameAccumulator&) = delete;
+
+    void resize(int width, int height);
+    void reset() { sampleCount = 0; }
+
+    // Offset in pixels for the next frame, in [-0.5, 0.5); the first sample is not jittered
+    glm::vec2 getNextJitter() const;
+    void accumulate(const RenderTarget& frame);
+
+    int getSampleCount() const { return sampleCount; }
+    const RenderTarget* getTarget() const { return target; }
+
+private:
+    RenderTargetPool& pool;
+    RenderTarget* target = nullptr;
+    std::unique_ptr<Shader> shader;
+    GLuint vao = 0;
+    int sampleCount = 0;
+};
+
+// Shifts the projection by a subpixel offset without changing the view frustum's shape
+glm::mat4 jitterProjection(const glm::mat4& projection, const glm::vec2& jitter, int width, int height);
+
+#endif
@@ -0,0 +1,158 @@
+﻿#include "FrameClock.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+    const double maxDeltaSeconds = 0.25;
+    const int maxStepsPerFrame = 8;          // beyond this, simulated time falls behind instead of spiralling
+    const size_t historySize = 240;
+    const std::chrono::microseconds spinMargin(2000);
+}
+
+SwapMode applySwapMode(SwapMode mode)
+{
+    if (mode == SwapMode::Adaptive &&
+        !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+    {
+        mode = SwapMode::VSync;
+    }
+    glfwSwapInterval(mode == SwapMode::Off ? 0 : mode == SwapMode::VSync ? 1 : -1);
+    return mode;
+}
+
+FrameClock::FrameClock()
+    : lastTick(Clock::now()),
+      nextFrame(lastTick),
+      history(historySize, 0.0f)
+{
+}
+
+double FrameClock::tick()
+{
+    Clock::time_point now = Clock::now();
+    double measured = std::chrono::duration<double>(now - lastTick).count();
+    lastTick = now;
+    deltaSeconds = std::min(measured, maxDeltaSeconds);
+    stepAccumulator += deltaSeconds;
+    stepsThisFrame = 0;
+
+    if (!skipSample)
+    {
+        history[historyNext] = static_cast<float>(measured * 1000.0);
+        historyNext = (historyNext + 1) % historySize;
+        historyCount = std::min(historyCount + 1, historySize);
+    }
+    skipSample = false;
+    return deltaSeconds;
+}
+
+void FrameClock::restart()
+{
+    lastTick = Clock::now();
+    nextFrame = lastTick;
+    skipSample = true;
+}
+
+bool FrameClock::consumeStep()
+{
+    if (stepAccumulator < fixedStep)
+    {
+        return false;
+    }
+    if (stepsThisFrame == maxStepsPerFrame)
+    {
+        stepAccumulator = std::fmod(stepAccumulator, fixedStep);
+        return false;
+    }
+    stepAccumulator -= fixedStep;
+    ++stepsThisFrame;
+    return true;
+}
+
+float FrameClock::getInterpolation() const
+{
+    return static_cast<float>(std::min(stepAccumulator / fixedStep, 1.0));
+}
+
+void FrameClock::setFrameRateLimit(double framesPerSecond)
+{
+    frameRateLimit = std::max(framesPerSecond, 0.0);
+    nextFrame = Clock::now();
+}
+
+void FrameClock::waitForNextFrame()
+{
+    if (frameRateLimit <= 0.0)
+    {
+        return;
+    }
+
+    // Frames are scheduled on a fixed grid so small overshoots don't accumulate;
+    // a frame that ran more than a whole period late starts a new grid
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRateLimit));
+    nextFrame += period;
+    Clock::time_point now = Clock::now();
+    if (nextFrame < now - period)
+    {
+        nextFrame = now;
+        return;
+    }
+
+    if (nextFrame - now > spinMargin)
+    {
+        std::this_thread::sleep_for(nextFrame - now - spinMargin);
+    }
+    while (Clock::now() < nextFrame)
+    {
+        std::this_thread::yield();
+    }
+}
+
+FrameTimeStats computeFrameTimeStats(std::vector<double> samples)
+{
+    FrameTimeStats stats;
+    if (samples.empty())
+    {
+        return stats;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p)
+    {
+        // Nearest-rank percentile
+        size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+        return samples[std::min(std::max<size_t>(rank, 1), samples.size()) - 1];
+    };
+
+    double sum = 0.0;
+    for (double sample : samples)
+    {
+        sum += sample;
+    }
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.avg = sum / samples.size();
+    stats.p95 = percentile(0.95);
+    stats.p99 = percentile(0.99);
+
+    double squares = 0.0;
+    for (double sample : samples)
+    {
+        squares += (sample - stats.avg) * (sample - stats.avg);
+    }
+    stats.stdDev = std::sqrt(squares / samples.size());
+    return stats;
+}
+
+FrameTimeStats FrameClock::getStats() const
+{
+    std::vector<double> samples(historyCount);
+    for (size_t i = 0; i < historyCount; ++i)
+    {
+        samples[i] = history[(historyNext + historySize - historyCount + i) % historySize];
+    }
+    return computeFrameTimeStats(samples);
+}
@@ -0,0 +1,80 @@
+﻿#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+// glfwSwapInterval 0, 1 and -1; adaptive vsync tears instead of waiting when a frame misses the interval
+enum class SwapMode
+{
+    Off,
+    VSync,
+    Adaptive
+};
+
+// Sets the swap interval of the current context; adaptive falls back to vsync without
+// EXT_swap_control_tear. Returns the mode actually applied.
+SwapMode applySwapMode(SwapMode mode);
+
+// Milliseconds; shared by the benchmark report and the interactive frame clock
+struct FrameTimeStats
+{
+    double min = 0.0;
+    double avg = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    double stdDev = 0.0; // frame-to-frame consistency, lower paces better
+};
+
+FrameTimeStats computeFrameTimeStats(std::vector<double> samples);
+
+// Measures real frame-to-frame time, drives fixed-timestep updates and paces frames to a cap.
+// Per frame: tick(), then consumeStep() in a loop to run the simulation at a fixed rate and
+// getInterpolation() to blend its last two states, then waitForNextFrame() before the swap.
+class FrameClock
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FrameClock();
+
+    // Seconds since the previous tick, clamped so a stall doesn't turn into one huge step
+    double tick();
+    double getDeltaSeconds() const { return deltaSeconds; }
+
+    // Forgets the time since the last tick (e.g. after sleeping on events): the next delta
+    // starts now and is left out of the frame-time statistics
+    void restart();
+
+    void setFixedStep(double seconds) { fixedStep = seconds; }
+    double getFixedStep() const { return fixedStep; }
+    bool consumeStep(); // true while a whole fixed step of frame time is left to simulate
+    float getInterpolation() const; // leftover fraction of a step, 0..1
+
+    // 0 disables the cap. Sleeps through most of the remaining frame time and
+    // spins for the rest, since sleeps overshoot by up to a scheduler tick.
+    void setFrameRateLimit(double framesPerSecond);
+    double getFrameRateLimit() const { return frameRateLimit; }
+    void waitForNextFrame();
+
+    FrameTimeStats getStats() const; // over the last few seconds of frames
+    const std::vector<float>& getHistory() const { return history; } // frame times in ms, ring buffer
+    size_t getHistoryOffset() const { return historyNext; }           // oldest sample
+
+private:
+    Clock::time_point lastTick;
+    Clock::time_point nextFrame;
+    double deltaSeconds = 0.0;
+    double fixedStep = 1.0 / 120.0;
+    double stepAccumulator = 0.0;
+    int stepsThisFrame = 0;
+    double frameRateLimit = 0.0;
+    bool skipSample = true;
+    std::vector<float> history;
+    size_t historyNext = 0;
+    size_t historyCount = 0;
+};
+
+#endif
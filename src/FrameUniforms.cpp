@@ -0,0 +1,68 @@
+﻿#include "FrameUniforms.h"
+#include "Profiler.h"
+#include <algorithm>
+
+int getUniformBlockBinding(const std::string& blockName)
+{
+    if (blockName == "FrameData")
+    {
+        return FRAME_DATA_BINDING;
+    }
+    if (blockName == "LightData")
+    {
+        return LIGHT_DATA_BINDING;
+    }
+    if (blockName == "ClusterData")
+    {
+        return CLUSTER_DATA_BINDING;
+    }
+    return -1;
+}
+
+FrameUniforms::FrameUniforms()
+{
+    glGenBuffers(1, &frameBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, frameBuffer);
+
+    glGenBuffers(1, &lightBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_DATA_BINDING, lightBuffer);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+FrameUniforms::~FrameUniforms()
+{
+    glDeleteBuffers(1, &frameBuffer);
+    glDeleteBuffers(1, &lightBuffer);
+}
+
+void FrameUniforms::update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+                           const Light* lights, size_t count, bool shadowRays)
+{
+    FrameData frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.viewPos = glm::vec4(viewPos, 1.0f);
+
+    LightData lightData;
+    int lightCount = static_cast<int>(std::min<size_t>(count, MAX_LIGHTS));
+    lightData.lightCount = glm::ivec4(lightCount, shadowRays ? 1 : 0, 0, 0);
+    for (int i = 0; i < lightCount; ++i)
+    {
+        lightData.lights[i].position = glm::vec4(lights[i].position, 1.0f);
+        lightData.lights[i].color = glm::vec4(lights[i].color, 1.0f);
+    }
+
+    // Only the used part of the light array is uploaded
+    glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &frame);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::ivec4) + lightCount * sizeof(GpuLight), &lightData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded,
+                               sizeof(FrameData) + sizeof(glm::ivec4) + lightCount * sizeof(GpuLight));
+}
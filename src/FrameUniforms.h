@@ -0,0 +1,54 @@
+﻿#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include "Light.h"
+
+// Per-frame data shared by every program through std140 uniform blocks. The
+// structs below mirror the FrameData and LightData blocks in the shaders.
+const GLuint FRAME_DATA_BINDING = 0;
+const GLuint LIGHT_DATA_BINDING = 1;
+const GLuint CLUSTER_DATA_BINDING = 2; // owned by ClusteredLighting
+const int MAX_LIGHTS = 16;
+
+struct FrameData
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;
+};
+
+struct GpuLight
+{
+    glm::vec4 position;
+    glm::vec4 color;
+};
+
+struct LightData
+{
+    glm::ivec4 lightCount; // x light count, y 1 when shadow rays trace the scene BVH, zw padding
+    GpuLight lights[MAX_LIGHTS];
+};
+
+// Binding point for a named uniform block, or -1 if the block is not shared
+int getUniformBlockBinding(const std::string& blockName);
+
+class FrameUniforms
+{
+public:
+    FrameUniforms();
+    ~FrameUniforms();
+    FrameUniforms(const FrameUniforms&) = delete;
+    FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+    void update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+                const Light* lights, size_t lightCount, bool shadowRays = false);
+
+private:
+    GLuint frameBuffer = 0;
+    GLuint lightBuffer = 0;
+};
+
+#endif
@@ -0,0 +1,159 @@
+﻿#include "GltfAccessor.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+    const unsigned char* accessorData(const tinygltf::Model& model, const tinygltf::Accessor& accessor,
+                                      size_t& stride)
+    {
+        if (accessor.bufferView < 0 || accessor.bufferView >= model.bufferViews.size())
+        {
+            std::cerr << "Error: Buffer view index out of range: " << accessor.bufferView << std::endl;
+            return nullptr;
+        }
+
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        if (bufferView.buffer < 0 || bufferView.buffer >= model.buffers.size())
+        {
+            std::cerr << "Error: Buffer index out of range: " << bufferView.buffer << std::endl;
+            return nullptr;
+        }
+
+        size_t elementSize = static_cast<size_t>(tinygltf::GetComponentSizeInBytes(accessor.componentType)) *
+            tinygltf::GetNumComponentsInType(accessor.type);
+        stride = bufferView.byteStride != 0 ? bufferView.byteStride : elementSize;
+
+        const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+        size_t begin = bufferView.byteOffset + accessor.byteOffset;
+        if (accessor.count > 0 && begin + stride * (accessor.count - 1) + elementSize > buffer.data.size())
+        {
+            std::cerr << "Error: Accessor data exceeds buffer size" << std::endl;
+            return nullptr;
+        }
+        return buffer.data.data() + begin;
+    }
+
+    float readComponent(const unsigned char* src, int componentType, bool normalized)
+    {
+        switch (componentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_FLOAT:
+        {
+            float value;
+            std::memcpy(&value, src, sizeof(value));
+            return value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return normalized ? *src / 255.0f : *src;
+        case TINYGLTF_COMPONENT_TYPE_BYTE:
+        {
+            float value = static_cast<float>(static_cast<int8_t>(*src));
+            return normalized ? std::max(value / 127.0f, -1.0f) : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        {
+            uint16_t value;
+            std::memcpy(&value, src, sizeof(value));
+            return normalized ? value / 65535.0f : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_SHORT:
+        {
+            int16_t value;
+            std::memcpy(&value, src, sizeof(value));
+            return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+        {
+            uint32_t value;
+            std::memcpy(&value, src, sizeof(value));
+            return static_cast<float>(value);
+        }
+        default:
+            return 0.0f;
+        }
+    }
+}
+
+bool readAccessorFloats(const tinygltf::Model& model, int accessorIndex, int components, std::vector<float>& out)
+{
+    if (accessorIndex < 0 || accessorIndex >= model.accessors.size())
+    {
+        std::cerr << "Error: Accessor index out of range: " << accessorIndex << std::endl;
+        return false;
+    }
+
+    const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+    size_t stride = 0;
+    const unsigned char* src = accessorData(model, accessor, stride);
+    if (!src)
+    {
+        return false;
+    }
+
+    int sourceComponents = tinygltf::GetNumComponentsInType(accessor.type);
+    int componentSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+    int copied = std::min(sourceComponents, components);
+
+    out.assign(accessor.count * components, 0.0f);
+    for (size_t i = 0; i < accessor.count; ++i)
+    {
+        const unsigned char* element = src + i * stride;
+        for (int c = 0; c < copied; ++c)
+        {
+            out[i * components + c] = readComponent(element + c * componentSize, accessor.componentType,
+                                                    accessor.normalized);
+        }
+    }
+    return true;
+}
+
+bool readAccessorIndices(const tinygltf::Model& model, int accessorIndex, std::vector<uint32_t>& out)
+{
+    if (accessorIndex < 0 || accessorIndex >= model.accessors.size())
+    {
+        std::cerr << "Error: Accessor index out of range: " << accessorIndex << std::endl;
+        return false;
+    }
+
+    const tinygltf::Accessor& accessor = model.accessors[accessorIndex];
+    size_t stride = 0;
+    const unsigned char* src = accessorData(model, accessor, stride);
+    if (!src)
+    {
+        return false;
+    }
+
+    out.resize(accessor.count);
+    for (size_t i = 0; i < accessor.count; ++i)
+    {
+        const unsigned char* element = src + i * stride;
+        switch (accessor.componentType)
+        {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            out[i] = *element;
+            break;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        {
+            uint16_t value;
+            std::memcpy(&value, element, sizeof(value));
+            out[i] = value;
+            break;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+            std::memcpy(&out[i], element, sizeof(uint32_t));
+            break;
+        default:
+            std::cerr << "Error: Unsupported index component type: " << accessor.componentType << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int findAttribute(const tinygltf::Primitive& primitive, const std::string& name)
+{
+    auto it = primitive.attributes.find(name);
+    return it != primitive.attributes.end() ? it->second : -1;
+}
@@ -0,0 +1,14 @@
+﻿#ifndef GLTF_ACCESSOR_H
+#define GLTF_ACCESSOR_H
+
+#include <tiny_gltf.h>
+#include <cstdint>
+#include <vector>
+
+// CPU-side readers for glTF accessors. Integer components are converted to float
+// (normalized when the accessor says so) and missing components are zero-filled.
+bool readAccessorFloats(const tinygltf::Model& model, int accessorIndex, int components, std::vector<float>& out);
+bool readAccessorIndices(const tinygltf::Model& model, int accessorIndex, std::vector<uint32_t>& out);
+int findAttribute(const tinygltf::Primitive& primitive, const std::string& name);
+
+#endif
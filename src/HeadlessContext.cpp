@@ -0,0 +1,202 @@
+﻿#include "HeadlessContext.h"
+#include <iostream>
+
+#ifdef GLEW_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include <vector>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+namespace
+{
+    bool hasExtension(const char* extensions, const char* name)
+    {
+        if (!extensions)
+        {
+            return false;
+        }
+        size_t length = std::strlen(name);
+        for (const char* found = std::strstr(extensions, name); found; found = std::strstr(found + length, name))
+        {
+            bool startsWord = found == extensions || found[-1] == ' ';
+            bool endsWord = found[length] == ' ' || found[length] == '\0';
+            if (startsWord && endsWord)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    EGLDisplay initializeDisplay(EGLenum platform, void* nativeDisplay)
+    {
+        auto getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (!getPlatformDisplay)
+        {
+            return EGL_NO_DISPLAY;
+        }
+        EGLDisplay display = getPlatformDisplay(platform, nativeDisplay, nullptr);
+        if (display != EGL_NO_DISPLAY && !eglInitialize(display, nullptr, nullptr))
+        {
+            return EGL_NO_DISPLAY;
+        }
+        return display;
+    }
+
+    // Mesa's surfaceless platform first, then the first GPU device that initializes
+    EGLDisplay openDisplay()
+    {
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+        {
+            EGLDisplay display = initializeDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY);
+            if (display != EGL_NO_DISPLAY)
+            {
+                return display;
+            }
+        }
+
+        auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+        if (!hasExtension(clientExtensions, "EGL_EXT_platform_device") || !queryDevices)
+        {
+            return EGL_NO_DISPLAY;
+        }
+        EGLint deviceCount = 0;
+        if (!queryDevices(0, nullptr, &deviceCount) || deviceCount <= 0)
+        {
+            return EGL_NO_DISPLAY;
+        }
+        std::vector<EGLDeviceEXT> devices(deviceCount);
+        queryDevices(deviceCount, devices.data(), &deviceCount);
+        for (EGLint i = 0; i < deviceCount; ++i)
+        {
+            EGLDisplay display = initializeDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i]);
+            if (display != EGL_NO_DISPLAY)
+            {
+                return display;
+            }
+        }
+        return EGL_NO_DISPLAY;
+    }
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    destroy();
+}
+
+bool HeadlessContext::create()
+{
+    EGLDisplay eglDisplay = openDisplay();
+    if (eglDisplay == EGL_NO_DISPLAY)
+    {
+        std::cerr << "Error: No EGL display for headless rendering (needs EGL_MESA_platform_surfaceless or "
+            "EGL_EXT_platform_device)" << std::endl;
+        return false;
+    }
+    display = eglDisplay;
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cerr << "Error: EGL driver has no desktop OpenGL" << std::endl;
+        destroy();
+        return false;
+    }
+
+    bool surfaceless = hasExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+    const EGLint configAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0)
+    {
+        std::cerr << "Error: No EGL config for an OpenGL context" << std::endl;
+        destroy();
+        return false;
+    }
+
+    // Everything renders into offscreen framebuffers; the pbuffer only exists to make the context current
+    EGLSurface eglSurface = EGL_NO_SURFACE;
+    if (!surfaceless)
+    {
+        const EGLint pbufferAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttributes);
+        if (eglSurface == EGL_NO_SURFACE)
+        {
+            std::cerr << "Error: Failed to create EGL pbuffer (0x" << std::hex << eglGetError() << std::dec << ")"
+                << std::endl;
+            destroy();
+            return false;
+        }
+        surface = eglSurface;
+    }
+
+    EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, nullptr);
+    if (eglContext == EGL_NO_CONTEXT)
+    {
+        std::cerr << "Error: Failed to create EGL context (0x" << std::hex << eglGetError() << std::dec << ")"
+            << std::endl;
+        destroy();
+        return false;
+    }
+    context = eglContext;
+
+    if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+    {
+        std::cerr << "Error: Failed to make the EGL context current (0x" << std::hex << eglGetError() << std::dec
+            << ")" << std::endl;
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void HeadlessContext::destroy()
+{
+    if (!display)
+    {
+        return;
+    }
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context)
+    {
+        eglDestroyContext(display, context);
+    }
+    if (surface)
+    {
+        eglDestroySurface(display, surface);
+    }
+    eglTerminate(display);
+    display = nullptr;
+    surface = nullptr;
+    context = nullptr;
+}
+
+#else
+
+HeadlessContext::~HeadlessContext()
+{
+}
+
+bool HeadlessContext::create()
+{
+    std::cerr << "Error: Headless rendering needs EGL, which this build does not use" << std::endl;
+    return false;
+}
+
+void HeadlessContext::destroy()
+{
+}
+
+#endif
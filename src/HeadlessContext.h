@@ -0,0 +1,25 @@
+﻿#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+// OpenGL context with no window and no display server, for the headless benchmark.
+// Uses EGL's surfaceless platform (Mesa) or a GPU device (EGL_EXT_platform_device),
+// with a 1x1 pbuffer when the driver lacks EGL_KHR_surfaceless_context.
+class HeadlessContext
+{
+public:
+    HeadlessContext() = default;
+    ~HeadlessContext();
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    // Creates the context and makes it current; prints the reason and returns false on failure
+    bool create();
+    void destroy();
+
+private:
+    void* display = nullptr; // EGLDisplay
+    void* surface = nullptr; // EGLSurface, only without EGL_KHR_surfaceless_context
+    void* context = nullptr; // EGLContext
+};
+
+#endif // HEADLESS_CONTEXT_H
@@ -0,0 +1,284 @@
+﻿#include "InstancedRenderer.h"
+#include "ClusteredLighting.h"
+#include "Model.h"
+#include "Profiler.h"
+#include "TriangleBvh.h"
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+InstancedRenderer::InstancedRenderer()
+{
+    // Sampler units are set on first draw so the compile can overlap the rest of startup
+    shader = std::make_unique<Shader>("shaders/instanced.vert", "shaders/raytrace.frag",
+                                      ClusteredLighting::getShaderPreamble());
+}
+
+InstancedRenderer::~InstancedRenderer()
+{
+    releaseGeometry();
+    shader->release();
+}
+
+void InstancedRenderer::setModel(const Model& sourceModel)
+{
+    releaseGeometry();
+    model = &sourceModel;
+
+    std::vector<CookedVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<std::vector<PrimitiveRange>> meshPrimitives(sourceModel.getMeshCount());
+    sourceModel.forEachPrimitive([&](const PrimitiveGeometry& geometry)
+    {
+        if (geometry.mesh < 0 || geometry.mesh >= static_cast<int>(meshPrimitives.size()))
+        {
+            return;
+        }
+
+        PrimitiveRange range;
+        range.indexCount = static_cast<GLsizei>(geometry.indexCount);
+        range.indexOffset = indices.size() * sizeof(uint32_t);
+        range.baseVertex = static_cast<GLint>(vertices.size());
+        meshPrimitives[geometry.mesh].push_back(range);
+
+        vertices.insert(vertices.end(), geometry.vertices, geometry.vertices + geometry.vertexCount);
+        indices.insert(indices.end(), geometry.indices, geometry.indices + geometry.indexCount);
+    });
+
+    const SceneGraph& sceneGraph = sourceModel.getSceneGraph();
+    if (sceneGraph.getNodeCount() == 0)
+    {
+        for (auto& primitives : meshPrimitives)
+        {
+            nodeDraws.push_back({glm::mat4(1.0f), primitives});
+        }
+    }
+    else
+    {
+        for (int node : sceneGraph.getDrawableNodes())
+        {
+            int mesh = sceneGraph.getMesh(node);
+            if (mesh >= 0 && mesh < static_cast<int>(meshPrimitives.size()))
+            {
+                nodeDraws.push_back({sceneGraph.getWorldMatrix(node), meshPrimitives[mesh]});
+            }
+        }
+    }
+    sceneVersion = sceneGraph.getVersion();
+
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(CookedVertex), vertices.data(), GL_STATIC_DRAW);
+
+    const GLsizei stride = sizeof(CookedVertex);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(CookedVertex, position)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(CookedVertex, normal)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(offsetof(CookedVertex, texCoord)));
+
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+
+    // A mat4 attribute is four vec4 columns, each stepping once per instance
+    glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint column = 0; column < 4; ++column)
+    {
+        GLuint location = INSTANCE_TRANSFORM_LOCATION + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              reinterpret_cast<const void*>(column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // The new buffer is empty, so every existing instance has to go up again
+    instanceCapacity = 0;
+    if (!instanceTransforms.empty())
+    {
+        dirtyBegin = 0;
+        dirtyEnd = instanceTransforms.size();
+    }
+}
+
+void InstancedRenderer::releaseGeometry()
+{
+    GLuint buffers[] = { vbo, ebo, instanceBuffer };
+    glDeleteBuffers(3, buffers);
+    glDeleteVertexArrays(1, &vao);
+    vao = vbo = ebo = instanceBuffer = 0;
+    instanceCapacity = 0;
+    nodeDraws.clear();
+    model = nullptr;
+}
+
+InstancedRenderer::InstanceId InstancedRenderer::addInstance(const glm::mat4& transform)
+{
+    InstanceId id;
+    if (!freeIds.empty())
+    {
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    else
+    {
+        id = static_cast<InstanceId>(idToSlot.size());
+        idToSlot.push_back(0);
+    }
+
+    size_t slot = instanceTransforms.size();
+    idToSlot[id] = static_cast<uint32_t>(slot);
+    instanceTransforms.push_back(transform);
+    slotToId.push_back(id);
+    markDirty(slot);
+    return id;
+}
+
+void InstancedRenderer::removeInstance(InstanceId id)
+{
+    if (id >= idToSlot.size() || idToSlot[id] == UINT32_MAX)
+    {
+        std::cerr << "Error: Instance " << id << " does not exist" << std::endl;
+        return;
+    }
+
+    // Move the last instance into the hole so the buffer stays dense
+    size_t slot = idToSlot[id];
+    size_t last = instanceTransforms.size() - 1;
+    if (slot != last)
+    {
+        instanceTransforms[slot] = instanceTransforms[last];
+        slotToId[slot] = slotToId[last];
+        idToSlot[slotToId[slot]] = static_cast<uint32_t>(slot);
+        markDirty(slot);
+    }
+    instanceTransforms.pop_back();
+    slotToId.pop_back();
+    idToSlot[id] = UINT32_MAX;
+    freeIds.push_back(id);
+    dirtyEnd = std::min(dirtyEnd, instanceTransforms.size());
+}
+
+void InstancedRenderer::setInstanceTransform(InstanceId id, const glm::mat4& transform)
+{
+    if (id >= idToSlot.size() || idToSlot[id] == UINT32_MAX)
+    {
+        std::cerr << "Error: Instance " << id << " does not exist" << std::endl;
+        return;
+    }
+    instanceTransforms[idToSlot[id]] = transform;
+    markDirty(idToSlot[id]);
+}
+
+void InstancedRenderer::clearInstances()
+{
+    instanceTransforms.clear();
+    slotToId.clear();
+    idToSlot.clear();
+    freeIds.clear();
+    dirtyBegin = SIZE_MAX;
+    dirtyEnd = 0;
+}
+
+void InstancedRenderer::markDirty(size_t slot)
+{
+    dirtyBegin = std::min(dirtyBegin, slot);
+    dirtyEnd = std::max(dirtyEnd, slot + 1);
+}
+
+void InstancedRenderer::syncNodeTransforms()
+{
+    const SceneGraph& sceneGraph = model->getSceneGraph();
+    if (sceneGraph.getVersion() == sceneVersion || sceneGraph.getNodeCount() == 0)
+    {
+        return;
+    }
+
+    const std::vector<int>& drawableNodes = sceneGraph.getDrawableNodes();
+    size_t drawIndex = 0;
+    for (int node : drawableNodes)
+    {
+        int mesh = sceneGraph.getMesh(node);
+        if (mesh >= 0 && mesh < model->getMeshCount() && drawIndex < nodeDraws.size())
+        {
+            nodeDraws[drawIndex++].world = sceneGraph.getWorldMatrix(node);
+        }
+    }
+    sceneVersion = sceneGraph.getVersion();
+}
+
+void InstancedRenderer::uploadInstances()
+{
+    bytesUploaded = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+    // Grow geometrically and re-specify the whole store; otherwise only the dirty slot range goes up
+    if (instanceTransforms.size() > instanceCapacity)
+    {
+        instanceCapacity = std::max(instanceTransforms.size(), instanceCapacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        dirtyBegin = 0;
+        dirtyEnd = instanceTransforms.size();
+    }
+
+    if (dirtyBegin < dirtyEnd)
+    {
+        bytesUploaded = (dirtyEnd - dirtyBegin) * sizeof(glm::mat4);
+        glBufferSubData(GL_ARRAY_BUFFER, dirtyBegin * sizeof(glm::mat4), bytesUploaded, &instanceTransforms[dirtyBegin]);
+    }
+    dirtyBegin = SIZE_MAX;
+    dirtyEnd = 0;
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, bytesUploaded);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstancedRenderer::draw()
+{
+    PROFILE_ZONE("InstancedRenderer::draw");
+    PROFILE_GPU_ZONE("InstancedRenderer::draw");
+    drawCallCount = 0;
+    if (vao == 0 || instanceTransforms.empty())
+    {
+        return;
+    }
+
+    syncNodeTransforms();
+    uploadInstances();
+
+    shader->use();
+    if (!samplersBound)
+    {
+        shader->setInt("texture_diffuse", 0);
+        shader->setInt("skybox", 1);
+        shader->setInt("bvhNodes", BVH_NODE_TEXTURE_UNIT);
+        shader->setInt("bvhTriangles", BVH_TRIANGLE_TEXTURE_UNIT);
+        samplersBound = true;
+    }
+    UniformHandle<glm::mat4> modelHandle = modelUniform.get(*shader);
+    GLsizei instanceCount = static_cast<GLsizei>(instanceTransforms.size());
+
+    glBindVertexArray(vao);
+    for (const NodeDraw& nodeDraw : nodeDraws)
+    {
+        shader->set(modelHandle, nodeDraw.world);
+        for (const PrimitiveRange& primitive : nodeDraw.primitives)
+        {
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, primitive.indexCount, GL_UNSIGNED_INT,
+                                              reinterpret_cast<void*>(primitive.indexOffset),
+                                              instanceCount, primitive.baseVertex);
+            ++drawCallCount;
+        }
+    }
+    glBindVertexArray(0);
+    Profiler::get().addCounter(ProfileCounter::StateChanges);
+    Profiler::get().addCounter(ProfileCounter::DrawCalls, drawCallCount);
+}
@@ -0,0 +1,88 @@
+﻿#ifndef INSTANCED_RENDERER_H
+#define INSTANCED_RENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "MeshCache.h"
+#include "Shader.h"
+
+class Model;
+
+// First vertex attribute of the per-instance mat4 (it occupies four consecutive locations)
+const GLuint INSTANCE_TRANSFORM_LOCATION = 3;
+
+// Draws many copies of one Model with glDrawElementsInstancedBaseVertex, one
+// call per primitive of every drawable node. The model's geometry is repacked
+// into a shared vertex/index buffer and per-instance transforms are fed as an
+// instanced vertex attribute. Instances are stored densely (removal swaps the
+// last one into the hole) and only the slot range touched since the last draw
+// is re-uploaded.
+class InstancedRenderer
+{
+public:
+    using InstanceId = uint32_t;
+
+    InstancedRenderer();
+    ~InstancedRenderer();
+    InstancedRenderer(const InstancedRenderer&) = delete;
+    InstancedRenderer& operator=(const InstancedRenderer&) = delete;
+
+    void setModel(const Model& model); // GL thread, the model must be loaded
+    void releaseGeometry();
+
+    InstanceId addInstance(const glm::mat4& transform);
+    void removeInstance(InstanceId id);
+    void setInstanceTransform(InstanceId id, const glm::mat4& transform);
+    void clearInstances();
+
+    void draw();
+
+    size_t getInstanceCount() const { return instanceTransforms.size(); }
+    size_t getDrawCallCount() const { return drawCallCount; }
+    size_t getBytesUploaded() const { return bytesUploaded; } // instance data sent by the last draw()
+
+private:
+    struct PrimitiveRange
+    {
+        GLsizei indexCount;
+        size_t indexOffset; // bytes
+        GLint baseVertex;
+    };
+
+    struct NodeDraw
+    {
+        glm::mat4 world;
+        std::vector<PrimitiveRange> primitives;
+    };
+
+    const Model* model = nullptr;
+    std::vector<NodeDraw> nodeDraws;
+    uint64_t sceneVersion = 0;
+
+    std::vector<glm::mat4> instanceTransforms; // dense, indexed by slot
+    std::vector<InstanceId> slotToId;
+    std::vector<uint32_t> idToSlot;
+    std::vector<InstanceId> freeIds;
+    size_t dirtyBegin = SIZE_MAX;
+    size_t dirtyEnd = 0;
+    size_t instanceCapacity = 0; // slots allocated in instanceBuffer
+
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint ebo = 0;
+    GLuint instanceBuffer = 0;
+    std::unique_ptr<Shader> shader;
+    CachedUniform<glm::mat4> modelUniform{"model"};
+    bool samplersBound = false;
+    size_t drawCallCount = 0;
+    size_t bytesUploaded = 0;
+
+    void markDirty(size_t slot);
+    void syncNodeTransforms();
+    void uploadInstances();
+};
+
+#endif
@@ -3,10 +3,19 @@
 
 #include <glm/glm.hpp>
 
+// Unattenuated light applied to every fragment
 struct Light
 {
     glm::vec3 position;
     glm::vec3 color;
 };
 
+// Local light that reaches zero at `radius`; these go through the clustered path
+struct PointLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+};
+
 #endif
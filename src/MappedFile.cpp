@@ -0,0 +1,157 @@
+﻿#include "MappedFile.h"
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    mappedData = static_cast<const unsigned char*>(view);
+    mappedSize = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mappedData)
+    {
+        UnmapViewOfFile(mappedData);
+    }
+    if (mappingHandle)
+    {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle)
+    {
+        CloseHandle(fileHandle);
+    }
+    mappedData = nullptr;
+    mappedSize = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+void MappedFile::evict(size_t offset, size_t size) const
+{
+    if (!mappedData || offset >= mappedSize)
+    {
+        return;
+    }
+    // Unlocking pages that were never locked trims them from the working set
+    VirtualUnlock(const_cast<unsigned char*>(mappedData) + offset, std::min(size, mappedSize - offset));
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+    madvise(view, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+    fileDescriptor = fd;
+    mappedData = static_cast<const unsigned char*>(view);
+    mappedSize = static_cast<size_t>(fileStat.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mappedData)
+    {
+        munmap(const_cast<unsigned char*>(mappedData), mappedSize);
+    }
+    if (fileDescriptor >= 0)
+    {
+        ::close(fileDescriptor);
+    }
+    mappedData = nullptr;
+    mappedSize = 0;
+    fileDescriptor = -1;
+}
+
+void MappedFile::evict(size_t offset, size_t size) const
+{
+    if (!mappedData || offset >= mappedSize)
+    {
+        return;
+    }
+    // madvise works on whole pages; only pages entirely inside the range are dropped
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+    size_t end = std::min(offset + size, mappedSize) / pageSize * pageSize;
+    if (begin < end)
+    {
+        madvise(const_cast<unsigned char*>(mappedData) + begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+#endif
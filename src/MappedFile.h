@@ -0,0 +1,39 @@
+﻿#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The view stays valid until close()
+// or destruction.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return mappedData != nullptr; }
+    const unsigned char* data() const { return mappedData; }
+    size_t size() const { return mappedSize; }
+
+    // Drops the range's pages from the process working set; they are read back from
+    // the file if touched again
+    void evict(size_t offset, size_t size) const;
+
+private:
+    const unsigned char* mappedData = nullptr;
+    size_t mappedSize = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+};
+
+#endif
@@ -0,0 +1,748 @@
+﻿#include "MeshCache.h"
+#include "GltfAccessor.h"
+#include "SceneGraph.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    uint64_t alignOffset(uint64_t offset)
+    {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    void writeAt(std::ofstream& out, uint64_t offset, const void* data, size_t size)
+    {
+        out.seekp(static_cast<std::streamoff>(offset));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    }
+
+    // The JSON chunk of a .glb, or the whole file for .gltf
+    std::string getGltfJson(const unsigned char* data, size_t size)
+    {
+        const uint32_t glbMagic = 0x46546C67; // "glTF"
+        uint32_t header[5];
+        if (size >= sizeof(header))
+        {
+            std::memcpy(header, data, sizeof(header));
+            if (header[0] == glbMagic)
+            {
+                uint32_t jsonLength = std::min<uint64_t>(header[3], size - sizeof(header));
+                return std::string(reinterpret_cast<const char*>(data) + sizeof(header), jsonLength);
+            }
+        }
+        return std::string(reinterpret_cast<const char*>(data), size);
+    }
+
+    // Every "uri" in glTF names a buffer or an image; data: URIs are embedded and skipped
+    std::vector<std::string> findExternalUris(const std::string& json)
+    {
+        std::vector<std::string> uris;
+        const std::string key = "\"uri\"";
+        for (size_t pos = json.find(key); pos != std::string::npos; pos = json.find(key, pos))
+        {
+            pos += key.size();
+            pos = json.find_first_not_of(" \t\r\n", pos);
+            if (pos == std::string::npos || json[pos] != ':')
+            {
+                continue;
+            }
+            pos = json.find_first_not_of(" \t\r\n", pos + 1);
+            if (pos == std::string::npos || json[pos] != '"')
+            {
+                continue;
+            }
+
+            std::string uri;
+            for (++pos; pos < json.size() && json[pos] != '"'; ++pos)
+            {
+                if (json[pos] == '\\' && pos + 1 < json.size())
+                {
+                    ++pos;
+                }
+                uri += json[pos];
+            }
+            if (uri.compare(0, 5, "data:") != 0)
+            {
+                uris.push_back(uri);
+            }
+        }
+        return uris;
+    }
+
+    // Same decoding tinygltf applies before opening the file
+    std::string decodePercentEscapes(const std::string& uri)
+    {
+        std::string decoded;
+        for (size_t i = 0; i < uri.size(); ++i)
+        {
+            if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit(static_cast<unsigned char>(uri[i + 1])) &&
+                std::isxdigit(static_cast<unsigned char>(uri[i + 2])))
+            {
+                decoded += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            }
+            else
+            {
+                decoded += uri[i];
+            }
+        }
+        return decoded;
+    }
+
+    // Clusters may cost up to 5% more vertex-cache misses in exchange for front-to-back cluster order
+    const float OVERDRAW_THRESHOLD = 1.05f;
+
+    struct OptimizeStats
+    {
+        size_t triangles = 0;
+        double missesBefore = 0.0;
+        double missesAfter = 0.0;
+        size_t duplicateVertices = 0;
+    };
+
+    // Dedup, cache and overdraw ordering for LOD 0, LOD generation, then a final fetch-order pass over all levels
+    void optimizePrimitive(std::vector<CookedVertex>& vertices, std::vector<uint32_t>& indices,
+                           std::vector<MeshLod>& lods, OptimizeStats& stats)
+    {
+        size_t triangles = indices.size() / 3;
+        stats.triangles += triangles;
+        stats.missesBefore += computeAcmr(indices.data(), indices.size(), vertices.size()) * triangles;
+
+        stats.duplicateVertices += optimizeVertexFetch(vertices, indices);
+        optimizeVertexCache(indices.data(), indices.size(), vertices.size());
+        optimizeOverdraw(indices.data(), indices.size(), vertices.data(), vertices.size(), OVERDRAW_THRESHOLD);
+
+        generateMeshLods(vertices.data(), vertices.size(), indices, lods);
+        for (size_t lod = 1; lod < lods.size(); ++lod)
+        {
+            optimizeVertexCache(indices.data() + lods[lod].firstIndex, lods[lod].indexCount, vertices.size());
+        }
+
+        // Simplified levels only reference LOD 0 vertices, so first-use order is driven by LOD 0
+        optimizeVertexFetch(vertices, indices);
+        stats.missesAfter += computeAcmr(indices.data(), lods[0].indexCount, vertices.size()) * triangles;
+    }
+
+    // Bump when an encoder changes so stale texcache entries are not reused
+    const uint64_t TEXTURE_ENCODER_VERSION = 1;
+
+    bool expandToRgba(const tinygltf::Image& image, std::vector<unsigned char>& rgba)
+    {
+        size_t texelCount = static_cast<size_t>(image.width) * image.height;
+        if (image.bits != 8 || image.component < 1 || image.component > 4 ||
+            image.image.size() < texelCount * image.component)
+        {
+            return false;
+        }
+
+        rgba.resize(texelCount * 4);
+        for (size_t i = 0; i < texelCount; ++i)
+        {
+            const unsigned char* source = image.image.data() + i * image.component;
+            unsigned char* texel = rgba.data() + i * 4;
+            switch (image.component)
+            {
+            case 1: texel[0] = texel[1] = texel[2] = source[0]; texel[3] = 255; break;
+            case 2: texel[0] = texel[1] = texel[2] = source[0]; texel[3] = source[1]; break;
+            case 3: texel[0] = source[0]; texel[1] = source[1]; texel[2] = source[2]; texel[3] = 255; break;
+            default: std::memcpy(texel, source, 4); break;
+            }
+        }
+        return true;
+    }
+
+    // KTX2 images are taken as they are; everything else is compressed or fetched from the texcache
+    bool cookImage(const tinygltf::Image& image, TextureUsage usage, const std::string& textureCacheDir,
+                   ThreadPool* pool, TextureImage& result)
+    {
+        if (isKtx2(image.image.data(), image.image.size()))
+        {
+            return parseKtx2(image.image.data(), image.image.size(), result);
+        }
+
+        std::vector<unsigned char> rgba;
+        if (!expandToRgba(image, rgba))
+        {
+            std::cerr << "Error: Image " << image.name << " has no 8-bit pixel data, not cooked" << std::endl;
+            return false;
+        }
+
+        bool hasAlpha = false;
+        for (size_t i = 3; i < rgba.size() && !hasAlpha; i += 4)
+        {
+            hasAlpha = rgba[i] != 255;
+        }
+        GLenum format = chooseTextureFormat(usage, hasAlpha);
+
+        uint64_t parameters[] = { static_cast<uint64_t>(image.width), static_cast<uint64_t>(image.height), format,
+                                  static_cast<uint64_t>(usage), TEXTURE_ENCODER_VERSION };
+        uint64_t key = hashBytes(rgba.data(), rgba.size()) ^
+            hashBytes(reinterpret_cast<const unsigned char*>(parameters), sizeof(parameters)) * 31;
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.ktx2", static_cast<unsigned long long>(key));
+        std::string cachedPath = (std::filesystem::path(textureCacheDir) / name).string();
+
+        if (std::filesystem::exists(cachedPath) && loadKtx2(cachedPath, result) && result.format == format &&
+            result.width == image.width && result.height == image.height)
+        {
+            return true;
+        }
+
+        if (!compressTexture(rgba.data(), image.width, image.height, usage, format, result, pool))
+        {
+            return false;
+        }
+
+        // A missing texcache only costs the next cook some time
+        std::error_code ec;
+        std::filesystem::create_directories(textureCacheDir, ec);
+        if (!ec)
+        {
+            writeKtx2(cachedPath, result);
+        }
+        return true;
+    }
+
+    void appendIndices(std::vector<unsigned char>& indexData, const std::vector<uint32_t>& indices, uint32_t indexSize)
+    {
+        indexData.resize(alignOffset(indexData.size()), 0);
+        size_t offset = indexData.size();
+        indexData.resize(offset + indices.size() * indexSize);
+        if (indexSize == sizeof(uint32_t))
+        {
+            std::memcpy(indexData.data() + offset, indices.data(), indices.size() * sizeof(uint32_t));
+            return;
+        }
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            uint16_t index = static_cast<uint16_t>(indices[i]);
+            std::memcpy(indexData.data() + offset + i * sizeof(uint16_t), &index, sizeof(uint16_t));
+        }
+    }
+}
+
+uint64_t hashBytes(const unsigned char* data, size_t size)
+{
+    // FNV-1a over 64-bit words, then the tail bytes
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+}
+
+uint64_t hashSourceFiles(const std::string& path, const unsigned char* data, size_t size)
+{
+    // Hashing every referenced file's contents would cost a full read per load; size and write time catch edits
+    std::vector<uint64_t> key = {hashBytes(data, size)};
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    for (const std::string& uri : findExternalUris(getGltfJson(data, size)))
+    {
+        std::filesystem::path file = directory / std::filesystem::u8path(decodePercentEscapes(uri));
+        std::error_code error;
+        uintmax_t fileSize = std::filesystem::file_size(file, error);
+        auto writeTime = std::filesystem::last_write_time(file, error);
+        key.push_back(hashBytes(reinterpret_cast<const unsigned char*>(uri.data()), uri.size()));
+        key.push_back(error ? 0 : static_cast<uint64_t>(fileSize));
+        key.push_back(error ? 0 : static_cast<uint64_t>(writeTime.time_since_epoch().count()));
+    }
+    return hashBytes(reinterpret_cast<const unsigned char*>(key.data()), key.size() * sizeof(uint64_t));
+}
+
+bool cookPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive,
+                   std::vector<CookedVertex>& vertices, std::vector<uint32_t>& indices)
+{
+    std::vector<float> positions, normals, texCoords;
+    if (!readAccessorFloats(model, findAttribute(primitive, "POSITION"), 3, positions))
+    {
+        std::cerr << "Error: Primitive without readable POSITION" << std::endl;
+        return false;
+    }
+    size_t vertexCount = positions.size() / 3;
+
+    // Attributes whose count does not match POSITION are dropped rather than read past
+    int normalAccessor = findAttribute(primitive, "NORMAL");
+    if (normalAccessor < 0 || !readAccessorFloats(model, normalAccessor, 3, normals) ||
+        normals.size() != vertexCount * 3)
+    {
+        normals.assign(vertexCount * 3, 0.0f);
+    }
+    int texCoordAccessor = findAttribute(primitive, "TEXCOORD_0");
+    if (texCoordAccessor < 0 || !readAccessorFloats(model, texCoordAccessor, 2, texCoords) ||
+        texCoords.size() != vertexCount * 2)
+    {
+        texCoords.assign(vertexCount * 2, 0.0f);
+    }
+
+    if (primitive.indices >= 0)
+    {
+        if (!readAccessorIndices(model, primitive.indices, indices))
+        {
+            return false;
+        }
+        // Every later pass (optimization, LODs, the cache itself) indexes vertex arrays with these
+        for (uint32_t index : indices)
+        {
+            if (index >= vertexCount)
+            {
+                std::cerr << "Error: Primitive index " << index << " is out of range (" << vertexCount << " vertices)"
+                    << std::endl;
+                return false;
+            }
+        }
+    }
+    else
+    {
+        indices.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            indices[i] = static_cast<uint32_t>(i);
+        }
+    }
+
+    vertices.resize(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        CookedVertex& vertex = vertices[v];
+        std::memcpy(vertex.position, &positions[v * 3], sizeof(vertex.position));
+        std::memcpy(vertex.normal, &normals[v * 3], sizeof(vertex.normal));
+        std::memcpy(vertex.texCoord, &texCoords[v * 2], sizeof(vertex.texCoord));
+    }
+    return true;
+}
+
+VertexDequantization getDequantization(const CookedPrimitive& primitive)
+{
+    VertexDequantization dequantization;
+    dequantization.positionOffset = glm::vec3(primitive.positionOffset[0], primitive.positionOffset[1],
+                                              primitive.positionOffset[2]);
+    dequantization.positionScale = glm::vec3(primitive.positionScale[0], primitive.positionScale[1],
+                                             primitive.positionScale[2]);
+    dequantization.texCoordOffset = glm::vec2(primitive.texCoordOffset[0], primitive.texCoordOffset[1]);
+    dequantization.texCoordScale = glm::vec2(primitive.texCoordScale[0], primitive.texCoordScale[1]);
+    dequantization.octahedralNormals = true;
+    return dequantization;
+}
+
+Aabb computeBounds(const CookedVertex* vertices, size_t vertexCount)
+{
+    Aabb bounds;
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        bounds.expand(glm::vec3(vertices[v].position[0], vertices[v].position[1], vertices[v].position[2]));
+    }
+    return bounds;
+}
+
+bool cookMeshCache(const tinygltf::Model& model, uint64_t sourceHash, const std::string& cachePath, ThreadPool* pool)
+{
+    std::vector<CookedPrimitive> primitives;
+    std::vector<QuantizedVertex> vertices;
+    std::vector<unsigned char> indexData;
+    OptimizeStats optimizeStats;
+
+    // A mesh's primitives are cooked first, so they can share one quantization range
+    struct CookedPart
+    {
+        int material;
+        std::vector<CookedVertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<MeshLod> lods;
+    };
+    std::vector<CookedPart> parts;
+    for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx)
+    {
+        const auto& meshPrimitives = model.meshes[meshIdx].primitives;
+        parts.assign(meshPrimitives.size(), CookedPart());
+        QuantizationRange range;
+        for (size_t p = 0; p < meshPrimitives.size(); ++p)
+        {
+            CookedPart& part = parts[p];
+            if (!cookPrimitive(model, meshPrimitives[p], part.vertices, part.indices))
+            {
+                std::cerr << "Error: Primitive could not be cooked, cache not written" << std::endl;
+                return false;
+            }
+            part.material = meshPrimitives[p].material;
+            optimizePrimitive(part.vertices, part.indices, part.lods, optimizeStats);
+            for (const CookedVertex& vertex : part.vertices)
+            {
+                range.expand(glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]),
+                             glm::vec2(vertex.texCoord[0], vertex.texCoord[1]));
+            }
+        }
+        VertexDequantization dequantization = range.getDequantization();
+
+        for (const CookedPart& part : parts)
+        {
+            CookedPrimitive cooked = {};
+            cooked.mesh = static_cast<uint32_t>(meshIdx);
+            cooked.material = part.material;
+            cooked.vertexOffset = vertices.size() * sizeof(QuantizedVertex);
+            cooked.indexSize = getMinimumIndexSize(part.vertices.size());
+            cooked.indexOffset = alignOffset(indexData.size());
+            cooked.vertexCount = static_cast<uint32_t>(part.vertices.size());
+            cooked.indexCount = part.lods[0].indexCount;
+            cooked.lodCount = static_cast<uint32_t>(part.lods.size());
+            for (size_t i = 0; i < part.lods.size(); ++i)
+            {
+                cooked.lods[i] = {part.lods[i].firstIndex, part.lods[i].indexCount, part.lods[i].error, 0};
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                cooked.positionOffset[i] = dequantization.positionOffset[i];
+                cooked.positionScale[i] = dequantization.positionScale[i];
+            }
+            for (int i = 0; i < 2; ++i)
+            {
+                cooked.texCoordOffset[i] = dequantization.texCoordOffset[i];
+                cooked.texCoordScale[i] = dequantization.texCoordScale[i];
+            }
+
+            // Bounds of the positions as drawn, after rounding
+            Aabb bounds;
+            for (const CookedVertex& vertex : part.vertices)
+            {
+                QuantizedVertex quantized = quantizeVertex(
+                    glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]),
+                    glm::vec3(vertex.normal[0], vertex.normal[1], vertex.normal[2]),
+                    glm::vec2(vertex.texCoord[0], vertex.texCoord[1]), dequantization);
+                glm::vec3 position, normal;
+                glm::vec2 texCoord;
+                dequantizeVertex(quantized, dequantization, position, normal, texCoord);
+                bounds.expand(position);
+                vertices.push_back(quantized);
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                cooked.boundsMin[i] = bounds.min[i];
+                cooked.boundsMax[i] = bounds.max[i];
+            }
+            primitives.push_back(cooked);
+
+            appendIndices(indexData, part.indices, cooked.indexSize);
+        }
+    }
+
+    if (optimizeStats.triangles > 0)
+    {
+        std::cout << "Optimized " << optimizeStats.triangles << " triangles: ACMR "
+            << optimizeStats.missesBefore / optimizeStats.triangles << " -> "
+            << optimizeStats.missesAfter / optimizeStats.triangles << ", "
+            << optimizeStats.duplicateVertices << " duplicate vertices removed" << std::endl;
+    }
+    std::cout << "Quantized " << vertices.size() << " vertices: " << vertices.size() * sizeof(CookedVertex)
+        << " -> " << vertices.size() * sizeof(QuantizedVertex) << " bytes" << std::endl;
+
+    std::vector<CookedMaterial> materials;
+    for (const auto& material : model.materials)
+    {
+        materials.push_back({material.pbrMetallicRoughness.baseColorTexture.index, material.normalTexture.index});
+    }
+
+    // Normal maps get a two-channel format, everything else is treated as colour
+    std::vector<TextureUsage> imageUsage(model.images.size(), TextureUsage::Color);
+    for (const auto& material : model.materials)
+    {
+        int textureIndex = material.normalTexture.index;
+        if (textureIndex >= 0 && textureIndex < static_cast<int>(model.textures.size()))
+        {
+            int source = model.textures[textureIndex].source;
+            if (source >= 0 && source < static_cast<int>(model.images.size()))
+            {
+                imageUsage[source] = TextureUsage::Normal;
+            }
+        }
+    }
+
+    std::string textureCacheDir = (std::filesystem::path(cachePath).parent_path() / "texcache").string();
+    std::vector<TextureImage> cookedImages(model.images.size());
+    size_t sourceBytes = 0, cookedBytes = 0;
+    for (size_t i = 0; i < model.images.size(); ++i)
+    {
+        if (!cookImage(model.images[i], imageUsage[i], textureCacheDir, pool, cookedImages[i]))
+        {
+            cookedImages[i] = TextureImage();
+            continue;
+        }
+        sourceBytes += static_cast<size_t>(cookedImages[i].width) * cookedImages[i].height * 4;
+        cookedBytes += cookedImages[i].data.size();
+    }
+    if (sourceBytes > 0)
+    {
+        std::cout << "Cooked " << model.images.size() << " images: " << sourceBytes << " bytes as RGBA8, "
+            << cookedBytes << " bytes cooked with mips" << std::endl;
+    }
+
+    std::vector<CookedTexture> textures;
+    for (const auto& texture : model.textures)
+    {
+        // KHR_texture_basisu points at a KTX2 image; use it when it loaded, otherwise the fallback source
+        int source = texture.source;
+        auto basisu = texture.extensions.find("KHR_texture_basisu");
+        if (basisu != texture.extensions.end() && basisu->second.Has("source"))
+        {
+            int ktxSource = basisu->second.Get("source").GetNumberAsInt();
+            if (ktxSource >= 0 && ktxSource < static_cast<int>(cookedImages.size()) &&
+                cookedImages[ktxSource].levelCount > 0)
+            {
+                source = ktxSource;
+            }
+        }
+        textures.push_back({source, texture.sampler});
+    }
+
+    std::vector<CookedNode> nodes;
+    for (const SceneNodeDesc& desc : SceneGraph::collectNodes(model))
+    {
+        CookedNode node = {};
+        node.parent = desc.parent;
+        node.mesh = desc.mesh;
+        for (int i = 0; i < 3; ++i)
+        {
+            node.translation[i] = desc.translation[i];
+            node.scale[i] = desc.scale[i];
+        }
+        node.rotation[0] = desc.rotation.x;
+        node.rotation[1] = desc.rotation.y;
+        node.rotation[2] = desc.rotation.z;
+        node.rotation[3] = desc.rotation.w;
+        nodes.push_back(node);
+    }
+
+    MeshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.meshCount = static_cast<uint32_t>(model.meshes.size());
+    header.primitiveCount = static_cast<uint32_t>(primitives.size());
+    header.materialCount = static_cast<uint32_t>(materials.size());
+    header.textureCount = static_cast<uint32_t>(textures.size());
+    header.imageCount = static_cast<uint32_t>(model.images.size());
+    header.nodeCount = static_cast<uint32_t>(nodes.size());
+    header.primitiveTableOffset = alignOffset(sizeof(MeshCacheHeader));
+    header.materialTableOffset = alignOffset(header.primitiveTableOffset + primitives.size() * sizeof(CookedPrimitive));
+    header.textureTableOffset = alignOffset(header.materialTableOffset + materials.size() * sizeof(CookedMaterial));
+    header.imageTableOffset = alignOffset(header.textureTableOffset + textures.size() * sizeof(CookedTexture));
+    header.nodeTableOffset = alignOffset(header.imageTableOffset + model.images.size() * sizeof(CookedImage));
+    header.vertexDataOffset = alignOffset(header.nodeTableOffset + nodes.size() * sizeof(CookedNode));
+    header.vertexDataSize = vertices.size() * sizeof(QuantizedVertex);
+    header.indexDataOffset = alignOffset(header.vertexDataOffset + header.vertexDataSize);
+    header.indexDataSize = indexData.size();
+
+    std::vector<CookedImage> images;
+    uint64_t pixelOffset = alignOffset(header.indexDataOffset + header.indexDataSize);
+    for (const TextureImage& image : cookedImages)
+    {
+        CookedImage cooked = {};
+        cooked.width = image.width;
+        cooked.height = image.height;
+        cooked.component = 4;
+        cooked.format = image.format;
+        cooked.levelCount = image.levelCount;
+        cooked.pixelOffset = pixelOffset;
+        cooked.pixelSize = image.data.size();
+        images.push_back(cooked);
+        pixelOffset = alignOffset(pixelOffset + cooked.pixelSize);
+    }
+
+    // Write to a temporary file first so an interrupted cook never leaves a truncated cache behind
+    std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+        {
+            std::cerr << "Failed to open mesh cache for writing: " << tempPath << std::endl;
+            return false;
+        }
+
+        writeAt(out, 0, &header, sizeof(header));
+        writeAt(out, header.primitiveTableOffset, primitives.data(), primitives.size() * sizeof(CookedPrimitive));
+        writeAt(out, header.materialTableOffset, materials.data(), materials.size() * sizeof(CookedMaterial));
+        writeAt(out, header.textureTableOffset, textures.data(), textures.size() * sizeof(CookedTexture));
+        writeAt(out, header.imageTableOffset, images.data(), images.size() * sizeof(CookedImage));
+        writeAt(out, header.nodeTableOffset, nodes.data(), nodes.size() * sizeof(CookedNode));
+        writeAt(out, header.vertexDataOffset, vertices.data(), header.vertexDataSize);
+        writeAt(out, header.indexDataOffset, indexData.data(), header.indexDataSize);
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            writeAt(out, images[i].pixelOffset, cookedImages[i].data.data(), images[i].pixelSize);
+        }
+
+        if (!out.good())
+        {
+            std::cerr << "Failed to write mesh cache: " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, cachePath, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to move mesh cache into place: " << ec.message() << std::endl;
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    std::cout << "Wrote mesh cache " << cachePath << " (" << pixelOffset << " bytes)" << std::endl;
+    return true;
+}
+
+bool MeshCache::open(const std::string& cachePath, uint64_t sourceHash)
+{
+    close();
+    if (!file.open(cachePath))
+    {
+        return false;
+    }
+
+    if (file.size() < sizeof(MeshCacheHeader))
+    {
+        close();
+        return false;
+    }
+
+    header = reinterpret_cast<const MeshCacheHeader*>(file.data());
+    if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+        header->sourceHash != sourceHash)
+    {
+        std::cout << "Mesh cache is stale: " << cachePath << std::endl;
+        close();
+        return false;
+    }
+
+    // Reject anything that would read past the end of the mapping
+    uint64_t size = file.size();
+    bool valid =
+        header->primitiveTableOffset + uint64_t(header->primitiveCount) * sizeof(CookedPrimitive) <= size &&
+        header->materialTableOffset + uint64_t(header->materialCount) * sizeof(CookedMaterial) <= size &&
+        header->textureTableOffset + uint64_t(header->textureCount) * sizeof(CookedTexture) <= size &&
+        header->imageTableOffset + uint64_t(header->imageCount) * sizeof(CookedImage) <= size &&
+        header->nodeTableOffset + uint64_t(header->nodeCount) * sizeof(CookedNode) <= size &&
+        header->vertexDataOffset + header->vertexDataSize <= size &&
+        header->indexDataOffset + header->indexDataSize <= size;
+    for (uint32_t i = 0; valid && i < header->imageCount; ++i)
+    {
+        const CookedImage& image = getImage(i);
+        valid = image.pixelOffset + image.pixelSize <= size &&
+            (image.pixelSize == 0 ||
+             (image.levelCount >= 1 && image.levelCount <= getMipLevelCount(image.width, image.height) &&
+              image.pixelSize == getTextureImageSize(image.format, image.width, image.height, image.levelCount)));
+    }
+    for (uint32_t i = 0; valid && i < header->primitiveCount; ++i)
+    {
+        const CookedPrimitive& primitive = getPrimitive(i);
+        valid = primitive.vertexOffset + uint64_t(primitive.vertexCount) * sizeof(QuantizedVertex) <=
+            header->vertexDataSize &&
+            (primitive.indexSize == 2 || primitive.indexSize == 4) &&
+            primitive.indexOffset + uint64_t(primitive.indexCount) * primitive.indexSize <= header->indexDataSize &&
+            primitive.lodCount >= 1 && primitive.lodCount <= MAX_MESH_LODS;
+        for (uint32_t lod = 0; valid && lod < primitive.lodCount; ++lod)
+        {
+            const CookedLod& level = primitive.lods[lod];
+            valid = primitive.indexOffset + (uint64_t(level.firstIndex) + level.indexCount) * primitive.indexSize <=
+                header->indexDataSize;
+        }
+    }
+
+    // Indices between tables; -1 means none. Nodes must stay parent-sorted for SceneGraph::build
+    auto inRange = [](int32_t index, uint32_t count) { return index >= -1 && index < static_cast<int64_t>(count); };
+    for (uint32_t i = 0; valid && i < header->primitiveCount; ++i)
+    {
+        const CookedPrimitive& primitive = getPrimitive(i);
+        valid = primitive.mesh < header->meshCount && inRange(primitive.material, header->materialCount);
+    }
+    for (uint32_t i = 0; valid && i < header->materialCount; ++i)
+    {
+        const CookedMaterial& material = getMaterial(i);
+        valid = inRange(material.baseColorTexture, header->textureCount) &&
+            inRange(material.normalTexture, header->textureCount);
+    }
+    for (uint32_t i = 0; valid && i < header->textureCount; ++i)
+    {
+        valid = inRange(getTexture(i).image, header->imageCount);
+    }
+    for (uint32_t i = 0; valid && i < header->nodeCount; ++i)
+    {
+        const CookedNode& node = getNode(i);
+        valid = inRange(node.parent, i) && inRange(node.mesh, header->meshCount);
+    }
+
+    if (!valid)
+    {
+        std::cerr << "Mesh cache is corrupt: " << cachePath << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MeshCache::close()
+{
+    file.close();
+    header = nullptr;
+}
+
+const CookedPrimitive& MeshCache::getPrimitive(uint32_t index) const
+{
+    return table<CookedPrimitive>(header->primitiveTableOffset)[index];
+}
+
+const CookedMaterial& MeshCache::getMaterial(uint32_t index) const
+{
+    return table<CookedMaterial>(header->materialTableOffset)[index];
+}
+
+const CookedTexture& MeshCache::getTexture(uint32_t index) const
+{
+    return table<CookedTexture>(header->textureTableOffset)[index];
+}
+
+const CookedImage& MeshCache::getImage(uint32_t index) const
+{
+    return table<CookedImage>(header->imageTableOffset)[index];
+}
+
+const CookedNode& MeshCache::getNode(uint32_t index) const
+{
+    return table<CookedNode>(header->nodeTableOffset)[index];
+}
+
+const unsigned char* MeshCache::getImagePixels(const CookedImage& image) const
+{
+    return file.data() + image.pixelOffset;
+}
+
+const unsigned char* MeshCache::getVertexData() const
+{
+    return file.data() + header->vertexDataOffset;
+}
+
+const unsigned char* MeshCache::getIndexData() const
+{
+    return file.data() + header->indexDataOffset;
+}
+
+void MeshCache::evictGeometry() const
+{
+    file.evict(header->vertexDataOffset, header->vertexDataSize);
+    file.evict(header->indexDataOffset, header->indexDataSize);
+}
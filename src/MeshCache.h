@@ -0,0 +1,164 @@
+﻿#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <tiny_gltf.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "Culling.h"
+#include "MeshLod.h"
+#include "TextureCompression.h"
+#include "VertexQuantization.h"
+
+class ThreadPool;
+
+// Renderer-native cache of a glTF asset. The file is written once after a full
+// tinygltf load and mapped on later starts, so geometry and decoded images can
+// be uploaded straight from the mapping without parsing or image decoding.
+//
+// Layout: header, primitive/material/texture/image tables, then the vertex,
+// index and pixel blobs. Every section starts on a 16 byte boundary.
+// Cooking deduplicates vertices and reorders triangles for the post-transform
+// cache and for overdraw, so the cached index order differs from the source.
+// Images are stored block compressed with their full mip chain. Vertices are
+// stored quantized (QuantizedVertex), with one dequantization per mesh.
+
+const uint32_t MESH_CACHE_MAGIC = 0x4352474F; // "OGRC"
+const uint32_t MESH_CACHE_VERSION = 9;
+
+// Float vertex used while cooking and by CPU consumers of the geometry
+struct CookedVertex
+{
+    float position[3];
+    float normal[3];
+    float texCoord[2];
+};
+
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t meshCount;
+    uint32_t primitiveCount;
+    uint32_t materialCount;
+    uint32_t textureCount;
+    uint32_t imageCount;
+    uint32_t nodeCount;
+    uint64_t primitiveTableOffset;
+    uint64_t materialTableOffset;
+    uint64_t textureTableOffset;
+    uint64_t imageTableOffset;
+    uint64_t nodeTableOffset;
+    uint64_t vertexDataOffset;
+    uint64_t vertexDataSize;
+    uint64_t indexDataOffset;
+    uint64_t indexDataSize;
+};
+
+struct CookedLod
+{
+    uint32_t firstIndex; // relative to the primitive's first index
+    uint32_t indexCount;
+    float error;
+    uint32_t reserved;
+};
+
+struct CookedPrimitive
+{
+    uint32_t mesh;
+    int32_t material;
+    uint64_t vertexOffset; // bytes into the vertex blob of QuantizedVertex
+    uint64_t indexOffset;  // bytes into the index blob, 16 byte aligned
+    uint32_t vertexCount;
+    uint32_t indexCount;   // LOD 0 only
+    float boundsMin[3];    // object-space position bounds
+    float boundsMax[3];
+    float positionOffset[3]; // dequantization of the mesh's vertices, the same for all its primitives
+    float positionScale[3];
+    float texCoordOffset[2];
+    float texCoordScale[2];
+    uint32_t lodCount;     // LOD index lists follow LOD 0 in the index blob
+    uint32_t indexSize;    // 2 or 4 bytes, the smallest that fits vertexCount
+    CookedLod lods[MAX_MESH_LODS];
+};
+
+struct CookedMaterial
+{
+    int32_t baseColorTexture;
+    int32_t normalTexture;
+};
+
+struct CookedTexture
+{
+    int32_t image;
+    int32_t sampler;
+};
+
+// Scene nodes in parent-sorted order with node matrices already decomposed
+struct CookedNode
+{
+    int32_t parent;
+    int32_t mesh;
+    float translation[3];
+    float rotation[4]; // x, y, z, w
+    float scale[3];
+};
+
+struct CookedImage
+{
+    int32_t width;
+    int32_t height;
+    int32_t component;
+    uint32_t format;      // GL internal format of the stored levels
+    int32_t levelCount;   // mips, tightly packed largest first
+    int32_t reserved;
+    uint64_t pixelOffset; // absolute file offset
+    uint64_t pixelSize;   // all levels
+};
+
+uint64_t hashBytes(const unsigned char* data, size_t size);
+// Cache key of a .gltf/.glb: its bytes plus the size and write time of every external buffer and
+// image it references, so editing a .bin or a texture re-cooks as well
+uint64_t hashSourceFiles(const std::string& path, const unsigned char* data, size_t size);
+
+// Converts one glTF primitive to the cooked layout; non-indexed primitives get a trivial index list.
+// Fails on indices past the vertex count, so every later pass can index vertex arrays unchecked
+bool cookPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive,
+                   std::vector<CookedVertex>& vertices, std::vector<uint32_t>& indices);
+Aabb computeBounds(const CookedVertex* vertices, size_t vertexCount);
+VertexDequantization getDequantization(const CookedPrimitive& primitive);
+// Compressed textures are also kept by content hash in a "texcache" directory next to the cache file,
+// so re-cooking an edited asset or cooking another asset with the same images skips the encoder
+bool cookMeshCache(const tinygltf::Model& model, uint64_t sourceHash, const std::string& cachePath,
+                   ThreadPool* pool = nullptr);
+
+class MeshCache
+{
+public:
+    bool open(const std::string& cachePath, uint64_t sourceHash);
+    void close();
+
+    const MeshCacheHeader& getHeader() const { return *header; }
+    const CookedPrimitive& getPrimitive(uint32_t index) const;
+    const CookedMaterial& getMaterial(uint32_t index) const;
+    const CookedTexture& getTexture(uint32_t index) const;
+    const CookedImage& getImage(uint32_t index) const;
+    const CookedNode& getNode(uint32_t index) const;
+    const unsigned char* getImagePixels(const CookedImage& image) const;
+    const unsigned char* getVertexData() const;
+    const unsigned char* getIndexData() const;
+
+    // After the GPU copy is made: releases the resident vertex and index pages, later reads page them back in
+    void evictGeometry() const;
+
+private:
+    MappedFile file;
+    const MeshCacheHeader* header = nullptr;
+
+    template <typename T>
+    const T* table(uint64_t offset) const { return reinterpret_cast<const T*>(file.data() + offset); }
+};
+
+#endif
@@ -0,0 +1,351 @@
+﻿#include "MeshLod.h"
+#include "MeshCache.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+    // Symmetric 4x4 error quadric: xx xy xz xw yy yz yw zz zw ww
+    struct Quadric
+    {
+        double a[10] = {};
+
+        void addPlane(double x, double y, double z, double d)
+        {
+            a[0] += x * x; a[1] += x * y; a[2] += x * z; a[3] += x * d;
+            a[4] += y * y; a[5] += y * z; a[6] += y * d;
+            a[7] += z * z; a[8] += z * d;
+            a[9] += d * d;
+        }
+
+        void add(const Quadric& other)
+        {
+            for (int i = 0; i < 10; ++i)
+            {
+                a[i] += other.a[i];
+            }
+        }
+
+        // Sum of squared distances from p to the accumulated planes
+        double evaluate(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double result = a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x +
+                a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y +
+                a[7] * z * z + 2.0 * a[8] * z + a[9];
+            return std::max(result, 0.0);
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        float cost;
+    };
+
+    struct PositionKey
+    {
+        uint32_t bits[3];
+        bool operator==(const PositionKey& other) const { return std::memcmp(bits, other.bits, sizeof(bits)) == 0; }
+    };
+
+    struct PositionKeyHash
+    {
+        size_t operator()(const PositionKey& key) const
+        {
+            return (key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u);
+        }
+    };
+
+    glm::vec3 getPosition(const CookedVertex& vertex)
+    {
+        return glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]);
+    }
+
+    uint64_t edgeKey(uint32_t a, uint32_t b)
+    {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+}
+
+float simplifyMesh(const CookedVertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+                   size_t targetIndexCount, std::vector<uint32_t>& result)
+{
+    result.assign(indices, indices + indexCount);
+    if (indexCount < 3 || targetIndexCount >= indexCount)
+    {
+        return 0.0f;
+    }
+
+    // Indices are range-checked once by cookPrimitive
+    assert(std::all_of(indices, indices + indexCount, [vertexCount](uint32_t index) { return index < vertexCount; }));
+
+    // Weld vertices by position; quadrics, borders and topology work on the welded ids
+    std::vector<uint32_t> weld(vertexCount);
+    std::vector<uint32_t> groupSize(vertexCount, 0);
+    std::unordered_map<PositionKey, uint32_t, PositionKeyHash> firstAtPosition;
+    firstAtPosition.reserve(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        PositionKey key;
+        std::memcpy(key.bits, vertices[v].position, sizeof(key.bits));
+        weld[v] = firstAtPosition.emplace(key, v).first->second;
+        ++groupSize[weld[v]];
+    }
+
+    // Seam vertices (split attributes) and open borders are locked
+    std::vector<uint8_t> lockedGroup(vertexCount, 0);
+    std::unordered_map<uint64_t, uint32_t> edgeUse;
+    edgeUse.reserve(indexCount);
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            ++edgeUse[edgeKey(weld[indices[i + k]], weld[indices[i + (k + 1) % 3]])];
+        }
+    }
+    for (const auto& edge : edgeUse)
+    {
+        if (edge.second == 1)
+        {
+            lockedGroup[edge.first >> 32] = 1;
+            lockedGroup[edge.first & 0xFFFFFFFFu] = 1;
+        }
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        if (groupSize[v] > 1)
+        {
+            lockedGroup[v] = 1;
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        glm::vec3 p0 = getPosition(vertices[indices[i]]);
+        glm::vec3 p1 = getPosition(vertices[indices[i + 1]]);
+        glm::vec3 p2 = getPosition(vertices[indices[i + 2]]);
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length <= 0.0f)
+        {
+            continue;
+        }
+        normal /= length;
+        double d = -glm::dot(normal, p0);
+        for (int k = 0; k < 3; ++k)
+        {
+            quadrics[weld[indices[i + k]]].addPlane(normal.x, normal.y, normal.z, d);
+        }
+    }
+
+    double maxCost = 0.0;
+    size_t targetTriangles = targetIndexCount / 3;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint8_t> touched(vertexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> next;
+
+    // Each pass collapses an independent set of the cheapest edges, then compacts the index list
+    while (result.size() / 3 > targetTriangles)
+    {
+        size_t triangleCount = result.size() / 3;
+
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (uint32_t index : result)
+        {
+            ++adjacencyOffsets[index + 1];
+        }
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        adjacency.resize(result.size());
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t u = result[i + k];
+                uint32_t v = result[i + (k + 1) % 3];
+                const glm::vec3 pu = getPosition(vertices[u]);
+                const glm::vec3 pv = getPosition(vertices[v]);
+                if (!lockedGroup[weld[u]])
+                {
+                    double cost = quadrics[weld[u]].evaluate(pv) + quadrics[weld[v]].evaluate(pv);
+                    collapses.push_back({u, v, static_cast<float>(cost)});
+                }
+                if (!lockedGroup[weld[v]])
+                {
+                    double cost = quadrics[weld[u]].evaluate(pu) + quadrics[weld[v]].evaluate(pu);
+                    collapses.push_back({v, u, static_cast<float>(cost)});
+                }
+            }
+        }
+        if (collapses.empty())
+        {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        for (uint32_t v = 0; v < vertexCount; ++v)
+        {
+            remap[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), 0);
+
+        size_t removable = triangleCount - targetTriangles;
+        size_t removed = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (removed >= removable)
+            {
+                break;
+            }
+
+            uint32_t fromGroup = weld[collapse.from];
+            uint32_t toGroup = weld[collapse.to];
+            if (touched[fromGroup] || touched[toGroup] || fromGroup == toGroup)
+            {
+                continue;
+            }
+
+            // Reject collapses that would flip a surviving triangle around the removed vertex
+            glm::vec3 target = getPosition(vertices[collapse.to]);
+            bool flips = false;
+            for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; ++a)
+            {
+                const uint32_t* triangle = &result[adjacency[a] * 3];
+                if (weld[triangle[0]] == toGroup || weld[triangle[1]] == toGroup || weld[triangle[2]] == toGroup)
+                {
+                    continue; // becomes degenerate and is removed
+                }
+
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    before[k] = getPosition(vertices[triangle[k]]);
+                    after[k] = triangle[k] == collapse.from ? target : before[k];
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                // Also reject large rotations, which tend to flip after a few more passes
+                float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+                flips = glm::dot(normalBefore, normalAfter) <= 0.25f * lengths;
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+            remap[collapse.from] = collapse.to;
+            quadrics[toGroup].add(quadrics[fromGroup]);
+            maxCost = std::max(maxCost, static_cast<double>(collapse.cost));
+            removed += 2;
+
+            // Lock the whole one-ring so collapses in this pass never interact
+            for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; ++a)
+            {
+                const uint32_t* triangle = &result[adjacency[a] * 3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    touched[weld[triangle[k]]] = 1;
+                }
+            }
+        }
+        if (removed == 0)
+        {
+            break;
+        }
+
+        next.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if (weld[a] != weld[b] && weld[b] != weld[c] && weld[a] != weld[c])
+            {
+                next.push_back(a);
+                next.push_back(b);
+                next.push_back(c);
+            }
+        }
+        result.swap(next);
+    }
+
+    return static_cast<float>(std::sqrt(maxCost));
+}
+
+void generateMeshLods(const CookedVertex* vertices, size_t vertexCount, std::vector<uint32_t>& indices,
+                      std::vector<MeshLod>& lods)
+{
+    const size_t minTriangles = 32;
+    const float minReduction = 0.85f; // a level must drop at least 15% of the triangles
+
+    lods.clear();
+    lods.push_back({0, static_cast<uint32_t>(indices.size()), 0.0f});
+
+    std::vector<uint32_t> source(indices);
+    std::vector<uint32_t> simplified;
+    float error = 0.0f;
+    while (lods.size() < MAX_MESH_LODS && source.size() / 3 >= minTriangles)
+    {
+        size_t target = source.size() / 6 * 3;
+        // Errors are measured against the previous level, so they accumulate down the chain
+        error += simplifyMesh(vertices, vertexCount, source.data(), source.size(), target, simplified);
+        if (simplified.empty() || simplified.size() > source.size() * minReduction)
+        {
+            break;
+        }
+
+        lods.push_back({static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(simplified.size()), error});
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        source.swap(simplified);
+    }
+}
+
+LodSelector::LodSelector(const glm::vec3& cameraPosition, float fovY, int viewportHeight, float errorPixels)
+    : cameraPosition(cameraPosition)
+{
+    pixelsPerUnitAtUnitDistance = viewportHeight / (2.0f * std::tan(fovY * 0.5f)) / std::max(errorPixels, 1e-3f);
+}
+
+uint32_t LodSelector::select(const MeshLod* lods, uint32_t lodCount, const Aabb& worldBounds, float worldScale) const
+{
+    // Distance to the closest point of the bounds; inside the box always gets full detail
+    glm::vec3 closest = glm::clamp(cameraPosition, worldBounds.min, worldBounds.max);
+    float distance = glm::length(closest - cameraPosition);
+    if (distance <= 0.0f || pixelsPerUnitAtUnitDistance <= 0.0f)
+    {
+        return 0;
+    }
+
+    for (uint32_t lod = lodCount; lod-- > 1;)
+    {
+        if (lods[lod].error * worldScale * pixelsPerUnitAtUnitDistance <= distance)
+        {
+            return lod;
+        }
+    }
+    return 0;
+}
+
+float getMaxScale(const glm::mat4& transform)
+{
+    float scale = std::max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+                           std::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+                                    glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))));
+    return std::sqrt(scale);
+}
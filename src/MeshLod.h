@@ -0,0 +1,58 @@
+﻿#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "Culling.h"
+
+struct CookedVertex;
+
+// LOD 0 is the source index list, every further level roughly halves the triangle count
+const uint32_t MAX_MESH_LODS = 5;
+
+struct MeshLod
+{
+    uint32_t firstIndex; // relative to the primitive's first index
+    uint32_t indexCount;
+    float error;         // object-space geometric error of this level
+};
+
+// Quadric-error edge collapse over an indexed triangle list. Vertices are never
+// moved or created: a collapse retargets one vertex onto a neighbour, so the
+// result indexes the original vertex buffer. Vertices on attribute seams (same
+// position, different normal/UV) and on open borders are locked, which keeps
+// seams and silhouettes intact. Returns the achieved error (distance-like).
+float simplifyMesh(const CookedVertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+                   size_t targetIndexCount, std::vector<uint32_t>& result);
+
+// Appends the simplified levels after the source indices in `indices` and fills
+// `lods` (including LOD 0). Stops early once a level no longer shrinks.
+void generateMeshLods(const CookedVertex* vertices, size_t vertexCount, std::vector<uint32_t>& indices,
+                      std::vector<MeshLod>& lods);
+
+// Picks the coarsest LOD whose error, projected to the screen, stays under the pixel threshold
+class LodSelector
+{
+public:
+    LodSelector() = default;
+    LodSelector(const glm::vec3& cameraPosition, float fovY, int viewportHeight, float errorPixels);
+
+    uint32_t select(const MeshLod* lods, uint32_t lodCount, const Aabb& worldBounds, float worldScale) const;
+
+private:
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float pixelsPerUnitAtUnitDistance = 0.0f; // divided by the threshold
+};
+
+// Draws per LOD level in the last frame, for the renderer panel
+struct LodStats
+{
+    size_t draws[MAX_MESH_LODS] = {};
+    size_t triangles = 0;
+};
+
+// Largest axis scale of a transform, used to bring object-space LOD errors into world space
+float getMaxScale(const glm::mat4& transform);
+
+#endif
@@ -0,0 +1,364 @@
+﻿#include "MeshOptimizer.h"
+#include "MeshCache.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+
+namespace
+{
+    // FIFO cache simulated with insertion timestamps; bumping the clock past cacheSize empties it
+    struct VertexCache
+    {
+        std::vector<uint32_t> timestamps;
+        uint32_t time;
+        uint32_t cacheSize;
+
+        VertexCache(size_t vertexCount, uint32_t cacheSize)
+            : timestamps(vertexCount, 0), time(cacheSize + 1), cacheSize(cacheSize)
+        {
+        }
+
+        // Returns 1 on a miss
+        uint32_t access(uint32_t vertex)
+        {
+            assert(vertex < timestamps.size());
+            if (time - timestamps[vertex] > cacheSize)
+            {
+                timestamps[vertex] = time++;
+                return 1;
+            }
+            return 0;
+        }
+
+        void reset()
+        {
+            time += cacheSize + 1;
+        }
+    };
+
+    struct Adjacency
+    {
+        std::vector<uint32_t> offsets;   // per vertex, into triangles
+        std::vector<uint32_t> triangles;
+    };
+
+    void buildAdjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount, Adjacency& adjacency)
+    {
+        adjacency.offsets.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            // cookPrimitive rejects out-of-range indices
+            assert(indices[i] < vertexCount);
+            adjacency.offsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            adjacency.offsets[v + 1] += adjacency.offsets[v];
+        }
+
+        std::vector<uint32_t> cursor(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+        adjacency.triangles.resize(indexCount);
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            adjacency.triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    glm::vec3 getPosition(const CookedVertex& vertex)
+    {
+        return glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]);
+    }
+
+    struct VertexHash
+    {
+        const CookedVertex* vertices;
+        size_t operator()(uint32_t index) const
+        {
+            return static_cast<size_t>(hashBytes(reinterpret_cast<const unsigned char*>(&vertices[index]),
+                                                 sizeof(CookedVertex)));
+        }
+    };
+
+    struct VertexEqual
+    {
+        const CookedVertex* vertices;
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            return std::memcmp(&vertices[a], &vertices[b], sizeof(CookedVertex)) == 0;
+        }
+    };
+}
+
+float computeAcmr(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    if (indexCount < 3)
+    {
+        return 0.0f;
+    }
+
+    VertexCache cache(vertexCount, cacheSize);
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        misses += cache.access(indices[i]);
+    }
+    return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    Adjacency adjacency;
+    buildAdjacency(indices, triangleCount * 3, vertexCount, adjacency);
+
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd; // recently referenced vertices, used when a fan runs dry
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(triangleCount * 3);
+
+    uint32_t time = cacheSize + 1;
+    size_t scan = 0; // next vertex to try once the dead-end stack is exhausted
+    int64_t fanVertex = 0;
+    while (fanVertex >= 0)
+    {
+        uint32_t fan = static_cast<uint32_t>(fanVertex);
+        candidates.clear();
+        for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1]; ++a)
+        {
+            uint32_t triangle = adjacency.triangles[a];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+            emitted[triangle] = true;
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[triangle * 3 + k];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                {
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // Prefer the candidate that entered the cache earliest but will still be resident after its fan
+        fanVertex = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveTriangles[v] == 0)
+            {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+            {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                fanVertex = v;
+            }
+        }
+
+        while (fanVertex < 0 && !deadEnd.empty())
+        {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[v] > 0)
+            {
+                fanVertex = v;
+            }
+        }
+        for (; fanVertex < 0 && scan < vertexCount; ++scan)
+        {
+            if (liveTriangles[scan] > 0)
+            {
+                fanVertex = static_cast<int64_t>(scan);
+            }
+        }
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const CookedVertex* vertices, size_t vertexCount,
+                      float threshold, uint32_t cacheSize)
+{
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+    {
+        return;
+    }
+
+    // Hard boundaries: triangles that miss on all three vertices start from a cold cache anyway
+    std::vector<size_t> hardBoundaries;
+    {
+        VertexCache cache(vertexCount, cacheSize);
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            uint32_t misses = cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) +
+                cache.access(indices[t * 3 + 2]);
+            if (t == 0 || misses == 3)
+            {
+                hardBoundaries.push_back(t);
+            }
+        }
+        hardBoundaries.push_back(triangleCount);
+    }
+
+    // Soft boundaries: inside each hard run, cut as soon as the prefix since the last cut is within the threshold
+    std::vector<size_t> clusters;
+    VertexCache cache(vertexCount, cacheSize);
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); ++h)
+    {
+        size_t start = hardBoundaries[h];
+        size_t end = hardBoundaries[h + 1];
+
+        cache.reset();
+        size_t runMisses = 0;
+        for (size_t t = start; t < end; ++t)
+        {
+            runMisses += cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) +
+                cache.access(indices[t * 3 + 2]);
+        }
+        float runAcmr = static_cast<float>(runMisses) / static_cast<float>(end - start);
+
+        cache.reset();
+        size_t clusterStart = start;
+        size_t clusterMisses = 0;
+        clusters.push_back(start);
+        for (size_t t = start; t < end; ++t)
+        {
+            clusterMisses += cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) +
+                cache.access(indices[t * 3 + 2]);
+            size_t clusterTriangles = t + 1 - clusterStart;
+            if (t + 1 < end && static_cast<float>(clusterMisses) <= runAcmr * threshold * clusterTriangles)
+            {
+                clusterStart = t + 1;
+                clusterMisses = 0;
+                clusters.push_back(clusterStart);
+                cache.reset();
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    size_t clusterCount = clusters.size() - 1;
+    if (clusterCount < 2)
+    {
+        return;
+    }
+
+    // Sort key: how far the cluster sits out along its own average normal, measured from the mesh centroid
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+    std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+    std::vector<float> clusterAreas(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; ++c)
+    {
+        for (size_t t = clusters[c]; t < clusters[c + 1]; ++t)
+        {
+            glm::vec3 p0 = getPosition(vertices[indices[t * 3]]);
+            glm::vec3 p1 = getPosition(vertices[indices[t * 3 + 1]]);
+            glm::vec3 p2 = getPosition(vertices[indices[t * 3 + 2]]);
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float area = glm::length(normal);
+            glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+
+            clusterCentroids[c] += centroid * area;
+            clusterNormals[c] += normal;
+            clusterAreas[c] += area;
+            meshCentroid += centroid * area;
+            meshArea += area;
+        }
+    }
+    if (meshArea > 0.0f)
+    {
+        meshCentroid /= meshArea;
+    }
+
+    std::vector<float> sortKeys(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; ++c)
+    {
+        float normalLength = glm::length(clusterNormals[c]);
+        if (clusterAreas[c] > 0.0f && normalLength > 0.0f)
+        {
+            glm::vec3 centroid = clusterCentroids[c] / clusterAreas[c];
+            sortKeys[c] = glm::dot(centroid - meshCentroid, clusterNormals[c] / normalLength);
+        }
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    for (uint32_t c = 0; c < clusterCount; ++c)
+    {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(triangleCount * 3);
+    for (uint32_t c : order)
+    {
+        result.insert(result.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+    }
+    std::copy(result.begin(), result.end(), indices);
+}
+
+size_t optimizeVertexFetch(std::vector<CookedVertex>& vertices, std::vector<uint32_t>& indices)
+{
+    // Duplicates map to the first of their kind
+    std::vector<uint32_t> canonical(vertices.size());
+    std::unordered_set<uint32_t, VertexHash, VertexEqual> unique(vertices.size(), VertexHash{vertices.data()},
+                                                                 VertexEqual{vertices.data()});
+    for (uint32_t v = 0; v < vertices.size(); ++v)
+    {
+        canonical[v] = *unique.insert(v).first;
+    }
+
+    const uint32_t unassigned = ~0u;
+    std::vector<uint32_t> remap(vertices.size(), unassigned);
+    std::vector<CookedVertex> reordered;
+    reordered.reserve(unique.size());
+    for (uint32_t& index : indices)
+    {
+        assert(index < vertices.size());
+        uint32_t source = canonical[index];
+        if (remap[source] == unassigned)
+        {
+            remap[source] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back(vertices[source]);
+        }
+        index = remap[source];
+    }
+
+    size_t removed = vertices.size() - reordered.size();
+    vertices.swap(reordered);
+    return removed;
+}
+
+uint32_t getMinimumIndexSize(size_t vertexCount)
+{
+    return vertexCount <= 65536 ? 2 : 4;
+}
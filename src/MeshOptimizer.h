@@ -0,0 +1,34 @@
+﻿#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct CookedVertex;
+
+// Cook-time index/vertex reordering. All passes keep the triangle set and winding intact.
+
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Average cache misses per triangle for a FIFO post-transform cache (0.5 is the ideal for large meshes, 3 the worst)
+float computeAcmr(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+                  uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsify (Sander et al. 2007): fans around the most recently used vertex that is still likely to be in the cache
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount,
+                         uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Splits cache-optimized indices into clusters that each cost at most `threshold` times the ACMR of their
+// run, then draws outward-facing clusters first so they occlude the rest. Run after optimizeVertexCache.
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const CookedVertex* vertices, size_t vertexCount,
+                      float threshold, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Merges bit-identical vertices and renumbers the rest in first-use order so vertex fetch walks memory forwards.
+// Unreferenced vertices are dropped. Returns the number of vertices removed.
+size_t optimizeVertexFetch(std::vector<CookedVertex>& vertices, std::vector<uint32_t>& indices);
+
+// 2 when every index fits in 16 bits, otherwise 4
+uint32_t getMinimumIndexSize(size_t vertexCount);
+
+#endif
@@ -0,0 +1,649 @@
+﻿#include "MeshoptCodec.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESHOPT_CODEC_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const unsigned char VERTEX_HEADER = 0xa0;
+    const unsigned char INDEX_HEADER = 0xe0;
+    const unsigned char SEQUENCE_HEADER = 0xd0;
+
+    const size_t VERTEX_BLOCK_SIZE_BYTES = 8192;
+    const size_t VERTEX_BLOCK_MAX_SIZE = 256;
+    const size_t BYTE_GROUP_SIZE = 16;
+    const size_t BYTE_GROUP_DECODE_LIMIT = 24; // the most one group can read
+    const size_t TAIL_MAX_SIZE = 32;
+
+    // Vertices per block: as many as fit the 8 KB scratch, a multiple of the byte group size
+    size_t getVertexBlockSize(size_t vertexSize)
+    {
+        size_t result = VERTEX_BLOCK_SIZE_BYTES / vertexSize;
+        result &= ~(BYTE_GROUP_SIZE - 1);
+        return std::min(result, VERTEX_BLOCK_MAX_SIZE);
+    }
+
+    unsigned char unzigzag8(unsigned char value)
+    {
+        return static_cast<unsigned char>(-(value & 1) ^ (value >> 1));
+    }
+
+    // 16 values of 0, 2, 4 or 8 bits; a value with all bits set is an escape for a whole byte that follows the group
+    const unsigned char* decodeBytesGroup(const unsigned char* data, unsigned char* buffer, int bitsLog2)
+    {
+        switch (bitsLog2)
+        {
+        case 0:
+            std::memset(buffer, 0, BYTE_GROUP_SIZE);
+            return data;
+        case 1:
+        case 2:
+        {
+            int bits = bitsLog2 == 1 ? 2 : 4;
+            unsigned int sentinel = (1u << bits) - 1;
+            size_t packedBytes = BYTE_GROUP_SIZE * bits / 8;
+            const unsigned char* escapes = data + packedBytes;
+            for (size_t i = 0; i < BYTE_GROUP_SIZE; ++i)
+            {
+                // Most significant bits first
+                size_t bit = i * bits;
+                unsigned int value = (data[bit / 8] >> (8 - bits - bit % 8)) & sentinel;
+                buffer[i] = value == sentinel ? *escapes++ : static_cast<unsigned char>(value);
+            }
+            return escapes;
+        }
+        default:
+            std::memcpy(buffer, data, BYTE_GROUP_SIZE);
+            return data + BYTE_GROUP_SIZE;
+        }
+    }
+
+    // One byte channel of a block; two header bits per group give its width
+    const unsigned char* decodeBytes(const unsigned char* data, const unsigned char* end, unsigned char* buffer,
+                                     size_t bufferSize)
+    {
+        const unsigned char* header = data;
+        size_t headerSize = (bufferSize / BYTE_GROUP_SIZE + 3) / 4;
+        if (static_cast<size_t>(end - data) < headerSize)
+        {
+            return nullptr;
+        }
+        data += headerSize;
+
+        for (size_t i = 0; i < bufferSize; i += BYTE_GROUP_SIZE)
+        {
+            if (static_cast<size_t>(end - data) < BYTE_GROUP_DECODE_LIMIT)
+            {
+                return nullptr;
+            }
+            size_t group = i / BYTE_GROUP_SIZE;
+            int bitsLog2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+            data = decodeBytesGroup(data, buffer + i, bitsLog2);
+        }
+        return data;
+    }
+
+    // Channels k..k+3 hold zigzagged byte deltas against the previous vertex. The SSE path
+    // transposes 16 vertices at a time and runs the prefix sum on all four bytes of a vertex at once.
+    void decodeDeltas4(const unsigned char (*channels)[VERTEX_BLOCK_MAX_SIZE], unsigned char* vertexData,
+                       size_t vertexCount, size_t vertexSize, unsigned char* lastVertex)
+    {
+#ifdef MESHOPT_CODEC_USE_SSE
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i lowBits = _mm_set1_epi8(0x7f);
+        auto unzigzag = [&](__m128i value)
+        {
+            __m128i half = _mm_and_si128(_mm_srli_epi16(value, 1), lowBits);
+            return _mm_xor_si128(half, _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(value, one)));
+        };
+
+        int32_t last;
+        std::memcpy(&last, lastVertex, sizeof(last));
+        __m128i carry = _mm_set1_epi32(last);
+        alignas(16) uint32_t vertices[BYTE_GROUP_SIZE];
+        for (size_t i = 0; i < vertexCount; i += BYTE_GROUP_SIZE)
+        {
+            __m128i c0 = unzigzag(_mm_loadu_si128(reinterpret_cast<const __m128i*>(channels[0] + i)));
+            __m128i c1 = unzigzag(_mm_loadu_si128(reinterpret_cast<const __m128i*>(channels[1] + i)));
+            __m128i c2 = unzigzag(_mm_loadu_si128(reinterpret_cast<const __m128i*>(channels[2] + i)));
+            __m128i c3 = unzigzag(_mm_loadu_si128(reinterpret_cast<const __m128i*>(channels[3] + i)));
+
+            __m128i c01Low = _mm_unpacklo_epi8(c0, c1);
+            __m128i c01High = _mm_unpackhi_epi8(c0, c1);
+            __m128i c23Low = _mm_unpacklo_epi8(c2, c3);
+            __m128i c23High = _mm_unpackhi_epi8(c2, c3);
+            __m128i rows[4] = {_mm_unpacklo_epi16(c01Low, c23Low), _mm_unpackhi_epi16(c01Low, c23Low),
+                               _mm_unpacklo_epi16(c01High, c23High), _mm_unpackhi_epi16(c01High, c23High)};
+
+            for (int r = 0; r < 4; ++r)
+            {
+                // Bytewise prefix sum over the four vertices of the row, then add the previous vertex
+                __m128i sum = rows[r];
+                sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 4));
+                sum = _mm_add_epi8(sum, _mm_slli_si128(sum, 8));
+                sum = _mm_add_epi8(sum, carry);
+                carry = _mm_shuffle_epi32(sum, 0xff);
+                _mm_store_si128(reinterpret_cast<__m128i*>(vertices + r * 4), sum);
+            }
+
+            size_t count = std::min(BYTE_GROUP_SIZE, vertexCount - i);
+            for (size_t j = 0; j < count; ++j)
+            {
+                std::memcpy(vertexData + (i + j) * vertexSize, &vertices[j], sizeof(uint32_t));
+            }
+        }
+#else
+        for (size_t k = 0; k < 4; ++k)
+        {
+            unsigned char previous = lastVertex[k];
+            for (size_t i = 0; i < vertexCount; ++i)
+            {
+                unsigned char value = static_cast<unsigned char>(unzigzag8(channels[k][i]) + previous);
+                vertexData[i * vertexSize + k] = value;
+                previous = value;
+            }
+        }
+#endif
+    }
+
+    const unsigned char* decodeVertexBlock(const unsigned char* data, const unsigned char* end,
+                                           unsigned char* vertexData, size_t vertexCount, size_t vertexSize,
+                                           unsigned char* lastVertex)
+    {
+        unsigned char channels[4][VERTEX_BLOCK_MAX_SIZE];
+        size_t alignedCount = (vertexCount + BYTE_GROUP_SIZE - 1) & ~(BYTE_GROUP_SIZE - 1);
+        for (size_t k = 0; k < vertexSize; k += 4)
+        {
+            for (size_t c = 0; c < 4; ++c)
+            {
+                data = decodeBytes(data, end, channels[c], alignedCount);
+                if (!data)
+                {
+                    return nullptr;
+                }
+            }
+            decodeDeltas4(channels, vertexData + k, vertexCount, vertexSize, lastVertex + k);
+        }
+        std::memcpy(lastVertex, vertexData + vertexSize * (vertexCount - 1), vertexSize);
+        return data;
+    }
+
+    // Little-endian base-128, at most five bytes
+    uint32_t decodeVByte(const unsigned char*& data)
+    {
+        unsigned char lead = *data++;
+        if (lead < 128)
+        {
+            return lead;
+        }
+        uint32_t result = lead & 127;
+        uint32_t shift = 7;
+        for (int i = 0; i < 4; ++i)
+        {
+            unsigned char group = *data++;
+            result |= static_cast<uint32_t>(group & 127) << shift;
+            shift += 7;
+            if (group < 128)
+            {
+                break;
+            }
+        }
+        return result;
+    }
+
+    uint32_t decodeIndex(const unsigned char*& data, uint32_t last)
+    {
+        uint32_t value = decodeVByte(data);
+        uint32_t delta = (value >> 1) ^ (0u - (value & 1));
+        return last + delta;
+    }
+
+    void writeIndex(unsigned char* destination, size_t index, size_t indexSize, uint32_t value)
+    {
+        if (indexSize == 2)
+        {
+            uint16_t shortValue = static_cast<uint16_t>(value);
+            std::memcpy(destination + index * 2, &shortValue, sizeof(shortValue));
+        }
+        else
+        {
+            std::memcpy(destination + index * 4, &value, sizeof(value));
+        }
+    }
+
+    struct IndexFifos
+    {
+        uint32_t edges[16][2];
+        uint32_t vertices[16];
+        size_t edgeOffset = 0;
+        size_t vertexOffset = 0;
+
+        IndexFifos()
+        {
+            std::memset(edges, -1, sizeof(edges));
+            std::memset(vertices, -1, sizeof(vertices));
+        }
+
+        // The decoder must push exactly what the encoder pushed
+        void pushEdge(uint32_t a, uint32_t b)
+        {
+            edges[edgeOffset][0] = a;
+            edges[edgeOffset][1] = b;
+            edgeOffset = (edgeOffset + 1) & 15;
+        }
+        void pushVertex(uint32_t v, bool advance = true)
+        {
+            vertices[vertexOffset] = v;
+            vertexOffset = (vertexOffset + (advance ? 1 : 0)) & 15;
+        }
+    };
+
+    template <typename T>
+    void decodeFilterOctahedral(T* data, size_t count)
+    {
+        // z carries the encoded length of one, so x and y are relative to it
+        const float maxValue = static_cast<float>((1 << (sizeof(T) * 8 - 1)) - 1);
+        for (size_t i = 0; i < count; ++i)
+        {
+            float x = static_cast<float>(data[i * 4 + 0]);
+            float y = static_cast<float>(data[i * 4 + 1]);
+            float z = static_cast<float>(data[i * 4 + 2]) - std::abs(x) - std::abs(y);
+            float fold = std::min(z, 0.0f);
+            x += x >= 0.0f ? fold : -fold;
+            y += y >= 0.0f ? fold : -fold;
+
+            float scale = maxValue / std::sqrt(x * x + y * y + z * z);
+            data[i * 4 + 0] = static_cast<T>(std::lround(x * scale));
+            data[i * 4 + 1] = static_cast<T>(std::lround(y * scale));
+            data[i * 4 + 2] = static_cast<T>(std::lround(z * scale));
+        }
+    }
+
+    void decodeFilterQuaternion(int16_t* data, size_t count)
+    {
+        // Three components scaled by 1/sqrt(2); the fourth holds the largest component's index and the scale
+        const float scale = 1.0f / std::sqrt(2.0f);
+        for (size_t i = 0; i < count; ++i)
+        {
+            int16_t* q = data + i * 4;
+            int encodedScale = q[3] | 3;
+            float componentScale = scale / static_cast<float>(encodedScale);
+            float x = q[0] * componentScale;
+            float y = q[1] * componentScale;
+            float z = q[2] * componentScale;
+            float w = std::sqrt(std::max(1.0f - x * x - y * y - z * z, 0.0f));
+
+            int largest = q[3] & 3;
+            q[(largest + 1) & 3] = static_cast<int16_t>(std::lround(x * 32767.0f));
+            q[(largest + 2) & 3] = static_cast<int16_t>(std::lround(y * 32767.0f));
+            q[(largest + 3) & 3] = static_cast<int16_t>(std::lround(z * 32767.0f));
+            q[(largest + 0) & 3] = static_cast<int16_t>(std::lround(w * 32767.0f));
+        }
+    }
+
+    void decodeFilterExponential(uint32_t* data, size_t count)
+    {
+        // 8-bit signed exponent over a 24-bit signed mantissa
+        for (size_t i = 0; i < count; ++i)
+        {
+            int32_t value = static_cast<int32_t>(data[i]);
+            int exponent = value >> 24;
+            int mantissa = static_cast<int32_t>(static_cast<uint32_t>(value) << 8) >> 8;
+            float result = std::ldexp(static_cast<float>(mantissa), exponent);
+            std::memcpy(&data[i], &result, sizeof(result));
+        }
+    }
+
+    size_t getSize(const tinygltf::Value& object, const char* key, size_t fallback)
+    {
+        return object.Has(key) ? static_cast<size_t>(object.Get(key).GetNumberAsDouble()) : fallback;
+    }
+
+    std::string getString(const tinygltf::Value& object, const char* key, const char* fallback)
+    {
+        return object.Has(key) ? object.Get(key).Get<std::string>() : std::string(fallback);
+    }
+}
+
+bool decodeMeshoptVertexBuffer(unsigned char* destination, size_t vertexCount, size_t vertexSize,
+                               const unsigned char* data, size_t size)
+{
+    if (vertexSize == 0 || vertexSize > 256 || vertexSize % 4 != 0)
+    {
+        return false;
+    }
+    const unsigned char* end = data + size;
+    size_t tailSize = std::max(vertexSize, TAIL_MAX_SIZE);
+    if (size < 1 + tailSize || (data[0] & 0xf0) != VERTEX_HEADER || (data[0] & 0x0f) > 0)
+    {
+        return false;
+    }
+    ++data;
+
+    // The tail ends with the first vertex, the base of the first block's deltas
+    unsigned char lastVertex[256];
+    std::memcpy(lastVertex, end - vertexSize, vertexSize);
+
+    size_t blockSize = getVertexBlockSize(vertexSize);
+    for (size_t offset = 0; offset < vertexCount; offset += blockSize)
+    {
+        size_t count = std::min(blockSize, vertexCount - offset);
+        data = decodeVertexBlock(data, end, destination + offset * vertexSize, count, vertexSize, lastVertex);
+        if (!data)
+        {
+            return false;
+        }
+    }
+    return static_cast<size_t>(end - data) == tailSize;
+}
+
+bool decodeMeshoptIndexBuffer(unsigned char* destination, size_t indexCount, size_t indexSize,
+                              const unsigned char* data, size_t size)
+{
+    // Header, one code byte per triangle, then the free-index data and a 16 byte code table at the end
+    if (indexCount % 3 != 0 || (indexSize != 2 && indexSize != 4) || size < 1 + indexCount / 3 + 16 ||
+        (data[0] & 0xf0) != INDEX_HEADER || (data[0] & 0x0f) > 1)
+    {
+        return false;
+    }
+    int version = data[0] & 0x0f;
+    int fecMax = version >= 1 ? 13 : 15; // version 1 encodes +-1 deltas as 13 and 14
+
+    IndexFifos fifos;
+    uint32_t next = 0;
+    uint32_t last = 0;
+    const unsigned char* code = data + 1;
+    const unsigned char* cursor = code + indexCount / 3;
+    const unsigned char* safeEnd = data + size - 16;
+    const unsigned char* codeAuxTable = safeEnd;
+
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        // A triangle reads at most 16 bytes, which the code table after safeEnd covers
+        if (cursor > safeEnd)
+        {
+            return false;
+        }
+
+        unsigned char codeTri = *code++;
+        if (codeTri < 0xf0)
+        {
+            // An edge from the fifo plus a new, cached or free third vertex
+            int fe = codeTri >> 4;
+            uint32_t a = fifos.edges[(fifos.edgeOffset - 1 - fe) & 15][0];
+            uint32_t b = fifos.edges[(fifos.edgeOffset - 1 - fe) & 15][1];
+            int fec = codeTri & 15;
+            uint32_t c;
+            if (fec < fecMax)
+            {
+                c = fec == 0 ? next++ : fifos.vertices[(fifos.vertexOffset - 1 - fec) & 15];
+                fifos.pushVertex(c, fec == 0);
+            }
+            else
+            {
+                c = last = fec != 15 ? last + (fec - (fec ^ 3)) : decodeIndex(cursor, last);
+                fifos.pushVertex(c);
+            }
+            writeIndex(destination, i + 0, indexSize, a);
+            writeIndex(destination, i + 1, indexSize, b);
+            writeIndex(destination, i + 2, indexSize, c);
+            fifos.pushEdge(c, b);
+            fifos.pushEdge(a, c);
+        }
+        else
+        {
+            // No shared edge: the first vertex is new (or free), the others come from the code table or a byte
+            int fea, feb, fec;
+            if (codeTri < 0xfe)
+            {
+                unsigned char codeAux = codeAuxTable[codeTri & 15];
+                fea = 0;
+                feb = codeAux >> 4;
+                fec = codeAux & 15;
+            }
+            else
+            {
+                unsigned char codeAux = *cursor++;
+                if (codeAux == 0)
+                {
+                    next = 0;
+                }
+                fea = codeTri == 0xfe ? 0 : 15;
+                feb = codeAux >> 4;
+                fec = codeAux & 15;
+            }
+
+            // Only the explicit form spells out free indices; in the table form 15 is a fifo slot
+            bool freeIndices = codeTri >= 0xfe;
+            bool newB = feb == 0 || (freeIndices && feb == 15);
+            bool newC = fec == 0 || (freeIndices && fec == 15);
+            uint32_t a = fea == 0 ? next++ : 0;
+            uint32_t b = feb == 0 ? next++ : fifos.vertices[(fifos.vertexOffset - feb) & 15];
+            uint32_t c = fec == 0 ? next++ : fifos.vertices[(fifos.vertexOffset - fec) & 15];
+            if (fea == 15)
+            {
+                last = a = decodeIndex(cursor, last);
+            }
+            if (freeIndices && feb == 15)
+            {
+                last = b = decodeIndex(cursor, last);
+            }
+            if (freeIndices && fec == 15)
+            {
+                last = c = decodeIndex(cursor, last);
+            }
+
+            writeIndex(destination, i + 0, indexSize, a);
+            writeIndex(destination, i + 1, indexSize, b);
+            writeIndex(destination, i + 2, indexSize, c);
+            fifos.pushVertex(a);
+            fifos.pushVertex(b, newB);
+            fifos.pushVertex(c, newC);
+            fifos.pushEdge(b, a);
+            fifos.pushEdge(c, b);
+            fifos.pushEdge(a, c);
+        }
+    }
+    return cursor == safeEnd;
+}
+
+bool decodeMeshoptIndexSequence(unsigned char* destination, size_t indexCount, size_t indexSize,
+                                const unsigned char* data, size_t size)
+{
+    // Header, at least a byte per index, then a 4 byte tail
+    if ((indexSize != 2 && indexSize != 4) || size < 1 + indexCount + 4 || (data[0] & 0xf0) != SEQUENCE_HEADER ||
+        (data[0] & 0x0f) > 1)
+    {
+        return false;
+    }
+
+    const unsigned char* cursor = data + 1;
+    const unsigned char* safeEnd = data + size - 4;
+    uint32_t last[2] = {0, 0};
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        if (cursor >= safeEnd)
+        {
+            return false;
+        }
+        // The low bit picks one of two baselines, the rest is a zigzag delta against it
+        uint32_t value = decodeVByte(cursor);
+        uint32_t baseline = value & 1;
+        value >>= 1;
+        uint32_t delta = (value >> 1) ^ (0u - (value & 1));
+        last[baseline] += delta;
+        writeIndex(destination, i, indexSize, last[baseline]);
+    }
+    return cursor == safeEnd;
+}
+
+bool applyMeshoptFilter(unsigned char* data, size_t count, size_t stride, MeshoptFilter filter)
+{
+    switch (filter)
+    {
+    case MeshoptFilter::None:
+        return true;
+    case MeshoptFilter::Octahedral:
+        if (stride == 4)
+        {
+            decodeFilterOctahedral(reinterpret_cast<int8_t*>(data), count);
+            return true;
+        }
+        if (stride == 8)
+        {
+            decodeFilterOctahedral(reinterpret_cast<int16_t*>(data), count);
+            return true;
+        }
+        return false;
+    case MeshoptFilter::Quaternion:
+        if (stride != 8)
+        {
+            return false;
+        }
+        decodeFilterQuaternion(reinterpret_cast<int16_t*>(data), count);
+        return true;
+    case MeshoptFilter::Exponential:
+        if (stride % 4 != 0)
+        {
+            return false;
+        }
+        decodeFilterExponential(reinterpret_cast<uint32_t*>(data), count * stride / 4);
+        return true;
+    }
+    return false;
+}
+
+bool decodeMeshoptBufferViews(tinygltf::Model& model, ThreadPool* pool)
+{
+    PROFILE_ZONE("decodeMeshoptBufferViews");
+    struct Job
+    {
+        size_t view;
+        int source;
+        size_t offset;
+        size_t length;
+        size_t stride;
+        size_t count;
+        std::string mode;
+        MeshoptFilter filter;
+    };
+
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < model.bufferViews.size(); ++i)
+    {
+        const tinygltf::BufferView& bufferView = model.bufferViews[i];
+        auto it = bufferView.extensions.find("EXT_meshopt_compression");
+        if (it == bufferView.extensions.end())
+        {
+            continue;
+        }
+
+        const tinygltf::Value& extension = it->second;
+        if (!extension.IsObject() || !extension.Has("buffer") || !extension.Has("byteLength") ||
+            !extension.Has("byteStride") || !extension.Has("count") || !extension.Has("mode"))
+        {
+            std::cerr << "Error: Buffer view " << i << " has an incomplete EXT_meshopt_compression object" << std::endl;
+            return false;
+        }
+
+        Job job;
+        job.view = i;
+        job.source = extension.Get("buffer").GetNumberAsInt();
+        job.offset = getSize(extension, "byteOffset", 0);
+        job.length = getSize(extension, "byteLength", 0);
+        job.stride = getSize(extension, "byteStride", 0);
+        job.count = getSize(extension, "count", 0);
+        job.mode = getString(extension, "mode", "");
+        std::string filter = getString(extension, "filter", "NONE");
+        job.filter = filter == "OCTAHEDRAL" ? MeshoptFilter::Octahedral
+                     : filter == "QUATERNION" ? MeshoptFilter::Quaternion
+                     : filter == "EXPONENTIAL" ? MeshoptFilter::Exponential : MeshoptFilter::None;
+
+        if (job.source < 0 || job.source >= static_cast<int>(model.buffers.size()) ||
+            job.offset + job.length > model.buffers[job.source].data.size())
+        {
+            std::cerr << "Error: Compressed data of buffer view " << i << " is out of range" << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    if (jobs.empty())
+    {
+        return true;
+    }
+
+    // Every view gets its own buffer, so the decodes are independent
+    size_t firstBuffer = model.buffers.size();
+    model.buffers.resize(firstBuffer + jobs.size());
+    size_t compressedBytes = 0, decodedBytes = 0;
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        model.buffers[firstBuffer + j].data.resize(jobs[j].count * jobs[j].stride);
+        compressedBytes += jobs[j].length;
+        decodedBytes += jobs[j].count * jobs[j].stride;
+    }
+
+    std::vector<char> decoded(jobs.size(), 0);
+    auto decode = [&](size_t j)
+    {
+        const Job& job = jobs[j];
+        unsigned char* destination = model.buffers[firstBuffer + j].data.data();
+        const unsigned char* source = model.buffers[job.source].data.data() + job.offset;
+        bool ok = false;
+        if (job.mode == "ATTRIBUTES")
+        {
+            ok = decodeMeshoptVertexBuffer(destination, job.count, job.stride, source, job.length) &&
+                applyMeshoptFilter(destination, job.count, job.stride, job.filter);
+        }
+        else if (job.mode == "TRIANGLES")
+        {
+            ok = decodeMeshoptIndexBuffer(destination, job.count, job.stride, source, job.length);
+        }
+        else if (job.mode == "INDICES")
+        {
+            ok = decodeMeshoptIndexSequence(destination, job.count, job.stride, source, job.length);
+        }
+        decoded[j] = ok ? 1 : 0;
+    };
+    if (pool)
+    {
+        pool->parallelFor(jobs.size(), decode);
+    }
+    else
+    {
+        for (size_t j = 0; j < jobs.size(); ++j)
+        {
+            decode(j);
+        }
+    }
+
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        if (!decoded[j])
+        {
+            std::cerr << "Error: Failed to decode meshopt " << jobs[j].mode << " data of buffer view " << jobs[j].view
+                << std::endl;
+            return false;
+        }
+        tinygltf::BufferView& bufferView = model.bufferViews[jobs[j].view];
+        bufferView.buffer = static_cast<int>(firstBuffer + j);
+        bufferView.byteOffset = 0;
+        bufferView.byteLength = jobs[j].count * jobs[j].stride;
+        bufferView.extensions.erase("EXT_meshopt_compression");
+    }
+
+    std::cout << "Decoded " << jobs.size() << " meshopt-compressed buffer views: " << compressedBytes << " -> "
+        << decodedBytes << " bytes" << std::endl;
+    return true;
+}
@@ -0,0 +1,34 @@
+﻿#ifndef MESHOPT_CODEC_H
+#define MESHOPT_CODEC_H
+
+#include <tiny_gltf.h>
+#include <cstddef>
+
+class ThreadPool;
+
+// Decoders for EXT_meshopt_compression buffer views: meshoptimizer's vertex codec
+// (version 0) and its triangle and index sequence codecs (versions 0 and 1). All return
+// false for malformed or truncated input instead of reading past `size`.
+bool decodeMeshoptVertexBuffer(unsigned char* destination, size_t vertexCount, size_t vertexSize,
+                               const unsigned char* data, size_t size);
+bool decodeMeshoptIndexBuffer(unsigned char* destination, size_t indexCount, size_t indexSize,
+                              const unsigned char* data, size_t size);
+bool decodeMeshoptIndexSequence(unsigned char* destination, size_t indexCount, size_t indexSize,
+                                const unsigned char* data, size_t size);
+
+enum class MeshoptFilter
+{
+    None,
+    Octahedral,  // 4 or 8 byte normals/tangents
+    Quaternion,  // 8 byte rotations
+    Exponential  // 32-bit floats as a shared-exponent mantissa
+};
+
+// Undoes a filter in place over `count` elements of `stride` bytes
+bool applyMeshoptFilter(unsigned char* data, size_t count, size_t stride, MeshoptFilter filter);
+
+// Decodes every buffer view compressed with EXT_meshopt_compression into a buffer of its own
+// and points the view at it, so accessors read plain data. Fallback buffers are never read.
+bool decodeMeshoptBufferViews(tinygltf::Model& model, ThreadPool* pool = nullptr);
+
+#endif
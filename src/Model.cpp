@@ -1,51 +1,404 @@
 ﻿#include "Model.h"
 #include "Texture.h"
+#include "Shader.h"
+#include "ThreadPool.h"
+#include "GltfAccessor.h"
+#include "MeshoptCodec.h"
+#include "Profiler.h"
+#include "TextureCompression.h"
+#include "TextureStreamer.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 
-Model::Model(const std::string& path)
+namespace
 {
-    loadModel(path);
-    createVAOs();
-}
+    // tinygltf image callback that only keeps the encoded bytes, so decoding can be spread over the pool
+    bool deferImageDecode(tinygltf::Image* image, const int imageIndex, std::string* err, std::string* warn,
+                          int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData)
+    {
+        auto* encodedImages = static_cast<std::vector<std::vector<unsigned char>>*>(userData);
+        if (imageIndex >= static_cast<int>(encodedImages->size()))
+        {
+            encodedImages->resize(imageIndex + 1);
+        }
+        (*encodedImages)[imageIndex].assign(bytes, bytes + size);
+        return true;
+    }
 
-void Model::draw(GLuint shaderProgram)
-{
-    for (const auto& mesh : model.meshes)
+    void decodeImage(tinygltf::Image& image, const std::vector<unsigned char>& encoded)
     {
-        int meshIdx = static_cast<int>(&mesh - &model.meshes[0]);
-        if (primitiveMap.find(meshIdx) == primitiveMap.end())
+        PROFILE_ZONE("decodeImage");
+        if (encoded.empty())
         {
-            std::cerr << "Error: Mesh index " << meshIdx << " not found in primitiveMap" << std::endl;
-            continue;
+            return;
         }
-        for (const auto& glPrimitive : primitiveMap[meshIdx])
+
+        // KTX2 payloads stay encoded; the cook and the upload read the container directly
+        TextureImage ktx;
+        if (isKtx2(encoded.data(), encoded.size()) && parseKtx2(encoded.data(), encoded.size(), ktx))
         {
-            glBindVertexArray(glPrimitive.vao);
+            image.width = ktx.width;
+            image.height = ktx.height;
+            image.component = 4;
+            image.bits = 8;
+            image.mimeType = "image/ktx2";
+            image.image = encoded;
+            return;
+        }
 
-            if (glPrimitive.indexCount > 0)
+        // Decode to RGBA like tinygltf's own loader does
+        int width, height, channels;
+        unsigned char* data = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()),
+                                                    &width, &height, &channels, STBI_rgb_alpha);
+        if (!data)
+        {
+            std::cerr << "Failed to decode image " << image.name << ": " << stbi_failure_reason() << std::endl;
+            return;
+        }
+
+        image.width = width;
+        image.height = height;
+        image.component = STBI_rgb_alpha;
+        image.bits = 8;
+        image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+        image.image.assign(data, data + static_cast<size_t>(width) * height * STBI_rgb_alpha);
+        stbi_image_free(data);
+    }
+
+    // glTF requires min/max on POSITION accessors, but fall back to scanning the data for files that omit them
+    Aabb getPositionBounds(const tinygltf::Model& model, const tinygltf::Primitive& primitive)
+    {
+        Aabb bounds;
+        int positionAccessor = findAttribute(primitive, "POSITION");
+        if (positionAccessor < 0)
+        {
+            return bounds;
+        }
+
+        const tinygltf::Accessor& accessor = model.accessors[positionAccessor];
+        if (accessor.minValues.size() >= 3 && accessor.maxValues.size() >= 3)
+        {
+            bounds.min = glm::vec3(accessor.minValues[0], accessor.minValues[1], accessor.minValues[2]);
+            bounds.max = glm::vec3(accessor.maxValues[0], accessor.maxValues[1], accessor.maxValues[2]);
+            return bounds;
+        }
+
+        std::vector<float> positions;
+        if (readAccessorFloats(model, positionAccessor, 3, positions))
+        {
+            for (size_t i = 0; i + 2 < positions.size(); i += 3)
             {
-                glDrawElements(GL_TRIANGLES, glPrimitive.indexCount, GL_UNSIGNED_SHORT, 0);
+                bounds.expand(glm::vec3(positions[i], positions[i + 1], positions[i + 2]));
             }
-            else
+        }
+        return bounds;
+    }
+
+    // A cache cooked on another machine may hold formats this context cannot sample
+    bool hasSupportedTextureFormats(const MeshCache& cache)
+    {
+        for (uint32_t i = 0; i < cache.getHeader().imageCount; ++i)
+        {
+            const CookedImage& image = cache.getImage(i);
+            if (image.pixelSize > 0 && !isTextureFormatSupported(image.format))
             {
-                glDrawArrays(GL_TRIANGLES, 0, glPrimitive.indexCount);
+                std::cout << "Mesh cache texture format 0x" << std::hex << image.format << std::dec
+                    << " is not supported here, re-cooking" << std::endl;
+                return false;
             }
+        }
+        return true;
+    }
 
-            glBindVertexArray(0);
+    size_t getIndexSize(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_BYTE ? 1 : indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    }
+}
+
+Model::Model(const std::string& path)
+{
+    load(path);
+    upload();
+}
+
+bool Model::load(const std::string& path, ThreadPool* pool)
+{
+    PROFILE_ZONE("Model::load");
+    sourcePath = path;
+
+    // The cooked cache is keyed by the source file and the files it references, so any edit to the asset re-cooks it
+    std::string cachePath = path + ".meshcache";
+    uint64_t sourceHash = 0;
+    MappedFile source;
+    if (source.open(path))
+    {
+        sourceHash = hashSourceFiles(path, source.data(), source.size());
+    }
+
+    if (sourceHash != 0 && cache.open(cachePath, sourceHash))
+    {
+        if (!requireGpuTextureFormats || hasSupportedTextureFormats(cache))
+        {
+            std::cout << "Loading cooked mesh cache: " << cachePath << std::endl;
+            loadedFromCache = true;
+            buildSceneGraph();
+            return true;
         }
+        cache.close();
+    }
+
+    bool loaded = loadModel(path, source, pool);
+    source.close();
+    if (!loaded)
+    {
+        return false;
+    }
+
+    // Switch to the fresh cache so the first run gets the cooked LOD chains too
+    if (sourceHash != 0 && cookMeshCache(model, sourceHash, cachePath, pool) && cache.open(cachePath, sourceHash))
+    {
+        loadedFromCache = true;
+        model = tinygltf::Model();
+    }
+    buildSceneGraph();
+    return true;
+}
+
+void Model::upload()
+{
+    PROFILE_ZONE("Model::upload");
+    if (loadedFromCache)
+    {
+        createVAOsFromCache();
+    }
+    else
+    {
+        createVAOs();
+    }
+    buildDrawItems();
+    bufferManager.finishUploads();
+    ready = true;
+}
+
+void Model::releaseCpuGeometry()
+{
+    if (loadedFromCache)
+    {
+        cache.evictGeometry();
     }
 }
 
-void Model::loadModel(const std::string& path)
+void Model::release()
+{
+    for (const auto& entry : primitiveMap)
+    {
+        for (const auto& glPrimitive : entry.second)
+        {
+            glDeleteVertexArrays(1, &glPrimitive.vao);
+        }
+    }
+    primitiveMap.clear();
+    drawItems.clear();
+    drawBounds.clear();
+    visibleItems.clear();
+    cullingBvh.clear();
+    bufferManager.release();
+    meshCount = 0;
+    ready = false;
+}
+
+void Model::draw(const Shader& shader, const Frustum* frustum, const LodSelector* lodSelector)
+{
+    PROFILE_ZONE("Model::draw");
+    PROFILE_GPU_ZONE("Model::draw");
+    UniformHandle<glm::mat4> modelHandle = modelUniform.get(shader);
+    updateDrawBounds();
+
+    visibleItems.clear();
+    if (frustum)
+    {
+        // Sorting restores node order so the model uniform is only set once per node
+        cullingBvh.cull(*frustum, visibleItems);
+        std::sort(visibleItems.begin(), visibleItems.end());
+    }
+    else
+    {
+        for (uint32_t i = 0; i < drawItems.size(); ++i)
+        {
+            visibleItems.push_back(i);
+        }
+    }
+    cullStats.visible = visibleItems.size();
+    cullStats.culled = drawItems.size() - visibleItems.size();
+    lodStats = LodStats();
+
+    int boundNode = -2;
+    const VertexDequantization* boundDequantization = nullptr;
+    for (uint32_t item : visibleItems)
+    {
+        const DrawItem& drawItem = drawItems[item];
+        if (drawItem.node != boundNode)
+        {
+            // Assets without a node hierarchy draw every mesh once at the origin
+            shader.set(modelHandle, drawItem.node >= 0 ? sceneGraph.getWorldMatrix(drawItem.node) : glm::mat4(1.0f));
+            boundNode = drawItem.node;
+        }
+
+        // Primitives of one mesh share their dequantization, so this changes about once per mesh
+        const GLPrimitive& glPrimitive = *drawItem.primitive;
+        if (!boundDequantization || *boundDequantization != glPrimitive.dequantization)
+        {
+            setVertexDequantization(shader, glPrimitive.dequantization);
+            boundDequantization = &glPrimitive.dequantization;
+        }
+        uint32_t lod = 0;
+        if (lodSelector)
+        {
+            float worldScale = drawItem.node >= 0 ? getMaxScale(sceneGraph.getWorldMatrix(drawItem.node)) : 1.0f;
+            lod = lodSelector->select(glPrimitive.lods, glPrimitive.lodCount, drawBounds[item], worldScale);
+        }
+        lodStats.draws[lod]++;
+        lodStats.triangles += glPrimitive.lods[lod].indexCount / 3;
+        drawPrimitive(glPrimitive, lod);
+    }
+}
+
+void Model::drawPrimitive(const GLPrimitive& glPrimitive, uint32_t lod)
+{
+    glBindVertexArray(glPrimitive.vao);
+    Profiler::get().addCounter(ProfileCounter::StateChanges);
+    Profiler::get().addCounter(ProfileCounter::DrawCalls);
+
+    if (glPrimitive.indexCount > 0)
+    {
+        const MeshLod& level = glPrimitive.lods[lod];
+        size_t offset = glPrimitive.indexOffset + level.firstIndex * getIndexSize(glPrimitive.indexType);
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(level.indexCount), glPrimitive.indexType,
+                       reinterpret_cast<const void*>(offset));
+    }
+    else
+    {
+        glDrawArrays(GL_TRIANGLES, 0, glPrimitive.indexCount);
+    }
+
+    glBindVertexArray(0);
+}
+
+void Model::buildDrawItems()
+{
+    drawItems.clear();
+    auto addMesh = [&](int meshIdx, int node)
+    {
+        auto it = primitiveMap.find(meshIdx);
+        if (it == primitiveMap.end())
+        {
+            std::cerr << "Error: Mesh index " << meshIdx << " not found in primitiveMap" << std::endl;
+            return;
+        }
+        for (const auto& glPrimitive : it->second)
+        {
+            drawItems.push_back({node, &glPrimitive});
+        }
+    };
+
+    if (sceneGraph.getNodeCount() == 0)
+    {
+        for (int meshIdx = 0; meshIdx < meshCount; ++meshIdx)
+        {
+            addMesh(meshIdx, -1);
+        }
+    }
+    else
+    {
+        for (int node : sceneGraph.getDrawableNodes())
+        {
+            addMesh(sceneGraph.getMesh(node), node);
+        }
+    }
+
+    drawBounds.resize(drawItems.size());
+    cullingBvh.clear(); // rebuilt on the next draw
+}
+
+void Model::updateDrawBounds()
+{
+    if (!cullingBvh.isEmpty() && boundsVersion == sceneGraph.getVersion())
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < drawItems.size(); ++i)
+    {
+        const DrawItem& drawItem = drawItems[i];
+        drawBounds[i] = drawItem.node >= 0 ?
+            transformAabb(drawItem.primitive->bounds, sceneGraph.getWorldMatrix(drawItem.node)) :
+            drawItem.primitive->bounds;
+    }
+
+    // Moving nodes keep the BVH topology and only refit the node bounds
+    if (cullingBvh.isEmpty())
+    {
+        cullingBvh.build(drawBounds);
+    }
+    else
+    {
+        cullingBvh.refit(drawBounds);
+    }
+    boundsVersion = sceneGraph.getVersion();
+}
+
+void Model::buildSceneGraph()
+{
+    if (!loadedFromCache)
+    {
+        sceneGraph.build(SceneGraph::collectNodes(model));
+        return;
+    }
+
+    std::vector<SceneNodeDesc> nodes(cache.getHeader().nodeCount);
+    for (uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        const CookedNode& cooked = cache.getNode(i);
+        SceneNodeDesc& desc = nodes[i];
+        desc.parent = cooked.parent;
+        desc.mesh = cooked.mesh;
+        desc.translation = glm::vec3(cooked.translation[0], cooked.translation[1], cooked.translation[2]);
+        desc.rotation = glm::quat(cooked.rotation[3], cooked.rotation[0], cooked.rotation[1], cooked.rotation[2]);
+        desc.scale = glm::vec3(cooked.scale[0], cooked.scale[1], cooked.scale[2]);
+    }
+    sceneGraph.build(nodes);
+}
+
+bool Model::loadModel(const std::string& path, const MappedFile& source, ThreadPool* pool)
 {
     tinygltf::TinyGLTF loader;
     std::string err;
     std::string warn;
 
+    std::vector<std::vector<unsigned char>> encodedImages;
+    loader.SetImageLoader(deferImageDecode, &encodedImages);
+
     bool ret = false;
     if (path.substr(path.find_last_of(".") + 1) == "glb")
     {
-        ret = loader.LoadBinaryFromFile(&model, &err, &warn, path); // for binary glTF (.glb)
+        // Parsed from the mapping the source hash was taken from, so the file is not read a second time
+        // into a temporary copy; only the BIN chunk is copied, into the model's buffer
+        if (source.isOpen() && source.size() <= UINT32_MAX)
+        {
+            std::string baseDir = std::filesystem::path(path).parent_path().string();
+            ret = loader.LoadBinaryFromMemory(&model, &err, &warn, source.data(), static_cast<unsigned int>(source.size()),
+                                              baseDir);
+        }
+        else
+        {
+            ret = loader.LoadBinaryFromFile(&model, &err, &warn, path); // for binary glTF (.glb)
+        }
     }
     else
     {
@@ -63,6 +416,28 @@ void Model::loadModel(const std::string& path)
     if (!ret)
     {
         std::cerr << "Failed to load glTF: " << path << std::endl;
+        return false;
+    }
+
+    // Compressed views are expanded in place, so the accessor readers never see them
+    if (!decodeMeshoptBufferViews(model, pool))
+    {
+        std::cerr << "Failed to decode meshopt buffers: " << path << std::endl;
+        return false;
+    }
+
+    encodedImages.resize(model.images.size());
+    auto decode = [&](size_t i) { decodeImage(model.images[i], encodedImages[i]); };
+    if (pool)
+    {
+        pool->parallelFor(model.images.size(), decode);
+    }
+    else
+    {
+        for (size_t i = 0; i < model.images.size(); ++i)
+        {
+            decode(i);
+        }
     }
 
     // Debug: Check image data
@@ -71,15 +446,7 @@ void Model::loadModel(const std::string& path)
         std::cout << "Image name: " << image.name << ", width: " << image.width << ", height: " << image.height <<
             ", size: " << image.image.size() << std::endl;
     }
-}
-
-GLuint Model::createBuffer(const std::vector<unsigned char>& data, GLenum target)
-{
-    GLuint buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(target, buffer);
-    glBufferData(target, static_cast<GLsizei>(data.size()), data.data(), GL_STATIC_DRAW);
-    return buffer;
+    return true;
 }
 
 void Model::createVAOs()
@@ -89,7 +456,7 @@ void Model::createVAOs()
         const tinygltf::Mesh& mesh = model.meshes[i];
         for (const auto& primitive : mesh.primitives)
         {
-            GLPrimitive glPrimitive;
+            GLPrimitive glPrimitive = {};
             glGenVertexArrays(1, &glPrimitive.vao);
             glBindVertexArray(glPrimitive.vao);
 
@@ -109,15 +476,12 @@ void Model::createVAOs()
                 }
 
                 const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-                if (model.buffers.size() <= bufferView.buffer)
+                GLuint vbo = bufferManager.getBuffer(model, accessor.bufferView);
+                if (vbo == 0)
                 {
-                    std::cerr << "Error: Buffer index out of range: " << bufferView.buffer << std::endl;
                     continue;
                 }
-
-                const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
-
-                GLuint vbo = createBuffer(buffer.data, GL_ARRAY_BUFFER);
+                glBindBuffer(GL_ARRAY_BUFFER, vbo);
                 glPrimitive.vbo = vbo;
 
                 GLuint attribIndex = 0; // Default to 0, change based on attribute name
@@ -141,7 +505,7 @@ void Model::createVAOs()
                     accessor.componentType,
                     accessor.normalized ? GL_TRUE : GL_FALSE,
                     bufferView.byteStride,
-                    reinterpret_cast<const void*>(accessor.byteOffset + bufferView.byteOffset)
+                    reinterpret_cast<const void*>(accessor.byteOffset)
                 );
             }
 
@@ -160,45 +524,398 @@ void Model::createVAOs()
                     continue;
                 }
 
-                const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-                if (model.buffers.size() <= bufferView.buffer)
+                GLuint ebo = bufferManager.getBuffer(model, accessor.bufferView);
+                if (ebo == 0)
                 {
-                    std::cerr << "Error: Buffer index out of range: " << bufferView.buffer << std::endl;
                     continue;
                 }
-
-                const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
-
-                GLuint ebo = createBuffer(buffer.data, GL_ELEMENT_ARRAY_BUFFER);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
                 glPrimitive.ebo = ebo;
                 glPrimitive.indexCount = static_cast<GLsizei>(accessor.count);
+                glPrimitive.indexType = accessor.componentType;
+                glPrimitive.indexOffset = accessor.byteOffset;
             }
             else
             {
+                glPrimitive.ebo = 0;
                 glPrimitive.indexCount = 0;
+                glPrimitive.indexOffset = 0;
             }
+            glPrimitive.bounds = getPositionBounds(model, primitive);
+            glPrimitive.lods[0] = {0, static_cast<uint32_t>(glPrimitive.indexCount), 0.0f};
+            glPrimitive.lodCount = 1;
 
             glBindVertexArray(0);
             primitiveMap[i].push_back(glPrimitive);
         }
     }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    meshCount = static_cast<int>(model.meshes.size());
+
+    std::cout << "Uploaded " << bufferManager.getBytesUploaded() << " bytes of geometry in "
+        << bufferManager.getBufferCount() << " buffers" << std::endl;
+}
+
+void Model::createVAOsFromCache()
+{
+    const MeshCacheHeader& header = cache.getHeader();
+
+    // Geometry is uploaded straight from the mapping; all primitives share one vertex and one index buffer
+    GLuint vbo = bufferManager.createBuffer(cache.getVertexData(), header.vertexDataSize);
+    GLuint ebo = bufferManager.createBuffer(cache.getIndexData(), header.indexDataSize);
+
+    // Quantized vertices; the octahedral normal stays unnormalized so the snorm conversion rule of the GL version doesn't matter
+    const GLsizei stride = sizeof(QuantizedVertex);
+    for (uint32_t i = 0; i < header.primitiveCount; ++i)
+    {
+        const CookedPrimitive& cooked = cache.getPrimitive(i);
+
+        GLPrimitive glPrimitive = {};
+        glGenVertexArrays(1, &glPrimitive.vao);
+        glBindVertexArray(glPrimitive.vao);
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                              reinterpret_cast<const void*>(cooked.vertexOffset + offsetof(QuantizedVertex, position)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, stride,
+                              reinterpret_cast<const void*>(cooked.vertexOffset + offsetof(QuantizedVertex, normal)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                              reinterpret_cast<const void*>(cooked.vertexOffset + offsetof(QuantizedVertex, texCoord)));
+        glPrimitive.dequantization = getDequantization(cooked);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glPrimitive.vbo = vbo;
+        glPrimitive.ebo = ebo;
+        glPrimitive.indexCount = static_cast<GLsizei>(cooked.indexCount);
+        glPrimitive.indexType = cooked.indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        glPrimitive.indexOffset = static_cast<size_t>(cooked.indexOffset);
+        glPrimitive.bounds.min = glm::vec3(cooked.boundsMin[0], cooked.boundsMin[1], cooked.boundsMin[2]);
+        glPrimitive.bounds.max = glm::vec3(cooked.boundsMax[0], cooked.boundsMax[1], cooked.boundsMax[2]);
+        glPrimitive.lodCount = cooked.lodCount;
+        for (uint32_t lod = 0; lod < cooked.lodCount; ++lod)
+        {
+            glPrimitive.lods[lod] = {cooked.lods[lod].firstIndex, cooked.lods[lod].indexCount, cooked.lods[lod].error};
+        }
+
+        glBindVertexArray(0);
+        primitiveMap[cooked.mesh].push_back(glPrimitive);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    meshCount = static_cast<int>(header.meshCount);
+
+    std::cout << "Uploaded " << bufferManager.getBytesUploaded() << " bytes of cooked geometry" << std::endl;
+}
+
+void Model::forEachPrimitive(const std::function<void(const PrimitiveGeometry&)>& visit) const
+{
+    if (loadedFromCache)
+    {
+        const MeshCacheHeader& header = cache.getHeader();
+        std::vector<uint32_t> widened;
+        std::vector<CookedVertex> dequantized;
+        for (uint32_t i = 0; i < header.primitiveCount; ++i)
+        {
+            const CookedPrimitive& cooked = cache.getPrimitive(i);
+            PrimitiveGeometry geometry;
+            geometry.mesh = static_cast<int>(cooked.mesh);
+            geometry.material = cooked.material;
+
+            // Visitors get float vertices, decoded exactly as the vertex shader does
+            const QuantizedVertex* quantized =
+                reinterpret_cast<const QuantizedVertex*>(cache.getVertexData() + cooked.vertexOffset);
+            VertexDequantization dequantization = getDequantization(cooked);
+            dequantized.resize(cooked.vertexCount);
+            for (uint32_t v = 0; v < cooked.vertexCount; ++v)
+            {
+                glm::vec3 position, normal;
+                glm::vec2 texCoord;
+                dequantizeVertex(quantized[v], dequantization, position, normal, texCoord);
+                CookedVertex& vertex = dequantized[v];
+                std::memcpy(vertex.position, &position[0], sizeof(vertex.position));
+                std::memcpy(vertex.normal, &normal[0], sizeof(vertex.normal));
+                std::memcpy(vertex.texCoord, &texCoord[0], sizeof(vertex.texCoord));
+            }
+            geometry.vertices = dequantized.data();
+            geometry.vertexCount = cooked.vertexCount;
+            geometry.indexCount = cooked.indexCount;
+            geometry.bounds.min = glm::vec3(cooked.boundsMin[0], cooked.boundsMin[1], cooked.boundsMin[2]);
+            geometry.bounds.max = glm::vec3(cooked.boundsMax[0], cooked.boundsMax[1], cooked.boundsMax[2]);
+            geometry.lodCount = cooked.lodCount;
+            size_t lodIndexCount = cooked.indexCount;
+            for (uint32_t lod = 0; lod < cooked.lodCount; ++lod)
+            {
+                geometry.lods[lod] = {cooked.lods[lod].firstIndex, cooked.lods[lod].indexCount, cooked.lods[lod].error};
+                lodIndexCount = std::max<size_t>(lodIndexCount, size_t(cooked.lods[lod].firstIndex) + cooked.lods[lod].indexCount);
+            }
+
+            // Visitors always see 32-bit indices; 16-bit primitives are widened for the visit
+            const unsigned char* indexData = cache.getIndexData() + cooked.indexOffset;
+            if (cooked.indexSize == sizeof(uint16_t))
+            {
+                const uint16_t* shortIndices = reinterpret_cast<const uint16_t*>(indexData);
+                widened.assign(shortIndices, shortIndices + lodIndexCount);
+                geometry.indices = widened.data();
+            }
+            else
+            {
+                geometry.indices = reinterpret_cast<const uint32_t*>(indexData);
+            }
+            visit(geometry);
+        }
+        return;
+    }
+
+    std::vector<CookedVertex> vertices;
+    std::vector<uint32_t> indices;
+    for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx)
+    {
+        for (const auto& primitive : model.meshes[meshIdx].primitives)
+        {
+            if (!cookPrimitive(model, primitive, vertices, indices))
+            {
+                continue;
+            }
+
+            PrimitiveGeometry geometry;
+            geometry.mesh = static_cast<int>(meshIdx);
+            geometry.material = primitive.material;
+            geometry.vertices = vertices.data();
+            geometry.vertexCount = vertices.size();
+            geometry.indices = indices.data();
+            geometry.indexCount = indices.size();
+            geometry.bounds = getPositionBounds(model, primitive);
+            geometry.lods[0] = {0, static_cast<uint32_t>(indices.size()), 0.0f};
+            geometry.lodCount = 1;
+            visit(geometry);
+        }
+    }
+}
+
+int Model::getTextureCount() const
+{
+    return loadedFromCache ? static_cast<int>(cache.getHeader().textureCount) : static_cast<int>(model.textures.size());
+}
+
+TextureRegistry::Handle Model::loadTextureFromModel(int textureIndex, TextureRegistry& registry,
+                                                    TextureStreamer* streamer)
+{
+    if (textureIndex < 0 || textureIndex >= getTextureCount())
+    {
+        std::cerr << "Error: Texture index out of range: " << textureIndex << std::endl;
+        return nullptr;
+    }
+
+    int width = 0, height = 0, component = 0;
+    const unsigned char* pixels = nullptr;
+    TextureKey key;
+    key.asset = sourcePath;
+
+    if (loadedFromCache)
+    {
+        const CookedTexture& texture = cache.getTexture(textureIndex);
+        if (texture.image < 0 || texture.image >= static_cast<int>(cache.getHeader().imageCount))
+        {
+            std::cerr << "Error: Image index out of range: " << texture.image << std::endl;
+            return nullptr;
+        }
+
+        const CookedImage& image = cache.getImage(texture.image);
+        if (image.width <= 0 || image.height <= 0 || image.pixelSize == 0)
+        {
+            std::cerr << "Error: Cooked image " << texture.image << " is invalid" << std::endl;
+            return nullptr;
+        }
+        key.image = texture.image;
+        key.sampler = texture.sampler;
+        key.format = image.format;
+
+        // Cooked images carry their final format and mip chain; streamed levels are read from the mapping
+        TextureRegistry::Handle handle = registry.acquire(key, [&]()
+        {
+            TextureUpload upload;
+            if (streamer)
+            {
+                StreamedImage streamed;
+                streamed.format = image.format;
+                streamed.width = image.width;
+                streamed.height = image.height;
+                streamed.levelCount = image.levelCount;
+                streamed.pixels = cache.getImagePixels(image);
+                upload.id = streamer->createTexture(std::move(streamed));
+                upload.bytes = streamer->getResidentBytes(upload.id);
+            }
+            else
+            {
+                upload.id = createTexture(image.format, image.width, image.height, image.levelCount,
+                                          cache.getImagePixels(image));
+                upload.bytes = upload.id != 0 ? static_cast<size_t>(image.pixelSize) : 0;
+            }
+            return upload;
+        });
+        if (streamer)
+        {
+            streamer->track(handle, registry);
+        }
+        return handle;
+    }
+    else
+    {
+        const tinygltf::Texture& texture = model.textures[textureIndex];
+        if (texture.source < 0 || texture.source >= model.images.size())
+        {
+            std::cerr << "Error: Image index out of range: " << texture.source << std::endl;
+            return nullptr;
+        }
+
+        const tinygltf::Image& image = model.images[texture.source];
+        if (image.width <= 0 || image.height <= 0 || image.image.empty())
+        {
+            std::cerr << "Error: Image " << texture.source << " is invalid" << std::endl;
+            return nullptr;
+        }
+        key.image = texture.source;
+        key.sampler = texture.sampler;
+
+        TextureImage ktx;
+        if (isKtx2(image.image.data(), image.image.size()) && parseKtx2(image.image.data(), image.image.size(), ktx))
+        {
+            key.format = ktx.format;
+            TextureRegistry::Handle handle = registry.acquire(key, [&]()
+            {
+                TextureUpload upload;
+                if (streamer)
+                {
+                    // The parsed chain is a temporary, so the streamer takes it over
+                    StreamedImage streamed;
+                    streamed.format = ktx.format;
+                    streamed.width = ktx.width;
+                    streamed.height = ktx.height;
+                    streamed.levelCount = ktx.levelCount;
+                    streamed.storage = std::move(ktx.data);
+                    upload.id = streamer->createTexture(std::move(streamed));
+                    upload.bytes = streamer->getResidentBytes(upload.id);
+                }
+                else
+                {
+                    upload.id = createTexture(ktx.format, ktx.width, ktx.height, ktx.levelCount, ktx.data.data());
+                    upload.bytes = upload.id != 0 ? ktx.data.size() : 0;
+                }
+                return upload;
+            });
+            if (streamer)
+            {
+                streamer->track(handle, registry);
+            }
+            return handle;
+        }
+        width = image.width;
+        height = image.height;
+        component = image.component;
+        pixels = image.image.data();
+    }
+    key.format = component == 3 ? GL_RGB8 : GL_RGBA8;
+
+    return registry.acquire(key, [&]()
+    {
+        TextureUpload upload;
+        upload.id = createTexture(width, height, component, pixels);
+        upload.bytes = upload.id != 0 ? estimateTextureBytes(width, height, true) : 0;
+        return upload;
+    });
+}
+
+int Model::getBaseColorTexture(int material) const
+{
+    if (loadedFromCache)
+    {
+        if (material < 0 || material >= static_cast<int>(cache.getHeader().materialCount))
+        {
+            return -1;
+        }
+        return cache.getMaterial(material).baseColorTexture;
+    }
+
+    if (material < 0 || material >= static_cast<int>(model.materials.size()))
+    {
+        return -1;
+    }
+    return model.materials[material].pbrMetallicRoughness.baseColorTexture.index;
 }
 
-GLuint Model::loadTextureFromModel(int textureIndex)
+bool Model::getTexturePixels(int textureIndex, ImageData& result) const
 {
-    if (textureIndex < 0 || textureIndex >= model.textures.size())
+    if (textureIndex < 0 || textureIndex >= getTextureCount())
     {
         std::cerr << "Error: Texture index out of range: " << textureIndex << std::endl;
-        return 0;
+        return false;
     }
 
-    const tinygltf::Texture& texture = model.textures[textureIndex];
-    if (texture.source < 0 || texture.source >= model.images.size())
+    TextureImage image;
+    if (loadedFromCache)
+    {
+        const CookedTexture& texture = cache.getTexture(textureIndex);
+        if (texture.image < 0 || texture.image >= static_cast<int>(cache.getHeader().imageCount))
+        {
+            std::cerr << "Error: Image index out of range: " << texture.image << std::endl;
+            return false;
+        }
+
+        const CookedImage& cooked = cache.getImage(texture.image);
+        if (cooked.width <= 0 || cooked.height <= 0 || cooked.pixelSize == 0)
+        {
+            std::cerr << "Error: Cooked image " << texture.image << " is invalid" << std::endl;
+            return false;
+        }
+        image.format = cooked.format;
+        image.width = cooked.width;
+        image.height = cooked.height;
+        image.levelCount = 1;
+        const unsigned char* pixels = cache.getImagePixels(cooked);
+        image.data.assign(pixels, pixels + getLevelSize(cooked.format, cooked.width, cooked.height));
+    }
+    else
     {
-        std::cerr << "Error: Image index out of range: " << texture.source << std::endl;
-        return 0;
+        const tinygltf::Texture& texture = model.textures[textureIndex];
+        if (texture.source < 0 || texture.source >= model.images.size())
+        {
+            std::cerr << "Error: Image index out of range: " << texture.source << std::endl;
+            return false;
+        }
+
+        const tinygltf::Image& source = model.images[texture.source];
+        if (source.width <= 0 || source.height <= 0 || source.image.empty())
+        {
+            std::cerr << "Error: Image " << texture.source << " is invalid" << std::endl;
+            return false;
+        }
+
+        if (!isKtx2(source.image.data(), source.image.size()))
+        {
+            result.width = source.width;
+            result.height = source.height;
+            result.component = source.component;
+            result.pixels = source.image;
+            return true;
+        }
+        if (!parseKtx2(source.image.data(), source.image.size(), image))
+        {
+            return false;
+        }
     }
 
-    const tinygltf::Image& image = model.images[texture.source];
-    return createTexture(image);
+    std::vector<unsigned char> rgba;
+    if (!decompressTexture(image, rgba))
+    {
+        std::cerr << "Cannot decode texture format 0x" << std::hex << image.format << std::dec
+            << " on the CPU" << std::endl;
+        return false;
+    }
+    result.width = image.width;
+    result.height = image.height;
+    result.component = 4;
+    result.pixels.swap(rgba);
+    return true;
 }
@@ -3,33 +3,128 @@
 
 #include <tiny_gltf.h>
 #include <GL/glew.h>
+#include "BufferManager.h"
+#include "MeshCache.h"
+#include "TextureRegistry.h"
+#include "SceneGraph.h"
+#include "Culling.h"
+#include "MeshLod.h"
+#include "Texture.h"
+#include "Shader.h"
+#include <functional>
 #include <unordered_map>
 #include <vector>
 #include <string>
 
+class TextureStreamer;
+class ThreadPool;
+
 struct GLPrimitive
 {
     GLuint vao;
     GLuint vbo;
     GLuint ebo;
     GLsizei indexCount;
+    GLenum indexType;
+    size_t indexOffset;
+    Aabb bounds; // object space, from the POSITION accessor min/max
+    MeshLod lods[MAX_MESH_LODS]; // only cooked primitives have more than LOD 0
+    uint32_t lodCount;
+    VertexDequantization dequantization; // identity for float vertices from the glTF buffers
+};
+
+// CPU view of one primitive as float vertices (cached ones dequantized); only valid during the visit
+struct PrimitiveGeometry
+{
+    int mesh;
+    int material;
+    const CookedVertex* vertices;
+    size_t vertexCount;
+    const uint32_t* indices;
+    size_t indexCount; // LOD 0
+    Aabb bounds;
+    MeshLod lods[MAX_MESH_LODS]; // firstIndex is relative to `indices`
+    uint32_t lodCount;
 };
 
 class Model
 {
 public:
+    Model() = default;
     Model(const std::string& path);
-    void draw(GLuint shaderProgram);
 
-    tinygltf::Model model; // Make model public for easier access
+    // Loading is split so the parse/decode half can run off the render thread
+    bool load(const std::string& path, ThreadPool* pool = nullptr); // no GL calls
+    void upload();                                                  // GL thread only
+    void release();
+    bool isReady() const { return ready; }
+
+    // Once everything that reads the geometry on the CPU after upload() has run: the cooked
+    // vertex and index pages leave the working set (they stay mapped and page back in if read)
+    void releaseCpuGeometry();
+
+    // Draws every mesh-carrying scene node with its world matrix in the "model" uniform.
+    // With a frustum, primitives whose world bounds are outside it are skipped.
+    // With a LOD selector, each primitive draws the coarsest LOD within its pixel error.
+    void draw(const Shader& shader, const Frustum* frustum = nullptr, const LodSelector* lodSelector = nullptr);
+    const CullStats& getCullStats() const { return cullStats; }
+    const LodStats& getLodStats() const { return lodStats; }
+
+    SceneGraph& getSceneGraph() { return sceneGraph; }
+    const SceneGraph& getSceneGraph() const { return sceneGraph; }
+
+    // Visits every primitive in mesh order, for renderers that repack the geometry
+    void forEachPrimitive(const std::function<void(const PrimitiveGeometry&)>& visit) const;
+    int getMeshCount() const { return meshCount; }
+
+    int getTextureCount() const;
+    // With a streamer, precomputed mip chains are created with their tail and stream in the rest
+    TextureRegistry::Handle loadTextureFromModel(int textureIndex, TextureRegistry& registry,
+                                                 TextureStreamer* streamer = nullptr);
+
+    // CPU-side texture access for renderers without a GL context
+    int getBaseColorTexture(int material) const; // -1 when the material has none
+    bool getTexturePixels(int textureIndex, ImageData& image) const; // level 0 decoded to RGBA8 or RGB8
+
+    // Off by default only for CPU rendering: any cached texture format is accepted, since
+    // without a context nothing is sampled by GL and a shared cache should not be re-cooked
+    void setRequireGpuTextureFormats(bool require) { requireGpuTextureFormats = require; }
+
+    tinygltf::Model model; // Make model public for easier access (empty when loaded from the mesh cache)
 
 private:
     std::unordered_map<int, std::vector<GLPrimitive>> primitiveMap;
+    BufferManager bufferManager;
+    MeshCache cache;
+    SceneGraph sceneGraph;
+    std::string sourcePath;
+    bool loadedFromCache = false;
+    bool ready = false;
+    bool requireGpuTextureFormats = true;
+    int meshCount = 0;
+
+    // One draw item per primitive of every drawable node, culled through a BVH over world bounds
+    struct DrawItem
+    {
+        int node; // -1 when the model has no scene graph
+        const GLPrimitive* primitive;
+    };
+    std::vector<DrawItem> drawItems;
+    std::vector<Aabb> drawBounds;
+    std::vector<uint32_t> visibleItems;
+    CullingBvh cullingBvh;
+    uint64_t boundsVersion = 0;
+    CullStats cullStats;
+    LodStats lodStats;
+    CachedUniform<glm::mat4> modelUniform{"model"};
 
-    void loadModel(const std::string& path);
-    GLuint createBuffer(const std::vector<unsigned char>& data, GLenum target);
+    bool loadModel(const std::string& path, const MappedFile& source, ThreadPool* pool);
     void createVAOs();
-    GLuint loadTextureFromModel(int textureIndex);
+    void createVAOsFromCache();
+    void buildSceneGraph();
+    void buildDrawItems();
+    void updateDrawBounds();
+    void drawPrimitive(const GLPrimitive& glPrimitive, uint32_t lod);
 };
 
 #endif
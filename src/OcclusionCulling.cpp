@@ -0,0 +1,267 @@
+﻿#include "OcclusionCulling.h"
+#include "BatchRenderer.h"
+#include "Profiler.h"
+#include "RenderTargetPool.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+    const GLuint CULL_GROUP_SIZE = 64;   // local_size_x of occlusion_cull.comp
+    const GLuint REDUCE_GROUP_SIZE = 8;  // local_size_x/y of hiz_reduce.comp
+    const size_t COUNTER_COUNT = 4;      // tested, occluded, late, padding
+
+    int getLevelCount(int width, int height)
+    {
+        int levels = 1;
+        while (width > 1 || height > 1)
+        {
+            width = std::max(1, (width + 1) / 2);
+            height = std::max(1, (height + 1) / 2);
+            ++levels;
+        }
+        return levels;
+    }
+}
+
+bool OcclusionCuller::isSupported()
+{
+    return GLEW_VERSION_4_3 != 0;
+}
+
+OcclusionCuller::OcclusionCuller()
+    : reduceShader("shaders/hiz_reduce.comp"), cullShader("shaders/occlusion_cull.comp")
+{
+    glGenBuffers(1, &counterBuffer);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+    glBufferData(GL_ATOMIC_COUNTER_BUFFER, COUNTER_COUNT * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    glGenBuffers(1, &readbackBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, COUNTER_COUNT * sizeof(GLuint), nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    releaseDrawBuffers();
+    glDeleteBuffers(1, &counterBuffer);
+    glDeleteBuffers(1, &readbackBuffer);
+    if (readbackFence)
+    {
+        glDeleteSync(readbackFence);
+    }
+    glDeleteTextures(1, &pyramidTexture);
+    reduceShader.release();
+    cullShader.release();
+}
+
+void OcclusionCuller::setDrawBounds(const std::vector<Aabb>& bounds)
+{
+    if (bounds.size() != drawCount)
+    {
+        releaseDrawBuffers();
+        drawCount = bounds.size();
+        if (drawCount == 0)
+        {
+            return;
+        }
+
+        glGenBuffers(1, &boundsBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawCount * 2 * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+
+        std::vector<GLuint> visible(drawCount, 1);
+        glGenBuffers(1, &visibilityBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawCount * sizeof(GLuint), visible.data(), GL_DYNAMIC_COPY);
+
+        GLuint commandBuffers[2];
+        glGenBuffers(2, commandBuffers);
+        earlyCommandBuffer = commandBuffers[0];
+        lateCommandBuffer = commandBuffers[1];
+        for (GLuint buffer : commandBuffers)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, drawCount * sizeof(DrawElementsIndirectCommand), nullptr,
+                         GL_DYNAMIC_COPY);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    if (drawCount == 0)
+    {
+        return;
+    }
+
+    // Boxes without geometry reach behind the camera, which the test treats as visible
+    stagingBounds.resize(drawCount * 2);
+    for (size_t i = 0; i < drawCount; ++i)
+    {
+        bool valid = bounds[i].isValid();
+        stagingBounds[i * 2] = glm::vec4(valid ? bounds[i].min : glm::vec3(-1e30f), 1.0f);
+        stagingBounds[i * 2 + 1] = glm::vec4(valid ? bounds[i].max : glm::vec3(1e30f), 1.0f);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, stagingBounds.size() * sizeof(glm::vec4), stagingBounds.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, stagingBounds.size() * sizeof(glm::vec4));
+}
+
+void OcclusionCuller::setView(const glm::mat4& viewProjectionMatrix, GLuint depth, int width, int height)
+{
+    viewProjection = viewProjectionMatrix;
+    depthTexture = depth;
+    viewportWidth = std::max(width, 1);
+    viewportHeight = std::max(height, 1);
+}
+
+GLuint OcclusionCuller::cullEarly(GLuint candidateBuffer)
+{
+    PROFILE_ZONE("OcclusionCuller::cullEarly");
+    PROFILE_GPU_ZONE("OcclusionCuller::cullEarly");
+    readStats();
+
+    // The counters of the last readback were copied before this clear in command order
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+    glClearBufferData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    dispatchCull(candidateBuffer, earlyCommandBuffer, false);
+    return earlyCommandBuffer;
+}
+
+GLuint OcclusionCuller::cullLate(GLuint candidateBuffer)
+{
+    PROFILE_ZONE("OcclusionCuller::cullLate");
+    PROFILE_GPU_ZONE("OcclusionCuller::cullLate");
+    buildPyramid();
+    dispatchCull(candidateBuffer, lateCommandBuffer, true);
+
+    // One readback in flight at a time; frames in between simply aren't counted
+    if (!readbackFence)
+    {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, COUNTER_COUNT * sizeof(GLuint));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    return lateCommandBuffer;
+}
+
+void OcclusionCuller::buildPyramid()
+{
+    // Storage follows the render target buckets, so dynamic resolution steps reuse it
+    int bucketWidth = (viewportWidth + RENDER_TARGET_BUCKET - 1) / RENDER_TARGET_BUCKET * RENDER_TARGET_BUCKET;
+    int bucketHeight = (viewportHeight + RENDER_TARGET_BUCKET - 1) / RENDER_TARGET_BUCKET * RENDER_TARGET_BUCKET;
+    int storageWidth = (bucketWidth + 1) / 2;
+    int storageHeight = (bucketHeight + 1) / 2;
+    if (storageWidth != pyramidWidth || storageHeight != pyramidHeight)
+    {
+        glDeleteTextures(1, &pyramidTexture);
+        glGenTextures(1, &pyramidTexture);
+        glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+        glTexStorage2D(GL_TEXTURE_2D, getLevelCount(storageWidth, storageHeight), GL_R32F, storageWidth, storageHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        pyramidWidth = storageWidth;
+        pyramidHeight = storageHeight;
+    }
+
+    // Levels round up, so level n covers ceil(viewport / 2^(n + 1)) texels
+    int levelWidth = (viewportWidth + 1) / 2;
+    int levelHeight = (viewportHeight + 1) / 2;
+    pyramidLevels = getLevelCount(levelWidth, levelHeight);
+
+    reduceShader.use();
+    reduceShader.setInt("source", DEPTH_PYRAMID_TEXTURE_UNIT);
+    UniformHandle<int> sourceLevel = reduceShader.getUniform<int>("sourceLevel");
+    UniformHandle<glm::vec2> sourceSize = reduceShader.getUniform<glm::vec2>("sourceSize");
+    UniformHandle<glm::vec2> destinationSize = reduceShader.getUniform<glm::vec2>("destinationSize");
+    glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_TEXTURE_UNIT);
+
+    int sourceWidth = viewportWidth;
+    int sourceHeight = viewportHeight;
+    for (int level = 0; level < pyramidLevels; ++level)
+    {
+        // Level 0 reads the depth attachment; the others read the level below them
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+        reduceShader.set(sourceLevel, level == 0 ? 0 : level - 1);
+        reduceShader.set(sourceSize, glm::vec2(sourceWidth, sourceHeight));
+        reduceShader.set(destinationSize, glm::vec2(levelWidth, levelHeight));
+        glBindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((levelWidth + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE,
+                          (levelHeight + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        sourceWidth = levelWidth;
+        sourceHeight = levelHeight;
+        levelWidth = std::max(1, (levelWidth + 1) / 2);
+        levelHeight = std::max(1, (levelHeight + 1) / 2);
+    }
+    glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void OcclusionCuller::dispatchCull(GLuint candidateBuffer, GLuint commandBuffer, bool latePhase)
+{
+    cullShader.use();
+    cullShader.setInt("drawCount", static_cast<int>(drawCount));
+    cullShader.setBool("latePhase", latePhase);
+    if (latePhase)
+    {
+        cullShader.setMat4("viewProjection", viewProjection);
+        cullShader.set(cullShader.getUniform<glm::vec2>("viewportSize"), glm::vec2(viewportWidth, viewportHeight));
+        cullShader.setInt("pyramidLevels", pyramidLevels);
+        cullShader.setInt("depthPyramid", DEPTH_PYRAMID_TEXTURE_UNIT);
+        glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_BOUNDS_BINDING, boundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_VISIBILITY_BINDING, visibilityBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_CANDIDATE_BINDING, candidateBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_COMMAND_BINDING, commandBuffer);
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, OCCLUSION_COUNTER_BINDING, counterBuffer);
+    glDispatchCompute(static_cast<GLuint>((drawCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+
+    // The commands feed the next multi-draw, the visibility flags the next dispatch
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void OcclusionCuller::readStats()
+{
+    if (!readbackFence)
+    {
+        return;
+    }
+    GLenum result = glClientWaitSync(readbackFence, 0, 0);
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+    {
+        return;
+    }
+    glDeleteSync(readbackFence);
+    readbackFence = nullptr;
+
+    GLuint counters[COUNTER_COUNT] = {};
+    glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counters), counters);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    stats.tested = counters[0];
+    stats.occluded = counters[1];
+    stats.lateDraws = counters[2];
+}
+
+void OcclusionCuller::releaseDrawBuffers()
+{
+    GLuint buffers[] = { boundsBuffer, visibilityBuffer, earlyCommandBuffer, lateCommandBuffer };
+    glDeleteBuffers(4, buffers);
+    boundsBuffer = visibilityBuffer = earlyCommandBuffer = lateCommandBuffer = 0;
+    drawCount = 0;
+}
@@ -0,0 +1,90 @@
+﻿#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+#include "Culling.h"
+#include "Shader.h"
+
+// Shader storage bindings of occlusion_cull.comp. The scene's buffers stay bound at 2-5
+// between the two draw phases, so the culling passes keep clear of them.
+const GLuint OCCLUSION_BOUNDS_BINDING = 0;
+const GLuint OCCLUSION_VISIBILITY_BINDING = 1;
+const GLuint OCCLUSION_CANDIDATE_BINDING = 6;
+const GLuint OCCLUSION_COMMAND_BINDING = 7;
+const GLuint OCCLUSION_COUNTER_BINDING = 0; // atomic counter buffer
+const GLuint DEPTH_PYRAMID_TEXTURE_UNIT = 6;
+
+// Counted on the GPU and read back a frame or two later
+struct OcclusionStats
+{
+    size_t tested = 0;    // draws that reached the depth test (inside the frustum)
+    size_t occluded = 0;  // of those, hidden behind the depth pyramid
+    size_t lateDraws = 0; // drawn in the second phase: visible now but not last frame
+};
+
+// Two-phase GPU occlusion culling for the batched multi-draw path. The draws that
+// were visible last frame go first; their depth is reduced into a max-depth mip
+// pyramid (Hi-Z), every candidate's world bounds are tested against the level where
+// they cover at most 2x2 texels, and the draws that turn out visible but were
+// skipped go out in a second multi-draw. Both command lists are written by compute
+// shaders, so the CPU never waits on a result. Needs GL 4.3.
+class OcclusionCuller
+{
+public:
+    static bool isSupported();
+
+    OcclusionCuller();
+    ~OcclusionCuller();
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // World bounds per draw. A new draw count marks every draw visible, so the first frame draws everything early.
+    void setDrawBounds(const std::vector<Aabb>& bounds);
+    size_t getDrawCount() const { return drawCount; }
+
+    // Camera and depth attachment of the pass about to draw; the depth covers (0, 0) to width x height
+    void setView(const glm::mat4& viewProjection, GLuint depthTexture, int width, int height);
+
+    // Both return an indirect buffer of getDrawCount() commands made from `candidateBuffer`,
+    // the CPU-culled commands with an instance count of zero for culled draws
+    GLuint cullEarly(GLuint candidateBuffer); // the candidates that were visible last frame
+    GLuint cullLate(GLuint candidateBuffer);  // after the early draws: the candidates visible only now
+
+    const OcclusionStats& getStats() const { return stats; }
+    int getPyramidLevels() const { return pyramidLevels; }
+
+private:
+    Shader reduceShader;
+    Shader cullShader;
+
+    size_t drawCount = 0;
+    GLuint boundsBuffer = 0;
+    GLuint visibilityBuffer = 0;
+    GLuint earlyCommandBuffer = 0;
+    GLuint lateCommandBuffer = 0;
+    GLuint counterBuffer = 0;
+    GLuint readbackBuffer = 0;
+    GLsync readbackFence = nullptr;
+    std::vector<glm::vec4> stagingBounds;
+
+    GLuint pyramidTexture = 0;
+    int pyramidWidth = 0; // level 0 storage, half a render target bucket
+    int pyramidHeight = 0;
+    int pyramidLevels = 0; // levels in use for the current viewport
+
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    GLuint depthTexture = 0;
+    int viewportWidth = 0;
+    int viewportHeight = 0;
+    OcclusionStats stats;
+
+    void buildPyramid();
+    void dispatchCull(GLuint candidateBuffer, GLuint commandBuffer, bool latePhase);
+    void readStats();
+    void releaseDrawBuffers();
+};
+
+#endif
@@ -0,0 +1,747 @@
+﻿#include "PathTracer.h"
+#include "Model.h"
+#include "ThreadPool.h"
+#include "TriangleBvh.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PATH_TRACER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const int TILE_SIZE = 16;
+    const uint32_t MAX_LEAF_TRIANGLES = 4; // one TriangleBlock
+    const int STACK_SIZE = 256;
+    const float RAY_OFFSET = 1e-4f;
+    const float PI = 3.14159265358979f;
+    const glm::vec3 CLEAR_COLOR(0.53f, 0.81f, 0.98f); // the rasterizer's background
+
+    float getSurfaceArea(const BvhNode& node)
+    {
+        glm::vec3 size(node.max[0] - node.min[0], node.max[1] - node.min[1], node.max[2] - node.min[2]);
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    // PCG hash step; state advances per call, floats are in [0, 1)
+    struct Random
+    {
+        uint32_t state;
+
+        float next()
+        {
+            state = state * 747796405u + 2891336453u;
+            uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            word = (word >> 22u) ^ word;
+            return (word >> 8) * (1.0f / 16777216.0f);
+        }
+    };
+
+    uint32_t hashSeed(uint32_t value)
+    {
+        value ^= value >> 16;
+        value *= 0x7feb352du;
+        value ^= value >> 15;
+        value *= 0x846ca68bu;
+        value ^= value >> 16;
+        return value;
+    }
+
+    glm::vec3 sampleCosineHemisphere(const glm::vec3& normal, float u1, float u2)
+    {
+        glm::vec3 tangent = std::fabs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        tangent = glm::normalize(glm::cross(tangent, normal));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+        float radius = std::sqrt(u1);
+        float angle = 2.0f * PI * u2;
+        return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) +
+            normal * std::sqrt(std::max(0.0f, 1.0f - u1));
+    }
+
+    glm::vec3 fetchTexel(const ImageData& image, int x, int y)
+    {
+        const unsigned char* texel = &image.pixels[(static_cast<size_t>(y) * image.width + x) * image.component];
+        if (image.component < 3)
+        {
+            return glm::vec3(texel[0] / 255.0f);
+        }
+        return glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+    }
+
+    // Bilinear with GL_REPEAT wrapping, like the rasterizer's samplers
+    glm::vec3 sampleTexture(const ImageData& image, const glm::vec2& texCoord)
+    {
+        float x = (texCoord.x - std::floor(texCoord.x)) * image.width - 0.5f;
+        float y = (texCoord.y - std::floor(texCoord.y)) * image.height - 0.5f;
+        float fx = std::floor(x), fy = std::floor(y);
+        float tx = x - fx, ty = y - fy;
+        int x0 = (static_cast<int>(fx) + image.width) % image.width;
+        int y0 = (static_cast<int>(fy) + image.height) % image.height;
+        int x1 = (x0 + 1) % image.width;
+        int y1 = (y0 + 1) % image.height;
+        glm::vec3 top = fetchTexel(image, x0, y0) * (1.0f - tx) + fetchTexel(image, x1, y0) * tx;
+        glm::vec3 bottom = fetchTexel(image, x0, y1) * (1.0f - tx) + fetchTexel(image, x1, y1) * tx;
+        return top * (1.0f - ty) + bottom * ty;
+    }
+}
+
+bool PathTracer::build(const Model& model, ThreadPool* pool)
+{
+    PROFILE_ZONE("PathTracer::build");
+    auto start = std::chrono::steady_clock::now();
+    nodes.clear();
+    blocks.clear();
+    shading.clear();
+    textures.clear();
+
+    // Cooked geometry per mesh, instanced below with the world matrix of every node that uses it
+    struct MeshPart
+    {
+        std::vector<CookedVertex> vertices;
+        std::vector<uint32_t> indices;
+        int texture;
+    };
+    std::vector<std::vector<MeshPart>> meshes;
+    std::unordered_map<int, int> textureSlots;
+    model.forEachPrimitive([&](const PrimitiveGeometry& geometry)
+    {
+        if (geometry.mesh >= static_cast<int>(meshes.size()))
+        {
+            meshes.resize(geometry.mesh + 1);
+        }
+
+        MeshPart part;
+        part.vertices.assign(geometry.vertices, geometry.vertices + geometry.vertexCount);
+        part.indices.assign(geometry.indices, geometry.indices + geometry.indexCount);
+        part.texture = -1;
+        int textureIndex = model.getBaseColorTexture(geometry.material);
+        if (textureIndex >= 0)
+        {
+            auto slot = textureSlots.find(textureIndex);
+            if (slot == textureSlots.end())
+            {
+                ImageData image;
+                int loaded = model.getTexturePixels(textureIndex, image) ? static_cast<int>(textures.size()) : -1;
+                if (loaded >= 0)
+                {
+                    textures.push_back(std::move(image));
+                }
+                slot = textureSlots.emplace(textureIndex, loaded).first;
+            }
+            part.texture = slot->second;
+        }
+        meshes[geometry.mesh].push_back(std::move(part));
+    });
+
+    std::vector<glm::vec3> positions;
+    auto addInstance = [&](int mesh, const glm::mat4& world)
+    {
+        if (mesh < 0 || mesh >= static_cast<int>(meshes.size()))
+        {
+            return;
+        }
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+        for (const MeshPart& part : meshes[mesh])
+        {
+            for (size_t i = 0; i + 2 < part.indices.size(); i += 3)
+            {
+                TriangleShading triangleShading;
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    const CookedVertex& vertex = part.vertices[part.indices[i + corner]];
+                    glm::vec3 position(vertex.position[0], vertex.position[1], vertex.position[2]);
+                    glm::vec3 normal(vertex.normal[0], vertex.normal[1], vertex.normal[2]);
+                    positions.push_back(glm::vec3(world * glm::vec4(position, 1.0f)));
+                    triangleShading.normals[corner] = normalMatrix * normal;
+                    triangleShading.texCoords[corner] = glm::vec2(vertex.texCoord[0], vertex.texCoord[1]);
+                }
+                triangleShading.texture = part.texture;
+                shading.push_back(triangleShading);
+            }
+        }
+    };
+
+    const SceneGraph& sceneGraph = model.getSceneGraph();
+    if (sceneGraph.getNodeCount() == 0)
+    {
+        for (int mesh = 0; mesh < static_cast<int>(meshes.size()); ++mesh)
+        {
+            addInstance(mesh, glm::mat4(1.0f));
+        }
+    }
+    else
+    {
+        for (int node : sceneGraph.getDrawableNodes())
+        {
+            addInstance(sceneGraph.getMesh(node), sceneGraph.getWorldMatrix(node));
+        }
+    }
+
+    if (shading.empty())
+    {
+        std::cerr << "Path tracer: the model has no triangles" << std::endl;
+        return false;
+    }
+
+    // Collapse the binary tree by repeatedly opening the child with the largest surface area until
+    // four slots are filled; binary leaves become triangle blocks
+    TriangleBvh bvh;
+    bvh.build(positions, pool, MAX_LEAF_TRIANGLES);
+    const std::vector<BvhNode>& binaryNodes = bvh.getNodes();
+    const std::vector<uint32_t>& order = bvh.getTriangleOrder();
+    std::vector<std::pair<uint32_t, size_t>> pending = {{0, 0}};
+    nodes.emplace_back();
+    while (!pending.empty())
+    {
+        uint32_t binaryIndex = pending.back().first;
+        size_t nodeIndex = pending.back().second;
+        pending.pop_back();
+
+        uint32_t children[4];
+        uint32_t childCount = 0;
+        if (binaryNodes[binaryIndex].count > 0)
+        {
+            children[childCount++] = binaryIndex;
+        }
+        else
+        {
+            children[childCount++] = binaryIndex + 1;
+            children[childCount++] = binaryNodes[binaryIndex].leftFirst;
+        }
+        while (childCount < 4)
+        {
+            int widest = -1;
+            float widestArea = -1.0f;
+            for (uint32_t i = 0; i < childCount; ++i)
+            {
+                const BvhNode& child = binaryNodes[children[i]];
+                float area = getSurfaceArea(child);
+                if (child.count == 0 && area > widestArea)
+                {
+                    widest = static_cast<int>(i);
+                    widestArea = area;
+                }
+            }
+            if (widest < 0)
+            {
+                break;
+            }
+            uint32_t opened = children[widest];
+            children[widest] = opened + 1;
+            children[childCount++] = binaryNodes[opened].leftFirst;
+        }
+
+        Node node = {};
+        node.childCount = childCount;
+        for (uint32_t i = 0; i < childCount; ++i)
+        {
+            const BvhNode& child = binaryNodes[children[i]];
+            node.minX[i] = child.min[0];
+            node.minY[i] = child.min[1];
+            node.minZ[i] = child.min[2];
+            node.maxX[i] = child.max[0];
+            node.maxY[i] = child.max[1];
+            node.maxZ[i] = child.max[2];
+
+            if (child.count == 0)
+            {
+                node.children[i] = static_cast<int32_t>(nodes.size());
+                pending.push_back({children[i], nodes.size()});
+                nodes.emplace_back();
+                continue;
+            }
+
+            TriangleBlock block = {};
+            for (uint32_t lane = 0; lane < 4; ++lane)
+            {
+                block.triangles[lane] = ~0u;
+                if (lane >= child.count)
+                {
+                    continue;
+                }
+                uint32_t triangleIndex = order[child.leftFirst + lane];
+                const glm::vec3* vertices = &positions[static_cast<size_t>(triangleIndex) * 3];
+                glm::vec3 edge1 = vertices[1] - vertices[0];
+                glm::vec3 edge2 = vertices[2] - vertices[0];
+                block.v0x[lane] = vertices[0].x;
+                block.v0y[lane] = vertices[0].y;
+                block.v0z[lane] = vertices[0].z;
+                block.e1x[lane] = edge1.x;
+                block.e1y[lane] = edge1.y;
+                block.e1z[lane] = edge1.z;
+                block.e2x[lane] = edge2.x;
+                block.e2y[lane] = edge2.y;
+                block.e2z[lane] = edge2.z;
+                block.triangles[lane] = triangleIndex;
+            }
+            node.children[i] = ~static_cast<int32_t>(blocks.size());
+            blocks.push_back(block);
+        }
+        nodes[nodeIndex] = node;
+    }
+
+    std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - start;
+    stats.triangles = shading.size();
+    stats.nodes = nodes.size();
+    stats.buildMilliseconds = buildTime.count();
+    std::cout << "Path tracer BVH: " << stats.triangles << " triangles, " << stats.nodes << " nodes, "
+        << blocks.size() << " leaves in " << stats.buildMilliseconds << " ms" << std::endl;
+
+    resetAccumulation();
+    return true;
+}
+
+bool PathTracer::loadEnvironment(const std::vector<std::string>& faces)
+{
+    environment.clear();
+    std::vector<ImageData> images(faces.size());
+    for (size_t i = 0; i < faces.size(); ++i)
+    {
+        if (!decodeImageFile(faces[i], images[i]) || images[i].component < 3)
+        {
+            std::cerr << "Path tracer: cannot use cubemap face " << faces[i] << ", falling back to the clear colour" << std::endl;
+            return false;
+        }
+    }
+    if (images.size() != 6)
+    {
+        return false;
+    }
+    environment.swap(images);
+    resetAccumulation();
+    return true;
+}
+
+void PathTracer::setLights(const Light* newLights, size_t count, const std::vector<PointLight>& newPointLights)
+{
+    lights.assign(newLights, newLights + count);
+    pointLights = newPointLights;
+    resetAccumulation();
+}
+
+void PathTracer::setCamera(const glm::vec3& position, const glm::vec3& front, const glm::vec3& up, float fovY)
+{
+    cameraPosition = position;
+    cameraFront = glm::normalize(front);
+    cameraRight = glm::normalize(glm::cross(cameraFront, up));
+    cameraUp = glm::cross(cameraRight, cameraFront);
+    tanHalfFov = std::tan(fovY * 0.5f);
+    resetAccumulation();
+}
+
+void PathTracer::setMaxBounces(int bounces)
+{
+    maxBounces = std::max(bounces, 0);
+    resetAccumulation();
+}
+
+void PathTracer::resize(int newWidth, int newHeight)
+{
+    width = std::max(newWidth, 0);
+    height = std::max(newHeight, 0);
+    resetAccumulation();
+}
+
+void PathTracer::resetAccumulation()
+{
+    accumulation.assign(static_cast<size_t>(width) * height, glm::vec3(0.0f));
+    sampleCount = 0;
+    stats.rays = 0;
+    stats.traceSeconds = 0.0;
+}
+
+void PathTracer::renderPass(ThreadPool& pool)
+{
+    PROFILE_ZONE("PathTracer::renderPass");
+    if (width == 0 || height == 0 || nodes.empty())
+    {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    std::atomic<uint64_t> passRays(0);
+    pool.parallelFor(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile)
+    {
+        uint64_t tileRays = 0;
+        traceTile(static_cast<int>(tile % tilesX), static_cast<int>(tile / tilesX), tileRays);
+        passRays += tileRays;
+    });
+    ++sampleCount;
+
+    std::chrono::duration<double> passTime = std::chrono::steady_clock::now() - start;
+    stats.rays += passRays.load();
+    stats.traceSeconds += passTime.count();
+}
+
+void PathTracer::resolve(std::vector<unsigned char>& rgb) const
+{
+    rgb.resize(accumulation.size() * 3);
+    float scale = sampleCount > 0 ? 1.0f / sampleCount : 0.0f;
+    for (size_t i = 0; i < accumulation.size(); ++i)
+    {
+        glm::vec3 color = accumulation[i] * scale;
+        rgb[i * 3] = static_cast<unsigned char>(std::min(std::max(color.x, 0.0f), 1.0f) * 255.0f + 0.5f);
+        rgb[i * 3 + 1] = static_cast<unsigned char>(std::min(std::max(color.y, 0.0f), 1.0f) * 255.0f + 0.5f);
+        rgb[i * 3 + 2] = static_cast<unsigned char>(std::min(std::max(color.z, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+void PathTracer::traceTile(int tileX, int tileY, uint64_t& rayCount)
+{
+    int endX = std::min((tileX + 1) * TILE_SIZE, width);
+    int endY = std::min((tileY + 1) * TILE_SIZE, height);
+    for (int y = tileY * TILE_SIZE; y < endY; ++y)
+    {
+        for (int x = tileX * TILE_SIZE; x < endX; ++x)
+        {
+            size_t pixel = static_cast<size_t>(y) * width + x;
+            uint32_t seed = hashSeed(static_cast<uint32_t>(pixel) ^ hashSeed(static_cast<uint32_t>(sampleCount) + 1u));
+            accumulation[pixel] += traceSample(x, y, seed, rayCount);
+        }
+    }
+}
+
+glm::vec3 PathTracer::traceSample(int x, int y, uint32_t seed, uint64_t& rayCount) const
+{
+    Random random = {seed};
+
+    // Jittered inside the pixel, so the running average also antialiases
+    float aspect = static_cast<float>(width) / height;
+    float screenX = ((x + random.next()) / width * 2.0f - 1.0f) * tanHalfFov * aspect;
+    float screenY = ((y + random.next()) / height * 2.0f - 1.0f) * tanHalfFov;
+
+    Ray ray;
+    ray.origin = cameraPosition;
+    ray.direction = glm::normalize(cameraFront + cameraRight * screenX + cameraUp * screenY);
+
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+    for (int bounce = 0; bounce <= maxBounces; ++bounce)
+    {
+        // Keep the slab test finite for axis-parallel rays
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float d = ray.direction[axis];
+            ray.inverseDirection[axis] = 1.0f / (std::fabs(d) > 1e-12f ? d : std::copysign(1e-12f, d));
+        }
+
+        Hit hit;
+        ++rayCount;
+        if (!intersect(ray, FLT_MAX, hit, false))
+        {
+            radiance += throughput * sampleEnvironment(ray.direction);
+            break;
+        }
+
+        const TriangleShading& triangle = shading[hit.triangle];
+        float w = 1.0f - hit.u - hit.v;
+        glm::vec3 position = ray.origin + ray.direction * hit.t;
+        glm::vec3 normal = triangle.normals[0] * w + triangle.normals[1] * hit.u + triangle.normals[2] * hit.v;
+        float normalLength = glm::length(normal);
+        normal = normalLength > 0.0f ? normal / normalLength : -ray.direction;
+        if (glm::dot(normal, ray.direction) > 0.0f)
+        {
+            normal = -normal; // back faces shade like the rasterizer's two-sided triangles
+        }
+        glm::vec3 albedo(0.8f);
+        if (triangle.texture >= 0)
+        {
+            glm::vec2 texCoord = triangle.texCoords[0] * w + triangle.texCoords[1] * hit.u + triangle.texCoords[2] * hit.v;
+            albedo = sampleTexture(textures[triangle.texture], texCoord);
+        }
+        glm::vec3 surfaceOrigin = position + normal * RAY_OFFSET;
+
+        auto isVisible = [&](const glm::vec3& toLight, float distance)
+        {
+            Ray shadowRay;
+            shadowRay.origin = surfaceOrigin;
+            shadowRay.direction = toLight;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float d = toLight[axis];
+                shadowRay.inverseDirection[axis] = 1.0f / (std::fabs(d) > 1e-12f ? d : std::copysign(1e-12f, d));
+            }
+            Hit shadowHit;
+            ++rayCount;
+            return !intersect(shadowRay, distance, shadowHit, true);
+        };
+
+        // Global lights: unattenuated Lambert like raytrace.frag, plus a shadow ray
+        for (const Light& light : lights)
+        {
+            glm::vec3 toLight = light.position - position;
+            float distance = glm::length(toLight);
+            toLight /= distance;
+            float diffuse = glm::dot(normal, toLight);
+            if (diffuse > 0.0f && isVisible(toLight, distance))
+            {
+                radiance += throughput * albedo * light.color * diffuse;
+            }
+        }
+
+        // One point light picked uniformly stands in for all of them, weighted by the count
+        if (!pointLights.empty())
+        {
+            size_t index = std::min(static_cast<size_t>(random.next() * pointLights.size()), pointLights.size() - 1);
+            const PointLight& light = pointLights[index];
+            glm::vec3 toLight = light.position - position;
+            float distanceSquared = glm::dot(toLight, toLight);
+            float radius4 = light.radius * light.radius * light.radius * light.radius;
+            float window = std::min(std::max(1.0f - distanceSquared * distanceSquared / radius4, 0.0f), 1.0f);
+            float attenuation = window * window / (distanceSquared + 1.0f);
+            float distance = std::sqrt(distanceSquared);
+            float diffuse = distance > 0.0f ? glm::dot(normal, toLight) / distance : 0.0f;
+            if (attenuation > 0.0f && diffuse > 0.0f && isVisible(toLight / distance, distance))
+            {
+                radiance += throughput * albedo * light.color * (diffuse * attenuation * pointLights.size());
+            }
+        }
+
+        // Cosine-weighted diffuse bounce: the Lambert BRDF and the pdf cancel to the albedo
+        throughput *= albedo;
+        if (bounce >= 2)
+        {
+            float survival = std::min(std::max(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.05f), 0.95f);
+            if (random.next() >= survival)
+            {
+                break;
+            }
+            throughput /= survival;
+        }
+        ray.origin = surfaceOrigin;
+        ray.direction = sampleCosineHemisphere(normal, random.next(), random.next());
+    }
+    return radiance;
+}
+
+bool PathTracer::intersect(const Ray& ray, float maxDistance, Hit& hit, bool anyHit) const
+{
+    hit.t = maxDistance;
+    bool found = false;
+
+    // Depth-first, nearest child on top of the stack; each pop pushes at most four
+    int32_t stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        int32_t item = stack[--stackSize];
+        if (item < 0)
+        {
+            if (intersectBlock(blocks[~item], ray, hit))
+            {
+                found = true;
+                if (anyHit)
+                {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        float distances[4];
+        uint32_t mask = intersectChildren(nodes[item], ray, hit.t, distances);
+        int hitChildren[4];
+        int hitCount = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            if (mask & (1u << i))
+            {
+                // Insertion sort, farthest first
+                int slot = hitCount++;
+                while (slot > 0 && distances[hitChildren[slot - 1]] < distances[i])
+                {
+                    hitChildren[slot] = hitChildren[slot - 1];
+                    --slot;
+                }
+                hitChildren[slot] = i;
+            }
+        }
+        for (int i = 0; i < hitCount && stackSize < STACK_SIZE; ++i)
+        {
+            stack[stackSize++] = nodes[item].children[hitChildren[i]];
+        }
+    }
+    return found;
+}
+
+uint32_t PathTracer::intersectChildren(const Node& node, const Ray& ray, float maxDistance, float* distances) const
+{
+    uint32_t mask = 0;
+#ifdef PATH_TRACER_USE_SSE
+    __m128 originX = _mm_set1_ps(ray.origin.x);
+    __m128 originY = _mm_set1_ps(ray.origin.y);
+    __m128 originZ = _mm_set1_ps(ray.origin.z);
+    __m128 inverseX = _mm_set1_ps(ray.inverseDirection.x);
+    __m128 inverseY = _mm_set1_ps(ray.inverseDirection.y);
+    __m128 inverseZ = _mm_set1_ps(ray.inverseDirection.z);
+
+    __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), inverseX);
+    __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), inverseX);
+    __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), inverseY);
+    __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), inverseY);
+    __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), inverseZ);
+    __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), inverseZ);
+
+    __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                              _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+    __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                             _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(maxDistance)));
+    mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)));
+    _mm_storeu_ps(distances, tNear);
+#else
+    for (int i = 0; i < 4; ++i)
+    {
+        float t0x = (node.minX[i] - ray.origin.x) * ray.inverseDirection.x;
+        float t1x = (node.maxX[i] - ray.origin.x) * ray.inverseDirection.x;
+        float t0y = (node.minY[i] - ray.origin.y) * ray.inverseDirection.y;
+        float t1y = (node.maxY[i] - ray.origin.y) * ray.inverseDirection.y;
+        float t0z = (node.minZ[i] - ray.origin.z) * ray.inverseDirection.z;
+        float t1z = (node.maxZ[i] - ray.origin.z) * ray.inverseDirection.z;
+        float tNear = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+        float tFar = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), maxDistance));
+        distances[i] = tNear;
+        if (tNear <= tFar)
+        {
+            mask |= 1u << i;
+        }
+    }
+#endif
+    return mask & ((1u << node.childCount) - 1u);
+}
+
+bool PathTracer::intersectBlock(const TriangleBlock& block, const Ray& ray, Hit& hit) const
+{
+    // Moller-Trumbore on four triangles at once; padding lanes have zero edges and fail the determinant test
+    float t[4], u[4], v[4];
+    uint32_t mask = 0;
+#ifdef PATH_TRACER_USE_SSE
+    __m128 dx = _mm_set1_ps(ray.direction.x);
+    __m128 dy = _mm_set1_ps(ray.direction.y);
+    __m128 dz = _mm_set1_ps(ray.direction.z);
+    __m128 e1x = _mm_load_ps(block.e1x), e1y = _mm_load_ps(block.e1y), e1z = _mm_load_ps(block.e1z);
+    __m128 e2x = _mm_load_ps(block.e2x), e2y = _mm_load_ps(block.e2y), e2z = _mm_load_ps(block.e2z);
+
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(block.v0x));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(block.v0y));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(block.v0z));
+    __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+    __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 valid = _mm_cmpneq_ps(det, zero);
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(uu, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(vv, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(tt, zero));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(tt, _mm_set1_ps(hit.t)));
+    mask = static_cast<uint32_t>(_mm_movemask_ps(valid));
+    if (mask == 0)
+    {
+        return false;
+    }
+    _mm_storeu_ps(t, tt);
+    _mm_storeu_ps(u, uu);
+    _mm_storeu_ps(v, vv);
+#else
+    for (int i = 0; i < 4; ++i)
+    {
+        glm::vec3 edge1(block.e1x[i], block.e1y[i], block.e1z[i]);
+        glm::vec3 edge2(block.e2x[i], block.e2y[i], block.e2z[i]);
+        glm::vec3 p = glm::cross(ray.direction, edge2);
+        float det = glm::dot(edge1, p);
+        if (det == 0.0f)
+        {
+            continue;
+        }
+        float inverseDet = 1.0f / det;
+        glm::vec3 s = ray.origin - glm::vec3(block.v0x[i], block.v0y[i], block.v0z[i]);
+        glm::vec3 q = glm::cross(s, edge1);
+        u[i] = glm::dot(s, p) * inverseDet;
+        v[i] = glm::dot(ray.direction, q) * inverseDet;
+        t[i] = glm::dot(edge2, q) * inverseDet;
+        if (u[i] >= 0.0f && v[i] >= 0.0f && u[i] + v[i] <= 1.0f && t[i] > 0.0f && t[i] < hit.t)
+        {
+            mask |= 1u << i;
+        }
+    }
+    if (mask == 0)
+    {
+        return false;
+    }
+#endif
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if ((mask & (1u << i)) && t[i] < hit.t)
+        {
+            hit.t = t[i];
+            hit.u = u[i];
+            hit.v = v[i];
+            hit.triangle = block.triangles[i];
+        }
+    }
+    return true;
+}
+
+glm::vec3 PathTracer::sampleEnvironment(const glm::vec3& direction) const
+{
+    if (environment.empty())
+    {
+        return CLEAR_COLOR;
+    }
+
+    // Face selection and face coordinates as in the GL cube map specification
+    glm::vec3 a(std::fabs(direction.x), std::fabs(direction.y), std::fabs(direction.z));
+    int face;
+    float s, t, major;
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        face = direction.x > 0.0f ? 0 : 1;
+        s = direction.x > 0.0f ? -direction.z : direction.z;
+        t = -direction.y;
+        major = a.x;
+    }
+    else if (a.y >= a.z)
+    {
+        face = direction.y > 0.0f ? 2 : 3;
+        s = direction.x;
+        t = direction.y > 0.0f ? direction.z : -direction.z;
+        major = a.y;
+    }
+    else
+    {
+        face = direction.z > 0.0f ? 4 : 5;
+        s = direction.z > 0.0f ? direction.x : -direction.x;
+        t = -direction.y;
+        major = a.z;
+    }
+
+    const ImageData& image = environment[face];
+    float fs = (s / major + 1.0f) * 0.5f;
+    float ft = (t / major + 1.0f) * 0.5f;
+    int x = std::min(static_cast<int>(fs * image.width), image.width - 1);
+    int y = std::min(static_cast<int>(ft * image.height), image.height - 1);
+    return fetchTexel(image, std::max(x, 0), std::max(y, 0));
+}
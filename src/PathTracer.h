@@ -0,0 +1,123 @@
+﻿#ifndef PATH_TRACER_H
+#define PATH_TRACER_H
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Light.h"
+#include "Texture.h"
+
+class Model;
+class ThreadPool;
+
+struct PathTracerStats
+{
+    size_t triangles = 0;
+    size_t nodes = 0;              // 4-wide BVH nodes
+    double buildMilliseconds = 0.0;
+    uint64_t rays = 0;             // camera, bounce and shadow rays since the last reset
+    double traceSeconds = 0.0;     // wall time inside renderPass since the last reset
+
+    double getRaysPerSecond() const { return traceSeconds > 0.0 ? rays / traceSeconds : 0.0; }
+};
+
+// CPU path tracer over the same model, camera and lights as the rasterizer, for
+// machines without a GPU. The scene is flattened to world-space triangles under a
+// 4-wide BVH (a TriangleBvh, collapsed), so one SSE op tests a ray against
+// four child boxes or four triangles. Each renderPass() adds one jittered sample per
+// pixel to a running average, traced in 16x16 tiles across the pool. The global
+// lights shade like the rasterizer's (unattenuated Lambert) with shadow rays, one
+// random point light is sampled per hit, and diffuse bounces pick up the cubemap.
+class PathTracer
+{
+public:
+    bool build(const Model& model, ThreadPool* pool = nullptr); // the scene graph must be up to date
+    bool loadEnvironment(const std::vector<std::string>& faces); // +X, -X, +Y, -Y, +Z, -Z like loadCubeMap
+
+    void setLights(const Light* lights, size_t count, const std::vector<PointLight>& pointLights);
+    void setCamera(const glm::vec3& position, const glm::vec3& front, const glm::vec3& up, float fovY);
+    void setMaxBounces(int bounces);
+    void resize(int width, int height);
+    void resetAccumulation();
+
+    void renderPass(ThreadPool& pool);
+    int getSampleCount() const { return sampleCount; }
+
+    // Averaged radiance as 8-bit RGB, rows bottom-up like glReadPixels
+    void resolve(std::vector<unsigned char>& rgb) const;
+
+    const PathTracerStats& getStats() const { return stats; }
+
+private:
+    // Four child boxes structure-of-arrays; children >= 0 are nodes, < 0 are ~block
+    struct alignas(16) Node
+    {
+        float minX[4], minY[4], minZ[4];
+        float maxX[4], maxY[4], maxZ[4];
+        int32_t children[4];
+        uint32_t childCount;
+    };
+
+    // One BVH leaf: up to four triangles as vertex 0 plus two edges, padded with degenerate ones
+    struct alignas(16) TriangleBlock
+    {
+        float v0x[4], v0y[4], v0z[4];
+        float e1x[4], e1y[4], e1z[4];
+        float e2x[4], e2y[4], e2z[4];
+        uint32_t triangles[4];
+    };
+
+    struct TriangleShading
+    {
+        glm::vec3 normals[3];
+        glm::vec2 texCoords[3];
+        int texture; // index into textures, -1 for none
+    };
+
+    struct Ray
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        glm::vec3 inverseDirection;
+    };
+
+    struct Hit
+    {
+        float t;
+        float u;
+        float v;
+        uint32_t triangle;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<TriangleBlock> blocks;
+    std::vector<TriangleShading> shading;
+    std::vector<ImageData> textures;
+    std::vector<ImageData> environment; // empty uses the rasterizer's clear colour
+
+    std::vector<Light> lights;
+    std::vector<PointLight> pointLights;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
+    glm::vec3 cameraRight = glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+    float tanHalfFov = 0.41421356f;
+    int maxBounces = 4;
+
+    int width = 0;
+    int height = 0;
+    int sampleCount = 0;
+    std::vector<glm::vec3> accumulation; // radiance sums, rows bottom-up
+    PathTracerStats stats;
+
+    void traceTile(int tileX, int tileY, uint64_t& rayCount);
+    glm::vec3 traceSample(int x, int y, uint32_t seed, uint64_t& rayCount) const;
+    bool intersect(const Ray& ray, float maxDistance, Hit& hit, bool anyHit) const;
+    uint32_t intersectChildren(const Node& node, const Ray& ray, float maxDistance, float* distances) const;
+    bool intersectBlock(const TriangleBlock& block, const Ray& ray, Hit& hit) const;
+    glm::vec3 sampleEnvironment(const glm::vec3& direction) const;
+};
+
+#endif
@@ -0,0 +1,304 @@
+﻿#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace
+{
+    // Open CPU zones of the calling thread: name and start time
+    thread_local std::vector<std::pair<const char*, uint64_t>> cpuZoneStack;
+    thread_local uint32_t profilerThreadId = UINT32_MAX;
+
+    const size_t NO_GPU_ZONE = SIZE_MAX;
+
+    const char* getCounterName(size_t counter)
+    {
+        switch (static_cast<ProfileCounter>(counter))
+        {
+        case ProfileCounter::DrawCalls: return "Draw calls";
+        case ProfileCounter::StateChanges: return "State changes";
+        case ProfileCounter::BytesUploaded: return "Bytes uploaded";
+        default: return "Unknown";
+        }
+    }
+}
+
+Profiler& Profiler::get()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+    : epoch(std::chrono::steady_clock::now())
+{
+    for (auto& counter : counters)
+    {
+        counter = 0;
+    }
+}
+
+uint64_t Profiler::nowNs() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+uint32_t Profiler::getThreadId()
+{
+    if (profilerThreadId == UINT32_MAX)
+    {
+        profilerThreadId = nextThreadId++;
+    }
+    return profilerThreadId;
+}
+
+void Profiler::beginFrame()
+{
+    if (!gpuInitialized)
+    {
+        gpuAvailable = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+        gpuInitialized = true;
+    }
+
+    // This slot was last used GPU_FRAME_LATENCY frames ago, so its queries are normally done by now
+    GpuFrameSlot& slot = gpuSlots[frameIndex % GPU_FRAME_LATENCY];
+    if (slot.pending)
+    {
+        resolveGpuSlot(slot);
+    }
+    slot.usedQueries = 0;
+    slot.zones.clear();
+    slot.frameIndex = frameIndex;
+    gpuStack.clear();
+
+    frameThread = getThreadId();
+    frameStartNs = nowNs();
+    if (gpuAvailable && enabled)
+    {
+        // Pair a GPU timestamp with the CPU clock so GPU zones can be placed on the CPU timeline
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        slot.gpuToCpuOffsetNs = static_cast<int64_t>(nowNs()) - gpuNow;
+    }
+    inFrame = true;
+}
+
+void Profiler::endFrame()
+{
+    ProfileFrame frame;
+    frame.index = frameIndex;
+    frame.startNs = frameStartNs;
+    frame.endNs = nowNs();
+    for (size_t i = 0; i < frame.counters.size(); ++i)
+    {
+        frame.counters[i] = counters[i].exchange(0, std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        frame.cpuEvents.swap(pendingCpuEvents);
+    }
+
+    GpuFrameSlot& slot = gpuSlots[frameIndex % GPU_FRAME_LATENCY];
+    slot.pending = !slot.zones.empty();
+    if (!slot.pending)
+    {
+        frame.gpuResolved = true;
+        lastResolvedFrame = frame.index;
+    }
+
+    history.push_back(std::move(frame));
+    while (history.size() > HISTORY_FRAMES)
+    {
+        history.pop_front();
+    }
+
+    ++frameIndex;
+    inFrame = false;
+}
+
+void Profiler::beginCpuZone(const char* name)
+{
+    cpuZoneStack.emplace_back(name, nowNs());
+}
+
+void Profiler::endCpuZone()
+{
+    if (cpuZoneStack.empty())
+    {
+        return;
+    }
+
+    std::pair<const char*, uint64_t> zone = cpuZoneStack.back();
+    cpuZoneStack.pop_back();
+    if (!enabled)
+    {
+        return;
+    }
+
+    ProfileEvent event;
+    event.name = zone.first;
+    event.startNs = zone.second;
+    event.endNs = nowNs();
+    event.thread = getThreadId();
+    event.depth = static_cast<uint32_t>(cpuZoneStack.size());
+
+    std::lock_guard<std::mutex> lock(eventMutex);
+    pendingCpuEvents.push_back(event);
+}
+
+void Profiler::beginGpuZone(const char* name)
+{
+    if (!gpuAvailable || !enabled || !inFrame)
+    {
+        gpuStack.push_back(NO_GPU_ZONE);
+        return;
+    }
+
+    GpuFrameSlot& slot = gpuSlots[frameIndex % GPU_FRAME_LATENCY];
+    GpuZone zone;
+    zone.name = name;
+    zone.depth = static_cast<uint32_t>(std::count_if(gpuStack.begin(), gpuStack.end(),
+                                                     [](size_t open) { return open != NO_GPU_ZONE; }));
+    zone.beginQuery = allocateQuery(slot);
+    zone.endQuery = NO_GPU_ZONE;
+    glQueryCounter(slot.queries[zone.beginQuery], GL_TIMESTAMP);
+
+    gpuStack.push_back(slot.zones.size());
+    slot.zones.push_back(zone);
+}
+
+void Profiler::endGpuZone()
+{
+    if (gpuStack.empty())
+    {
+        return;
+    }
+
+    size_t zoneIndex = gpuStack.back();
+    gpuStack.pop_back();
+    if (zoneIndex == NO_GPU_ZONE)
+    {
+        return;
+    }
+
+    GpuFrameSlot& slot = gpuSlots[frameIndex % GPU_FRAME_LATENCY];
+    GpuZone& zone = slot.zones[zoneIndex];
+    zone.endQuery = allocateQuery(slot);
+    glQueryCounter(slot.queries[zone.endQuery], GL_TIMESTAMP);
+}
+
+size_t Profiler::allocateQuery(GpuFrameSlot& slot)
+{
+    if (slot.usedQueries == slot.queries.size())
+    {
+        // Grow in chunks; the pool is reused every GPU_FRAME_LATENCY frames
+        size_t grow = std::max<size_t>(16, slot.queries.size());
+        slot.queries.resize(slot.queries.size() + grow);
+        glGenQueries(static_cast<GLsizei>(grow), slot.queries.data() + slot.usedQueries);
+    }
+    return slot.usedQueries++;
+}
+
+void Profiler::resolveGpuSlot(GpuFrameSlot& slot)
+{
+    slot.pending = false;
+    if (history.empty() || slot.frameIndex < history.front().index)
+    {
+        return; // frame already dropped from the history
+    }
+
+    ProfileFrame& frame = history[static_cast<size_t>(slot.frameIndex - history.front().index)];
+    for (const GpuZone& zone : slot.zones)
+    {
+        if (zone.endQuery == NO_GPU_ZONE)
+        {
+            continue; // zone was never closed
+        }
+
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(slot.queries[zone.beginQuery], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(slot.queries[zone.endQuery], GL_QUERY_RESULT, &end);
+
+        ProfileEvent event;
+        event.name = zone.name;
+        event.startNs = static_cast<uint64_t>(static_cast<int64_t>(begin) + slot.gpuToCpuOffsetNs);
+        event.endNs = event.startNs + (end > begin ? end - begin : 0);
+        event.thread = GPU_THREAD;
+        event.depth = zone.depth;
+        frame.gpuEvents.push_back(event);
+        if (zone.depth == 0)
+        {
+            frame.gpuNs += event.endNs - event.startNs;
+        }
+    }
+    frame.gpuResolved = true;
+    if (lastResolvedFrame == UINT64_MAX || frame.index > lastResolvedFrame)
+    {
+        lastResolvedFrame = frame.index;
+    }
+}
+
+const ProfileFrame* Profiler::getLastResolvedFrame() const
+{
+    if (lastResolvedFrame == UINT64_MAX || history.empty() || lastResolvedFrame < history.front().index)
+    {
+        return nullptr;
+    }
+    return &history[static_cast<size_t>(lastResolvedFrame - history.front().index)];
+}
+
+bool Profiler::exportChromeTrace(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cerr << "Failed to write trace: " << path << std::endl;
+        return false;
+    }
+
+    // Chrome trace event format; timestamps and durations are in microseconds
+    file << "{\"traceEvents\":[\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GPU_THREAD << ",\"args\":{\"name\":\"GPU\"}}";
+    auto writeEvent = [&](const ProfileEvent& event)
+    {
+        file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+            << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+    };
+    for (const ProfileFrame& frame : history)
+    {
+        file << ",\n{\"name\":\"Frame " << frame.index << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << GPU_THREAD + 1
+            << ",\"ts\":" << frame.startNs / 1000.0 << ",\"dur\":" << (frame.endNs - frame.startNs) / 1000.0 << "}";
+        for (size_t i = 0; i < frame.counters.size(); ++i)
+        {
+            file << ",\n{\"name\":\"" << getCounterName(i) << "\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+                << frame.startNs / 1000.0 << ",\"args\":{\"value\":" << frame.counters[i] << "}}";
+        }
+        for (const ProfileEvent& event : frame.cpuEvents)
+        {
+            writeEvent(event);
+        }
+        for (const ProfileEvent& event : frame.gpuEvents)
+        {
+            writeEvent(event);
+        }
+    }
+    file << "\n]}\n";
+
+    std::cout << "Wrote " << history.size() << " frames of profiling data to " << path << std::endl;
+    return true;
+}
+
+void Profiler::releaseGpuResources()
+{
+    for (GpuFrameSlot& slot : gpuSlots)
+    {
+        if (!slot.queries.empty())
+        {
+            glDeleteQueries(static_cast<GLsizei>(slot.queries.size()), slot.queries.data());
+        }
+        slot = GpuFrameSlot();
+    }
+    gpuStack.clear();
+    gpuAvailable = false;
+}
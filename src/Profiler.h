@@ -0,0 +1,150 @@
+﻿#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class ProfileCounter
+{
+    DrawCalls,
+    StateChanges, // program and vertex array binds
+    BytesUploaded,
+    Count
+};
+
+struct ProfileEvent
+{
+    const char* name; // zone names are string literals
+    uint64_t startNs; // relative to the profiler epoch
+    uint64_t endNs;
+    uint32_t thread;  // 0 is the first thread that profiled anything, GPU events use GPU_THREAD
+    uint32_t depth;
+};
+
+struct ProfileFrame
+{
+    uint64_t index = 0;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    uint64_t gpuNs = 0; // sum of the outermost GPU zones
+    bool gpuResolved = false;
+    std::array<uint64_t, static_cast<size_t>(ProfileCounter::Count)> counters = {};
+    std::vector<ProfileEvent> cpuEvents;
+    std::vector<ProfileEvent> gpuEvents;
+};
+
+// Frame-based CPU/GPU instrumentation. CPU zones nest per thread and can be
+// opened from any thread; GPU zones (GL thread only) are bracketed with
+// GL_TIMESTAMP queries so they nest too. Each frame's queries live in one slot of
+// a GPU_FRAME_LATENCY ring and are read back that many frames later, so reading
+// them does not stall. A short history of frames is kept for the panel and for
+// Chrome trace export.
+class Profiler
+{
+public:
+    static const uint32_t GPU_THREAD = 1000;
+    static const int GPU_FRAME_LATENCY = 4;
+    static const size_t HISTORY_FRAMES = 240;
+
+    static Profiler& get();
+
+    void setEnabled(bool enabled) { this->enabled = enabled; }
+    bool isEnabled() const { return enabled; }
+
+    // GL thread, once per frame
+    void beginFrame();
+    void endFrame();
+
+    void beginCpuZone(const char* name);
+    void endCpuZone();
+    void beginGpuZone(const char* name);
+    void endGpuZone();
+
+    void addCounter(ProfileCounter counter, uint64_t value = 1)
+    {
+        counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Latest frame whose GPU results have been read back (nullptr until one has)
+    const ProfileFrame* getLastResolvedFrame() const;
+    const std::deque<ProfileFrame>& getHistory() const { return history; }
+    uint32_t getFrameThread() const { return frameThread; } // thread id of the beginFrame() caller
+
+    bool exportChromeTrace(const std::string& path) const;
+    void releaseGpuResources(); // before the GL context goes away
+
+private:
+    struct GpuZone
+    {
+        const char* name;
+        uint32_t depth;
+        size_t beginQuery;
+        size_t endQuery;
+    };
+
+    struct GpuFrameSlot
+    {
+        std::vector<GLuint> queries;
+        size_t usedQueries = 0;
+        std::vector<GpuZone> zones;
+        uint64_t frameIndex = 0;
+        int64_t gpuToCpuOffsetNs = 0;
+        bool pending = false;
+    };
+
+    Profiler();
+
+    bool enabled = true;
+    std::chrono::steady_clock::time_point epoch;
+    uint64_t frameIndex = 0;
+    uint64_t frameStartNs = 0;
+    uint32_t frameThread = 0;
+    bool inFrame = false;
+
+    std::mutex eventMutex;
+    std::vector<ProfileEvent> pendingCpuEvents;
+    std::atomic<uint64_t> counters[static_cast<size_t>(ProfileCounter::Count)];
+    std::atomic<uint32_t> nextThreadId{0};
+
+    bool gpuAvailable = false;
+    bool gpuInitialized = false;
+    GpuFrameSlot gpuSlots[GPU_FRAME_LATENCY];
+    std::vector<size_t> gpuStack; // open zone indices in the current slot
+
+    std::deque<ProfileFrame> history;
+    uint64_t lastResolvedFrame = UINT64_MAX;
+
+    uint64_t nowNs() const;
+    uint32_t getThreadId();
+    size_t allocateQuery(GpuFrameSlot& slot);
+    void resolveGpuSlot(GpuFrameSlot& slot);
+};
+
+// RAII helpers; names must outlive the profiler (use string literals)
+class CpuProfileScope
+{
+public:
+    explicit CpuProfileScope(const char* name) { Profiler::get().beginCpuZone(name); }
+    ~CpuProfileScope() { Profiler::get().endCpuZone(); }
+};
+
+class GpuProfileScope
+{
+public:
+    explicit GpuProfileScope(const char* name) { Profiler::get().beginGpuZone(name); }
+    ~GpuProfileScope() { Profiler::get().endGpuZone(); }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) CpuProfileScope PROFILE_CONCAT(cpuProfileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+
+#endif
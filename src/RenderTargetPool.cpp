@@ -0,0 +1,190 @@
+﻿#include "RenderTargetPool.h"
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+    const uint64_t evictAfterFrames = 300;
+
+    int roundUpToBucket(int size)
+    {
+        return (std::max(size, 1) + RENDER_TARGET_BUCKET - 1) / RENDER_TARGET_BUCKET * RENDER_TARGET_BUCKET;
+    }
+
+    void getPixelFormat(GLenum colorFormat, GLenum& format, GLenum& type, size_t& bytesPerPixel)
+    {
+        switch (colorFormat)
+        {
+        case GL_RGBA16F:
+            format = GL_RGBA;
+            type = GL_HALF_FLOAT;
+            bytesPerPixel = 8;
+            break;
+        case GL_RGBA8:
+            format = GL_RGBA;
+            type = GL_UNSIGNED_BYTE;
+            bytesPerPixel = 4;
+            break;
+        default:
+            format = GL_RGB;
+            type = GL_UNSIGNED_BYTE;
+            bytesPerPixel = 4; // drivers pad RGB8
+            break;
+        }
+    }
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+    clear();
+}
+
+RenderTarget* RenderTargetPool::acquire(int width, int height, GLenum colorFormat, bool depth)
+{
+    // Anything larger than twice the bucket area would waste memory on a small pass
+    int bucketWidth = roundUpToBucket(width);
+    int bucketHeight = roundUpToBucket(height);
+    size_t maxArea = static_cast<size_t>(bucketWidth) * bucketHeight * 2;
+
+    Entry* best = nullptr;
+    for (Entry& entry : entries)
+    {
+        const RenderTarget& target = *entry.target;
+        size_t area = static_cast<size_t>(target.width) * target.height;
+        if (entry.inUse || entry.depth != depth || target.colorFormat != colorFormat ||
+            target.width < width || target.height < height || area > maxArea)
+        {
+            continue;
+        }
+        if (!best || area < static_cast<size_t>(best->target->width) * best->target->height)
+        {
+            best = &entry;
+        }
+    }
+
+    RenderTarget* target = nullptr;
+    if (best)
+    {
+        best->inUse = true;
+        target = best->target.get();
+        ++reuses;
+    }
+    else
+    {
+        target = create(bucketWidth, bucketHeight, colorFormat, depth);
+    }
+    target->usedWidth = width;
+    target->usedHeight = height;
+    return target;
+}
+
+void RenderTargetPool::release(RenderTarget* target)
+{
+    for (Entry& entry : entries)
+    {
+        if (entry.target.get() == target)
+        {
+            entry.inUse = false;
+            entry.releasedFrame = frame;
+            return;
+        }
+    }
+}
+
+RenderTarget* RenderTargetPool::resize(RenderTarget* target, int width, int height)
+{
+    GLenum colorFormat = target->colorFormat;
+    bool depth = target->depthTexture != 0;
+    release(target);
+    return acquire(width, height, colorFormat, depth);
+}
+
+void RenderTargetPool::update()
+{
+    ++frame;
+    for (size_t i = 0; i < entries.size();)
+    {
+        if (!entries[i].inUse && frame - entries[i].releasedFrame > evictAfterFrames)
+        {
+            destroy(*entries[i].target);
+            entries[i] = std::move(entries.back());
+            entries.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void RenderTargetPool::clear()
+{
+    for (Entry& entry : entries)
+    {
+        destroy(*entry.target);
+    }
+    entries.clear();
+}
+
+RenderTarget* RenderTargetPool::create(int width, int height, GLenum colorFormat, bool depth)
+{
+    Entry entry;
+    entry.target = std::make_unique<RenderTarget>();
+    entry.depth = depth;
+    entry.inUse = true;
+    RenderTarget& target = *entry.target;
+    target.colorFormat = colorFormat;
+    target.width = width;
+    target.height = height;
+
+    GLenum format, type;
+    size_t bytesPerPixel;
+    getPixelFormat(colorFormat, format, type, bytesPerPixel);
+
+    glGenFramebuffers(1, &target.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+
+    glGenTextures(1, &target.colorTexture);
+    glBindTexture(GL_TEXTURE_2D, target.colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, colorFormat, width, height, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.colorTexture, 0);
+    target.bytes = static_cast<size_t>(width) * height * bytesPerPixel;
+
+    if (depth)
+    {
+        glGenTextures(1, &target.depthTexture);
+        glBindTexture(GL_TEXTURE_2D, target.depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8,
+                     NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, target.depthTexture, 0);
+        target.bytes += static_cast<size_t>(width) * height * 4;
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    residentBytes += target.bytes;
+    ++allocations;
+    entries.push_back(std::move(entry));
+    return entries.back().target.get();
+}
+
+void RenderTargetPool::destroy(RenderTarget& target)
+{
+    glDeleteFramebuffers(1, &target.framebuffer);
+    glDeleteTextures(1, &target.colorTexture);
+    if (target.depthTexture)
+    {
+        glDeleteTextures(1, &target.depthTexture);
+    }
+    residentBytes -= target.bytes;
+}
@@ -0,0 +1,80 @@
+﻿#ifndef RENDER_TARGET_POOL_H
+#define RENDER_TARGET_POOL_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Sizes are rounded up to this many pixels, so resizing within a bucket reuses the target
+const int RENDER_TARGET_BUCKET = 256;
+
+// A framebuffer with one colour texture and an optional depth/stencil texture (a
+// texture rather than a renderbuffer so later passes can read the depth).
+// width/height are the allocated size; passes draw into the rectangle at (0, 0)
+// they asked for, so getUvScale() maps it back to texture coordinates.
+struct RenderTarget
+{
+    GLuint framebuffer = 0;
+    GLuint colorTexture = 0;
+    GLuint depthTexture = 0;
+    GLenum colorFormat = GL_RGB8;
+    int width = 0;
+    int height = 0;
+    int usedWidth = 0;  // size requested by the current owner
+    int usedHeight = 0;
+    size_t bytes = 0;
+
+    float getUvScaleX() const { return static_cast<float>(usedWidth) / width; }
+    float getUvScaleY() const { return static_cast<float>(usedHeight) / height; }
+};
+
+// Hands out render targets in size buckets and keeps released ones for later
+// requests of the same format, so resizes and transient passes rarely allocate.
+// Targets nobody has asked for in a while are deleted by update().
+class RenderTargetPool
+{
+public:
+    RenderTargetPool() = default;
+    ~RenderTargetPool();
+    RenderTargetPool(const RenderTargetPool&) = delete;
+    RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+    // The smallest free target that fits, or a new bucket-sized one. colorFormat is
+    // GL_RGB8, GL_RGBA8 or GL_RGBA16F.
+    RenderTarget* acquire(int width, int height, GLenum colorFormat, bool depth);
+    void release(RenderTarget* target);
+
+    // Returns `target` to the pool and acquires one for the new size (often the same one)
+    RenderTarget* resize(RenderTarget* target, int width, int height);
+
+    // Call once per frame: deletes targets released more than a few seconds of frames ago
+    void update();
+    void clear();
+
+    size_t getTargetCount() const { return entries.size(); }
+    size_t getResidentBytes() const { return residentBytes; }
+    size_t getAllocationCount() const { return allocations; }
+    size_t getReuseCount() const { return reuses; }
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<RenderTarget> target;
+        bool depth = false;
+        bool inUse = false;
+        uint64_t releasedFrame = 0;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t frame = 0;
+    size_t residentBytes = 0;
+    size_t allocations = 0;
+    size_t reuses = 0;
+
+    RenderTarget* create(int width, int height, GLenum colorFormat, bool depth);
+    void destroy(RenderTarget& target);
+};
+
+#endif
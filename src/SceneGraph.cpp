@@ -0,0 +1,262 @@
+﻿#include "SceneGraph.h"
+#include <algorithm>
+#include <deque>
+#include <iostream>
+
+namespace
+{
+    glm::mat4 composeTransform(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+    {
+        glm::mat4 m = glm::mat4_cast(rotation);
+        m[0] *= scale.x;
+        m[1] *= scale.y;
+        m[2] *= scale.z;
+        m[3] = glm::vec4(translation, 1.0f);
+        return m;
+    }
+
+    void decomposeMatrix(const std::vector<double>& matrix, SceneNodeDesc& desc)
+    {
+        glm::mat4 m;
+        for (int column = 0; column < 4; ++column)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                m[column][row] = static_cast<float>(matrix[column * 4 + row]);
+            }
+        }
+
+        desc.translation = glm::vec3(m[3]);
+        glm::vec3 axes[3] = { glm::vec3(m[0]), glm::vec3(m[1]), glm::vec3(m[2]) };
+        desc.scale = glm::vec3(glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2]));
+        if (glm::dot(glm::cross(axes[0], axes[1]), axes[2]) < 0.0f)
+        {
+            desc.scale.x = -desc.scale.x;
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            if (desc.scale[i] != 0.0f)
+            {
+                axes[i] /= desc.scale[i];
+            }
+        }
+        desc.rotation = glm::normalize(glm::quat_cast(glm::mat3(axes[0], axes[1], axes[2])));
+    }
+}
+
+std::vector<SceneNodeDesc> SceneGraph::collectNodes(const tinygltf::Model& model)
+{
+    std::vector<int> roots;
+    int sceneIndex = model.defaultScene >= 0 ? model.defaultScene : 0;
+    if (sceneIndex < model.scenes.size())
+    {
+        roots = model.scenes[sceneIndex].nodes;
+    }
+    else
+    {
+        // No scenes: every node that is nobody's child is a root
+        std::vector<bool> isChild(model.nodes.size(), false);
+        for (const auto& node : model.nodes)
+        {
+            for (int child : node.children)
+            {
+                if (child >= 0 && child < model.nodes.size())
+                {
+                    isChild[child] = true;
+                }
+            }
+        }
+        for (size_t i = 0; i < model.nodes.size(); ++i)
+        {
+            if (!isChild[i])
+            {
+                roots.push_back(static_cast<int>(i));
+            }
+        }
+    }
+
+    // Breadth-first order guarantees parents come before children
+    std::vector<SceneNodeDesc> nodes;
+    std::vector<bool> visited(model.nodes.size(), false);
+    std::deque<std::pair<int, int>> queue; // (glTF node, parent index in output)
+    for (int root : roots)
+    {
+        queue.emplace_back(root, -1);
+    }
+    while (!queue.empty())
+    {
+        auto [gltfIndex, parent] = queue.front();
+        queue.pop_front();
+        if (gltfIndex < 0 || gltfIndex >= model.nodes.size() || visited[gltfIndex])
+        {
+            std::cerr << "Error: Invalid or repeated scene node: " << gltfIndex << std::endl;
+            continue;
+        }
+        visited[gltfIndex] = true;
+
+        const tinygltf::Node& node = model.nodes[gltfIndex];
+        SceneNodeDesc desc;
+        desc.parent = parent;
+        desc.mesh = node.mesh;
+        desc.name = node.name;
+        if (node.matrix.size() == 16)
+        {
+            decomposeMatrix(node.matrix, desc);
+        }
+        else
+        {
+            if (node.translation.size() == 3)
+            {
+                desc.translation = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
+            }
+            if (node.rotation.size() == 4)
+            {
+                // glTF stores quaternions as (x, y, z, w)
+                desc.rotation = glm::quat(static_cast<float>(node.rotation[3]), static_cast<float>(node.rotation[0]),
+                                          static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2]));
+            }
+            if (node.scale.size() == 3)
+            {
+                desc.scale = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+            }
+        }
+
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(desc);
+        for (int child : node.children)
+        {
+            queue.emplace_back(child, index);
+        }
+    }
+    return nodes;
+}
+
+void SceneGraph::build(const std::vector<SceneNodeDesc>& nodes)
+{
+    clear();
+
+    size_t count = nodes.size();
+    parents.resize(count);
+    meshes.resize(count);
+    names.resize(count);
+    translations.resize(count);
+    rotations.resize(count);
+    scales.resize(count);
+    localMatrices.resize(count);
+    worldMatrices.resize(count);
+    localDirty.assign(count, 1);
+    worldChanged.assign(count, 0);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const SceneNodeDesc& desc = nodes[i];
+        parents[i] = desc.parent < static_cast<int>(i) ? desc.parent : -1;
+        meshes[i] = desc.mesh;
+        names[i] = desc.name;
+        translations[i] = desc.translation;
+        rotations[i] = desc.rotation;
+        scales[i] = desc.scale;
+        if (desc.mesh >= 0)
+        {
+            drawableNodes.push_back(static_cast<int>(i));
+        }
+    }
+
+    firstDirty = count > 0 ? 0 : SIZE_MAX;
+    update();
+}
+
+void SceneGraph::clear()
+{
+    parents.clear();
+    meshes.clear();
+    names.clear();
+    translations.clear();
+    rotations.clear();
+    scales.clear();
+    localMatrices.clear();
+    worldMatrices.clear();
+    localDirty.clear();
+    worldChanged.clear();
+    drawableNodes.clear();
+    changedNodes.clear();
+    firstDirty = SIZE_MAX;
+}
+
+bool SceneGraph::update()
+{
+    changedNodes.clear();
+    if (firstDirty == SIZE_MAX)
+    {
+        return false;
+    }
+
+    // Nothing before firstDirty changed, so parents below that index count as clean
+    const int start = static_cast<int>(firstDirty);
+    const size_t count = parents.size();
+    for (size_t i = firstDirty; i < count; ++i)
+    {
+        bool changed = localDirty[i] != 0;
+        if (changed)
+        {
+            localMatrices[i] = composeTransform(translations[i], rotations[i], scales[i]);
+            localDirty[i] = 0;
+        }
+
+        int parent = parents[i];
+        if (parent >= start && worldChanged[parent])
+        {
+            changed = true;
+        }
+        worldChanged[i] = changed;
+
+        if (changed)
+        {
+            worldMatrices[i] = parent >= 0 ? worldMatrices[parent] * localMatrices[i] : localMatrices[i];
+            changedNodes.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    firstDirty = SIZE_MAX;
+    ++version;
+    return !changedNodes.empty();
+}
+
+int SceneGraph::findNode(const std::string& name) const
+{
+    auto it = std::find(names.begin(), names.end(), name);
+    return it != names.end() ? static_cast<int>(it - names.begin()) : -1;
+}
+
+void SceneGraph::setTranslation(int node, const glm::vec3& translation)
+{
+    translations[node] = translation;
+    markDirty(node);
+}
+
+void SceneGraph::setRotation(int node, const glm::quat& rotation)
+{
+    rotations[node] = rotation;
+    markDirty(node);
+}
+
+void SceneGraph::setScale(int node, const glm::vec3& scale)
+{
+    scales[node] = scale;
+    markDirty(node);
+}
+
+void SceneGraph::setLocalTransform(int node, const glm::vec3& translation, const glm::quat& rotation,
+                                   const glm::vec3& scale)
+{
+    translations[node] = translation;
+    rotations[node] = rotation;
+    scales[node] = scale;
+    markDirty(node);
+}
+
+void SceneGraph::markDirty(int node)
+{
+    localDirty[node] = 1;
+    firstDirty = std::min(firstDirty, static_cast<size_t>(node));
+}
@@ -0,0 +1,73 @@
+﻿#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <tiny_gltf.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct SceneNodeDesc
+{
+    int parent = -1;
+    int mesh = -1;
+    glm::vec3 translation = glm::vec3(0.0f);
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+    std::string name;
+};
+
+// Node hierarchy stored as flat arrays sorted so every parent precedes its
+// children. Edits only flag the node; update() then walks the arrays once from
+// the first dirty node and recomputes world matrices for dirty subtrees only.
+class SceneGraph
+{
+public:
+    // Flattens the default scene (or all root nodes) breadth first, decomposing node matrices into TRS
+    static std::vector<SceneNodeDesc> collectNodes(const tinygltf::Model& model);
+
+    void build(const std::vector<SceneNodeDesc>& nodes); // nodes must be parent-sorted
+    void clear();
+
+    bool update(); // returns true when any world matrix changed
+
+    size_t getNodeCount() const { return parents.size(); }
+    int getParent(int node) const { return parents[node]; }
+    int getMesh(int node) const { return meshes[node]; }
+    const std::string& getName(int node) const { return names[node]; }
+    int findNode(const std::string& name) const;
+
+    const glm::vec3& getTranslation(int node) const { return translations[node]; }
+    const glm::quat& getRotation(int node) const { return rotations[node]; }
+    const glm::vec3& getScale(int node) const { return scales[node]; }
+    void setTranslation(int node, const glm::vec3& translation);
+    void setRotation(int node, const glm::quat& rotation);
+    void setScale(int node, const glm::vec3& scale);
+    void setLocalTransform(int node, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+
+    const glm::mat4& getWorldMatrix(int node) const { return worldMatrices[node]; }
+    const std::vector<int>& getDrawableNodes() const { return drawableNodes; }
+    const std::vector<uint32_t>& getChangedNodes() const { return changedNodes; } // from the last update()
+    uint64_t getVersion() const { return version; }
+
+private:
+    std::vector<int> parents;
+    std::vector<int> meshes;
+    std::vector<std::string> names;
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> localMatrices;
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<uint8_t> localDirty;
+    std::vector<uint8_t> worldChanged;
+    std::vector<int> drawableNodes;
+    std::vector<uint32_t> changedNodes;
+    size_t firstDirty = SIZE_MAX;
+    uint64_t version = 0;
+
+    void markDirty(int node);
+};
+
+#endif
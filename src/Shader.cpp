@@ -2,72 +2,565 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <vector>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "Light.h"
+#include "FrameUniforms.h"
+#include "Profiler.h"
+#include "ShaderCache.h"
 
-Shader::Shader(const std::string& vertexPath, const std::string& fragmentPath)
+namespace
 {
-    std::string vertexCode = readFile(vertexPath);
-    std::string fragmentCode = readFile(fragmentPath);
-    const char* vShaderCode = vertexCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
+    // Every constructed shader, so the main loop can poll compiles and hot reloads in one place
+    std::vector<Shader*>& getLiveShaders()
+    {
+        static std::vector<Shader*> shaders;
+        return shaders;
+    }
+
+    // Lets the driver compile on its own threads; checked once per context
+    bool hasParallelCompile()
+    {
+        static int available = -1;
+        if (available < 0)
+        {
+            available = 0;
+            if (GLEW_KHR_parallel_shader_compile)
+            {
+                glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+                available = 1;
+            }
+            else if (GLEW_ARB_parallel_shader_compile)
+            {
+                glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+                available = 1;
+            }
+        }
+        return available == 1;
+    }
+
+    std::string applyPreamble(const std::string& source, const std::string& preamble)
+    {
+        if (preamble.empty())
+        {
+            return source;
+        }
+
+        size_t bodyStart = 0;
+        if (source.compare(0, 8, "#version") == 0)
+        {
+            size_t lineEnd = source.find('\n');
+            bodyStart = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+        }
+        std::string versionLine = preamble.compare(0, 8, "#version") == 0 ? "" : source.substr(0, bodyStart);
 
-    GLuint vertex, fragment;
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    checkCompileErrors(vertex, "VERTEX");
+        // Keep compiler messages on the line numbers of the file
+        return versionLine + preamble + "#line " + std::to_string(bodyStart > 0 ? 2 : 1) + "\n" + source.substr(bodyStart);
+    }
 
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    checkCompileErrors(fragment, "FRAGMENT");
+    GLuint compileStage(GLenum stage, const std::string& source)
+    {
+        const char* code = source.c_str();
+        GLuint shader = glCreateShader(stage);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
 
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
+    void copyUniform(GLuint from, GLint source, GLint target, GLenum type)
+    {
+        GLfloat floats[16];
+        GLint value = 0;
+        switch (type)
+        {
+        case GL_FLOAT: glGetUniformfv(from, source, floats); glUniform1fv(target, 1, floats); break;
+        case GL_FLOAT_VEC2: glGetUniformfv(from, source, floats); glUniform2fv(target, 1, floats); break;
+        case GL_FLOAT_VEC3: glGetUniformfv(from, source, floats); glUniform3fv(target, 1, floats); break;
+        case GL_FLOAT_VEC4: glGetUniformfv(from, source, floats); glUniform4fv(target, 1, floats); break;
+        case GL_FLOAT_MAT3: glGetUniformfv(from, source, floats); glUniformMatrix3fv(target, 1, GL_FALSE, floats); break;
+        case GL_FLOAT_MAT4: glGetUniformfv(from, source, floats); glUniformMatrix4fv(target, 1, GL_FALSE, floats); break;
+        case GL_INT:
+        case GL_BOOL:
+        case GL_SAMPLER_2D:
+        case GL_SAMPLER_3D:
+        case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_ARRAY:
+            glGetUniformiv(from, source, &value);
+            glUniform1i(target, value);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Carries default-block uniform values (sampler units, toggles set once at startup) over to a reloaded program
+    void copyUniformValues(GLuint from, GLuint to)
+    {
+        GLint previous = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+        glUseProgram(to);
 
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+        GLint uniformCount = 0, maxNameLength = 0;
+        glGetProgramiv(to, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(to, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+        std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+        for (GLint i = 0; i < uniformCount; ++i)
+        {
+            GLint size;
+            GLenum type;
+            GLsizei length;
+            glGetActiveUniform(to, i, static_cast<GLsizei>(nameBuffer.size()), &length, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data(), length);
+            std::string base = name;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                base = name.substr(0, name.size() - 3);
+            }
+
+            for (GLint element = 0; element < size; ++element)
+            {
+                std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : name;
+                GLint source = glGetUniformLocation(from, elementName.c_str());
+                GLint target = glGetUniformLocation(to, elementName.c_str());
+                if (source >= 0 && target >= 0)
+                {
+                    copyUniform(from, source, target, type);
+                }
+            }
+        }
+
+        glUseProgram(static_cast<GLuint>(previous));
+    }
+
+    void deleteStage(GLuint program, GLuint& stage)
+    {
+        if (stage != 0)
+        {
+            glDetachShader(program, stage);
+            glDeleteShader(stage);
+            stage = 0;
+        }
+    }
+
+    void deleteStages(GLuint program, GLuint& vertex, GLuint& fragment, GLuint& compute)
+    {
+        deleteStage(program, vertex);
+        deleteStage(program, fragment);
+        deleteStage(program, compute);
+    }
+}
+
+Shader::Shader(const std::string& vertexPath, const std::string& fragmentPath, const std::string& fragmentPreamble)
+    : vertexPath(vertexPath), fragmentPath(fragmentPath), fragmentPreamble(fragmentPreamble),
+      lastReloadCheck(std::chrono::steady_clock::now())
+{
+    getLiveShaders().push_back(this);
+
+    std::error_code ec;
+    vertexTime = std::filesystem::last_write_time(vertexPath, ec);
+    fragmentTime = std::filesystem::last_write_time(fragmentPath, ec);
+
+    if (startCompile(pending))
+    {
+        ID = pending.program;
+    }
+}
+
+Shader::Shader(const std::string& computePath)
+    : computePath(computePath), lastReloadCheck(std::chrono::steady_clock::now())
+{
+    getLiveShaders().push_back(this);
+
+    std::error_code ec;
+    computeTime = std::filesystem::last_write_time(computePath, ec);
+
+    if (startCompile(pending))
+    {
+        ID = pending.program;
+    }
+}
+
+Shader::~Shader()
+{
+    // No GL calls here: the main shader outlives the context; call release() while it is current
+    std::vector<Shader*>& shaders = getLiveShaders();
+    shaders.erase(std::remove(shaders.begin(), shaders.end(), this), shaders.end());
 }
 
 void Shader::use()
 {
+    waitForFirstLink();
     glUseProgram(ID);
+    Profiler::get().addCounter(ProfileCounter::StateChanges);
+}
+
+void Shader::release()
+{
+    if (pending.program != 0)
+    {
+        deleteStages(pending.program, pending.vertex, pending.fragment, pending.compute);
+        if (pending.program != ID)
+        {
+            glDeleteProgram(pending.program);
+        }
+        pending = PendingProgram();
+    }
+    if (ID != 0)
+    {
+        glDeleteProgram(ID);
+        ID = 0;
+    }
+    linked = false;
+    uniformLocations.clear();
+    generation = 0;
+}
+
+bool Shader::isReady() const
+{
+    if (pending.program != 0 && pending.program == ID && !isComplete(pending))
+    {
+        return false;
+    }
+    waitForFirstLink();
+    return true;
+}
+
+bool Shader::isLinked() const
+{
+    waitForFirstLink();
+    return linked;
+}
+
+void Shader::reloadIfChanged()
+{
+    // Either the first link or a previous reload is still in flight
+    if (pending.program != 0)
+    {
+        return;
+    }
+
+    // Two stat calls per shader are cheap, but there is no reason to make them every frame
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastReloadCheck < std::chrono::milliseconds(500))
+    {
+        return;
+    }
+    lastReloadCheck = now;
+
+    if (!computePath.empty())
+    {
+        std::error_code computeError;
+        auto newComputeTime = std::filesystem::last_write_time(computePath, computeError);
+        if (computeError || newComputeTime == computeTime)
+        {
+            return;
+        }
+        computeTime = newComputeTime;
+    }
+    else
+    {
+        std::error_code vertexError, fragmentError;
+        auto newVertexTime = std::filesystem::last_write_time(vertexPath, vertexError);
+        auto newFragmentTime = std::filesystem::last_write_time(fragmentPath, fragmentError);
+        if (vertexError || fragmentError || (newVertexTime == vertexTime && newFragmentTime == fragmentTime))
+        {
+            return;
+        }
+        vertexTime = newVertexTime;
+        fragmentTime = newFragmentTime;
+    }
+
+    std::cout << "Reloading shader " << getName() << std::endl;
+    startCompile(pending);
+}
+
+bool Shader::updateAll(bool hotReload)
+{
+    bool changed = false;
+    for (Shader* shader : getLiveShaders())
+    {
+        if (shader->pending.program == 0)
+        {
+            if (hotReload)
+            {
+                shader->reloadIfChanged();
+            }
+        }
+        else if (shader->isComplete(shader->pending))
+        {
+            if (shader->pending.program == shader->ID)
+            {
+                shader->waitForFirstLink();
+            }
+            else
+            {
+                shader->swapInReload();
+            }
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool Shader::startCompile(PendingProgram& target)
+{
+    std::string vertexCode, fragmentCode, computeCode;
+    if (computePath.empty())
+    {
+        vertexCode = readFile(vertexPath);
+        fragmentCode = readFile(fragmentPath);
+        if (vertexCode.empty() || fragmentCode.empty())
+        {
+            return false;
+        }
+        fragmentCode = applyPreamble(fragmentCode, fragmentPreamble);
+    }
+    else
+    {
+        computeCode = readFile(computePath);
+        if (computeCode.empty())
+        {
+            return false;
+        }
+    }
+
+    target = PendingProgram();
+    target.started = std::chrono::steady_clock::now();
+    target.program = glCreateProgram();
+
+    ShaderCache& cache = ShaderCache::get();
+    target.cacheKey = cache.makeKey(computeCode.empty() ? vertexCode : computeCode, fragmentCode);
+    if (cache.load(target.cacheKey, target.program))
+    {
+        target.fromBinary = true;
+        return true;
+    }
+
+    // Status queries are left for finishCompile so the driver can work in the background
+    hasParallelCompile();
+    if (computeCode.empty())
+    {
+        target.vertex = compileStage(GL_VERTEX_SHADER, vertexCode);
+        target.fragment = compileStage(GL_FRAGMENT_SHADER, fragmentCode);
+        glAttachShader(target.program, target.vertex);
+        glAttachShader(target.program, target.fragment);
+    }
+    else
+    {
+        target.compute = compileStage(GL_COMPUTE_SHADER, computeCode);
+        glAttachShader(target.program, target.compute);
+    }
+    if (cache.isEnabled())
+    {
+        glProgramParameteri(target.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(target.program);
+    return true;
+}
+
+bool Shader::isComplete(const PendingProgram& target) const
+{
+    // Without the extension the status query in finishCompile simply blocks
+    if (target.fromBinary || !hasParallelCompile())
+    {
+        return true;
+    }
+    GLint complete = GL_FALSE;
+    glGetProgramiv(target.program, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
+}
+
+bool Shader::finishCompile(PendingProgram& target) const
+{
+    bool success = true;
+    if (!target.fromBinary)
+    {
+        if (target.compute != 0)
+        {
+            success = checkCompileErrors(target.compute, "COMPUTE");
+        }
+        else
+        {
+            success = checkCompileErrors(target.vertex, "VERTEX");
+            success = checkCompileErrors(target.fragment, "FRAGMENT") && success;
+        }
+        success = checkCompileErrors(target.program, "PROGRAM") && success;
+        deleteStages(target.program, target.vertex, target.fragment, target.compute);
+        if (success)
+        {
+            ShaderCache::get().store(target.cacheKey, target.program);
+        }
+    }
+
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - target.started).count();
+    std::cout << "Shader " << getName() << (success ? " ready after " : " failed after ") <<
+        milliseconds << " ms" << (target.fromBinary ? " (cached binary)" : "") << std::endl;
+    return success;
+}
+
+void Shader::waitForFirstLink() const
+{
+    if (pending.program == 0 || pending.program != ID)
+    {
+        return;
+    }
+    linked = finishCompile(pending);
+    pending = PendingProgram();
+    if (linked)
+    {
+        reflectUniforms();
+    }
+}
+
+void Shader::swapInReload()
+{
+    PendingProgram reload = pending;
+    pending = PendingProgram();
+    if (!finishCompile(reload))
+    {
+        glDeleteProgram(reload.program);
+        std::cerr << "Keeping the previous program for " << getName() << std::endl;
+        return;
+    }
+
+    if (ID != 0)
+    {
+        if (linked)
+        {
+            copyUniformValues(ID, reload.program);
+        }
+        glDeleteProgram(ID);
+    }
+    ID = reload.program;
+    linked = true;
+    reflectUniforms();
+}
+
+std::string Shader::getName() const
+{
+    return computePath.empty() ? vertexPath + " + " + fragmentPath : computePath;
+}
+
+GLint Shader::getUniformLocation(const std::string& name) const
+{
+    waitForFirstLink();
+    auto it = uniformLocations.find(name);
+    return it != uniformLocations.end() ? it->second : -1;
+}
+
+void Shader::set(UniformHandle<bool> handle, bool value) const
+{
+    glUniform1i(handle.location, (int)value);
+}
+
+void Shader::set(UniformHandle<int> handle, int value) const
+{
+    glUniform1i(handle.location, value);
+}
+
+void Shader::set(UniformHandle<float> handle, float value) const
+{
+    glUniform1f(handle.location, value);
+}
+
+void Shader::set(UniformHandle<glm::vec2> handle, const glm::vec2& value) const
+{
+    glUniform2fv(handle.location, 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::vec3> handle, const glm::vec3& value) const
+{
+    glUniform3fv(handle.location, 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::vec4> handle, const glm::vec4& value) const
+{
+    glUniform4fv(handle.location, 1, glm::value_ptr(value));
+}
+
+void Shader::set(UniformHandle<glm::mat4> handle, const glm::mat4& value) const
+{
+    glUniformMatrix4fv(handle.location, 1, GL_FALSE, glm::value_ptr(value));
 }
 
 void Shader::setBool(const std::string& name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    set(getUniform<bool>(name), value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    set(getUniform<int>(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    set(getUniform<float>(name), value);
 }
 
 void Shader::setVec3(const std::string& name, const glm::vec3& value) const
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    set(getUniform<glm::vec3>(name), value);
 }
 
-void Shader::setLight(const std::string& name, const Light& light) const
+void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
 {
-    setVec3(name + ".position", light.position);
-    setVec3(name + ".color", light.color);
+    set(getUniform<glm::mat4>(name), mat);
 }
 
-void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
+void Shader::reflectUniforms() const
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+    static uint64_t lastGeneration = 0;
+    generation = ++lastGeneration;
+    uniformLocations.clear();
+
+    GLint uniformCount = 0, maxNameLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+    for (GLint i = 0; i < uniformCount; ++i)
+    {
+        GLint size;
+        GLenum type;
+        GLsizei length;
+        glGetActiveUniform(ID, i, static_cast<GLsizei>(nameBuffer.size()), &length, &size, &type, nameBuffer.data());
+
+        // Block members have no location and are reached through their buffer instead
+        std::string name(nameBuffer.data(), length);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (location < 0)
+        {
+            continue;
+        }
+        uniformLocations[name] = location;
+
+        // Arrays are reported as "name[0]"; make the bare name resolve too
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+        {
+            uniformLocations[name.substr(0, name.size() - 3)] = location;
+        }
+    }
+
+    GLint blockCount = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+    for (GLint i = 0; i < blockCount; ++i)
+    {
+        GLint blockNameLength = 0;
+        glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_NAME_LENGTH, &blockNameLength);
+        std::vector<GLchar> blockName(std::max(blockNameLength, 1));
+        glGetActiveUniformBlockName(ID, i, blockNameLength, nullptr, blockName.data());
+
+        int binding = getUniformBlockBinding(blockName.data());
+        if (binding >= 0)
+        {
+            glUniformBlockBinding(ID, i, binding);
+        }
+        else
+        {
+            std::cerr << "Warning: Uniform block " << blockName.data() << " has no shared binding" << std::endl;
+        }
+    }
 }
 
 std::string Shader::readFile(const std::string& filePath)
@@ -83,7 +576,7 @@ std::string Shader::readFile(const std::string& filePath)
     return buffer.str();
 }
 
-void Shader::checkCompileErrors(GLuint shader, std::string type)
+bool Shader::checkCompileErrors(GLuint shader, std::string type) const
 {
     GLint success;
     GLchar infoLog[1024];
@@ -107,4 +600,5 @@ void Shader::checkCompileErrors(GLuint shader, std::string type)
                 "\n -- --------------------------------------------------- -- " << std::endl;
         }
     }
+    return success == GL_TRUE;
 }
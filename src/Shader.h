@@ -1,29 +1,134 @@
 ﻿#ifndef SHADER_H
 #define SHADER_H
 
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <string>
+#include <unordered_map>
 #include <GL/glew.h>
 #include <glm/fwd.hpp>
 
-#include "Light.h"
+// Location of an active uniform, resolved once and typed by the value it takes
+template <typename T>
+struct UniformHandle
+{
+    GLint location = -1;
+    bool isValid() const { return location >= 0; }
+};
 
 class Shader
 {
 public:
-    GLuint ID;
-    Shader(const std::string& vertexPath, const std::string& fragmentPath);
+    GLuint ID = 0;
+
+    // Loads a cached program binary or starts compiling without waiting for the driver.
+    // The first use() or uniform lookup waits for whatever is still outstanding.
+    // `fragmentPreamble` goes after the fragment shader's #version line, or replaces
+    // that line when it starts with its own #version (shader variants).
+    Shader(const std::string& vertexPath, const std::string& fragmentPath, const std::string& fragmentPreamble = "");
+    explicit Shader(const std::string& computePath); // compute program, cached and reloaded the same way
+    ~Shader();
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
 
     void use();
+    void release(); // deletes the program and any pending reload, the object stays registered
+
+    bool isReady() const; // never blocks with KHR/ARB_parallel_shader_compile
+    bool isLinked() const;
+
+    // Recompiles in the background once a source file changes on disk. The old program stays
+    // bound until the new one links and is kept when it fails; uniform values carry over.
+    void reloadIfChanged();
+
+    // Finishes completed compiles of every live shader and optionally polls their sources.
+    // True when a program finished linking or a reload was swapped in (the image may change).
+    static bool updateAll(bool hotReload);
+
+    template <typename T>
+    UniformHandle<T> getUniform(const std::string& name) const
+    {
+        return UniformHandle<T>{getUniformLocation(name)};
+    }
+    GLint getUniformLocation(const std::string& name) const;
+    // New for every link and hot reload, unique across shaders; 0 before the first link
+    uint64_t getProgramGeneration() const { return generation; }
+
+    void set(UniformHandle<bool> handle, bool value) const;
+    void set(UniformHandle<int> handle, int value) const;
+    void set(UniformHandle<float> handle, float value) const;
+    void set(UniformHandle<glm::vec2> handle, const glm::vec2& value) const;
+    void set(UniformHandle<glm::vec3> handle, const glm::vec3& value) const;
+    void set(UniformHandle<glm::vec4> handle, const glm::vec4& value) const;
+    void set(UniformHandle<glm::mat4> handle, const glm::mat4& value) const;
+
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
     void setFloat(const std::string& name, float value) const;
     void setVec3(const std::string& name, const glm::vec3& value) const;
-    void setLight(const std::string& name, const Light& light) const;
     void setMat4(const std::string& name, const glm::mat4& mat) const;
 
 private:
+    struct PendingProgram
+    {
+        GLuint program = 0;
+        GLuint vertex = 0;
+        GLuint fragment = 0;
+        GLuint compute = 0;
+        uint64_t cacheKey = 0;
+        bool fromBinary = false;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string fragmentPreamble;
+    std::string computePath; // set for compute programs, which have no vertex and fragment paths
+    std::filesystem::file_time_type vertexTime;
+    std::filesystem::file_time_type fragmentTime;
+    std::filesystem::file_time_type computeTime;
+    std::chrono::steady_clock::time_point lastReloadCheck;
+
+    // Lookups are const but have to wait for the first link, so that state is mutable
+    mutable PendingProgram pending;
+    mutable bool linked = false;
+    mutable std::unordered_map<std::string, GLint> uniformLocations;
+    mutable uint64_t generation = 0;
+
+    bool startCompile(PendingProgram& target);
+    bool isComplete(const PendingProgram& target) const;
+    bool finishCompile(PendingProgram& target) const;
+    void waitForFirstLink() const;
+    void swapInReload();
+    std::string getName() const;
+
     std::string readFile(const std::string& filePath);
-    void checkCompileErrors(GLuint shader, std::string type);
+    bool checkCompileErrors(GLuint shader, std::string type) const;
+    void reflectUniforms() const;
+};
+
+// A uniform looked up by name once and reused until the program is relinked or reloaded
+template <typename T>
+class CachedUniform
+{
+public:
+    explicit CachedUniform(const char* name) : name(name) {}
+
+    UniformHandle<T> get(const Shader& shader)
+    {
+        if (generation == 0 || shader.getProgramGeneration() != generation)
+        {
+            handle = shader.getUniform<T>(name);
+            generation = shader.getProgramGeneration();
+        }
+        return handle;
+    }
+
+private:
+    const char* name;
+    UniformHandle<T> handle;
+    uint64_t generation = 0;
 };
 
 #endif
@@ -0,0 +1,163 @@
+﻿#include "ShaderCache.h"
+#include "MeshCache.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    const uint32_t PROGRAM_BINARY_MAGIC = 0x42505247; // "GRPB"
+    const uint32_t PROGRAM_BINARY_VERSION = 1;
+
+    struct ProgramBinaryHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t binaryFormat;
+        uint32_t length;
+    };
+
+    std::string getGlString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? reinterpret_cast<const char*>(value) : "";
+    }
+}
+
+ShaderCache& ShaderCache::get()
+{
+    static ShaderCache instance;
+    return instance;
+}
+
+bool ShaderCache::isEnabled()
+{
+    if (supported < 0)
+    {
+        GLint formatCount = 0;
+        if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+        {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        }
+        supported = formatCount > 0 ? 1 : 0;
+        if (!supported)
+        {
+            std::cout << "Program binaries not supported by this driver, shaders always compile from source" << std::endl;
+        }
+    }
+    return enabled && supported == 1;
+}
+
+uint64_t ShaderCache::makeKey(const std::string& vertexSource, const std::string& fragmentSource)
+{
+    if (driverId.empty())
+    {
+        driverId = getGlString(GL_VENDOR) + "|" + getGlString(GL_RENDERER) + "|" + getGlString(GL_VERSION) + "|" +
+            getGlString(GL_SHADING_LANGUAGE_VERSION);
+    }
+
+    std::string keySource = vertexSource + '\0' + fragmentSource + '\0' + driverId;
+    return hashBytes(reinterpret_cast<const unsigned char*>(keySource.data()), keySource.size());
+}
+
+bool ShaderCache::load(uint64_t key, GLuint program)
+{
+    if (!isEnabled())
+    {
+        return false;
+    }
+
+    std::string path = getEntryPath(key);
+    std::ifstream in(path, std::ios::binary);
+    ProgramBinaryHeader header = {};
+    if (!in.is_open() || !in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != PROGRAM_BINARY_MAGIC || header.version != PROGRAM_BINARY_VERSION || header.key != key)
+    {
+        ++misses;
+        return false;
+    }
+
+    std::vector<char> binary(header.length);
+    if (!in.read(binary.data(), static_cast<std::streamsize>(binary.size())))
+    {
+        ++misses;
+        return false;
+    }
+    in.close();
+
+    // Loading a binary is a link without the compile; the driver may still refuse it
+    glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        ++rejects;
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return false;
+    }
+
+    ++hits;
+    return true;
+}
+
+void ShaderCache::store(uint64_t key, GLuint program)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+    {
+        return;
+    }
+
+    ProgramBinaryHeader header = {};
+    header.magic = PROGRAM_BINARY_MAGIC;
+    header.version = PROGRAM_BINARY_VERSION;
+    header.key = key;
+    std::vector<char> binary(length);
+    GLsizei written = 0;
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+    {
+        return;
+    }
+    header.binaryFormat = format;
+    header.length = static_cast<uint32_t>(written);
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    std::string path = getEntryPath(key);
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(binary.data(), written);
+        if (!out.good())
+        {
+            std::cerr << "Failed to write program binary: " << tempPath << std::endl;
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(tempPath, ec);
+    }
+}
+
+std::string ShaderCache::getEntryPath(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(directory) / name).string();
+}
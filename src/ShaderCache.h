@@ -0,0 +1,42 @@
+﻿#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Linked program binaries on disk (glGetProgramBinary/glProgramBinary). Entries are
+// keyed by the shader sources plus the driver's vendor, renderer and version
+// strings, so a driver update simply misses; binaries the driver still rejects
+// are deleted and the caller compiles from source. GL thread only.
+class ShaderCache
+{
+public:
+    static ShaderCache& get();
+
+    void setDirectory(const std::string& path) { directory = path; }
+    void setEnabled(bool enable) { enabled = enable; }
+    bool isEnabled(); // also false when the driver offers no binary formats
+
+    uint64_t makeKey(const std::string& vertexSource, const std::string& fragmentSource);
+    bool load(uint64_t key, GLuint program);  // program must be freshly created and unlinked
+    void store(uint64_t key, GLuint program); // program must be linked
+
+    size_t getHitCount() const { return hits; }
+    size_t getMissCount() const { return misses; }
+    size_t getRejectCount() const { return rejects; }
+
+private:
+    std::string directory = "shader_cache";
+    std::string driverId;
+    bool enabled = true;
+    int supported = -1; // -1 until the context has been queried
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t rejects = 0;
+
+    std::string getEntryPath(uint64_t key) const;
+};
+
+#endif
@@ -0,0 +1,107 @@
+﻿#include "StagingRing.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+StagingRing::StagingRing(size_t segmentSize, int segmentCount)
+    : segmentSize(segmentSize),
+      fences(static_cast<size_t>(segmentCount), nullptr)
+{
+    if (!(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage))
+    {
+        return;
+    }
+
+    // Coherent, so writes through the pointer are visible to copies issued after them without a flush
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr capacity = static_cast<GLsizeiptr>(segmentSize * fences.size());
+    glGenBuffers(1, &ring);
+    glBindBuffer(GL_COPY_READ_BUFFER, ring);
+    glBufferStorage(GL_COPY_READ_BUFFER, capacity, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    if (!mapped)
+    {
+        std::cerr << "Failed to map the staging ring, uploading with glBufferSubData" << std::endl;
+        glDeleteBuffers(1, &ring);
+        ring = 0;
+    }
+}
+
+StagingRing::~StagingRing()
+{
+    for (GLsync fence : fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+    }
+    if (ring)
+    {
+        // Copies still in flight keep their source alive; GL defers the delete
+        glBindBuffer(GL_COPY_READ_BUFFER, ring);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &ring);
+    }
+}
+
+void StagingRing::upload(GLuint buffer, size_t offset, const void* data, size_t size)
+{
+    PROFILE_ZONE("StagingRing::upload");
+    const unsigned char* source = static_cast<const unsigned char*>(data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (mapped)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, ring);
+    }
+
+    for (size_t done = 0; done < size;)
+    {
+        size_t piece = std::min(segmentSize, size - done);
+        if (mapped)
+        {
+            size_t segment = nextSegment;
+            nextSegment = (nextSegment + 1) % fences.size();
+            waitForSegment(segment);
+            std::memcpy(mapped + segment * segmentSize, source + done, piece);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(segment * segmentSize),
+                                static_cast<GLintptr>(offset + done), static_cast<GLsizeiptr>(piece));
+            fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        else
+        {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(offset + done), static_cast<GLsizeiptr>(piece),
+                            source + done);
+        }
+        done += piece;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void StagingRing::waitForSegment(size_t segment)
+{
+    GLsync fence = fences[segment];
+    if (!fence)
+    {
+        return;
+    }
+
+    // The first wait flushes so the fence is guaranteed to signal
+    GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;)
+    {
+        GLenum result = glClientWaitSync(fence, waitFlags, 100000000); // 100 ms
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+        {
+            break;
+        }
+        waitFlags = 0;
+    }
+    glDeleteSync(fence);
+    fences[segment] = nullptr;
+}
@@ -0,0 +1,36 @@
+﻿#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+
+// Persistently mapped staging memory (ARB_buffer_storage) for streaming large
+// uploads in bounded pieces. The ring is split into segments, each guarded by a
+// fence, so a segment is only rewritten once the GPU copy that read it is done and
+// the driver never needs a staging copy of a whole multi-GB buffer. Without buffer
+// storage the same pieces go through glBufferSubData.
+class StagingRing
+{
+public:
+    explicit StagingRing(size_t segmentSize = 4 * 1024 * 1024, int segmentCount = 4);
+    ~StagingRing();
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    bool isPersistent() const { return mapped != nullptr; }
+
+    // Copies into an existing buffer; leaves GL_COPY_READ_BUFFER and GL_COPY_WRITE_BUFFER unbound
+    void upload(GLuint buffer, size_t offset, const void* data, size_t size);
+
+private:
+    GLuint ring = 0;
+    unsigned char* mapped = nullptr;
+    size_t segmentSize;
+    std::vector<GLsync> fences; // one per segment, null when the segment is free
+    size_t nextSegment = 0;
+
+    void waitForSegment(size_t segment);
+};
+
+#endif
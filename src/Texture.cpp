@@ -1,5 +1,8 @@
 ﻿#include <stb_image.h>
 #include "Texture.h"
+#include "TextureCompression.h"
+#include "Profiler.h"
+#include <algorithm>
 #include <iostream>
 
 GLuint createTexture(const tinygltf::Image& image)
@@ -16,6 +19,15 @@ GLuint createTexture(const tinygltf::Image& image)
     std::cout << "Creating texture from image: width = " << image.width << ", height = " << image.height << ", size = "
         << image.image.size() << std::endl;
 
+    return createTexture(image.width, image.height, image.component, image.image.data());
+}
+
+GLuint createTexture(int width, int height, int component, const unsigned char* pixels)
+{
+    PROFILE_ZONE("createTexture");
+    PROFILE_GPU_ZONE("createTexture");
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, static_cast<uint64_t>(width) * height * component);
+
     // Generate and bind the texture
     GLuint textureID;
     glGenTextures(1, &textureID);
@@ -23,13 +35,13 @@ GLuint createTexture(const tinygltf::Image& image)
 
     // Determine the format
     GLenum format = GL_RGBA;
-    if (image.component == 3)
+    if (component == 3)
     {
         format = GL_RGB;
     }
 
     // Create the texture
-    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, &image.image[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
 
     // Check for OpenGL errors
     GLenum error = glGetError();
@@ -60,29 +72,113 @@ GLuint createTexture(const tinygltf::Image& image)
     return textureID;
 }
 
-GLuint loadCubeMap(const std::vector<std::string>& faces)
+GLuint createTexture(GLenum format, int width, int height, int levelCount, const unsigned char* data)
 {
+    PROFILE_ZONE("createTexture");
+    PROFILE_GPU_ZONE("createTexture");
+    if (!isTextureFormatSupported(format))
+    {
+        std::cerr << "Error: Texture format 0x" << std::hex << format << std::dec << " is not supported by this context"
+            << std::endl;
+        return 0;
+    }
+
     GLuint textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
+    // Mips come precomputed, so no glGenerateMipmap
+    size_t offset = 0;
+    for (int level = 0; level < levelCount; ++level)
     {
-        std::cout << "Loading cubemap texture at path: " << faces[i] << std::endl;
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
+        int levelWidth = std::max(1, width >> level);
+        int levelHeight = std::max(1, height >> level);
+        size_t levelSize = getLevelSize(format, levelWidth, levelHeight);
+        if (isCompressedFormat(format))
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                         0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, format, levelWidth, levelHeight, 0,
+                                   static_cast<GLsizei>(levelSize), data + offset);
         }
         else
         {
-            std::cerr << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            std::cerr << "stbi_load error: " << stbi_failure_reason() << std::endl; // Print the reason for failure
-            stbi_image_free(data);
+            glTexImage2D(GL_TEXTURE_2D, level, format, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         data + offset);
+        }
+        offset += levelSize;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, offset);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        std::cerr << "OpenGL error after uploading compressed texture: " << error << std::endl;
+        glDeleteTextures(1, &textureID);
+        return 0;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(levelCount - 1, 0));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return textureID;
+}
+
+size_t estimateTextureBytes(int width, int height, bool mipmapped)
+{
+    // Drivers store RGB8 padded to four bytes, so both formats cost the same
+    size_t bytes = static_cast<size_t>(width) * height * 4;
+    return mipmapped ? bytes * 4 / 3 : bytes;
+}
+
+bool decodeImageFile(const std::string& path, ImageData& image)
+{
+    std::cout << "Loading cubemap texture at path: " << path << std::endl;
+    int width, height, nrChannels;
+    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+    if (!data)
+    {
+        std::cerr << "Cubemap texture failed to load at path: " << path << std::endl;
+        std::cerr << "stbi_load error: " << stbi_failure_reason() << std::endl; // Print the reason for failure
+        return false;
+    }
+
+    image.width = width;
+    image.height = height;
+    image.component = nrChannels;
+    image.pixels.assign(data, data + static_cast<size_t>(width) * height * nrChannels);
+    stbi_image_free(data);
+    return true;
+}
+
+GLuint loadCubeMap(const std::vector<std::string>& faces)
+{
+    std::vector<ImageData> images(faces.size());
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        decodeImageFile(faces[i], images[i]);
+    }
+    return createCubeMap(images);
+}
+
+GLuint createCubeMap(const std::vector<ImageData>& faces)
+{
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+    for (unsigned int i = 0; i < faces.size(); i++)
+    {
+        const ImageData& face = faces[i];
+        if (face.pixels.empty())
+        {
+            continue;
         }
+        GLenum format = face.component == 4 ? GL_RGBA : GL_RGB;
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                     0, GL_RGB, face.width, face.height, 0, format, GL_UNSIGNED_BYTE, face.pixels.data());
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
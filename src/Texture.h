@@ -6,7 +6,23 @@
 #include <string>
 #include <vector>
 
+struct ImageData
+{
+    int width = 0;
+    int height = 0;
+    int component = 0;
+    std::vector<unsigned char> pixels;
+};
+
 GLuint createTexture(const tinygltf::Image& image);
+GLuint createTexture(int width, int height, int component, const unsigned char* pixels);
+// Uploads a precomputed mip chain (tightly packed, largest level first); block formats go through glCompressedTexImage2D
+GLuint createTexture(GLenum format, int width, int height, int levelCount, const unsigned char* data);
+size_t estimateTextureBytes(int width, int height, bool mipmapped);
+
+// decodeImageFile touches no GL state and may run on any thread
+bool decodeImageFile(const std::string& path, ImageData& image);
+GLuint createCubeMap(const std::vector<ImageData>& faces);
 GLuint loadCubeMap(const std::vector<std::string>& faces);
 
 #endif
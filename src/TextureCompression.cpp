@@ -0,0 +1,1147 @@
+﻿#include "TextureCompression.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    const size_t KTX2_HEADER_SIZE = 80;
+    const size_t KTX2_LEVEL_ENTRY_SIZE = 24;
+
+    struct FormatInfo
+    {
+        GLenum glFormat;
+        uint32_t vkFormat;
+        uint32_t blockBytes; // bytes per 4x4 block, or per texel for uncompressed formats
+        bool compressed;
+        bool srgb;
+    };
+
+    const FormatInfo FORMATS[] = {
+        { GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 131, 8, true, false },
+        { GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 132, 8, true, true },
+        { GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 133, 8, true, false },
+        { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 134, 8, true, true },
+        { GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 137, 16, true, false },
+        { GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 138, 16, true, true },
+        { GL_COMPRESSED_RED_RGTC1, 139, 8, true, false },
+        { GL_COMPRESSED_RG_RGTC2, 141, 16, true, false },
+        { GL_COMPRESSED_RGBA_BPTC_UNORM, 145, 16, true, false },
+        { GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 146, 16, true, true },
+        { GL_RGBA8, 37, 4, false, false },
+        { GL_SRGB8_ALPHA8, 43, 4, false, true },
+    };
+
+    const FormatInfo* findFormat(GLenum glFormat)
+    {
+        for (const FormatInfo& info : FORMATS)
+        {
+            if (info.glFormat == glFormat)
+            {
+                return &info;
+            }
+        }
+        return nullptr;
+    }
+
+    const FormatInfo* findVkFormat(uint32_t vkFormat)
+    {
+        for (const FormatInfo& info : FORMATS)
+        {
+            if (info.vkFormat == vkFormat)
+            {
+                return &info;
+            }
+        }
+        return nullptr;
+    }
+
+    int getLevelDimension(int size, int level)
+    {
+        return std::max(1, size >> level);
+    }
+
+    uint32_t readU32(const unsigned char* data)
+    {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint64_t readU64(const unsigned char* data)
+    {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    // Largest eigenvector of the covariance of `count`-channel texels, by power iteration
+    template <int N>
+    void principalAxis(const float (&points)[16][N], float (&mean)[N], float (&axis)[N])
+    {
+        for (int c = 0; c < N; ++c)
+        {
+            mean[c] = 0.0f;
+            for (int i = 0; i < 16; ++i)
+            {
+                mean[c] += points[i][c];
+            }
+            mean[c] /= 16.0f;
+        }
+
+        float covariance[N][N] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int a = 0; a < N; ++a)
+            {
+                for (int b = 0; b < N; ++b)
+                {
+                    covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+                }
+            }
+        }
+
+        for (int c = 0; c < N; ++c)
+        {
+            axis[c] = 1.0f;
+        }
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[N] = {};
+            float length = 0.0f;
+            for (int a = 0; a < N; ++a)
+            {
+                for (int b = 0; b < N; ++b)
+                {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length += next[a] * next[a];
+            }
+            if (length < 1e-12f)
+            {
+                break; // flat block, any axis will do
+            }
+            length = std::sqrt(length);
+            for (int c = 0; c < N; ++c)
+            {
+                axis[c] = next[c] / length;
+            }
+        }
+    }
+
+    uint16_t packRgb565(const float* color)
+    {
+        int r = std::clamp(static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+        int g = std::clamp(static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+        int b = std::clamp(static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    void unpackRgb565(uint16_t packed, int* color)
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // BC1 colour half, always in four-colour mode so it is also valid inside BC3
+    void encodeColorBlock(const unsigned char* block, unsigned char* out)
+    {
+        float points[16][3];
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                points[i][c] = block[i * 4 + c];
+            }
+        }
+
+        float mean[3], axis[3];
+        principalAxis(points, mean, axis);
+        float minT = 0.0f, maxT = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < 3; ++c)
+            {
+                t += (points[i][c] - mean[c]) * axis[c];
+            }
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        // Inset the endpoints a little so the interpolated colours cover the block evenly
+        float inset = (maxT - minT) / 16.0f;
+        float endpoints[2][3];
+        for (int c = 0; c < 3; ++c)
+        {
+            endpoints[0][c] = std::clamp(mean[c] + axis[c] * (maxT - inset), 0.0f, 255.0f);
+            endpoints[1][c] = std::clamp(mean[c] + axis[c] * (minT + inset), 0.0f, 255.0f);
+        }
+
+        uint16_t color0 = packRgb565(endpoints[0]);
+        uint16_t color1 = packRgb565(endpoints[1]);
+        if (color0 < color1)
+        {
+            std::swap(color0, color1);
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1)
+        {
+            int palette[4][3];
+            unpackRgb565(color0, palette[0]);
+            unpackRgb565(color1, palette[1]);
+            for (int c = 0; c < 3; ++c)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int bestIndex = 0, bestError = INT32_MAX;
+                for (int p = 0; p < 4; ++p)
+                {
+                    int error = 0;
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        int d = block[i * 4 + c] - palette[p][c];
+                        error += d * d;
+                    }
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        bestIndex = p;
+                    }
+                }
+                indices |= static_cast<uint32_t>(bestIndex) << (i * 2);
+            }
+        }
+
+        std::memcpy(out, &color0, 2);
+        std::memcpy(out + 2, &color1, 2);
+        std::memcpy(out + 4, &indices, 4);
+    }
+
+    // BC4 single channel block in the eight-value mode
+    void encodeChannelBlock(const unsigned char* block, int channel, unsigned char* out)
+    {
+        int low = 255, high = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            low = std::min<int>(low, block[i * 4 + channel]);
+            high = std::max<int>(high, block[i * 4 + channel]);
+        }
+
+        out[0] = static_cast<unsigned char>(high);
+        out[1] = static_cast<unsigned char>(low);
+        uint64_t indices = 0;
+        if (high != low)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                // Step along the ramp from high (index 0) to low (index 1); the steps between map to indices 2..7
+                int step = (7 * (high - block[i * 4 + channel]) + (high - low) / 2) / (high - low);
+                uint64_t index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+                indices |= index << (i * 3);
+            }
+        }
+        for (int b = 0; b < 6; ++b)
+        {
+            out[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+        }
+    }
+
+    const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    // Mode 6 endpoints: 7 bits per channel plus one shared p-bit per endpoint
+    struct Bc7Endpoints
+    {
+        int value[2][4];
+        int pBit[2];
+    };
+
+    void quantizeBc7Endpoint(const float* endpoint, int* value, int& pBit)
+    {
+        float bestError = 1e30f;
+        for (int p = 0; p < 2; ++p)
+        {
+            int candidate[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; ++c)
+            {
+                candidate[c] = std::clamp(static_cast<int>(std::lround((endpoint[c] - p) / 2.0f)), 0, 127);
+                float d = static_cast<float>((candidate[c] << 1) | p) - endpoint[c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pBit = p;
+                std::memcpy(value, candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    int assignBc7Indices(const unsigned char* block, const Bc7Endpoints& endpoints, int* indices)
+    {
+        int palette[16][4];
+        for (int c = 0; c < 4; ++c)
+        {
+            int e0 = (endpoints.value[0][c] << 1) | endpoints.pBit[0];
+            int e1 = (endpoints.value[1][c] << 1) | endpoints.pBit[1];
+            for (int i = 0; i < 16; ++i)
+            {
+                palette[i][c] = ((64 - BC7_WEIGHTS4[i]) * e0 + BC7_WEIGHTS4[i] * e1 + 32) >> 6;
+            }
+        }
+
+        int totalError = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int bestIndex = 0, bestError = INT32_MAX;
+            for (int p = 0; p < 16; ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; ++c)
+                {
+                    int d = block[i * 4 + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestIndex = p;
+                }
+            }
+            indices[i] = bestIndex;
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+    struct BitWriter
+    {
+        unsigned char* out;
+        int position = 0;
+
+        void write(uint32_t value, int bits)
+        {
+            for (int b = 0; b < bits; ++b, ++position)
+            {
+                if ((value >> b) & 1)
+                {
+                    out[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+                }
+            }
+        }
+    };
+
+    struct BitReader
+    {
+        const unsigned char* in;
+        int position = 0;
+
+        uint32_t read(int bits)
+        {
+            uint32_t value = 0;
+            for (int b = 0; b < bits; ++b, ++position)
+            {
+                value |= static_cast<uint32_t>((in[position >> 3] >> (position & 7)) & 1) << b;
+            }
+            return value;
+        }
+    };
+
+    // BC1 colour half; inside BC3 the three-colour mode does not exist
+    void decodeColorBlock(const unsigned char* in, unsigned char* out, bool allowThreeColor)
+    {
+        uint16_t color0, color1;
+        uint32_t indices;
+        std::memcpy(&color0, in, 2);
+        std::memcpy(&color1, in + 2, 2);
+        std::memcpy(&indices, in + 4, 4);
+
+        int palette[4][4];
+        unpackRgb565(color0, palette[0]);
+        unpackRgb565(color1, palette[1]);
+        bool threeColor = allowThreeColor && color0 <= color1;
+        for (int c = 0; c < 3; ++c)
+        {
+            if (threeColor)
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+            else
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+        }
+        palette[0][3] = palette[1][3] = palette[2][3] = 255;
+        palette[3][3] = threeColor ? 0 : 255;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            const int* color = palette[(indices >> (i * 2)) & 3];
+            for (int c = 0; c < 4; ++c)
+            {
+                out[i * 4 + c] = static_cast<unsigned char>(color[c]);
+            }
+        }
+    }
+
+    void decodeChannelBlock(const unsigned char* in, int channel, unsigned char* out)
+    {
+        int ramp[8] = { in[0], in[1] };
+        for (int step = 1; step < 7; ++step)
+        {
+            if (ramp[0] > ramp[1])
+            {
+                ramp[step + 1] = ((7 - step) * ramp[0] + step * ramp[1]) / 7;
+            }
+            else if (step < 5)
+            {
+                ramp[step + 1] = ((5 - step) * ramp[0] + step * ramp[1]) / 5;
+            }
+        }
+        if (ramp[0] <= ramp[1])
+        {
+            ramp[6] = 0;
+            ramp[7] = 255;
+        }
+
+        uint64_t indices = 0;
+        for (int b = 0; b < 6; ++b)
+        {
+            indices |= static_cast<uint64_t>(in[2 + b]) << (b * 8);
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            out[i * 4 + channel] = static_cast<unsigned char>(ramp[(indices >> (i * 3)) & 7]);
+        }
+    }
+
+    using BlockEncoder = void (*)(const unsigned char*, unsigned char*);
+
+    BlockEncoder getBlockEncoder(GLenum format)
+    {
+        switch (format)
+        {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            return encodeBlockBC1;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return encodeBlockBC3;
+        case GL_COMPRESSED_RG_RGTC2:
+            return encodeBlockBC5;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            return encodeBlockBC7;
+        default:
+            return nullptr;
+        }
+    }
+
+    using BlockDecoder = void (*)(const unsigned char*, unsigned char*);
+
+    void decodeBlockBC1Alpha(const unsigned char* block, unsigned char* out)
+    {
+        decodeColorBlock(block, out, true);
+    }
+
+    void decodeBlockBC4(const unsigned char* block, unsigned char* out)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            out[i * 4 + 1] = out[i * 4 + 2] = 0;
+            out[i * 4 + 3] = 255;
+        }
+        decodeChannelBlock(block, 0, out);
+    }
+
+    BlockDecoder getBlockDecoder(GLenum format)
+    {
+        switch (format)
+        {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            return decodeBlockBC1;
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            return decodeBlockBC1Alpha;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return decodeBlockBC3;
+        case GL_COMPRESSED_RED_RGTC1:
+            return decodeBlockBC4;
+        case GL_COMPRESSED_RG_RGTC2:
+            return decodeBlockBC5;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return decodeBlockBC7;
+        default:
+            return nullptr;
+        }
+    }
+
+    // Next mip from the previous one with a 2x2 box filter; normal maps are renormalised
+    void downsample(const unsigned char* source, int width, int height, TextureUsage usage,
+                    std::vector<unsigned char>& result)
+    {
+        int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+        result.resize(static_cast<size_t>(nextWidth) * nextHeight * 4);
+        for (int y = 0; y < nextHeight; ++y)
+        {
+            for (int x = 0; x < nextWidth; ++x)
+            {
+                float sum[4] = {};
+                for (int dy = 0; dy < 2; ++dy)
+                {
+                    for (int dx = 0; dx < 2; ++dx)
+                    {
+                        int sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+                        const unsigned char* texel = source + (static_cast<size_t>(sy) * width + sx) * 4;
+                        for (int c = 0; c < 4; ++c)
+                        {
+                            sum[c] += usage == TextureUsage::Normal && c < 3 ? texel[c] / 127.5f - 1.0f : texel[c];
+                        }
+                    }
+                }
+
+                unsigned char* texel = result.data() + (static_cast<size_t>(y) * nextWidth + x) * 4;
+                if (usage == TextureUsage::Normal)
+                {
+                    float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        float n = length > 0.0f ? sum[c] / length : (c == 2 ? 1.0f : 0.0f);
+                        texel[c] = static_cast<unsigned char>(std::clamp((n + 1.0f) * 127.5f + 0.5f, 0.0f, 255.0f));
+                    }
+                    texel[3] = static_cast<unsigned char>(sum[3] / 4.0f + 0.5f);
+                }
+                else
+                {
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        texel[c] = static_cast<unsigned char>(sum[c] / 4.0f + 0.5f);
+                    }
+                }
+            }
+        }
+    }
+
+    struct DfdSample
+    {
+        uint32_t bitOffset;
+        uint32_t bitLength;
+        uint32_t channel;
+        uint32_t upper;
+    };
+
+    // Basic data format descriptor (KDF 1.3) for the formats this file writes
+    std::vector<uint32_t> buildDataFormatDescriptor(const FormatInfo& info)
+    {
+        const uint32_t full = 0xFFFFFFFFu;
+        uint32_t colorModel = 1; // RGBSDA
+        std::vector<DfdSample> samples;
+        switch (info.glFormat)
+        {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            colorModel = 128;
+            samples = { { 0, 64, 0, full } };
+            break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+            colorModel = 128;
+            samples = { { 0, 64, 1, full } };
+            break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            colorModel = 130;
+            samples = { { 0, 64, 15, full }, { 64, 64, 0, full } };
+            break;
+        case GL_COMPRESSED_RED_RGTC1:
+            colorModel = 131;
+            samples = { { 0, 64, 0, full } };
+            break;
+        case GL_COMPRESSED_RG_RGTC2:
+            colorModel = 132;
+            samples = { { 0, 64, 0, full }, { 64, 64, 1, full } };
+            break;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            colorModel = 134;
+            samples = { { 0, 128, 0, full } };
+            break;
+        default:
+            samples = { { 0, 8, 0, 255 }, { 8, 8, 1, 255 }, { 16, 8, 2, 255 }, { 24, 8, 15, 255 } };
+            break;
+        }
+
+        uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+        std::vector<uint32_t> words;
+        words.push_back(4 + blockSize);
+        words.push_back(0); // Khronos vendor, basic descriptor type
+        words.push_back(2 | (blockSize << 16));
+        words.push_back(colorModel | (1u << 8) | ((info.srgb ? 2u : 1u) << 16));
+        words.push_back(info.compressed ? (3u | (3u << 8)) : 0u);
+        words.push_back(info.blockBytes);
+        words.push_back(0);
+        for (const DfdSample& sample : samples)
+        {
+            // Alpha stays linear in sRGB formats
+            uint32_t qualifiers = info.srgb && sample.channel == 15 ? 0x10u : 0u;
+            words.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | ((sample.channel | qualifiers) << 24));
+            words.push_back(0);
+            words.push_back(0);
+            words.push_back(sample.upper);
+        }
+        return words;
+    }
+}
+
+bool isCompressedFormat(GLenum format)
+{
+    const FormatInfo* info = findFormat(format);
+    return info && info->compressed;
+}
+
+bool isTextureFormatSupported(GLenum format)
+{
+    switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return GLEW_EXT_texture_compression_s3tc;
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_RG_RGTC2:
+        return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+    case GL_RGBA8:
+    case GL_SRGB8_ALPHA8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t getLevelSize(GLenum format, int width, int height)
+{
+    const FormatInfo* info = findFormat(format);
+    if (!info)
+    {
+        return 0;
+    }
+    if (!info->compressed)
+    {
+        return static_cast<size_t>(width) * height * info->blockBytes;
+    }
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * info->blockBytes;
+}
+
+size_t getTextureImageSize(GLenum format, int width, int height, int levelCount)
+{
+    size_t size = 0;
+    for (int level = 0; level < levelCount; ++level)
+    {
+        size += getLevelSize(format, getLevelDimension(width, level), getLevelDimension(height, level));
+    }
+    return size;
+}
+
+int getMipLevelCount(int width, int height)
+{
+    int levels = 1;
+    for (int size = std::max(width, height); size > 1; size >>= 1)
+    {
+        ++levels;
+    }
+    return levels;
+}
+
+GLenum chooseTextureFormat(TextureUsage usage, bool hasAlpha)
+{
+    if (usage == TextureUsage::Normal && isTextureFormatSupported(GL_COMPRESSED_RG_RGTC2))
+    {
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+    if (isTextureFormatSupported(GL_COMPRESSED_RGBA_BPTC_UNORM))
+    {
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    if (isTextureFormatSupported(GL_COMPRESSED_RGBA_S3TC_DXT5_EXT))
+    {
+        return hasAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    }
+    return GL_RGBA8;
+}
+
+bool compressTexture(const unsigned char* rgba, int width, int height, TextureUsage usage, GLenum format,
+                     TextureImage& result, ThreadPool* pool)
+{
+    BlockEncoder encoder = getBlockEncoder(format);
+    if (width <= 0 || height <= 0 || (!encoder && format != GL_RGBA8))
+    {
+        std::cerr << "Cannot compress " << width << "x" << height << " texture to format 0x" << std::hex << format
+            << std::dec << std::endl;
+        return false;
+    }
+
+    result.format = format;
+    result.width = width;
+    result.height = height;
+    result.levelCount = getMipLevelCount(width, height);
+    result.data.assign(getTextureImageSize(format, width, height, result.levelCount), 0);
+
+    std::vector<unsigned char> level(rgba, rgba + static_cast<size_t>(width) * height * 4);
+    std::vector<unsigned char> nextLevel;
+    size_t levelOffset = 0;
+    for (int mip = 0; mip < result.levelCount; ++mip)
+    {
+        int levelWidth = getLevelDimension(width, mip), levelHeight = getLevelDimension(height, mip);
+        unsigned char* out = result.data.data() + levelOffset;
+        if (!encoder)
+        {
+            std::memcpy(out, level.data(), level.size());
+        }
+        else
+        {
+            int blocksX = (levelWidth + 3) / 4, blocksY = (levelHeight + 3) / 4;
+            size_t blockBytes = findFormat(format)->blockBytes;
+            auto encodeRow = [&](size_t row)
+            {
+                unsigned char block[64];
+                for (int bx = 0; bx < blocksX; ++bx)
+                {
+                    // Edge blocks repeat the last row/column
+                    for (int y = 0; y < 4; ++y)
+                    {
+                        int sy = std::min(static_cast<int>(row) * 4 + y, levelHeight - 1);
+                        for (int x = 0; x < 4; ++x)
+                        {
+                            int sx = std::min(bx * 4 + x, levelWidth - 1);
+                            std::memcpy(block + (y * 4 + x) * 4,
+                                        level.data() + (static_cast<size_t>(sy) * levelWidth + sx) * 4, 4);
+                        }
+                    }
+                    encoder(block, out + (row * blocksX + bx) * blockBytes);
+                }
+            };
+
+            if (pool)
+            {
+                pool->parallelFor(static_cast<size_t>(blocksY), encodeRow);
+            }
+            else
+            {
+                for (int row = 0; row < blocksY; ++row)
+                {
+                    encodeRow(row);
+                }
+            }
+        }
+
+        levelOffset += getLevelSize(format, levelWidth, levelHeight);
+        if (mip + 1 < result.levelCount)
+        {
+            downsample(level.data(), levelWidth, levelHeight, usage, nextLevel);
+            level.swap(nextLevel);
+        }
+    }
+    return true;
+}
+
+void encodeBlockBC1(const unsigned char* block, unsigned char* out)
+{
+    encodeColorBlock(block, out);
+}
+
+void encodeBlockBC3(const unsigned char* block, unsigned char* out)
+{
+    encodeChannelBlock(block, 3, out);
+    encodeColorBlock(block, out + 8);
+}
+
+void encodeBlockBC5(const unsigned char* block, unsigned char* out)
+{
+    encodeChannelBlock(block, 0, out);
+    encodeChannelBlock(block, 1, out + 8);
+}
+
+void encodeBlockBC7(const unsigned char* block, unsigned char* out)
+{
+    // Mode 6 only: one RGBA line segment with 4-bit indices, refined by least squares
+    float points[16][4];
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            points[i][c] = block[i * 4 + c];
+        }
+    }
+
+    float mean[4], axis[4];
+    principalAxis(points, mean, axis);
+    float minT = 0.0f, maxT = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            t += (points[i][c] - mean[c]) * axis[c];
+        }
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+
+    float line[2][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        line[0][c] = std::clamp(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+        line[1][c] = std::clamp(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+    }
+
+    Bc7Endpoints best;
+    int bestIndices[16];
+    quantizeBc7Endpoint(line[0], best.value[0], best.pBit[0]);
+    quantizeBc7Endpoint(line[1], best.value[1], best.pBit[1]);
+    int bestError = assignBc7Indices(block, best, bestIndices);
+
+    for (int iteration = 0; iteration < 2 && bestError > 0; ++iteration)
+    {
+        // Solve for the endpoints that best reproduce the texels with the current index weights
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            float w = BC7_WEIGHTS4[bestIndices[i]] / 64.0f;
+            aa += (1.0f - w) * (1.0f - w);
+            ab += (1.0f - w) * w;
+            bb += w * w;
+            for (int c = 0; c < 4; ++c)
+            {
+                ax[c] += (1.0f - w) * points[i][c];
+                bx[c] += w * points[i][c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+        {
+            break;
+        }
+        for (int c = 0; c < 4; ++c)
+        {
+            line[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+            line[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+        }
+
+        Bc7Endpoints candidate;
+        int candidateIndices[16];
+        quantizeBc7Endpoint(line[0], candidate.value[0], candidate.pBit[0]);
+        quantizeBc7Endpoint(line[1], candidate.value[1], candidate.pBit[1]);
+        int error = assignBc7Indices(block, candidate, candidateIndices);
+        if (error >= bestError)
+        {
+            break;
+        }
+        best = candidate;
+        bestError = error;
+        std::memcpy(bestIndices, candidateIndices, sizeof(bestIndices));
+    }
+
+    // The first index is stored with its top bit implied to be zero
+    if (bestIndices[0] >= 8)
+    {
+        std::swap(best.value[0], best.value[1]);
+        std::swap(best.pBit[0], best.pBit[1]);
+        for (int& index : bestIndices)
+        {
+            index = 15 - index;
+        }
+    }
+
+    std::memset(out, 0, 16);
+    BitWriter writer{out};
+    writer.write(1u << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+        writer.write(best.value[0][c], 7);
+        writer.write(best.value[1][c], 7);
+    }
+    writer.write(best.pBit[0], 1);
+    writer.write(best.pBit[1], 1);
+    writer.write(bestIndices[0], 3);
+    for (int i = 1; i < 16; ++i)
+    {
+        writer.write(bestIndices[i], 4);
+    }
+}
+
+void decodeBlockBC1(const unsigned char* block, unsigned char* out)
+{
+    // GL_COMPRESSED_RGB_S3TC_DXT1 has no transparent texel, the fourth three-colour entry is opaque black
+    decodeColorBlock(block, out, true);
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i * 4 + 3] = 255;
+    }
+}
+
+void decodeBlockBC3(const unsigned char* block, unsigned char* out)
+{
+    decodeColorBlock(block + 8, out, false);
+    decodeChannelBlock(block, 3, out);
+}
+
+void decodeBlockBC5(const unsigned char* block, unsigned char* out)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        out[i * 4 + 2] = 0;
+        out[i * 4 + 3] = 255;
+    }
+    decodeChannelBlock(block, 0, out);
+    decodeChannelBlock(block + 8, 1, out);
+}
+
+void decodeBlockBC7(const unsigned char* block, unsigned char* out)
+{
+    BitReader reader{block};
+    int mode = 0;
+    while (mode < 8 && reader.read(1) == 0)
+    {
+        ++mode;
+    }
+    if (mode != 6)
+    {
+        std::memset(out, 128, 64);
+        return;
+    }
+
+    int endpoints[2][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        endpoints[0][c] = static_cast<int>(reader.read(7)) << 1;
+        endpoints[1][c] = static_cast<int>(reader.read(7)) << 1;
+    }
+    int pBit0 = static_cast<int>(reader.read(1)), pBit1 = static_cast<int>(reader.read(1));
+    for (int c = 0; c < 4; ++c)
+    {
+        endpoints[0][c] |= pBit0;
+        endpoints[1][c] |= pBit1;
+    }
+
+    for (int i = 0; i < 16; ++i)
+    {
+        int weight = BC7_WEIGHTS4[reader.read(i == 0 ? 3 : 4)];
+        for (int c = 0; c < 4; ++c)
+        {
+            out[i * 4 + c] = static_cast<unsigned char>(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+        }
+    }
+}
+
+bool decompressTexture(const TextureImage& image, std::vector<unsigned char>& rgba)
+{
+    size_t texelCount = static_cast<size_t>(image.width) * image.height;
+    if (image.width <= 0 || image.height <= 0 || image.data.size() < getLevelSize(image.format, image.width, image.height))
+    {
+        return false;
+    }
+    if (image.format == GL_RGBA8 || image.format == GL_SRGB8_ALPHA8)
+    {
+        rgba.assign(image.data.begin(), image.data.begin() + texelCount * 4);
+        return true;
+    }
+
+    BlockDecoder decoder = getBlockDecoder(image.format);
+    if (!decoder)
+    {
+        return false;
+    }
+
+    rgba.resize(texelCount * 4);
+    int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+    size_t blockBytes = findFormat(image.format)->blockBytes;
+    unsigned char block[64];
+    for (int by = 0; by < blocksY; ++by)
+    {
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            decoder(image.data.data() + (static_cast<size_t>(by) * blocksX + bx) * blockBytes, block);
+            for (int y = 0; y < 4 && by * 4 + y < image.height; ++y)
+            {
+                int columns = std::min(4, image.width - bx * 4);
+                std::memcpy(rgba.data() + ((static_cast<size_t>(by) * 4 + y) * image.width + bx * 4) * 4, block + y * 16,
+                            columns * 4);
+            }
+        }
+    }
+    return true;
+}
+
+bool isKtx2(const unsigned char* data, size_t size)
+{
+    return size >= sizeof(KTX2_IDENTIFIER) && std::memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0;
+}
+
+bool parseKtx2(const unsigned char* data, size_t size, TextureImage& image)
+{
+    if (!isKtx2(data, size) || size < KTX2_HEADER_SIZE)
+    {
+        std::cerr << "Not a KTX2 file" << std::endl;
+        return false;
+    }
+
+    uint32_t vkFormat = readU32(data + 12);
+    uint32_t width = readU32(data + 20);
+    uint32_t height = readU32(data + 24);
+    uint32_t depth = readU32(data + 28);
+    uint32_t layerCount = readU32(data + 32);
+    uint32_t faceCount = readU32(data + 36);
+    uint32_t levelCount = std::max(readU32(data + 40), 1u);
+    uint32_t supercompression = readU32(data + 44);
+
+    const FormatInfo* info = findVkFormat(vkFormat);
+    if (!info)
+    {
+        std::cerr << "Unsupported KTX2 vkFormat " << vkFormat << std::endl;
+        return false;
+    }
+    if (supercompression != 0)
+    {
+        std::cerr << "KTX2 supercompression scheme " << supercompression << " needs a transcoder and is not supported"
+            << std::endl;
+        return false;
+    }
+    if (width == 0 || height == 0 || depth > 1 || layerCount > 1 || faceCount != 1 ||
+        levelCount > static_cast<uint32_t>(getMipLevelCount(width, height)) ||
+        KTX2_HEADER_SIZE + uint64_t(levelCount) * KTX2_LEVEL_ENTRY_SIZE > size)
+    {
+        std::cerr << "Unsupported KTX2 layout (only single 2D images are loaded)" << std::endl;
+        return false;
+    }
+
+    image.format = info->glFormat;
+    image.width = static_cast<int>(width);
+    image.height = static_cast<int>(height);
+    image.levelCount = static_cast<int>(levelCount);
+    image.data.clear();
+    image.data.reserve(getTextureImageSize(image.format, image.width, image.height, image.levelCount));
+    for (uint32_t level = 0; level < levelCount; ++level)
+    {
+        const unsigned char* entry = data + KTX2_HEADER_SIZE + level * KTX2_LEVEL_ENTRY_SIZE;
+        uint64_t offset = readU64(entry);
+        uint64_t length = readU64(entry + 8);
+        size_t expected = getLevelSize(image.format, getLevelDimension(image.width, level),
+                                       getLevelDimension(image.height, level));
+        if (length != expected || offset + length > size)
+        {
+            std::cerr << "KTX2 level " << level << " is truncated or has an unexpected size" << std::endl;
+            return false;
+        }
+        image.data.insert(image.data.end(), data + offset, data + offset + length);
+    }
+    return true;
+}
+
+bool loadKtx2(const std::string& path, TextureImage& image)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        return false;
+    }
+    return parseKtx2(file.data(), file.size(), image);
+}
+
+bool writeKtx2(const std::string& path, const TextureImage& image)
+{
+    const FormatInfo* info = findFormat(image.format);
+    if (!info || image.levelCount <= 0 ||
+        image.data.size() != getTextureImageSize(image.format, image.width, image.height, image.levelCount))
+    {
+        std::cerr << "Cannot write KTX2 for texture format 0x" << std::hex << image.format << std::dec << std::endl;
+        return false;
+    }
+
+    std::vector<uint32_t> dfd = buildDataFormatDescriptor(*info);
+    uint32_t dfdOffset = static_cast<uint32_t>(KTX2_HEADER_SIZE + image.levelCount * KTX2_LEVEL_ENTRY_SIZE);
+    uint32_t dfdLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+    // Levels are stored smallest first, each on a 16 byte boundary
+    std::vector<uint64_t> levelOffsets(image.levelCount), levelSizes(image.levelCount), sourceOffsets(image.levelCount);
+    uint64_t sourceOffset = 0;
+    for (int level = 0; level < image.levelCount; ++level)
+    {
+        levelSizes[level] = getLevelSize(image.format, getLevelDimension(image.width, level),
+                                         getLevelDimension(image.height, level));
+        sourceOffsets[level] = sourceOffset;
+        sourceOffset += levelSizes[level];
+    }
+    uint64_t fileOffset = dfdOffset + dfdLength;
+    for (int level = image.levelCount - 1; level >= 0; --level)
+    {
+        fileOffset = (fileOffset + 15) & ~uint64_t(15);
+        levelOffsets[level] = fileOffset;
+        fileOffset += levelSizes[level];
+    }
+
+    std::vector<unsigned char> file(fileOffset, 0);
+    auto putU32 = [&](size_t offset, uint32_t value) { std::memcpy(file.data() + offset, &value, sizeof(value)); };
+    auto putU64 = [&](size_t offset, uint64_t value) { std::memcpy(file.data() + offset, &value, sizeof(value)); };
+    std::memcpy(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    putU32(12, info->vkFormat);
+    putU32(16, 1); // typeSize
+    putU32(20, static_cast<uint32_t>(image.width));
+    putU32(24, static_cast<uint32_t>(image.height));
+    putU32(36, 1); // faceCount
+    putU32(40, static_cast<uint32_t>(image.levelCount));
+    putU32(48, dfdOffset);
+    putU32(52, dfdLength);
+    for (int level = 0; level < image.levelCount; ++level)
+    {
+        size_t entry = KTX2_HEADER_SIZE + level * KTX2_LEVEL_ENTRY_SIZE;
+        putU64(entry, levelOffsets[level]);
+        putU64(entry + 8, levelSizes[level]);
+        putU64(entry + 16, levelSizes[level]);
+        std::memcpy(file.data() + levelOffsets[level], image.data.data() + sourceOffsets[level], levelSizes[level]);
+    }
+    std::memcpy(file.data() + dfdOffset, dfd.data(), dfdLength);
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        if (!out.good())
+        {
+            std::cerr << "Failed to write KTX2 file: " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+    {
+        std::cerr << "Failed to move KTX2 file into place: " << ec.message() << std::endl;
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+    return true;
+}
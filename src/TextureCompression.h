@@ -0,0 +1,64 @@
+﻿#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// A full mip chain in one GL internal format; levels are tightly packed, largest first
+struct TextureImage
+{
+    GLenum format = 0;
+    int width = 0;
+    int height = 0;
+    int levelCount = 0;
+    std::vector<unsigned char> data;
+};
+
+enum class TextureUsage
+{
+    Color,
+    Normal // tangent-space XY in the red/green channels
+};
+
+bool isCompressedFormat(GLenum format);
+bool isTextureFormatSupported(GLenum format); // reads GLEW extension flags, GLEW must be initialised
+size_t getLevelSize(GLenum format, int width, int height);
+size_t getTextureImageSize(GLenum format, int width, int height, int levelCount);
+int getMipLevelCount(int width, int height);
+
+// BC7 for colour (BC1/BC3 without BPTC), BC5 for normal maps; RGBA8 when the context has no BCn support
+GLenum chooseTextureFormat(TextureUsage usage, bool hasAlpha);
+
+// Box-filtered mips down to 1x1 from RGBA8 pixels, then block compression of every level into `format`.
+// Block rows are spread over the pool when one is given.
+bool compressTexture(const unsigned char* rgba, int width, int height, TextureUsage usage, GLenum format,
+                     TextureImage& result, ThreadPool* pool = nullptr);
+
+// Single 4x4 block encoders; `block` is 16 RGBA8 texels in row order
+void encodeBlockBC1(const unsigned char* block, unsigned char* out);
+void encodeBlockBC3(const unsigned char* block, unsigned char* out);
+void encodeBlockBC5(const unsigned char* block, unsigned char* out);
+void encodeBlockBC7(const unsigned char* block, unsigned char* out);
+
+// Decoders for the same block formats, used to read cooked textures back on the CPU. BC7 decodes
+// mode 6 only (all the encoder emits); blocks in other modes come out mid grey.
+void decodeBlockBC1(const unsigned char* block, unsigned char* out);
+void decodeBlockBC3(const unsigned char* block, unsigned char* out);
+void decodeBlockBC5(const unsigned char* block, unsigned char* out);
+void decodeBlockBC7(const unsigned char* block, unsigned char* out);
+
+// Level 0 as RGBA8; false for formats without a decoder
+bool decompressTexture(const TextureImage& image, std::vector<unsigned char>& rgba);
+
+// KTX2 containers without supercompression (Basis/Zstd payloads are rejected) in BCn or RGBA8 formats
+bool isKtx2(const unsigned char* data, size_t size);
+bool parseKtx2(const unsigned char* data, size_t size, TextureImage& image);
+bool loadKtx2(const std::string& path, TextureImage& image);
+bool writeKtx2(const std::string& path, const TextureImage& image);
+
+#endif
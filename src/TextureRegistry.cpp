@@ -0,0 +1,145 @@
+﻿#include "TextureRegistry.h"
+
+size_t TextureKeyHash::operator()(const TextureKey& key) const
+{
+    size_t hash = std::hash<std::string>()(key.asset);
+    hash ^= std::hash<int>()(key.image) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<int>()(key.sampler) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    hash ^= std::hash<unsigned int>()(key.format) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+TextureRegistry::TextureRegistry(size_t budgetBytes)
+    : budgetBytes(budgetBytes)
+{
+}
+
+TextureRegistry::~TextureRegistry()
+{
+    clear();
+}
+
+void TextureRegistry::clear()
+{
+    for (const auto& entry : lru)
+    {
+        glDeleteTextures(1, &entry->id);
+    }
+    lru.clear();
+    entries.clear();
+    residentBytes = 0;
+}
+
+TextureRegistry::Handle TextureRegistry::acquire(const TextureKey& key, const std::function<TextureUpload()>& upload)
+{
+    auto found = entries.find(key);
+    if (found != entries.end())
+    {
+        ++hits;
+        lru.splice(lru.begin(), lru, found->second);
+        (*found->second)->lastUsedFrame = frame;
+        return *found->second;
+    }
+
+    ++misses;
+    TextureUpload result = upload();
+    if (result.id == 0)
+    {
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<RegisteredTexture>();
+    entry->id = result.id;
+    entry->bytes = result.bytes;
+    entry->key = key;
+    entry->lastUsedFrame = frame;
+
+    lru.push_front(entry);
+    entries[key] = lru.begin();
+    residentBytes += result.bytes;
+
+    enforceBudget();
+    return entry;
+}
+
+void TextureRegistry::touch(const Handle& handle)
+{
+    if (!handle)
+    {
+        return;
+    }
+
+    auto found = entries.find(handle->key);
+    if (found != entries.end())
+    {
+        lru.splice(lru.begin(), lru, found->second);
+        (*found->second)->lastUsedFrame = frame;
+    }
+}
+
+void TextureRegistry::setResidentBytes(const Handle& handle, size_t bytes)
+{
+    if (!handle)
+    {
+        return;
+    }
+
+    auto found = entries.find(handle->key);
+    if (found != entries.end())
+    {
+        RegisteredTexture& entry = **found->second;
+        residentBytes = residentBytes - entry.bytes + bytes;
+        entry.bytes = bytes;
+    }
+}
+
+void TextureRegistry::update()
+{
+    ++frame;
+    enforceBudget();
+}
+
+void TextureRegistry::evictUnused()
+{
+    for (auto it = lru.begin(); it != lru.end();)
+    {
+        auto current = it++;
+        if (current->use_count() == 1)
+        {
+            evict(current);
+        }
+    }
+}
+
+std::vector<TextureRegistry::Handle> TextureRegistry::getTextures() const
+{
+    return std::vector<Handle>(lru.begin(), lru.end());
+}
+
+void TextureRegistry::enforceBudget()
+{
+    // Walk from the cold end; textures that still have outside handles are never evicted
+    auto it = lru.end();
+    while (residentBytes > budgetBytes && it != lru.begin())
+    {
+        auto current = std::prev(it);
+        if (current->use_count() == 1)
+        {
+            evict(current);
+        }
+        else
+        {
+            it = current;
+        }
+    }
+}
+
+void TextureRegistry::evict(std::list<Entry>::iterator it)
+{
+    const Entry& entry = *it;
+    glDeleteTextures(1, &entry->id);
+    residentBytes -= entry->bytes;
+    entries.erase(entry->key);
+    lru.erase(it);
+    ++evictions;
+}
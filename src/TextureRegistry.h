@@ -0,0 +1,97 @@
+﻿#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TextureKey
+{
+    std::string asset;
+    int image = -1;
+    int sampler = -1;
+    GLenum format = 0;
+
+    bool operator==(const TextureKey& other) const
+    {
+        return image == other.image && sampler == other.sampler && format == other.format && asset == other.asset;
+    }
+};
+
+struct TextureKeyHash
+{
+    size_t operator()(const TextureKey& key) const;
+};
+
+struct RegisteredTexture
+{
+    GLuint id = 0;
+    size_t bytes = 0;
+    TextureKey key;
+    uint64_t lastUsedFrame = 0;
+};
+
+// Result of the upload callback passed to TextureRegistry::acquire
+struct TextureUpload
+{
+    GLuint id = 0;
+    size_t bytes = 0;
+};
+
+// Deduplicates GL textures by (asset, image, sampler, format). Handles are shared
+// and reference counted; textures nobody holds stay cached until the resident
+// total exceeds the budget, then the least recently used ones are deleted.
+class TextureRegistry
+{
+public:
+    using Handle = std::shared_ptr<const RegisteredTexture>;
+
+    explicit TextureRegistry(size_t budgetBytes = 512ull * 1024 * 1024);
+    ~TextureRegistry();
+    TextureRegistry(const TextureRegistry&) = delete;
+    TextureRegistry& operator=(const TextureRegistry&) = delete;
+
+    // upload is only called on a miss and must return the new texture and its size
+    Handle acquire(const TextureKey& key, const std::function<TextureUpload()>& upload);
+    void touch(const Handle& handle);
+    // Streamed textures allocate and release levels after upload; the budget follows what is resident
+    void setResidentBytes(const Handle& handle, size_t bytes);
+
+    // Call once per frame: advances the LRU clock and evicts down to the budget
+    void update();
+    void evictUnused();
+    void clear();
+
+    void setBudget(size_t bytes) { budgetBytes = bytes; }
+    size_t getBudget() const { return budgetBytes; }
+    size_t getResidentBytes() const { return residentBytes; }
+    size_t getTextureCount() const { return entries.size(); }
+    size_t getHitCount() const { return hits; }
+    size_t getMissCount() const { return misses; }
+    size_t getEvictionCount() const { return evictions; }
+    std::vector<Handle> getTextures() const;
+
+    static bool isInUse(const Handle& handle) { return handle.use_count() > 1; }
+
+private:
+    using Entry = std::shared_ptr<RegisteredTexture>;
+
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<TextureKey, std::list<Entry>::iterator, TextureKeyHash> entries;
+    size_t budgetBytes;
+    size_t residentBytes = 0;
+    uint64_t frame = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+
+    void enforceBudget();
+    void evict(std::list<Entry>::iterator it);
+};
+
+#endif
@@ -0,0 +1,531 @@
+﻿#include "TextureStreamer.h"
+#include "TextureCompression.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+    // Each finished level fades in over four frames
+    const float MIN_LOD_FADE_STEP = 0.25f;
+
+    int getLevelDimension(int size, int level)
+    {
+        return std::max(1, size >> level);
+    }
+
+    // Uploads bind on their own unit; the previously active unit is restored afterwards
+    class StreamingUnitScope
+    {
+    public:
+        StreamingUnitScope()
+        {
+            glGetIntegerv(GL_ACTIVE_TEXTURE, &previousUnit);
+            glActiveTexture(GL_TEXTURE0 + STREAMING_TEXTURE_UNIT);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        }
+        ~StreamingUnitScope()
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(static_cast<GLenum>(previousUnit));
+        }
+
+    private:
+        GLint previousUnit = GL_TEXTURE0;
+    };
+
+    const unsigned char* getPixels(const StreamedImage& image)
+    {
+        return image.pixels ? image.pixels : image.storage.data();
+    }
+}
+
+TextureStreamer::TextureStreamer(size_t frameBudgetBytes, size_t bufferSize, int bufferCount)
+    : buffers(static_cast<size_t>(bufferCount), 0),
+      bufferSizes(static_cast<size_t>(bufferCount), bufferSize),
+      fences(static_cast<size_t>(bufferCount), nullptr),
+      bufferSize(bufferSize),
+      frameBudgetBytes(frameBudgetBytes)
+{
+    glGenBuffers(bufferCount, buffers.data());
+    for (GLuint buffer : buffers)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bufferSize), nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    for (GLsync fence : fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+}
+
+GLuint TextureStreamer::createTexture(StreamedImage image)
+{
+    PROFILE_ZONE("TextureStreamer::createTexture");
+    if (!isTextureFormatSupported(image.format))
+    {
+        std::cerr << "Error: Texture format 0x" << std::hex << image.format << std::dec
+            << " is not supported by this context" << std::endl;
+        return 0;
+    }
+    if (image.width <= 0 || image.height <= 0 || image.levelCount <= 0 ||
+        (!image.pixels && image.storage.size() < getTextureImageSize(image.format, image.width, image.height,
+                                                                     image.levelCount)))
+    {
+        std::cerr << "Error: Streamed image is invalid" << std::endl;
+        return 0;
+    }
+
+    Entry entry;
+    entry.image = std::move(image);
+    const StreamedImage& source = entry.image;
+    size_t offset = 0;
+    entry.tailLevel = source.levelCount - 1;
+    for (int level = 0; level < source.levelCount; ++level)
+    {
+        int levelWidth = getLevelDimension(source.width, level);
+        int levelHeight = getLevelDimension(source.height, level);
+        if (std::max(levelWidth, levelHeight) <= MIP_TAIL_SIZE)
+        {
+            entry.tailLevel = std::min(entry.tailLevel, level);
+        }
+        entry.levelOffsets.push_back(offset);
+        offset += getLevelSize(source.format, levelWidth, levelHeight);
+    }
+    entry.residentLevel = entry.tailLevel;
+    entry.wantedLevel = entry.tailLevel;
+    entry.lastFineFrame = frame;
+
+    StreamingUnitScope scope;
+    glGenTextures(1, &entry.id);
+    glBindTexture(GL_TEXTURE_2D, entry.id);
+
+    // The tail is small enough to upload directly; finer levels stay undefined until streamed
+    size_t tailBytes = 0;
+    for (int level = entry.tailLevel; level < source.levelCount; ++level)
+    {
+        int levelWidth = getLevelDimension(source.width, level);
+        int levelHeight = getLevelDimension(source.height, level);
+        size_t levelSize = getLevelSize(source.format, levelWidth, levelHeight);
+        const unsigned char* pixels = getPixels(source) + entry.levelOffsets[level];
+        if (isCompressedFormat(source.format))
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, source.format, levelWidth, levelHeight, 0,
+                                   static_cast<GLsizei>(levelSize), pixels);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, source.format, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         pixels);
+        }
+        tailBytes += levelSize;
+    }
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, tailBytes);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        std::cerr << "OpenGL error after uploading texture mip tail: " << error << std::endl;
+        glDeleteTextures(1, &entry.id);
+        return 0;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.tailLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, source.levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    source.levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    GLuint id = entry.id;
+    entries.push_back(std::move(entry));
+    updateStats();
+    return id;
+}
+
+void TextureStreamer::track(const TextureRegistry::Handle& handle, TextureRegistry& registry)
+{
+    Entry* entry = handle ? findEntry(handle->id) : nullptr;
+    if (entry && !entry->tracked)
+    {
+        entry->owner = handle;
+        entry->registry = &registry;
+        entry->tracked = true;
+        reportResidentBytes(*entry);
+    }
+}
+
+size_t TextureStreamer::getResidentBytes(GLuint texture)
+{
+    Entry* entry = findEntry(texture);
+    return entry ? getAllocatedBytes(*entry) : 0;
+}
+
+void TextureStreamer::request(GLuint texture, float screenPixels)
+{
+    Entry* entry = findEntry(texture);
+    if (!entry)
+    {
+        return;
+    }
+
+    // One texel per pixel: every halving of the screen size allows one coarser level
+    float size = static_cast<float>(std::max(entry->image.width, entry->image.height));
+    int level = 0;
+    if (screenPixels < size)
+    {
+        level = static_cast<int>(std::floor(std::log2(size / std::max(screenPixels, 1.0f))));
+    }
+    level = std::min(level, entry->tailLevel);
+    if (entry->requestedLevel < 0 || level < entry->requestedLevel)
+    {
+        entry->requestedLevel = level;
+    }
+}
+
+bool TextureStreamer::update()
+{
+    PROFILE_ZONE("TextureStreamer::update");
+    ++frame;
+
+    // The registry deleted these, and their names may already belong to new textures
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const Entry& entry) { return entry.tracked && entry.owner.expired(); }),
+                  entries.end());
+
+    StreamingUnitScope scope;
+    bool changed = false;
+    for (Entry& entry : entries)
+    {
+        // Finer requests apply at once; coarser ones only after they have held for the drop delay
+        int requested = entry.requestedLevel >= 0 ? entry.requestedLevel : entry.tailLevel;
+        entry.requestedLevel = -1;
+        if (requested <= entry.wantedLevel)
+        {
+            entry.wantedLevel = requested;
+            entry.lastFineFrame = frame;
+        }
+        else if (frame - entry.lastFineFrame > dropDelayFrames)
+        {
+            entry.wantedLevel = requested;
+            if (entry.residentLevel < requested || (entry.loadingLevel >= 0 && entry.loadingLevel < requested))
+            {
+                glBindTexture(GL_TEXTURE_2D, entry.id);
+                dropLevels(entry, requested);
+                changed = true;
+            }
+        }
+
+        if (entry.minLod > 0.0f)
+        {
+            entry.minLod = std::max(0.0f, entry.minLod - MIN_LOD_FADE_STEP);
+            glBindTexture(GL_TEXTURE_2D, entry.id);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod);
+            changed = true;
+        }
+    }
+
+    stats.uploadedBytes = uploadPending(frameBudgetBytes, false);
+    updateStats();
+    return changed;
+}
+
+void TextureStreamer::flush()
+{
+    PROFILE_ZONE("TextureStreamer::flush");
+    StreamingUnitScope scope;
+    for (Entry& entry : entries)
+    {
+        entry.wantedLevel = 0;
+        entry.lastFineFrame = frame;
+    }
+    stats.uploadedBytes = uploadPending(std::numeric_limits<size_t>::max(), true);
+    for (Entry& entry : entries)
+    {
+        entry.minLod = 0.0f;
+        glBindTexture(GL_TEXTURE_2D, entry.id);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 0.0f);
+    }
+    updateStats();
+}
+
+void TextureStreamer::clear()
+{
+    // The textures themselves belong to the registry
+    entries.clear();
+    updateStats();
+}
+
+bool TextureStreamer::isBusy() const
+{
+    for (const Entry& entry : entries)
+    {
+        if (entry.loadingLevel >= 0 || entry.residentLevel > entry.wantedLevel || entry.minLod > 0.0f)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TextureStreamer::uploadPending(size_t budget, bool wait)
+{
+    size_t uploaded = 0;
+    while (uploaded < budget)
+    {
+        // The smallest missing level first, so every texture sharpens a step before any gets its largest level
+        Entry* next = nullptr;
+        size_t nextSize = 0;
+        for (Entry& entry : entries)
+        {
+            int level = entry.loadingLevel >= 0 ? entry.loadingLevel
+                        : entry.residentLevel > entry.wantedLevel ? entry.residentLevel - 1 : -1;
+            if (level < 0)
+            {
+                continue;
+            }
+            size_t size = getLevelSize(entry.image.format, getLevelDimension(entry.image.width, level),
+                                       getLevelDimension(entry.image.height, level));
+            if (!next || size < nextSize)
+            {
+                next = &entry;
+                nextSize = size;
+            }
+        }
+        if (!next)
+        {
+            break;
+        }
+
+        size_t bytes = uploadPiece(*next, budget - uploaded, wait);
+        if (bytes == 0)
+        {
+            break; // the ring is still in use by the GPU; carry on next frame
+        }
+        uploaded += bytes;
+    }
+    return uploaded;
+}
+
+size_t TextureStreamer::uploadPiece(Entry& entry, size_t budget, bool wait)
+{
+    PROFILE_ZONE("TextureStreamer::uploadPiece");
+    size_t buffer = nextBuffer;
+    if (!acquireBuffer(buffer, wait))
+    {
+        return 0;
+    }
+    nextBuffer = (nextBuffer + 1) % buffers.size();
+
+    glBindTexture(GL_TEXTURE_2D, entry.id);
+    if (entry.loadingLevel < 0)
+    {
+        entry.loadingLevel = entry.residentLevel - 1;
+        entry.loadedRows = 0;
+        defineLevel(entry, entry.loadingLevel, false);
+        reportResidentBytes(entry);
+    }
+
+    // Whole rows (block rows for compressed formats), at least one per piece
+    const StreamedImage& image = entry.image;
+    int level = entry.loadingLevel;
+    int levelWidth = getLevelDimension(image.width, level);
+    int levelHeight = getLevelDimension(image.height, level);
+    bool compressed = isCompressedFormat(image.format);
+    int rowHeight = compressed ? 4 : 1;
+    size_t rowBytes = getLevelSize(image.format, levelWidth, rowHeight);
+    size_t rowCount = std::max<size_t>(1, std::min(budget, bufferSize) / rowBytes);
+    int rows = static_cast<int>(std::min<size_t>(rowCount * rowHeight, static_cast<size_t>(levelHeight - entry.loadedRows)));
+    size_t bytes = getLevelSize(image.format, levelWidth, rows);
+    const unsigned char* source =
+        getPixels(image) + entry.levelOffsets[level] + static_cast<size_t>(entry.loadedRows / rowHeight) * rowBytes;
+
+    // Unsynchronized is safe: the fence says the GPU has finished reading this buffer
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[buffer]);
+    if (bufferSizes[buffer] < bytes)
+    {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr, GL_STREAM_DRAW);
+        bufferSizes[buffer] = bytes;
+    }
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes),
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    const void* pixels = nullptr; // offset 0 of the bound buffer
+    if (mapped)
+    {
+        std::memcpy(mapped, source, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pixels = source;
+    }
+
+    if (compressed)
+    {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, entry.loadedRows, levelWidth, rows, image.format,
+                                  static_cast<GLsizei>(bytes), pixels);
+    }
+    else
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, entry.loadedRows, levelWidth, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+                        pixels);
+    }
+    if (mapped)
+    {
+        fences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, bytes);
+
+    entry.loadedRows += rows;
+    if (entry.loadedRows >= levelHeight)
+    {
+        finishLevel(entry);
+    }
+    return bytes;
+}
+
+bool TextureStreamer::acquireBuffer(size_t buffer, bool wait)
+{
+    GLsync fence = fences[buffer];
+    if (!fence)
+    {
+        return true;
+    }
+
+    // Without waiting, a buffer the GPU hasn't consumed yet ends this frame's uploads instead of stalling
+    GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;)
+    {
+        GLenum result = glClientWaitSync(fence, waitFlags, wait ? 100000000 : 0); // 100 ms
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+        {
+            break;
+        }
+        if (!wait)
+        {
+            return false;
+        }
+        waitFlags = 0;
+    }
+    glDeleteSync(fence);
+    fences[buffer] = nullptr;
+    return true;
+}
+
+void TextureStreamer::finishLevel(Entry& entry)
+{
+    // Sampling starts at the level that was resident and fades down to the new one
+    entry.residentLevel = entry.loadingLevel;
+    entry.loadingLevel = -1;
+    entry.loadedRows = 0;
+    entry.minLod = 1.0f;
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.residentLevel);
+}
+
+void TextureStreamer::dropLevels(Entry& entry, int level)
+{
+    if (entry.loadingLevel >= 0 && entry.loadingLevel < level)
+    {
+        defineLevel(entry, entry.loadingLevel, true);
+        entry.loadingLevel = -1;
+        entry.loadedRows = 0;
+        ++stats.droppedLevels;
+    }
+    if (entry.residentLevel < level)
+    {
+        // Move the base first so the released levels are outside the sampled range
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        entry.minLod = 0.0f;
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.minLod);
+        for (int dropped = entry.residentLevel; dropped < level; ++dropped)
+        {
+            defineLevel(entry, dropped, true);
+            ++stats.droppedLevels;
+        }
+        entry.residentLevel = level;
+    }
+    reportResidentBytes(entry);
+}
+
+void TextureStreamer::defineLevel(const Entry& entry, int level, bool empty)
+{
+    // Storage without contents (no unpack buffer is bound here); a 0x0 image releases the level
+    const StreamedImage& image = entry.image;
+    int levelWidth = empty ? 0 : getLevelDimension(image.width, level);
+    int levelHeight = empty ? 0 : getLevelDimension(image.height, level);
+    if (isCompressedFormat(image.format))
+    {
+        size_t levelSize = empty ? 0 : getLevelSize(image.format, levelWidth, levelHeight);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, levelWidth, levelHeight, 0,
+                               static_cast<GLsizei>(levelSize), nullptr);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, level, image.format, levelWidth, levelHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     nullptr);
+    }
+}
+
+size_t TextureStreamer::getAllocatedBytes(const Entry& entry) const
+{
+    // Resident levels plus the one being streamed, whose storage is already defined
+    const StreamedImage& image = entry.image;
+    size_t bytes = 0;
+    int firstLevel = entry.loadingLevel >= 0 ? entry.loadingLevel : entry.residentLevel;
+    for (int level = firstLevel; level < image.levelCount; ++level)
+    {
+        bytes += getLevelSize(image.format, getLevelDimension(image.width, level),
+                              getLevelDimension(image.height, level));
+    }
+    return bytes;
+}
+
+void TextureStreamer::reportResidentBytes(const Entry& entry)
+{
+    TextureRegistry::Handle owner = entry.owner.lock();
+    if (entry.registry && owner)
+    {
+        entry.registry->setResidentBytes(owner, getAllocatedBytes(entry));
+    }
+}
+
+TextureStreamer::Entry* TextureStreamer::findEntry(GLuint texture)
+{
+    for (Entry& entry : entries)
+    {
+        if (entry.id == texture && !(entry.tracked && entry.owner.expired()))
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void TextureStreamer::updateStats()
+{
+    stats.textures = entries.size();
+    stats.pendingLevels = 0;
+    stats.residentBytes = 0;
+    for (const Entry& entry : entries)
+    {
+        stats.pendingLevels += static_cast<size_t>(std::max(0, entry.residentLevel - entry.wantedLevel));
+        stats.residentBytes += getAllocatedBytes(entry);
+    }
+}
@@ -0,0 +1,118 @@
+﻿#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "TextureRegistry.h"
+
+// Levels this size and smaller are uploaded when the texture is created
+const int MIP_TAIL_SIZE = 128;
+
+// Binding point used while uploading, so the material units keep their textures
+const GLuint STREAMING_TEXTURE_UNIT = 5;
+
+// A precomputed mip chain (tightly packed, largest level first). Borrowed pixels must
+// outlive the texture; without them the chain is read from storage, which the streamer owns.
+struct StreamedImage
+{
+    GLenum format = 0;
+    int width = 0;
+    int height = 0;
+    int levelCount = 0;
+    const unsigned char* pixels = nullptr;
+    std::vector<unsigned char> storage;
+};
+
+struct TextureStreamerStats
+{
+    size_t textures = 0;
+    size_t pendingLevels = 0;  // wanted but not resident yet
+    size_t residentBytes = 0;  // resident levels plus the one being streamed
+    size_t uploadedBytes = 0;  // during the last update
+    size_t droppedLevels = 0;  // since creation
+};
+
+// Uploads mip chains a piece at a time. A new texture gets its small tail at once,
+// then finer levels stream in through a ring of pixel buffer objects within a byte
+// budget per frame, coarsest first. GL_TEXTURE_BASE_LEVEL keeps sampling on the
+// resident levels and GL_TEXTURE_MIN_LOD fades each new level in. Levels finer
+// than anything requested for dropDelayFrames are released again.
+class TextureStreamer
+{
+public:
+    explicit TextureStreamer(size_t frameBudgetBytes = 4 * 1024 * 1024, size_t bufferSize = 1024 * 1024,
+                             int bufferCount = 4);
+    ~TextureStreamer();
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // The texture with its mip tail resident, or 0 on failure
+    GLuint createTexture(StreamedImage image);
+    // Ties the texture to its registry handle; once the registry deletes it, streaming stops.
+    // The registry is told the resident size whenever levels are allocated or released.
+    void track(const TextureRegistry::Handle& handle, TextureRegistry& registry);
+    // Bytes of the allocated levels, the mip tail right after createTexture
+    size_t getResidentBytes(GLuint texture);
+
+    // The texture covers about screenPixels (its larger side) on screen this frame
+    void request(GLuint texture, float screenPixels);
+
+    // Call once per frame; true when sampled detail changed
+    bool update();
+    // Streams every texture to full detail now, ignoring the budget (benchmarks)
+    void flush();
+    void clear();
+
+    bool isBusy() const; // levels pending or fading in
+
+    void setFrameBudget(size_t bytes) { frameBudgetBytes = bytes; }
+    size_t getFrameBudget() const { return frameBudgetBytes; }
+    void setDropDelay(uint64_t frames) { dropDelayFrames = frames; }
+    const TextureStreamerStats& getStats() const { return stats; }
+
+private:
+    struct Entry
+    {
+        GLuint id = 0;
+        std::weak_ptr<const RegisteredTexture> owner;
+        TextureRegistry* registry = nullptr;
+        bool tracked = false;
+        StreamedImage image;
+        std::vector<size_t> levelOffsets;
+        int tailLevel = 0;
+        int residentLevel = 0;   // GL_TEXTURE_BASE_LEVEL
+        int loadingLevel = -1;   // defined, rows [0, loadedRows) uploaded
+        int loadedRows = 0;
+        int requestedLevel = -1; // finest requested this frame, -1 for none
+        int wantedLevel = 0;
+        uint64_t lastFineFrame = 0;
+        float minLod = 0.0f;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<GLuint> buffers;
+    std::vector<size_t> bufferSizes;
+    std::vector<GLsync> fences; // one per buffer, null when the buffer is free
+    size_t nextBuffer = 0;
+    size_t bufferSize;
+    size_t frameBudgetBytes;
+    uint64_t dropDelayFrames = 600;
+    uint64_t frame = 0;
+    TextureStreamerStats stats;
+
+    size_t uploadPending(size_t budget, bool wait);
+    size_t uploadPiece(Entry& entry, size_t budget, bool wait);
+    bool acquireBuffer(size_t buffer, bool wait);
+    void finishLevel(Entry& entry);
+    void dropLevels(Entry& entry, int level);
+    void defineLevel(const Entry& entry, int level, bool empty);
+    size_t getAllocatedBytes(const Entry& entry) const;
+    void reportResidentBytes(const Entry& entry);
+    Entry* findEntry(GLuint texture);
+    void updateStats();
+};
+
+#endif
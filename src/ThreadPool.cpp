@@ -0,0 +1,128 @@
+﻿#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    tasksDone.wait(lock, [this] { return tasks.empty() && activeTasks == 0; });
+}
+
+void ThreadPool::cancelPending()
+{
+    // parallelFor helpers may be among them; the calling thread runs their share itself
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.clear();
+    if (activeTasks == 0)
+    {
+        tasksDone.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Shared so helpers that only get scheduled after the loop has finished can still exit cleanly
+    struct LoopState
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> finished{0};
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<LoopState>();
+    const std::function<void(size_t)>* loopBody = &body;
+
+    auto run = [state, loopBody, count]()
+    {
+        for (size_t i = state->next++; i < count; i = state->next++)
+        {
+            (*loopBody)(i);
+            if (++state->finished == count)
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min<size_t>(workers.size(), count - 1);
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        submit(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->finished == count; });
+}
+
+void ThreadPool::workerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            ++activeTasks;
+        }
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --activeTasks;
+            if (tasks.empty() && activeTasks == 0)
+            {
+                tasksDone.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,43 @@
+﻿#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool. Tasks must not touch GL; anything that needs the
+// context is handed back to the render thread by the caller.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threadCount = 0); // 0 picks the hardware concurrency
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void waitIdle();
+    void cancelPending(); // drops queued tasks; running ones finish
+
+    // Runs body(i) for i in [0, count). The calling thread takes part, so this is
+    // safe to call from inside a pool task without deadlocking.
+    void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable tasksDone;
+    size_t activeTasks = 0;
+    bool stopping = false;
+
+    void workerLoop();
+};
+
+#endif
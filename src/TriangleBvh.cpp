@@ -0,0 +1,558 @@
+﻿#include "TriangleBvh.h"
+#include "Culling.h"
+#include "Model.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+    const int BIN_COUNT = 16;
+    const uint32_t CHUNK_SIZE = 1u << 13;               // triangles per pool task when scanning a node
+    const uint32_t PARALLEL_SCAN_THRESHOLD = 1u << 15;  // nodes this large are scanned in chunks
+    const uint32_t PARALLEL_SUBTREE_THRESHOLD = 1u << 12; // subtrees this large build as their own tasks
+
+    // Aabb::expand is defined in Culling.cpp; the build loops need these inlined
+    inline void grow(Aabb& box, const glm::vec3& point)
+    {
+        box.min = glm::min(box.min, point);
+        box.max = glm::max(box.max, point);
+    }
+
+    inline void grow(Aabb& box, const Aabb& other)
+    {
+        box.min = glm::min(box.min, other.min);
+        box.max = glm::max(box.max, other.max);
+    }
+
+    // Node of the unflattened tree; children are allocated as a pair
+    struct BuildNode
+    {
+        Aabb bounds;
+        uint32_t first;
+        uint32_t count;
+        uint32_t left; // 0 for leaves (the root is never a child)
+    };
+
+    struct RangeBounds
+    {
+        Aabb bounds;
+        Aabb centroids;
+
+        void merge(const RangeBounds& other)
+        {
+            grow(bounds, other.bounds);
+            grow(centroids, other.centroids);
+        }
+    };
+
+    struct Bins
+    {
+        Aabb bounds[3][BIN_COUNT];
+        uint32_t counts[3][BIN_COUNT] = {};
+
+        void merge(const Bins& other)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int bin = 0; bin < BIN_COUNT; ++bin)
+                {
+                    grow(bounds[axis][bin], other.bounds[axis][bin]);
+                    counts[axis][bin] += other.counts[axis][bin];
+                }
+            }
+        }
+    };
+
+    float getSurfaceArea(const Aabb& box)
+    {
+        if (!box.isValid())
+        {
+            return 0.0f;
+        }
+        glm::vec3 size = box.max - box.min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    int getBin(float centroid, float minCentroid, float scale)
+    {
+        return std::min(std::max(static_cast<int>((centroid - minCentroid) * scale), 0), BIN_COUNT - 1);
+    }
+
+    class BvhBuilder
+    {
+    public:
+        BvhBuilder(const std::vector<glm::vec3>& positions, ThreadPool* pool, uint32_t maxLeafSize)
+            : pool(pool), maxLeafSize(std::max(maxLeafSize, 1u))
+        {
+            uint32_t triangleCount = static_cast<uint32_t>(positions.size() / 3);
+            triangleBounds.resize(triangleCount);
+            centroids.resize(triangleCount);
+            order.resize(triangleCount);
+            forChunks(0, triangleCount, [&](uint32_t first, uint32_t count, size_t)
+            {
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    Aabb bounds;
+                    grow(bounds, positions[i * 3]);
+                    grow(bounds, positions[i * 3 + 1]);
+                    grow(bounds, positions[i * 3 + 2]);
+                    triangleBounds[i] = bounds;
+                    centroids[i] = (bounds.min + bounds.max) * 0.5f;
+                    order[i] = i;
+                }
+            });
+
+            // A binary tree with non-empty leaves has at most 2n - 1 nodes
+            buildNodes.resize(std::max<size_t>(static_cast<size_t>(triangleCount) * 2, 1));
+        }
+
+        std::vector<uint32_t> order;
+        std::vector<BuildNode> buildNodes;
+        std::atomic<uint32_t> nodeCount{1};
+        std::atomic<uint32_t> maxDepth{0};
+
+        void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+        {
+            RangeBounds range = computeBounds(first, count);
+            BuildNode& node = buildNodes[nodeIndex];
+            node.bounds = range.bounds;
+            node.first = first;
+            node.count = count;
+            node.left = 0;
+            uint32_t deepest = maxDepth.load();
+            while (depth > deepest && !maxDepth.compare_exchange_weak(deepest, depth))
+            {
+            }
+            if (count <= maxLeafSize)
+            {
+                return;
+            }
+
+            Bins bins = binTriangles(first, count, range.centroids);
+            float bestCost = FLT_MAX;
+            int bestAxis = -1;
+            int bestBin = 0;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (range.centroids.max[axis] <= range.centroids.min[axis])
+                {
+                    continue;
+                }
+
+                float rightAreas[BIN_COUNT];
+                uint32_t rightCounts[BIN_COUNT];
+                Aabb accumulated;
+                uint32_t accumulatedCount = 0;
+                for (int bin = BIN_COUNT - 1; bin > 0; --bin)
+                {
+                    grow(accumulated, bins.bounds[axis][bin]);
+                    accumulatedCount += bins.counts[axis][bin];
+                    rightAreas[bin - 1] = getSurfaceArea(accumulated);
+                    rightCounts[bin - 1] = accumulatedCount;
+                }
+
+                accumulated = Aabb();
+                accumulatedCount = 0;
+                for (int bin = 0; bin < BIN_COUNT - 1; ++bin)
+                {
+                    grow(accumulated, bins.bounds[axis][bin]);
+                    accumulatedCount += bins.counts[axis][bin];
+                    if (accumulatedCount == 0 || rightCounts[bin] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = accumulatedCount * getSurfaceArea(accumulated) + rightCounts[bin] * rightAreas[bin];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = bin;
+                    }
+                }
+            }
+
+            // Coincident centroids cannot be binned apart; halving the range still bounds the leaf size
+            uint32_t middle = first + count / 2;
+            if (bestAxis >= 0)
+            {
+                float minCentroid = range.centroids.min[bestAxis];
+                float scale = getBinScale(range.centroids, bestAxis);
+                auto split = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t i)
+                {
+                    return getBin(centroids[i][bestAxis], minCentroid, scale) <= bestBin;
+                });
+                middle = static_cast<uint32_t>(split - order.begin());
+            }
+
+            uint32_t left = nodeCount.fetch_add(2);
+            node.left = left;
+            uint32_t leftCount = middle - first;
+            uint32_t rightCount = first + count - middle;
+            if (pool && std::min(leftCount, rightCount) >= PARALLEL_SUBTREE_THRESHOLD)
+            {
+                pool->parallelFor(2, [&](size_t child)
+                {
+                    if (child == 0)
+                    {
+                        buildNode(left, first, leftCount, depth + 1);
+                    }
+                    else
+                    {
+                        buildNode(left + 1, middle, rightCount, depth + 1);
+                    }
+                });
+            }
+            else
+            {
+                buildNode(left, first, leftCount, depth + 1);
+                buildNode(left + 1, middle, rightCount, depth + 1);
+            }
+        }
+
+    private:
+        ThreadPool* pool;
+        uint32_t maxLeafSize;
+        std::vector<Aabb> triangleBounds;
+        std::vector<glm::vec3> centroids;
+
+        // body(first, count, chunk) over [first, first + count), split across the pool when the range is large
+        template <typename Body>
+        size_t forChunks(uint32_t first, uint32_t count, const Body& body)
+        {
+            if (!pool || count < PARALLEL_SCAN_THRESHOLD)
+            {
+                body(first, count, 0);
+                return 1;
+            }
+            size_t chunkCount = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+            pool->parallelFor(chunkCount, [&](size_t chunk)
+            {
+                uint32_t chunkFirst = first + static_cast<uint32_t>(chunk) * CHUNK_SIZE;
+                body(chunkFirst, std::min(CHUNK_SIZE, first + count - chunkFirst), chunk);
+            });
+            return chunkCount;
+        }
+
+        size_t getChunkCount(uint32_t count) const
+        {
+            return !pool || count < PARALLEL_SCAN_THRESHOLD ? 1 : (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        }
+
+        static float getBinScale(const Aabb& centroidBounds, int axis)
+        {
+            return BIN_COUNT / (centroidBounds.max[axis] - centroidBounds.min[axis]);
+        }
+
+        RangeBounds computeBounds(uint32_t first, uint32_t count)
+        {
+            std::vector<RangeBounds> partial(getChunkCount(count));
+            forChunks(first, count, [&](uint32_t chunkFirst, uint32_t chunkCount, size_t chunk)
+            {
+                RangeBounds& range = partial[chunk];
+                for (uint32_t i = chunkFirst; i < chunkFirst + chunkCount; ++i)
+                {
+                    grow(range.bounds, triangleBounds[order[i]]);
+                    grow(range.centroids, centroids[order[i]]);
+                }
+            });
+            for (size_t i = 1; i < partial.size(); ++i)
+            {
+                partial[0].merge(partial[i]);
+            }
+            return partial[0];
+        }
+
+        Bins binTriangles(uint32_t first, uint32_t count, const Aabb& centroidBounds)
+        {
+            float scales[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bool flat = centroidBounds.max[axis] <= centroidBounds.min[axis];
+                scales[axis] = flat ? 0.0f : getBinScale(centroidBounds, axis);
+            }
+
+            std::vector<Bins> partial(getChunkCount(count));
+            forChunks(first, count, [&](uint32_t chunkFirst, uint32_t chunkCount, size_t chunk)
+            {
+                Bins& bins = partial[chunk];
+                for (uint32_t i = chunkFirst; i < chunkFirst + chunkCount; ++i)
+                {
+                    uint32_t triangle = order[i];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        int bin = getBin(centroids[triangle][axis], centroidBounds.min[axis], scales[axis]);
+                        grow(bins.bounds[axis][bin], triangleBounds[triangle]);
+                        ++bins.counts[axis][bin];
+                    }
+                }
+            });
+            for (size_t i = 1; i < partial.size(); ++i)
+            {
+                partial[0].merge(partial[i]);
+            }
+            return partial[0];
+        }
+    };
+
+    uint32_t flattenNode(const std::vector<BuildNode>& buildNodes, uint32_t buildIndex, std::vector<BvhNode>& nodes)
+    {
+        const BuildNode& buildNode = buildNodes[buildIndex];
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        BvhNode node = {};
+        node.min[0] = buildNode.bounds.min.x;
+        node.min[1] = buildNode.bounds.min.y;
+        node.min[2] = buildNode.bounds.min.z;
+        node.max[0] = buildNode.bounds.max.x;
+        node.max[1] = buildNode.bounds.max.y;
+        node.max[2] = buildNode.bounds.max.z;
+        node.leftFirst = buildNode.first;
+        node.count = buildNode.count;
+        nodes.push_back(node);
+        if (buildNode.left != 0)
+        {
+            nodes[index].count = 0;
+            flattenNode(buildNodes, buildNode.left, nodes);
+            nodes[index].leftFirst = flattenNode(buildNodes, buildNode.left + 1, nodes);
+        }
+        return index;
+    }
+
+    Aabb getNodeBounds(const BvhNode& node)
+    {
+        Aabb bounds;
+        bounds.min = glm::vec3(node.min[0], node.min[1], node.min[2]);
+        bounds.max = glm::vec3(node.max[0], node.max[1], node.max[2]);
+        return bounds;
+    }
+
+    void setNodeBounds(BvhNode& node, const Aabb& bounds)
+    {
+        node.min[0] = bounds.min.x;
+        node.min[1] = bounds.min.y;
+        node.min[2] = bounds.min.z;
+        node.max[0] = bounds.max.x;
+        node.max[1] = bounds.max.y;
+        node.max[2] = bounds.max.z;
+    }
+}
+
+void TriangleBvh::build(const std::vector<glm::vec3>& positions, ThreadPool* pool, uint32_t maxLeafSize)
+{
+    PROFILE_ZONE("TriangleBvh::build");
+    auto start = std::chrono::steady_clock::now();
+    clear();
+    uint32_t triangleCount = static_cast<uint32_t>(positions.size() / 3);
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    BvhBuilder builder(positions, pool, maxLeafSize);
+    builder.buildNode(0, 0, triangleCount, 0);
+
+    nodes.reserve(builder.nodeCount.load());
+    flattenNode(builder.buildNodes, 0, nodes);
+    triangleOrder.swap(builder.order);
+
+    std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - start;
+    stats.triangles = triangleCount;
+    stats.nodes = nodes.size();
+    stats.leaves = (nodes.size() + 1) / 2;
+    stats.maxDepth = builder.maxDepth.load();
+    stats.buildMilliseconds = buildTime.count();
+    updateSahCost();
+}
+
+bool TriangleBvh::refit(const std::vector<glm::vec3>& positions)
+{
+    PROFILE_ZONE("TriangleBvh::refit");
+    if (nodes.empty() || positions.size() / 3 != triangleOrder.size())
+    {
+        return false;
+    }
+
+    // Children always follow their parent, so one reverse pass sees them first
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = nodes[i];
+        Aabb bounds;
+        if (node.count > 0)
+        {
+            for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; ++slot)
+            {
+                const glm::vec3* triangle = &positions[static_cast<size_t>(triangleOrder[slot]) * 3];
+                bounds.expand(triangle[0]);
+                bounds.expand(triangle[1]);
+                bounds.expand(triangle[2]);
+            }
+        }
+        else
+        {
+            bounds = getNodeBounds(nodes[i + 1]);
+            bounds.expand(getNodeBounds(nodes[node.leftFirst]));
+        }
+        setNodeBounds(node, bounds);
+    }
+
+    std::chrono::duration<double, std::milli> refitTime = std::chrono::steady_clock::now() - start;
+    stats.buildMilliseconds = refitTime.count();
+    updateSahCost();
+    return true;
+}
+
+void TriangleBvh::clear()
+{
+    nodes.clear();
+    triangleOrder.clear();
+    stats = BvhStats();
+}
+
+void TriangleBvh::updateSahCost()
+{
+    float rootArea = getSurfaceArea(getNodeBounds(nodes[0]));
+    double cost = 0.0;
+    for (const BvhNode& node : nodes)
+    {
+        cost += getSurfaceArea(getNodeBounds(node)) * (node.count > 0 ? node.count : 1u);
+    }
+    stats.sahCost = rootArea > 0.0f ? cost / rootArea : 0.0;
+}
+
+void gatherWorldTriangles(const Model& model, std::vector<glm::vec3>& positions)
+{
+    PROFILE_ZONE("gatherWorldTriangles");
+    positions.clear();
+
+    // Object-space LOD 0 triangles per mesh, instanced below with each node's world matrix
+    std::vector<std::vector<glm::vec3>> meshTriangles;
+    model.forEachPrimitive([&](const PrimitiveGeometry& geometry)
+    {
+        if (geometry.mesh >= static_cast<int>(meshTriangles.size()))
+        {
+            meshTriangles.resize(geometry.mesh + 1);
+        }
+        std::vector<glm::vec3>& triangles = meshTriangles[geometry.mesh];
+        for (size_t i = 0; i + 2 < geometry.indexCount; i += 3)
+        {
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                const float* position = geometry.vertices[geometry.indices[i + corner]].position;
+                triangles.push_back(glm::vec3(position[0], position[1], position[2]));
+            }
+        }
+    });
+
+    const SceneGraph& sceneGraph = model.getSceneGraph();
+    if (sceneGraph.getNodeCount() == 0)
+    {
+        for (const std::vector<glm::vec3>& triangles : meshTriangles)
+        {
+            positions.insert(positions.end(), triangles.begin(), triangles.end());
+        }
+        return;
+    }
+
+    for (int node : sceneGraph.getDrawableNodes())
+    {
+        int mesh = sceneGraph.getMesh(node);
+        if (mesh < 0 || mesh >= static_cast<int>(meshTriangles.size()))
+        {
+            continue;
+        }
+        const glm::mat4& world = sceneGraph.getWorldMatrix(node);
+        for (const glm::vec3& position : meshTriangles[mesh])
+        {
+            positions.push_back(glm::vec3(world * glm::vec4(position, 1.0f)));
+        }
+    }
+}
+
+BvhBuffers::BvhBuffers()
+{
+    glGenBuffers(1, &nodeBuffer);
+    glGenBuffers(1, &triangleBuffer);
+    glGenTextures(1, &nodeTexture);
+    glGenTextures(1, &triangleTexture);
+}
+
+BvhBuffers::~BvhBuffers()
+{
+    glDeleteTextures(1, &nodeTexture);
+    glDeleteTextures(1, &triangleTexture);
+    glDeleteBuffers(1, &nodeBuffer);
+    glDeleteBuffers(1, &triangleBuffer);
+}
+
+void BvhBuffers::upload(const TriangleBvh& bvh, const std::vector<glm::vec3>& positions)
+{
+    PROFILE_ZONE("BvhBuffers::upload");
+    const std::vector<BvhNode>& nodes = bvh.getNodes();
+    const std::vector<uint32_t>& order = bvh.getTriangleOrder();
+
+    // Vertex 0 and the two edges, as the shader's intersection test wants them
+    staging.resize(order.size() * 3);
+    for (size_t slot = 0; slot < order.size(); ++slot)
+    {
+        const glm::vec3* triangle = &positions[static_cast<size_t>(order[slot]) * 3];
+        staging[slot * 3] = glm::vec4(triangle[0], 1.0f);
+        staging[slot * 3 + 1] = glm::vec4(triangle[1] - triangle[0], 0.0f);
+        staging[slot * 3 + 2] = glm::vec4(triangle[2] - triangle[0], 0.0f);
+    }
+
+    size_t newNodeTexels = nodes.size() * 2;
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if (std::max(newNodeTexels, staging.size()) > static_cast<size_t>(maxTexels))
+    {
+        std::cerr << "BVH needs " << std::max(newNodeTexels, staging.size()) << " texels, more than the "
+            << maxTexels << " a texture buffer holds here; shadow rays are disabled" << std::endl;
+        newNodeTexels = 0;
+        staging.clear();
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, nodeBuffer);
+    if (newNodeTexels == nodeTexels && nodeTexels > 0)
+    {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, newNodeTexels * sizeof(glm::vec4), nodes.data());
+    }
+    else
+    {
+        glBufferData(GL_TEXTURE_BUFFER, newNodeTexels * sizeof(glm::vec4), newNodeTexels ? nodes.data() : nullptr,
+                     GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, triangleBuffer);
+    if (staging.size() == triangleTexels && triangleTexels > 0)
+    {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, staging.size() * sizeof(glm::vec4), staging.data());
+    }
+    else
+    {
+        glBufferData(GL_TEXTURE_BUFFER, staging.size() * sizeof(glm::vec4), staging.empty() ? nullptr : staging.data(),
+                     GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    nodeTexels = newNodeTexels;
+    triangleTexels = staging.size();
+
+    glBindTexture(GL_TEXTURE_BUFFER, nodeTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, nodeBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, triangleTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, triangleBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    Profiler::get().addCounter(ProfileCounter::BytesUploaded, (nodeTexels + triangleTexels) * sizeof(glm::vec4));
+}
+
+void BvhBuffers::bind() const
+{
+    glActiveTexture(GL_TEXTURE0 + BVH_NODE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, nodeTexture);
+    glActiveTexture(GL_TEXTURE0 + BVH_TRIANGLE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, triangleTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
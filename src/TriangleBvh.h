@@ -0,0 +1,93 @@
+﻿#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Model;
+class ThreadPool;
+
+// Texture units of the samplerBuffers in raytrace.frag; 0-2 hold the material and cube map textures
+const GLuint BVH_NODE_TEXTURE_UNIT = 3;
+const GLuint BVH_TRIANGLE_TEXTURE_UNIT = 4;
+
+// 32 bytes, uploaded as two RGBA32F texels with the integers bit-cast
+struct BvhNode
+{
+    float min[3];
+    uint32_t leftFirst; // inner nodes: right child (the left child is the next node); leaves: first triangle
+    float max[3];
+    uint32_t count;     // triangles in the leaf, 0 for inner nodes
+};
+
+struct BvhStats
+{
+    size_t triangles = 0;
+    size_t nodes = 0;
+    size_t leaves = 0;
+    uint32_t maxDepth = 0;
+    double buildMilliseconds = 0.0; // last build or refit
+    double sahCost = 0.0;           // traversal and intersection cost 1, relative to the root area
+};
+
+// Binned-SAH BVH over triangles, flattened depth-first so a node's left child
+// follows it and refit() is one reverse pass. Large nodes are binned in parallel
+// chunks and large subtrees build as separate pool tasks; the result does not
+// depend on the pool. Leaves reference a permuted triangle order.
+class TriangleBvh
+{
+public:
+    // Three vertices per triangle
+    void build(const std::vector<glm::vec3>& positions, ThreadPool* pool = nullptr, uint32_t maxLeafSize = 4);
+
+    // New positions for the same triangles (animated nodes): bounds are recomputed, the topology is kept.
+    // False when the triangle count changed and a full build is needed.
+    bool refit(const std::vector<glm::vec3>& positions);
+
+    void clear();
+
+    bool isEmpty() const { return nodes.empty(); }
+    const std::vector<BvhNode>& getNodes() const { return nodes; }
+    const std::vector<uint32_t>& getTriangleOrder() const { return triangleOrder; } // leaf slot -> input triangle
+    const BvhStats& getStats() const { return stats; }
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> triangleOrder;
+    BvhStats stats;
+
+    void updateSahCost();
+};
+
+// World-space triangles of every drawable scene node (LOD 0), three vertices each
+void gatherWorldTriangles(const Model& model, std::vector<glm::vec3>& positions);
+
+// The BVH and its triangles (leaf order, three RGBA32F texels each) in texture
+// buffers, so GLSL 3.30 shaders can trace rays through texelFetch
+class BvhBuffers
+{
+public:
+    BvhBuffers();
+    ~BvhBuffers();
+    BvhBuffers(const BvhBuffers&) = delete;
+    BvhBuffers& operator=(const BvhBuffers&) = delete;
+
+    // Sizes that match the last upload are updated in place (refits)
+    void upload(const TriangleBvh& bvh, const std::vector<glm::vec3>& positions);
+    void bind() const;
+    bool isEmpty() const { return nodeTexels == 0; }
+
+private:
+    GLuint nodeBuffer = 0;
+    GLuint triangleBuffer = 0;
+    GLuint nodeTexture = 0;
+    GLuint triangleTexture = 0;
+    size_t nodeTexels = 0;
+    size_t triangleTexels = 0;
+    std::vector<glm::vec4> staging;
+};
+
+#endif
@@ -0,0 +1,114 @@
+﻿#include "VertexQuantization.h"
+#include "Shader.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    uint16_t quantizeUnorm16(float value, float offset, float scale)
+    {
+        float normalized = scale > 0.0f ? (value - offset) / scale : 0.0f;
+        return static_cast<uint16_t>(std::lround(std::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+    }
+
+    int16_t quantizeSnorm16(float value)
+    {
+        return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+    }
+
+    float signNotZero(float value)
+    {
+        return value >= 0.0f ? 1.0f : -1.0f;
+    }
+}
+
+void QuantizationRange::expand(const glm::vec3& position, const glm::vec2& texCoord)
+{
+    positionMin = glm::min(positionMin, position);
+    positionMax = glm::max(positionMax, position);
+    texCoordMin = glm::min(texCoordMin, texCoord);
+    texCoordMax = glm::max(texCoordMax, texCoord);
+}
+
+VertexDequantization QuantizationRange::getDequantization() const
+{
+    VertexDequantization dequantization;
+    dequantization.octahedralNormals = true;
+    if (positionMin.x > positionMax.x)
+    {
+        return dequantization; // no vertices
+    }
+    dequantization.positionOffset = positionMin;
+    dequantization.positionScale = positionMax - positionMin;
+    dequantization.texCoordOffset = texCoordMin;
+    dequantization.texCoordScale = texCoordMax - texCoordMin;
+    return dequantization;
+}
+
+void encodeOctahedral(const glm::vec3& normal, int16_t encoded[2])
+{
+    // Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the diagonals
+    float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (length == 0.0f)
+    {
+        encoded[0] = encoded[1] = 0;
+        return;
+    }
+    float x = normal.x / length;
+    float y = normal.y / length;
+    if (normal.z < 0.0f)
+    {
+        float foldedX = (1.0f - std::abs(y)) * signNotZero(x);
+        float foldedY = (1.0f - std::abs(x)) * signNotZero(y);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = quantizeSnorm16(x);
+    encoded[1] = quantizeSnorm16(y);
+}
+
+glm::vec3 decodeOctahedral(const int16_t encoded[2])
+{
+    glm::vec3 normal(encoded[0] / 32767.0f, encoded[1] / 32767.0f, 0.0f);
+    normal.z = 1.0f - std::abs(normal.x) - std::abs(normal.y);
+    float fold = std::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return glm::normalize(normal);
+}
+
+QuantizedVertex quantizeVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& texCoord,
+                               const VertexDequantization& dequantization)
+{
+    QuantizedVertex vertex = {};
+    for (int i = 0; i < 3; ++i)
+    {
+        vertex.position[i] = quantizeUnorm16(position[i], dequantization.positionOffset[i], dequantization.positionScale[i]);
+    }
+    encodeOctahedral(normal, vertex.normal);
+    for (int i = 0; i < 2; ++i)
+    {
+        vertex.texCoord[i] = quantizeUnorm16(texCoord[i], dequantization.texCoordOffset[i], dequantization.texCoordScale[i]);
+    }
+    return vertex;
+}
+
+void dequantizeVertex(const QuantizedVertex& vertex, const VertexDequantization& dequantization, glm::vec3& position,
+                      glm::vec3& normal, glm::vec2& texCoord)
+{
+    // The same arithmetic as raytrace.vert, so CPU consumers see the triangles the GPU draws
+    glm::vec3 quantizedPosition(vertex.position[0], vertex.position[1], vertex.position[2]);
+    position = dequantization.positionOffset + quantizedPosition / 65535.0f * dequantization.positionScale;
+    normal = decodeOctahedral(vertex.normal);
+    glm::vec2 quantizedTexCoord(vertex.texCoord[0], vertex.texCoord[1]);
+    texCoord = dequantization.texCoordOffset + quantizedTexCoord / 65535.0f * dequantization.texCoordScale;
+}
+
+void setVertexDequantization(const Shader& shader, const VertexDequantization& dequantization)
+{
+    shader.set(shader.getUniform<glm::vec3>("positionOffset"), dequantization.positionOffset);
+    shader.set(shader.getUniform<glm::vec3>("positionScale"), dequantization.positionScale);
+    shader.set(shader.getUniform<glm::vec4>("texCoordTransform"),
+               glm::vec4(dequantization.texCoordOffset, dequantization.texCoordScale));
+    shader.set(shader.getUniform<bool>("octahedralNormals"), dequantization.octahedralNormals);
+}
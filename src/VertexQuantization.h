@@ -0,0 +1,62 @@
+﻿#ifndef VERTEX_QUANTIZATION_H
+#define VERTEX_QUANTIZATION_H
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+class Shader;
+
+// 16 bytes, half of a float vertex: position and texture coordinates as unorm16 within the
+// mesh's ranges, the normal octahedral-encoded as two snorm16 (read unnormalized, see raytrace.vert)
+struct QuantizedVertex
+{
+    uint16_t position[4]; // w is padding
+    int16_t normal[2];
+    uint16_t texCoord[2];
+};
+
+// Maps unorm16 positions and texture coordinates back to mesh space; the default is the
+// identity used by float vertices
+struct VertexDequantization
+{
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+    glm::vec2 texCoordOffset = glm::vec2(0.0f);
+    glm::vec2 texCoordScale = glm::vec2(1.0f);
+    bool octahedralNormals = false;
+
+    bool operator==(const VertexDequantization& other) const
+    {
+        return positionOffset == other.positionOffset && positionScale == other.positionScale &&
+            texCoordOffset == other.texCoordOffset && texCoordScale == other.texCoordScale &&
+            octahedralNormals == other.octahedralNormals;
+    }
+    bool operator!=(const VertexDequantization& other) const { return !(*this == other); }
+};
+
+// Accumulates the ranges of every vertex that will share one dequantization
+class QuantizationRange
+{
+public:
+    void expand(const glm::vec3& position, const glm::vec2& texCoord);
+    VertexDequantization getDequantization() const;
+
+private:
+    glm::vec3 positionMin = glm::vec3(3.4e38f);
+    glm::vec3 positionMax = glm::vec3(-3.4e38f);
+    glm::vec2 texCoordMin = glm::vec2(3.4e38f);
+    glm::vec2 texCoordMax = glm::vec2(-3.4e38f);
+};
+
+void encodeOctahedral(const glm::vec3& normal, int16_t encoded[2]);
+glm::vec3 decodeOctahedral(const int16_t encoded[2]);
+
+QuantizedVertex quantizeVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& texCoord,
+                               const VertexDequantization& dequantization);
+void dequantizeVertex(const QuantizedVertex& vertex, const VertexDequantization& dequantization, glm::vec3& position,
+                      glm::vec3& normal, glm::vec2& texCoord);
+
+// Sets the decode uniforms of raytrace.vert
+void setVertexDequantization(const Shader& shader, const VertexDequantization& dequantization);
+
+#endif
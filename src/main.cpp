@@ -1,4 +1,4 @@
-#include <GL/glew.h>
+﻿#include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -6,13 +6,39 @@
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <limits>
 #include <filesystem>
+#include <memory>
+#include <thread>
 #include "Camera.h"
 #include "Shader.h"
+#include "ShaderCache.h"
 #include "Model.h"
 #include "Texture.h"
 #include "Light.h"
+#include "AssetLoader.h"
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+#include "FrameUniforms.h"
+#include "FrameAccumulator.h"
+#include "FrameClock.h"
+#include "RenderTargetPool.h"
+#include "DynamicResolution.h"
+#include "BatchRenderer.h"
+#include "InstancedRenderer.h"
+#include "OcclusionCulling.h"
+#include "ClusteredLighting.h"
+#include "PathTracer.h"
+#include "TriangleBvh.h"
+#include "ThreadPool.h"
+#include "Benchmark.h"
+#include "HeadlessContext.h"
+#include "Profiler.h"
 
 // Camera settings
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, 0.0f);
@@ -20,12 +46,94 @@ float lastX = 400, lastY = 300;
 bool firstMouse = true;
 glm::vec3 lightColor1(1.0f, 1.0f, 1.0f);
 glm::vec3 lightColor2(1.0f, 1.0f, 1.0f);
+const glm::vec3 lightPosition1(1.2f, 1.0f, 2.0f);
+const glm::vec3 lightPosition2(-1.2f, -1.0f, -2.0f);
 
-// Framebuffer
-GLuint framebuffer, textureColorbuffer, rbo;
+const std::vector<std::string> cubemapFaces = {
+    "textures/cubemap/right.jpg",
+    "textures/cubemap/left.jpg",
+    "textures/cubemap/top.jpg",
+    "textures/cubemap/bottom.jpg",
+    "textures/cubemap/front.jpg",
+    "textures/cubemap/back.jpg"
+};
+
+// Real frame timing: camera movement steps at a fixed rate and is drawn interpolated between steps
+FrameClock frameClock;
+glm::vec3 previousCameraPosition = camera.position;
+float cameraInterpolation = 1.0f;
+SwapMode swapMode = SwapMode::VSync;
+int frameRateLimit = 0; // frames per second, 0 is uncapped
+
+// Offscreen targets come from a pool; the scene is drawn into the lower-left
+// framebufferWidth x framebufferHeight corner of sceneTarget
+std::unique_ptr<RenderTargetPool> renderTargets;
+RenderTarget* sceneTarget = nullptr;
+
+// Internal resolution follows the viewport's GPU time toward a budget; ImGui::Image upscales it to the panel
+std::unique_ptr<DynamicResolution> dynamicResolution;
 bool mouseInViewport = false;
 bool rightMousePressed = false;
 
+// Camera and light data shared by all programs
+std::unique_ptr<FrameUniforms> frameUniforms;
+glm::mat4 projectionMat;
+const float nearPlane = 0.1f;
+const float farPlane = 100.0f;
+
+// Point lights scattered around the scene, shaded per cluster (null without GL 4.3)
+std::unique_ptr<ClusteredLighting> clusteredLighting;
+std::vector<PointLight> pointLights;
+int pointLightCount = 0;
+
+// Batched multi-draw path, toggled from the Renderer panel
+std::unique_ptr<BatchRenderer> batchRenderer;
+bool useBatchRenderer = false;
+bool useFrustumCulling = true;
+
+// Two-phase Hi-Z occlusion culling of the batched multi-draws (null without GL 4.3)
+std::unique_ptr<OcclusionCuller> occlusionCuller;
+bool useOcclusionCulling = true;
+
+// Mesh LOD selection; the allowed screen-space error is 2^lodBias pixels
+bool useMeshLods = true;
+float lodBias = 0.0f;
+
+// World-space scene triangles under a BVH in texture buffers, traced for the global lights' shadows
+TriangleBvh sceneBvh;
+std::unique_ptr<BvhBuffers> bvhBuffers;
+std::vector<glm::vec3> sceneTriangles;
+bool bvhShadows = false;
+
+// Recompile shaders whose files under shaders/ change on disk
+bool hotReloadShaders = true;
+
+// Unchanged frames reuse the last image and refine it with jittered samples; once that
+// is done the main loop sleeps in glfwWaitEventsTimeout instead of polling
+RedrawTracker viewportRedraw;
+std::unique_ptr<FrameAccumulator> frameAccumulator;
+bool skipUnchangedFrames = true;
+int maxAccumulatedSamples = 16;
+bool viewportIdle = false;
+int redrawnFrames = 0;
+int skippedFrames = 0;
+const double idleWaitSeconds = 0.5; // also bounds the latency of shader hot reload polling
+
+// Instanced copies of the model laid out on a grid, sized from the Renderer panel
+std::unique_ptr<InstancedRenderer> instancedRenderer;
+std::vector<InstancedRenderer::InstanceId> gridInstances;
+int instanceGridCount = 0;
+
+// The Profiler panel docks next to Light Control the first time it is shown
+ImGuiID lightControlDockId = 0;
+std::string traceExportStatus;
+
+// Handles keep the model's textures resident in the registry
+TextureRegistry::Handle diffuseTexture, normalTexture;
+
+// Mip levels beyond the tail arrive over later frames, as the model's screen size asks for them
+std::unique_ptr<TextureStreamer> textureStreamer;
+
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -34,6 +142,7 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     }
 }
 
+// Keyboard movement, called once per fixed step
 void processInput(GLFWwindow* window, Camera& camera, float deltaTime)
 {
     if (mouseInViewport && rightMousePressed)
@@ -50,7 +159,14 @@ void processInput(GLFWwindow* window, Camera& camera, float deltaTime)
             camera.processKeyboard(UP, deltaTime);
         if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
             camera.processKeyboard(DOWN, deltaTime);
+    }
+}
 
+// Mouse look follows the cursor directly, once per frame
+void processMouseLook(GLFWwindow* window, Camera& camera)
+{
+    if (mouseInViewport && rightMousePressed)
+    {
         // Handle mouse input
         double xpos, ypos;
         glfwGetCursorPos(window, &xpos, &ypos);
@@ -65,37 +181,401 @@ void processInput(GLFWwindow* window, Camera& camera, float deltaTime)
     }
 }
 
+// The camera as displayed, its position blended between the last two fixed steps
+Camera getRenderCamera()
+{
+    Camera view = camera;
+    view.position = glm::mix(previousCameraPosition, camera.position, cameraInterpolation);
+    return view;
+}
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
 }
 
-void renderToFramebuffer(Shader& shader, Model& model, GLuint cubemapTexture, int framebufferWidth, int framebufferHeight)
+void resizePointLights(int count)
+{
+    Aabb bounds;
+    bounds.min = glm::vec3(-12.0f, -3.0f, -12.0f);
+    bounds.max = glm::vec3(12.0f, 3.0f, 12.0f);
+    scatterPointLights(pointLights, static_cast<size_t>(count), bounds, 0.5f, 2.5f);
+    pointLightCount = count;
+}
+
+void rebuildSceneBvh(const Model& model, ThreadPool& pool)
+{
+    gatherWorldTriangles(model, sceneTriangles);
+    sceneBvh.build(sceneTriangles, &pool);
+    bvhBuffers->upload(sceneBvh, sceneTriangles);
+    const BvhStats& stats = sceneBvh.getStats();
+    std::cout << "Scene BVH: " << stats.triangles << " triangles, " << stats.nodes << " nodes, depth "
+        << stats.maxDepth << ", SAH cost " << stats.sahCost << ", built in " << stats.buildMilliseconds << " ms" << std::endl;
+}
+
+// Moved nodes keep the tree topology, so only the bounds are refit
+void refitSceneBvh(const Model& model, ThreadPool& pool)
+{
+    if (sceneBvh.isEmpty())
+    {
+        return;
+    }
+    gatherWorldTriangles(model, sceneTriangles);
+    if (sceneBvh.refit(sceneTriangles))
+    {
+        bvhBuffers->upload(sceneBvh, sceneTriangles);
+    }
+    else
+    {
+        rebuildSceneBvh(model, pool);
+    }
+}
+
+// Projected diameter of the scene bounds, the most screen space the model's textures can cover
+float getSceneScreenPixels(const glm::vec3& eye, int viewportHeight)
+{
+    if (sceneBvh.isEmpty())
+    {
+        return std::numeric_limits<float>::max();
+    }
+    const BvhNode& root = sceneBvh.getNodes()[0];
+    glm::vec3 boundsMin(root.min[0], root.min[1], root.min[2]);
+    glm::vec3 boundsMax(root.max[0], root.max[1], root.max[2]);
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+    float distance = glm::length(eye - (boundsMin + boundsMax) * 0.5f);
+    if (distance <= radius)
+    {
+        return std::numeric_limits<float>::max();
+    }
+    float focalPixels = viewportHeight / (2.0f * std::tan(glm::radians(45.0f) * 0.5f));
+    return 2.0f * radius / distance * focalPixels;
+}
+
+void requestModelTextures(int framebufferHeight)
+{
+    float screenPixels = getSceneScreenPixels(getRenderCamera().position, framebufferHeight);
+    for (const TextureRegistry::Handle& texture : {diffuseTexture, normalTexture})
+    {
+        if (texture)
+        {
+            textureStreamer->request(texture->id, screenPixels);
+        }
+    }
+}
+
+void renderToFramebuffer(Shader& shader, Model& model, GLuint cubemapTexture, int framebufferWidth, int framebufferHeight,
+                         ThreadPool& pool, const glm::vec2& jitter = glm::vec2(0.0f))
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    PROFILE_ZONE("renderToFramebuffer");
+    PROFILE_GPU_ZONE("renderToFramebuffer");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneTarget->framebuffer);
     glViewport(0, 0, framebufferWidth, framebufferHeight);
     glClearColor(0.53f, 0.81f, 0.98f, 1.0f); // Light blue background
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     shader.use();
-    glm::mat4 viewMat = camera.getViewMatrix();
-    shader.setMat4("view", viewMat);
-    shader.setVec3("viewPos", camera.position);
-
-    Light light1 = { glm::vec3(1.2f, 1.0f, 2.0f), lightColor1 };
-    Light light2 = { glm::vec3(-1.2f, -1.0f, -2.0f), lightColor2 };
-    shader.setLight("light1", light1);
-    shader.setLight("light2", light2);
+    Camera view = getRenderCamera();
+    glm::mat4 viewMat = view.getViewMatrix();
+    Light lights[] = {
+        { lightPosition1, lightColor1 },
+        { lightPosition2, lightColor2 }
+    };
+    bool shadowRays = bvhShadows && !bvhBuffers->isEmpty();
+    glm::mat4 jitteredProjection = jitterProjection(projectionMat, jitter, framebufferWidth, framebufferHeight);
+    frameUniforms->update(viewMat, jitteredProjection, view.position, lights, 2, shadowRays);
+    if (shadowRays)
+    {
+        bvhBuffers->bind();
+    }
+    if (clusteredLighting)
+    {
+        clusteredLighting->update(viewMat, projectionMat, nearPlane, farPlane, framebufferWidth, framebufferHeight,
+                                  pointLights, &pool);
+    }
 
     glActiveTexture(GL_TEXTURE2);
     glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
 
-    model.draw(shader.ID);
+    Frustum frustum(projectionMat * viewMat);
+    const Frustum* cullFrustum = useFrustumCulling ? &frustum : nullptr;
+    LodSelector lodSelector(view.position, glm::radians(45.0f), framebufferHeight, std::exp2(lodBias));
+    const LodSelector* meshLodSelector = useMeshLods ? &lodSelector : nullptr;
+    if (instancedRenderer->getInstanceCount() > 0)
+    {
+        instancedRenderer->draw();
+    }
+    else if (useBatchRenderer && batchRenderer->getDrawCount() > 0)
+    {
+        // Tested against this frame's depth, so the jittered projection the scene is drawn with
+        OcclusionCuller* culler = nullptr;
+        if (useOcclusionCulling && occlusionCuller)
+        {
+            occlusionCuller->setView(jitteredProjection * viewMat, sceneTarget->depthTexture, framebufferWidth,
+                                     framebufferHeight);
+            culler = occlusionCuller.get();
+        }
+        batchRenderer->draw(shader, cullFrustum, meshLodSelector, culler);
+    }
+    else
+    {
+        model.draw(shader, cullFrustum, meshLodSelector);
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0); // Unbind framebuffer
 }
 
-void renderImGui(GLFWwindow* window, Shader& shader, Model& model, GLuint cubemapTexture, int& framebufferWidth, int& framebufferHeight, float deltaTime)
+// Everything the viewport image depends on that can change without an event of its own
+void trackViewportState(const Shader& shader, const Model& model, GLuint cubemapTexture, int framebufferWidth, int framebufferHeight)
+{
+    viewportRedraw.add(framebufferWidth);
+    viewportRedraw.add(framebufferHeight);
+    viewportRedraw.add(getRenderCamera().position);
+    viewportRedraw.add(camera.front);
+    viewportRedraw.add(camera.up);
+    viewportRedraw.add(projectionMat);
+    viewportRedraw.add(lightColor1);
+    viewportRedraw.add(lightColor2);
+    viewportRedraw.add(pointLights.data(), pointLights.size() * sizeof(PointLight));
+    viewportRedraw.add(useBatchRenderer);
+    viewportRedraw.add(useFrustumCulling);
+    viewportRedraw.add(useOcclusionCulling);
+    viewportRedraw.add(useMeshLods);
+    viewportRedraw.add(lodBias);
+    viewportRedraw.add(bvhShadows);
+    viewportRedraw.add(instanceGridCount);
+    viewportRedraw.add(maxAccumulatedSamples);
+    viewportRedraw.add(cubemapTexture);
+    viewportRedraw.add(shader.ID);
+    viewportRedraw.add(model.isReady());
+}
+
+void resizeInstanceGrid(int count)
+{
+    // Positions depend only on the index, so growing adds slots and shrinking drops them without touching the rest
+    const int columns = 128;
+    const float spacing = 3.0f;
+    while (static_cast<int>(gridInstances.size()) < count)
+    {
+        int index = static_cast<int>(gridInstances.size());
+        glm::vec3 position((index % columns) * spacing, 0.0f, -(index / columns) * spacing);
+        gridInstances.push_back(instancedRenderer->addInstance(glm::translate(glm::mat4(1.0f), position)));
+    }
+    while (static_cast<int>(gridInstances.size()) > count)
+    {
+        instancedRenderer->removeInstance(gridInstances.back());
+        gridInstances.pop_back();
+    }
+}
+
+// Sizes within the current bucket keep the same target, so dragging a splitter doesn't reallocate
+void resizeFramebuffer(int width, int height)
+{
+    sceneTarget = sceneTarget ? renderTargets->resize(sceneTarget, width, height)
+                              : renderTargets->acquire(width, height, GL_RGB8, true);
+}
+
+void bindModelTextures(Shader& shader, Model& model, TextureRegistry& registry)
+{
+    shader.use();
+
+    bool diffuseTextureBound = false;
+    bool normalTextureBound = false;
+    for (int textureIndex = 0; textureIndex < model.getTextureCount(); ++textureIndex)
+    {
+        if (!diffuseTextureBound)
+        {
+            diffuseTexture = model.loadTextureFromModel(textureIndex, registry, textureStreamer.get());
+            if (!diffuseTexture)
+            {
+                continue;
+            }
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, diffuseTexture->id);
+            shader.setInt("texture_diffuse", 0);
+            diffuseTextureBound = true;
+        }
+        if (!normalTextureBound)
+        {
+            // Same image as the diffuse slot, so the registry hands back the existing texture
+            normalTexture = model.loadTextureFromModel(textureIndex, registry, textureStreamer.get());
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, normalTexture ? normalTexture->id : 0);
+            shader.setInt("texture_normal", 1);
+            normalTextureBound = true;
+        }
+    }
+}
+
+void renderTextureRegistry(TextureRegistry& registry)
+{
+    ImGui::Begin("Textures");
+
+    int budgetMB = static_cast<int>(registry.getBudget() / (1024 * 1024));
+    if (ImGui::SliderInt("Budget (MB)", &budgetMB, 16, 4096))
+    {
+        registry.setBudget(static_cast<size_t>(budgetMB) * 1024 * 1024);
+    }
+    ImGui::Text("Resident: %.1f MB in %d textures", registry.getResidentBytes() / (1024.0 * 1024.0),
+                static_cast<int>(registry.getTextureCount()));
+    ImGui::Text("Hits: %d  Misses: %d  Evictions: %d", static_cast<int>(registry.getHitCount()),
+                static_cast<int>(registry.getMissCount()), static_cast<int>(registry.getEvictionCount()));
+    if (ImGui::Button("Evict Unused"))
+    {
+        registry.evictUnused();
+    }
+
+    ImGui::Separator();
+    const TextureStreamerStats& streamStats = textureStreamer->getStats();
+    int streamBudgetKB = static_cast<int>(textureStreamer->getFrameBudget() / 1024);
+    if (ImGui::SliderInt("Stream Budget (KB/frame)", &streamBudgetKB, 256, 32768))
+    {
+        textureStreamer->setFrameBudget(static_cast<size_t>(streamBudgetKB) * 1024);
+    }
+    ImGui::Text("Streamed: %.1f MB in %d textures  Pending levels: %d", streamStats.residentBytes / (1024.0 * 1024.0),
+                static_cast<int>(streamStats.textures), static_cast<int>(streamStats.pendingLevels));
+    ImGui::Text("Last frame: %.1f KB  Dropped levels: %d", streamStats.uploadedBytes / 1024.0,
+                static_cast<int>(streamStats.droppedLevels));
+
+    if (ImGui::BeginTable("TextureList", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("ID");
+        ImGui::TableSetupColumn("Image");
+        ImGui::TableSetupColumn("KB");
+        ImGui::TableSetupColumn("In Use");
+        ImGui::TableHeadersRow();
+        for (const auto& texture : registry.getTextures())
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", texture->id);
+            ImGui::TableNextColumn();
+            ImGui::Text("%s #%d", texture->key.asset.c_str(), texture->key.image);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", texture->bytes / 1024.0);
+            ImGui::TableNextColumn();
+            // The list returned by getTextures() holds one extra reference per texture
+            ImGui::Text("%s", texture.use_count() > 2 ? "yes" : "no");
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+void renderSceneGraph(Model& model)
+{
+    ImGui::Begin("Scene");
+
+    // The loader thread builds the graph until the model is ready, so it must not be read before then
+    if (!model.isReady())
+    {
+        ImGui::Text("Loading...");
+        ImGui::End();
+        return;
+    }
+
+    SceneGraph& sceneGraph = model.getSceneGraph();
+    ImGui::Text("Nodes: %d", static_cast<int>(sceneGraph.getNodeCount()));
+
+    // Listing is capped so huge scenes don't turn the panel into the bottleneck
+    const int maxListedNodes = 256;
+    int listed = std::min(static_cast<int>(sceneGraph.getNodeCount()), maxListedNodes);
+    for (int node = 0; node < listed; ++node)
+    {
+        ImGui::PushID(node);
+        const std::string& name = sceneGraph.getName(node);
+        ImGui::Text("%d: %s", node, name.empty() ? "(unnamed)" : name.c_str());
+
+        glm::vec3 translation = sceneGraph.getTranslation(node);
+        if (ImGui::DragFloat3("Translation", glm::value_ptr(translation), 0.01f))
+        {
+            sceneGraph.setTranslation(node, translation);
+        }
+        glm::vec3 scale = sceneGraph.getScale(node);
+        if (ImGui::DragFloat3("Scale", glm::value_ptr(scale), 0.01f))
+        {
+            sceneGraph.setScale(node, scale);
+        }
+        ImGui::PopID();
+    }
+
+    ImGui::End();
+}
+
+void renderProfilerEvents(const std::vector<ProfileEvent>& events, uint32_t thread)
+{
+    for (const ProfileEvent& event : events)
+    {
+        if (event.thread != thread)
+        {
+            continue;
+        }
+        ImGui::Text("%*s%s  %.3f ms", static_cast<int>(event.depth * 2), "", event.name,
+                    (event.endNs - event.startNs) / 1.0e6);
+    }
+}
+
+void renderProfiler()
+{
+    if (lightControlDockId != 0)
+    {
+        ImGui::SetNextWindowDockID(lightControlDockId, ImGuiCond_FirstUseEver);
+    }
+    ImGui::Begin("Profiler");
+
+    Profiler& profiler = Profiler::get();
+    bool enabled = profiler.isEnabled();
+    if (ImGui::Checkbox("Enabled", &enabled))
+    {
+        profiler.setEnabled(enabled);
+    }
+
+    const std::deque<ProfileFrame>& history = profiler.getHistory();
+    float frameTimes[Profiler::HISTORY_FRAMES] = {};
+    int frameCount = 0;
+    for (const ProfileFrame& frame : history)
+    {
+        frameTimes[frameCount++] = (frame.endNs - frame.startNs) / 1.0e6f;
+    }
+    ImGui::PlotLines("Frame (ms)", frameTimes, frameCount, 0, nullptr, 0.0f, 33.3f, ImVec2(0, 60));
+
+    // GPU results arrive a few frames late, so everything below describes the same resolved frame
+    const ProfileFrame* frame = profiler.getLastResolvedFrame();
+    if (frame)
+    {
+        ImGui::Text("Frame %d  CPU %.3f ms  GPU %.3f ms", static_cast<int>(frame->index),
+                    (frame->endNs - frame->startNs) / 1.0e6, frame->gpuNs / 1.0e6);
+        ImGui::Text("Draw calls: %d  State changes: %d  Uploaded: %d bytes",
+                    static_cast<int>(frame->counters[static_cast<size_t>(ProfileCounter::DrawCalls)]),
+                    static_cast<int>(frame->counters[static_cast<size_t>(ProfileCounter::StateChanges)]),
+                    static_cast<int>(frame->counters[static_cast<size_t>(ProfileCounter::BytesUploaded)]));
+
+        if (ImGui::CollapsingHeader("CPU zones", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            renderProfilerEvents(frame->cpuEvents, profiler.getFrameThread());
+        }
+        if (ImGui::CollapsingHeader("GPU zones", ImGuiTreeNodeFlags_DefaultOpen))
+        {
+            renderProfilerEvents(frame->gpuEvents, Profiler::GPU_THREAD);
+        }
+    }
+
+    ImGui::Separator();
+    if (ImGui::Button("Export Chrome Trace"))
+    {
+        traceExportStatus = profiler.exportChromeTrace("profile_trace.json") ?
+            "Wrote profile_trace.json" : "Failed to write profile_trace.json";
+    }
+    if (!traceExportStatus.empty())
+    {
+        ImGui::TextUnformatted(traceExportStatus.c_str());
+    }
+
+    ImGui::End();
+}
+
+void renderImGui(GLFWwindow* window, Shader& shader, Model& model, AssetLoader& loader, TextureRegistry& registry, GLuint cubemapTexture, int& framebufferWidth, int& framebufferHeight)
 {
     // Start the ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
@@ -121,6 +601,142 @@ void renderImGui(GLFWwindow* window, Shader& shader, Model& model, GLuint cubema
     ImGui::Begin("Light Control");
     ImGui::ColorEdit3("Light 1 Color", glm::value_ptr(lightColor1));
     ImGui::ColorEdit3("Light 2 Color", glm::value_ptr(lightColor2));
+    ImGui::Separator();
+    if (clusteredLighting)
+    {
+        if (ImGui::SliderInt("Point Lights", &pointLightCount, 0, 4096))
+        {
+            resizePointLights(pointLightCount);
+        }
+        if (ImGui::Button("Stress Test (4096 lights)"))
+        {
+            resizePointLights(4096);
+        }
+        const ClusterStats& clusterStats = clusteredLighting->getStats();
+        ImGui::Text("In view range: %d  Cluster entries: %d", static_cast<int>(clusterStats.lights),
+                    static_cast<int>(clusterStats.lightIndices));
+        ImGui::Text("Occupied clusters: %d / %d  Max per cluster: %d", static_cast<int>(clusterStats.occupiedClusters),
+                    static_cast<int>(CLUSTER_COUNT), static_cast<int>(clusterStats.maxClusterLights));
+    }
+    else
+    {
+        ImGui::Text("Point lights need OpenGL 4.3");
+    }
+    if (loader.isBusy())
+    {
+        ImGui::Separator();
+        ImGui::Text("Loading assets...");
+        ImGui::ProgressBar(loader.getProgress());
+    }
+    lightControlDockId = ImGui::GetWindowDockID();
+    ImGui::End();
+
+    renderProfiler();
+
+    renderTextureRegistry(registry);
+    renderSceneGraph(model);
+
+    ImGui::Begin("Renderer");
+    ImGui::Checkbox("Batched Rendering", &useBatchRenderer);
+    ImGui::Text("Path: %s", batchRenderer->isMultiDrawAvailable() ? "glMultiDrawElementsIndirect" : "glDrawElementsBaseVertex loop");
+    ImGui::Text("Draws: %d  Submits: %d", static_cast<int>(batchRenderer->getDrawCount()),
+                static_cast<int>(batchRenderer->getSubmitCount()));
+    ImGui::Checkbox("Frustum Culling", &useFrustumCulling);
+    const CullStats& cullStats = useBatchRenderer ? batchRenderer->getCullStats() : model.getCullStats();
+    ImGui::Text("Visible: %d  Culled: %d", static_cast<int>(cullStats.visible), static_cast<int>(cullStats.culled));
+    if (occlusionCuller && batchRenderer->isMultiDrawAvailable())
+    {
+        ImGui::Checkbox("Occlusion Culling (batched)", &useOcclusionCulling);
+        if (useOcclusionCulling && useBatchRenderer)
+        {
+            const OcclusionStats& occlusionStats = occlusionCuller->getStats();
+            ImGui::Text("Occluded: %d of %d  Late draws: %d  Hi-Z levels: %d",
+                        static_cast<int>(occlusionStats.occluded), static_cast<int>(occlusionStats.tested),
+                        static_cast<int>(occlusionStats.lateDraws), occlusionCuller->getPyramidLevels());
+        }
+    }
+    ImGui::Checkbox("Mesh LODs", &useMeshLods);
+    ImGui::SliderFloat("LOD Bias", &lodBias, -2.0f, 4.0f, "%.1f");
+    const LodStats& lodStats = useBatchRenderer ? batchRenderer->getLodStats() : model.getLodStats();
+    float lodHistogram[MAX_MESH_LODS];
+    for (uint32_t lod = 0; lod < MAX_MESH_LODS; ++lod)
+    {
+        lodHistogram[lod] = static_cast<float>(lodStats.draws[lod]);
+    }
+    ImGui::PlotHistogram("Draws per LOD", lodHistogram, MAX_MESH_LODS, 0, nullptr, 0.0f, 3.4e38f, ImVec2(0, 40));
+    ImGui::Text("Triangles: %d", static_cast<int>(lodStats.triangles));
+    ImGui::Separator();
+    ImGui::Checkbox("Ray-Traced Shadows", &bvhShadows);
+    const BvhStats& bvhStats = sceneBvh.getStats();
+    ImGui::Text("BVH: %d triangles, %d nodes, depth %d", static_cast<int>(bvhStats.triangles),
+                static_cast<int>(bvhStats.nodes), static_cast<int>(bvhStats.maxDepth));
+    ImGui::Text("Last build/refit: %.2f ms  SAH cost: %.1f", bvhStats.buildMilliseconds, bvhStats.sahCost);
+    if (ImGui::Button("Rebuild BVH") && model.isReady())
+    {
+        rebuildSceneBvh(model, loader.getThreadPool());
+    }
+    ImGui::Separator();
+    ImGui::Checkbox("Skip Unchanged Frames", &skipUnchangedFrames);
+    ImGui::SliderInt("Accumulated Samples", &maxAccumulatedSamples, 1, 64);
+    ImGui::Text("Samples: %d  Redrawn: %d  Skipped: %d%s", frameAccumulator->getSampleCount(), redrawnFrames,
+                skippedFrames, viewportIdle ? "  (idle)" : "");
+    ImGui::Separator();
+    bool dynamicScaling = dynamicResolution->isEnabled();
+    if (ImGui::Checkbox("Dynamic Resolution", &dynamicScaling))
+    {
+        dynamicResolution->setEnabled(dynamicScaling);
+    }
+    if (dynamicScaling)
+    {
+        float budget = static_cast<float>(dynamicResolution->getBudgetMilliseconds());
+        if (ImGui::SliderFloat("GPU Budget", &budget, 2.0f, 33.0f, "%.1f ms"))
+        {
+            dynamicResolution->setBudgetMilliseconds(budget);
+        }
+        ImGui::Text("Render scale: %.2f  Viewport GPU: %.2f ms", dynamicResolution->getScale(),
+                    dynamicResolution->getGpuMilliseconds());
+    }
+    else
+    {
+        float manualScale = dynamicResolution->getScale();
+        if (ImGui::SliderFloat("Render Scale", &manualScale, 0.5f, 1.0f, "%.2f"))
+        {
+            dynamicResolution->setScale(manualScale);
+        }
+    }
+    ImGui::Text("Render targets: %d (%.1f MB)  Allocated: %d  Reused: %d", static_cast<int>(renderTargets->getTargetCount()),
+                renderTargets->getResidentBytes() / (1024.0 * 1024.0), static_cast<int>(renderTargets->getAllocationCount()),
+                static_cast<int>(renderTargets->getReuseCount()));
+    ImGui::Separator();
+    const char* swapModes[] = { "Off", "VSync", "Adaptive VSync" };
+    int swapModeIndex = static_cast<int>(swapMode);
+    if (ImGui::Combo("Swap Interval", &swapModeIndex, swapModes, IM_ARRAYSIZE(swapModes)))
+    {
+        swapMode = applySwapMode(static_cast<SwapMode>(swapModeIndex));
+    }
+    if (ImGui::SliderInt("Frame Cap", &frameRateLimit, 0, 240, frameRateLimit == 0 ? "Off" : "%d fps"))
+    {
+        frameClock.setFrameRateLimit(frameRateLimit);
+    }
+    FrameTimeStats frameStats = frameClock.getStats();
+    ImGui::Text("Frame: %.2f ms (%.0f fps)  Std dev: %.2f ms", frameStats.avg,
+                frameStats.avg > 0.0 ? 1000.0 / frameStats.avg : 0.0, frameStats.stdDev);
+    ImGui::Text("Min: %.2f  p99: %.2f  Max: %.2f ms", frameStats.min, frameStats.p99, frameStats.max);
+    const std::vector<float>& frameHistory = frameClock.getHistory();
+    ImGui::PlotLines("Frame Times", frameHistory.data(), static_cast<int>(frameHistory.size()),
+                     static_cast<int>(frameClock.getHistoryOffset()), nullptr, 0.0f, 3.4e38f, ImVec2(0, 40));
+    ImGui::Separator();
+    ImGui::Checkbox("Hot Reload Shaders", &hotReloadShaders);
+    ShaderCache& shaderCache = ShaderCache::get();
+    ImGui::Text("Program binaries  Hits: %d  Misses: %d  Rejected: %d", static_cast<int>(shaderCache.getHitCount()),
+                static_cast<int>(shaderCache.getMissCount()), static_cast<int>(shaderCache.getRejectCount()));
+    ImGui::Separator();
+    if (ImGui::SliderInt("Instances", &instanceGridCount, 0, 16384) && model.isReady())
+    {
+        resizeInstanceGrid(instanceGridCount);
+    }
+    ImGui::Text("Instanced draw calls: %d  Uploaded: %d bytes", static_cast<int>(instancedRenderer->getDrawCallCount()),
+                static_cast<int>(instancedRenderer->getBytesUploaded()));
     ImGui::End();
 
     // 3D Viewport Tab
@@ -131,24 +747,58 @@ void renderImGui(GLFWwindow* window, Shader& shader, Model& model, GLuint cubema
     // Get the size of the available space in the viewport
     ImVec2 viewportSize = ImGui::GetContentRegionAvail();
 
-    if (framebufferWidth != (int)viewportSize.x || framebufferHeight != (int)viewportSize.y)
+    // The internal resolution is the panel size times the render scale
+    float renderScale = dynamicResolution->getScale();
+    int renderWidth = std::max(1, static_cast<int>(viewportSize.x * renderScale));
+    int renderHeight = std::max(1, static_cast<int>(viewportSize.y * renderScale));
+    if (framebufferWidth != renderWidth || framebufferHeight != renderHeight)
     {
-        framebufferWidth = (int)viewportSize.x;
-        framebufferHeight = (int)viewportSize.y;
-
-        // Resize framebuffer attachments
-        glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, framebufferWidth, framebufferHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        framebufferWidth = renderWidth;
+        framebufferHeight = renderHeight;
+        resizeFramebuffer(framebufferWidth, framebufferHeight);
+        frameAccumulator->resize(framebufferWidth, framebufferHeight);
+    }
 
-        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, framebufferWidth, framebufferHeight);
+    // Redraw when something changed, then keep adding jittered samples until the average is complete
+    trackViewportState(shader, model, cubemapTexture, framebufferWidth, framebufferHeight);
+    bool changed = viewportRedraw.commit() || !skipUnchangedFrames;
+    if (changed)
+    {
+        frameAccumulator->reset();
+    }
+    bool accumulating = maxAccumulatedSamples > 1;
+    bool refining = accumulating && frameAccumulator->getSampleCount() < maxAccumulatedSamples;
+    if (changed || refining)
+    {
+        // Only frames that follow changes are timed; refinement of a still view keeps its scale
+        if (changed)
+        {
+            dynamicResolution->begin();
+        }
+        renderToFramebuffer(shader, model, cubemapTexture, framebufferWidth, framebufferHeight, loader.getThreadPool(),
+                            frameAccumulator->getNextJitter());
+        if (changed)
+        {
+            dynamicResolution->end();
+        }
+        if (accumulating)
+        {
+            frameAccumulator->accumulate(*sceneTarget);
+        }
+        ++redrawnFrames;
     }
+    else
+    {
+        ++skippedFrames;
+    }
+    viewportIdle = !changed && !refining;
 
-    // Render to framebuffer with the new size
-    renderToFramebuffer(shader, model, cubemapTexture, framebufferWidth, framebufferHeight);
+    dynamicResolution->update();
 
-    // Display the framebuffer texture in the ImGui window
-    ImGui::Image((void*)(intptr_t)textureColorbuffer, viewportSize, ImVec2(0, 1), ImVec2(1, 0));
+    // Display the used corner of the target in the ImGui window, stretched to the panel
+    const RenderTarget& viewportTarget = accumulating ? *frameAccumulator->getTarget() : *sceneTarget;
+    ImGui::Image((void*)(intptr_t)viewportTarget.colorTexture, viewportSize, ImVec2(0, viewportTarget.getUvScaleY()),
+                 ImVec2(viewportTarget.getUvScaleX(), 0));
 
     // Check if the mouse is in the viewport
     mouseInViewport = ImGui::IsItemHovered();
@@ -172,159 +822,372 @@ void renderImGui(GLFWwindow* window, Shader& shader, Model& model, GLuint cubema
 
     ImGui::End();
 
-    // Process input
-    processInput(window, camera, deltaTime);
+    processMouseLook(window, camera);
 
     // Render ImGui
+    PROFILE_ZONE("ImGui");
+    PROFILE_GPU_ZONE("ImGui");
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
-int main()
+// Renders a fixed number of frames along a camera path into the offscreen framebuffer and reports frame times
+int runBenchmark(const BenchmarkOptions& options, Shader& shader, Model& model, AssetLoader& loader,
+                 TextureRegistry& registry, GLuint& cubemapTexture)
 {
-    std::filesystem::current_path("../");
-    std::cout << "Current working directory: " << std::filesystem::current_path() << std::endl;
+    while (loader.isBusy())
+    {
+        loader.update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!model.isReady())
+    {
+        std::cerr << "Benchmark aborted, model failed to load: " << options.modelPath << std::endl;
+        return -1;
+    }
+    // Measured frames shouldn't include texture streaming
+    textureStreamer->flush();
 
-    if (!glfwInit())
+    CameraPath cameraPath;
+    if (options.cameraPath.empty())
+    {
+        cameraPath.setOrbit(glm::vec3(0.0f), 5.0f, 0.0f);
+    }
+    else if (!cameraPath.load(options.cameraPath))
     {
-        std::cerr << "Failed to initialize GLFW" << std::endl;
         return -1;
     }
 
-    glfwSetErrorCallback([](int error, const char* description)
+    if (!options.frameDumpDir.empty())
     {
-        std::cerr << "Error: " << description << std::endl;
-    });
+        std::filesystem::create_directories(options.frameDumpDir);
+    }
+
+    resizeFramebuffer(options.width, options.height);
+    projectionMat = glm::perspective(glm::radians(45.0f), static_cast<float>(options.width) / options.height, nearPlane, farPlane);
+    resizePointLights(options.pointLights);
 
-    GLFWwindow* window = glfwCreateWindow(800, 600, "OpenGL Raytraced Renderer", nullptr, nullptr);
-    if (!window)
+    GpuFrameTimer gpuTimer;
+    std::vector<double> cpuSamples;
+    for (int frame = 0; frame < options.warmupFrames + options.frames; ++frame)
     {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        bool measured = frame >= options.warmupFrames;
+        int index = frame - options.warmupFrames;
+        float t = measured && options.frames > 1 ? static_cast<float>(index) / (options.frames - 1) : 0.0f;
+
+        glm::vec3 position;
+        float yaw = camera.yaw, pitch = camera.pitch;
+        cameraPath.sample(t, position, yaw, pitch);
+        camera.setPose(position, yaw, pitch);
+
+        Profiler::get().beginFrame();
+        auto frameStart = std::chrono::steady_clock::now();
+        if (model.getSceneGraph().update())
+        {
+            batchRenderer->syncTransforms();
+            refitSceneBvh(model, loader.getThreadPool());
+        }
+        registry.update();
+
+        if (measured)
+        {
+            gpuTimer.begin();
+        }
+        renderToFramebuffer(shader, model, cubemapTexture, options.width, options.height, loader.getThreadPool());
+        if (measured)
+        {
+            gpuTimer.end();
+            std::chrono::duration<double, std::milli> cpuTime = std::chrono::steady_clock::now() - frameStart;
+            cpuSamples.push_back(cpuTime.count());
+        }
+
+        if (measured && !options.frameDumpDir.empty())
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%05d.png", index);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneTarget->framebuffer);
+            saveFramebufferImage((std::filesystem::path(options.frameDumpDir) / name).string(), options.width, options.height);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        }
+        gpuTimer.collect(false);
+        Profiler::get().endFrame();
     }
+    gpuTimer.collect(true);
 
-    glfwMakeContextCurrent(window);
-    glfwSetKeyCallback(window, keyCallback);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    return writeBenchmarkReport(options, cpuSamples, gpuTimer.getSamples()) ? 0 : -1;
+}
 
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK)
+// Path traces the model from the default camera on the CPU, for machines without a GPU.
+// Nothing here touches GLFW or GL; the image goes to options.cpuOutputPath.
+int runCpuRender(const BenchmarkOptions& options)
+{
+    ThreadPool pool;
+    Model model;
+    model.setRequireGpuTextureFormats(false);
+    if (!model.load(options.modelPath, &pool))
+    {
+        std::cerr << "CPU render aborted, model failed to load: " << options.modelPath << std::endl;
+        return -1;
+    }
+    model.getSceneGraph().update();
+
+    PathTracer tracer;
+    if (!tracer.build(model, &pool))
     {
-        std::cerr << "Failed to initialize GLEW" << std::endl;
         return -1;
     }
+    tracer.loadEnvironment(cubemapFaces);
 
-    // Setup ImGui context
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    io.ConfigFlags |= ImGuiConfigFlags_DockingEnable; // Enable Docking
-
-    ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330");
-
-    Shader shader("shaders/raytrace.vert", "shaders/raytrace.frag");
-    GLuint shaderProgram = shader.ID;
-    glfwSetWindowUserPointer(window, &shaderProgram);
-
-    Model model("DamagedHelmet.glb");
-    std::vector<std::string> faces = {
-        "textures/cubemap/right.jpg",
-        "textures/cubemap/left.jpg",
-        "textures/cubemap/top.jpg",
-        "textures/cubemap/bottom.jpg",
-        "textures/cubemap/front.jpg",
-        "textures/cubemap/back.jpg"
+    resizePointLights(options.pointLights);
+    Light lights[] = {
+        { lightPosition1, lightColor1 },
+        { lightPosition2, lightColor2 }
     };
-    GLuint cubemapTexture = loadCubeMap(faces);
+    tracer.setLights(lights, 2, pointLights);
+    tracer.setCamera(camera.position, camera.front, camera.up, glm::radians(45.0f));
+    tracer.resize(options.width, options.height);
+
+    for (int pass = 0; pass < options.samplesPerPixel; ++pass)
+    {
+        tracer.renderPass(pool);
+        const PathTracerStats& stats = tracer.getStats();
+        std::cout << "\rCPU render: " << tracer.getSampleCount() << "/" << options.samplesPerPixel << " spp, "
+            << stats.getRaysPerSecond() / 1e6 << " Mrays/s" << std::flush;
+    }
+    std::cout << std::endl;
+
+    const PathTracerStats& stats = tracer.getStats();
+    std::cout << "CPU render: " << options.width << "x" << options.height << ", " << stats.rays << " rays in "
+        << stats.traceSeconds << " s on " << pool.getThreadCount() << " threads, "
+        << stats.getRaysPerSecond() / 1e6 << " Mrays/s" << std::endl;
+
+    std::vector<unsigned char> pixels;
+    tracer.resolve(pixels);
+    return saveImageBottomUp(options.cpuOutputPath, options.width, options.height, pixels.data()) ? 0 : -1;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    if (!parseBenchmarkOptions(argc, argv, options))
+    {
+        return argc > 1 && (std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") ? 0 : -1;
+    }
+
+    std::filesystem::current_path(options.workingDirectory);
+    std::cout << "Current working directory: " << std::filesystem::current_path() << std::endl;
+
+    if (options.cpuRender)
+    {
+        return runCpuRender(options);
+    }
+
+    // Headless runs never touch GLFW: the context is surfaceless EGL and everything renders into
+    // the offscreen framebuffer, so no X11 or Wayland connection is needed
+    HeadlessContext headlessContext;
+    GLFWwindow* window = nullptr;
+    if (options.headless)
+    {
+        if (!headlessContext.create())
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        if (!glfwInit())
+        {
+            std::cerr << "Failed to initialize GLFW" << std::endl;
+            return -1;
+        }
+
+        glfwSetErrorCallback([](int error, const char* description)
+        {
+            std::cerr << "Error: " << description << std::endl;
+        });
 
-    Light light1 = { glm::vec3(1.2f, 1.0f, 2.0f), lightColor1 };
-    Light light2 = { glm::vec3(-1.2f, -1.0f, -2.0f), lightColor2 };
+#ifdef GLEW_EGL
+        // GLEW loads entry points through EGL on this platform, so windows get EGL contexts too
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
+        window = glfwCreateWindow(800, 600, "OpenGL Raytraced Renderer", nullptr, nullptr);
+        if (!window)
+        {
+            std::cerr << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
 
-    // Create framebuffer for offscreen rendering
-    glGenFramebuffers(1, &framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glfwMakeContextCurrent(window);
+        glfwSetKeyCallback(window, keyCallback);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    }
 
-    // Create a color attachment texture
-    glGenTextures(1, &textureColorbuffer);
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 800, 600, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureColorbuffer, 0);
+    glewExperimental = GL_TRUE;
+    GLenum glewStatus = glewInit();
+    if (glewStatus != GLEW_OK)
+    {
+        std::cerr << "Failed to initialize GLEW: " << glewGetErrorString(glewStatus) << std::endl;
+        return -1;
+    }
 
-    // Create a renderbuffer object for depth and stencil attachment
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 800, 600);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
+    if (!options.headless)
+    {
+        // Setup ImGui context
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGuiIO& io = ImGui::GetIO(); (void)io;
+        io.ConfigFlags |= ImGuiConfigFlags_DockingEnable; // Enable Docking
 
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cerr << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        ImGui::StyleColorsDark();
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+        ImGui_ImplOpenGL3_Init("#version 330");
+        swapMode = applySwapMode(swapMode);
+    }
+
+    // Compiles (or loads a cached binary) in the background; the first use() waits for it
+    Shader shader("shaders/raytrace.vert", "shaders/raytrace.frag", ClusteredLighting::getShaderPreamble());
+
+    // Assets stream in on worker threads while the viewport keeps rendering
+    Model model;
+    TextureRegistry textureRegistry;
+    GLuint cubemapTexture = 0;
+    AssetLoader loader;
+    loader.loadModel(model, options.modelPath, [&]()
+    {
+        bindModelTextures(shader, model, textureRegistry);
+        batchRenderer->addModel(model, glm::mat4(1.0f));
+        batchRenderer->upload();
+        instancedRenderer->setModel(model);
+        resizeInstanceGrid(instanceGridCount);
+        rebuildSceneBvh(model, loader.getThreadPool());
+        model.releaseCpuGeometry();
+        viewportRedraw.invalidate();
+    });
+    loader.loadCubeMap(cubemapFaces, [&](GLuint texture) { cubemapTexture = texture; });
+
+    // Offscreen colour + depth/stencil target for the scene
+    renderTargets = std::make_unique<RenderTargetPool>();
+    resizeFramebuffer(800, 600);
 
     glEnable(GL_DEPTH_TEST);
 
-    glm::mat4 modelMat = glm::mat4(1.0f);
-    glm::mat4 projectionMat = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    projectionMat = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, nearPlane, farPlane);
+
+    frameUniforms = std::make_unique<FrameUniforms>();
+    if (ClusteredLighting::isSupported())
+    {
+        clusteredLighting = std::make_unique<ClusteredLighting>();
+    }
+    textureStreamer = std::make_unique<TextureStreamer>();
+    batchRenderer = std::make_unique<BatchRenderer>();
+    if (OcclusionCuller::isSupported())
+    {
+        occlusionCuller = std::make_unique<OcclusionCuller>();
+    }
+    instancedRenderer = std::make_unique<InstancedRenderer>();
+    bvhBuffers = std::make_unique<BvhBuffers>();
+    frameAccumulator = std::make_unique<FrameAccumulator>(*renderTargets);
+    dynamicResolution = std::make_unique<DynamicResolution>();
+    frameAccumulator->resize(800, 600);
 
     shader.use();
-    shader.setMat4("model", modelMat);
-    shader.setMat4("projection", projectionMat);
-    shader.setVec3("lightPos1", light1.position);
-    shader.setVec3("lightColor1", light1.color);
-    shader.setVec3("lightPos2", light2.position);
-    shader.setVec3("lightColor2", light2.color);
     shader.setInt("skybox", 1);
+    shader.setInt("bvhNodes", BVH_NODE_TEXTURE_UNIT);
+    shader.setInt("bvhTriangles", BVH_TRIANGLE_TEXTURE_UNIT);
 
-    bool diffuseTextureBound = false;
-    bool normalTextureBound = false;
-    for (const auto& texture : model.model.textures)
+    int framebufferWidth = 800, framebufferHeight = 600;
+    int exitCode = 0;
+
+    if (options.headless)
+    {
+        exitCode = runBenchmark(options, shader, model, loader, textureRegistry, cubemapTexture);
+    }
+
+    while (!options.headless && !glfwWindowShouldClose(window))
     {
-        if (texture.source >= 0)
+        Profiler::get().beginFrame();
+        // Nothing to redraw or refine: sleep until input arrives, waking periodically for hot reload
+        if (viewportIdle && !loader.isBusy() && !textureStreamer->isBusy() && !rightMousePressed)
         {
-            const tinygltf::Image& image = model.model.images[texture.source];
-            if (!diffuseTextureBound)
-            {
-                GLuint textureID = createTexture(image);
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, textureID);
-                shader.setInt("texture_diffuse", 0);
-                diffuseTextureBound = true;
-            }
-            if (!normalTextureBound)
-            {
-                GLuint textureID = createTexture(image);
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, textureID);
-                shader.setInt("texture_normal", 1);
-                normalTextureBound = true;
-            }
+            glfwWaitEventsTimeout(idleWaitSeconds);
+            frameClock.restart();
         }
-    }
+        else
+        {
+            glfwPollEvents();
+        }
+        frameClock.tick();
 
-    int framebufferWidth = 800, framebufferHeight = 600;
+        // Finish any loads whose CPU work is done (GL uploads happen here)
+        loader.update();
+        if (Shader::updateAll(hotReloadShaders))
+        {
+            viewportRedraw.invalidate();
+        }
 
-    while (!glfwWindowShouldClose(window))
-    {
-        float deltaTime = 0.01f; // Adjust as needed
+        // Propagate node edits to world matrices, then to the batched draws
+        if (model.isReady() && model.getSceneGraph().update())
+        {
+            batchRenderer->syncTransforms();
+            refitSceneBvh(model, loader.getThreadPool());
+            viewportRedraw.invalidate();
+        }
+        textureRegistry.update();
+        requestModelTextures(framebufferHeight);
+        if (textureStreamer->update())
+        {
+            viewportRedraw.invalidate();
+        }
+        renderTargets->update();
 
-        glfwPollEvents();
+        // Camera movement runs in fixed steps so its speed doesn't depend on the frame rate
+        while (frameClock.consumeStep())
+        {
+            previousCameraPosition = camera.position;
+            processInput(window, camera, static_cast<float>(frameClock.getFixedStep()));
+        }
+        cameraInterpolation = frameClock.getInterpolation();
 
         // Start the ImGui frame and render everything
-        renderImGui(window, shader, model, cubemapTexture, framebufferWidth, framebufferHeight, deltaTime);
+        renderImGui(window, shader, model, loader, textureRegistry, cubemapTexture, framebufferWidth, framebufferHeight);
 
-        // Swap buffers and poll events
+        // Hold the frame until the cap allows it, then swap
+        frameClock.waitForNextFrame();
         glfwSwapBuffers(window);
+        Profiler::get().endFrame();
     }
 
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
-    ImGui::DestroyContext();
+    // No loader job may still be writing into the model or waiting for a GL upload
+    loader.shutdown();
+
+    // Release GL objects while the context is still alive
+    diffuseTexture.reset();
+    normalTexture.reset();
+    textureStreamer.reset();
+    textureRegistry.clear();
+    model.release();
+    frameUniforms.reset();
+    clusteredLighting.reset();
+    batchRenderer.reset();
+    occlusionCuller.reset();
+    instancedRenderer.reset();
+    bvhBuffers.reset();
+    frameAccumulator.reset();
+    dynamicResolution.reset();
+    sceneTarget = nullptr;
+    renderTargets.reset();
+    shader.release();
+    Profiler::get().releaseGpuResources();
 
-    glfwDestroyWindow(window);
-    glfwTerminate();
-    return 0;
+    if (!options.headless)
+    {
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return exitCode;
 }